@@ -0,0 +1,46 @@
+#version 300 es
+precision highp float;
+precision highp sampler3D;
+uniform sampler2D yTexture;
+uniform sampler2D uTexture;
+uniform sampler2D vTexture;
+uniform sampler3D lutAtlas;
+uniform float thumbSize;
+uniform int atlasCols;
+uniform int selectedTile;
+in vec2 TexCoord;
+flat in int Tile;
+out vec4 fragColor;
+
+void main()
+{
+    float y = texture(yTexture, TexCoord).r;
+    float u = texture(uTexture, TexCoord).r - 0.5;
+    float v = texture(vTexture, TexCoord).r - 0.5;
+    
+    //YUV to RGB conversion matrix (BT.601)
+    //Note that opengl defines columns first, so the first three elements are in column 1
+    mat3 yuvToRgb = mat3(
+        1.000, 1.000, 1.000,
+        0.000, -0.3441, 1.7720,
+        1.4020, -0.7141, 0.000
+    );
+
+    vec3 orig_color;
+    orig_color = yuvToRgb * vec3(y, u, v);
+    
+    // Clamp to valid range, same channel order as viewfinder_fs.glsl
+    orig_color = clamp(orig_color, 0.0, 1.0).bgr;
+
+    // Each LUT is a thumbSize^3 block of the atlas, laid out atlasCols x atlasCols in x/y.
+    // Keeping coordinates between the first and last texel centre stops filtering from bleeding into neighbours
+    vec2 block = vec2(float(Tile % atlasCols), float(Tile / atlasCols));
+    vec3 texel = orig_color * (thumbSize - 1.0) + 0.5;
+    vec3 atlas_size = vec3(thumbSize * float(atlasCols), thumbSize * float(atlasCols), thumbSize);
+    fragColor = texture(lutAtlas, (vec3(block * thumbSize, 0.0) + texel) / atlas_size);
+
+    // outline the currently selected LUT
+    if (Tile == selectedTile && (min(TexCoord.x, TexCoord.y) < 0.02 || max(TexCoord.x, TexCoord.y) > 0.98)) {
+        fragColor = vec4(1.0);
+    }
+}
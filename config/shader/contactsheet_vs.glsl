@@ -0,0 +1,19 @@
+#version 300 es
+in vec2 aPos;
+in vec2 aTexCoord;
+out vec2 TexCoord;
+flat out int Tile;
+uniform mat4 transform;
+uniform int gridSize;
+
+// One instance per tile, each instance shrinks the full screen quad into its grid cell
+void main() {
+    int col = gl_InstanceID % gridSize;
+    int row = gl_InstanceID / gridSize;
+    float scale = 1.0 / float(gridSize);
+    vec2 offset = vec2(-1.0 + scale * (2.0 * float(col) + 1.0), 1.0 - scale * (2.0 * float(row) + 1.0));
+
+    gl_Position = transform * vec4(aPos * scale + offset, 0.0, 1.0);
+    TexCoord = aTexCoord;
+    Tile = gl_InstanceID;
+}
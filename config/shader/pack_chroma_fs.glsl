@@ -0,0 +1,26 @@
+#version 300 es
+precision highp float;
+layout(location = 0) out vec4 cbOut;
+layout(location = 1) out vec4 crOut;
+uniform sampler2D rgbImage;
+
+// 2x2 box average of the rendered capture (centred 4:2:0 siting, as JPEG expects), four chroma samples per
+// fragment of the eighth width, half height targets
+vec3 Average(ivec2 pos)
+{
+    return 0.25 * (texelFetch(rgbImage, pos, 0).rgb + texelFetch(rgbImage, pos + ivec2(1, 0), 0).rgb +
+                   texelFetch(rgbImage, pos + ivec2(0, 1), 0).rgb + texelFetch(rgbImage, pos + ivec2(1, 1), 0).rgb);
+}
+
+void main()
+{
+    ivec2 base = ivec2(int(gl_FragCoord.x) * 8, int(gl_FragCoord.y) * 2);
+    const vec3 cbWeights = vec3(-0.168736, -0.331264, 0.5);
+    const vec3 crWeights = vec3(0.5, -0.418688, -0.081312);
+
+    for (int i = 0; i < 4; i++) {
+        vec3 rgb = Average(base + ivec2(2 * i, 0));
+        cbOut[i] = dot(rgb, cbWeights) + 0.5;
+        crOut[i] = dot(rgb, crWeights) + 0.5;
+    }
+}
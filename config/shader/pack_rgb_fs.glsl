@@ -0,0 +1,18 @@
+#version 300 es
+precision highp float;
+out vec4 fragColor;
+uniform sampler2D rgbImage;
+
+// Every fragment of the 3/4 width target holds four consecutive bytes of a tightly packed RGB888 row, so the
+// readback has no alpha channel. byte b of a row is channel b % 3 of pixel b / 3
+float PackedByte(int b, int row)
+{
+    return texelFetch(rgbImage, ivec2(b / 3, row), 0)[b % 3];
+}
+
+void main()
+{
+    int first = int(gl_FragCoord.x) * 4;
+    int row = int(gl_FragCoord.y);
+    fragColor = vec4(PackedByte(first, row), PackedByte(first + 1, row), PackedByte(first + 2, row), PackedByte(first + 3, row));
+}
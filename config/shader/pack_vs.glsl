@@ -0,0 +1,8 @@
+#version 300 es
+in vec2 aPos;
+
+// Untransformed full screen quad for the passes that repack the rendered capture, they address texels directly
+void main()
+{
+    gl_Position = vec4(aPos, 0.0, 1.0);
+}
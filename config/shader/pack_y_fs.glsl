@@ -0,0 +1,18 @@
+#version 300 es
+precision highp float;
+out vec4 fragColor;
+uniform sampler2D rgbImage;
+
+// Every fragment of the quarter width target packs the luma of four horizontally adjacent pixels of the
+// rendered capture, so the readback is a plain 8 bit Y plane. JFIF full range BT.601
+void main()
+{
+    ivec2 base = ivec2(int(gl_FragCoord.x) * 4, int(gl_FragCoord.y));
+    const vec3 luma = vec3(0.299, 0.587, 0.114);
+
+    fragColor = vec4(
+        dot(texelFetch(rgbImage, base, 0).rgb, luma),
+        dot(texelFetch(rgbImage, base + ivec2(1, 0), 0).rgb, luma),
+        dot(texelFetch(rgbImage, base + ivec2(2, 0), 0).rgb, luma),
+        dot(texelFetch(rgbImage, base + ivec2(3, 0), 0).rgb, luma));
+}
@@ -0,0 +1,16 @@
+#version 300 es
+precision highp float;
+in vec2 TexCoord;
+out vec4 fragColor;
+uniform sampler2D yTexture;
+uniform sampler2D toneCurve;
+
+// Still capture counterpart of viewfinder_mono_fs.glsl
+void main()
+{
+    float y = texture(yTexture, TexCoord).r;
+
+    // sample texel centres of the 256x1 curve
+    float tone = texture(toneCurve, vec2(y * (255.0 / 256.0) + 0.5 / 256.0, 0.5)).r;
+    fragColor = vec4(tone, tone, tone, 1.0);
+}
@@ -0,0 +1,49 @@
+#version 300 es
+precision highp float;
+precision highp sampler3D;
+in vec2 TexCoord;
+layout(location = 0) out vec4 look0;
+layout(location = 1) out vec4 look1;
+layout(location = 2) out vec4 look2;
+layout(location = 3) out vec4 look3;
+uniform sampler2D yTexture;
+uniform sampler2D uTexture;
+uniform sampler2D vTexture;
+uniform sampler3D clut0;
+uniform sampler3D clut1;
+uniform sampler3D clut2;
+uniform sampler3D clut3;
+uniform int numLooks;
+
+// Same conversion as stillcapture_fs.glsl, but the YUV planes are read once and pushed through up to four LUTs
+void main()
+{
+    float y = texture(yTexture, TexCoord).r;
+    float u = texture(uTexture, TexCoord).r - 0.5;
+    float v = texture(vTexture, TexCoord).r - 0.5;
+    
+    //YUV to RGB conversion matrix (BT.601)
+    //Note that opengl defines columns first, so the first three elements are in column 1
+    mat3 yuvToRgb = mat3(
+        1.000, 1.000, 1.000,
+        0.000, -0.3441, 1.7720,
+        1.4020, -0.7141, 0.000
+    );
+
+    vec3 orig_color;
+    orig_color = yuvToRgb * vec3(y, u, v);
+    
+    // Clamp to valid range
+    orig_color = clamp(orig_color, 0.0, 1.0);
+
+    look0 = texture(clut0, orig_color);
+    if (numLooks > 1) {
+        look1 = texture(clut1, orig_color);
+    }
+    if (numLooks > 2) {
+        look2 = texture(clut2, orig_color);
+    }
+    if (numLooks > 3) {
+        look3 = texture(clut3, orig_color);
+    }
+}
@@ -3,9 +3,11 @@ in vec2 aPos;
 in vec2 aTexCoord;
 out vec2 TexCoord;
 uniform mat4 rotate;
+// part of the plane textures that is drawn, offset in xy and size in zw. all of it unless the still is drawn in tiles
+uniform vec4 texRegion;
 
 void main()
 {
     gl_Position = rotate * vec4(aPos, 0.0, 1.0);
-    TexCoord = aTexCoord;
+    TexCoord = texRegion.xy + aTexCoord * texRegion.zw;
 }
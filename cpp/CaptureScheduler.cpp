@@ -0,0 +1,133 @@
+#include <CaptureScheduler.hpp>
+#include <algorithm>
+#include <log.hpp>
+
+CaptureScheduler::CaptureScheduler(RoutePolicy policy, unsigned int num_threads)
+    : policy(policy), pool(num_threads > 1 ? num_threads - 1 : 1) {
+    thread = std::thread(&CaptureScheduler::Loop, this);
+}
+
+CaptureScheduler::~CaptureScheduler() {
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        shutdown = true;
+    }
+    cv.notify_all();
+    thread.join();
+
+    for (CaptureRoute route : {CaptureRoute::GPU, CaptureRoute::CPU}) {
+        RouteStats stats = GetStats(route);
+        if (stats.Captures > 0) {
+            LOG << (route == CaptureRoute::GPU ? "GPU" : "CPU") << " captures: " << stats.Captures << ", "
+                << stats.Captures / stats.Seconds << " per second" << std::endl;
+        }
+    }
+}
+
+float CaptureScheduler::Megapixels(int width, int height) {
+    return static_cast<float>(width) * height * 1e-6f;
+}
+
+CaptureRoute CaptureScheduler::Choose(int width, int height, int gpu_depth, Clock::time_point deadline) {
+    std::unique_lock<std::mutex> lock(mutex);
+    bool cpu_accepts = cpu_busy < max_cpu_captures;
+    if (policy == RoutePolicy::GPU_ONLY) {
+        return gpu_depth == 0 ? CaptureRoute::GPU : CaptureRoute::DEFER;
+    }
+    if (policy == RoutePolicy::CPU_ONLY) {
+        return cpu_accepts ? CaptureRoute::CPU : CaptureRoute::DEFER;
+    }
+
+    // an idle GPU always wins, it is several times faster and leaves the cores to the encoders
+    if (gpu_depth == 0) {
+        return CaptureRoute::GPU;
+    }
+
+    const float megapixels = Megapixels(width, height);
+    const Clock::time_point now = Clock::now();
+    auto estimate = [&](float seconds) {
+        return now + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<float>(seconds));
+    };
+    Clock::time_point gpu_done = gpu_depth < 0 ? Clock::time_point::max() : estimate((gpu_depth + 1) * gpu_rate * megapixels);
+    Clock::time_point cpu_done = cpu_accepts ? estimate((cpu_busy + 1) * cpu_rate * megapixels) : Clock::time_point::max();
+
+    Clock::time_point done = std::min(gpu_done, cpu_done);
+    if (done > deadline) {
+        return CaptureRoute::DEFER;
+    }
+    return cpu_done < gpu_done ? CaptureRoute::CPU : CaptureRoute::GPU;
+}
+
+void CaptureScheduler::SubmitCpu(std::vector<uint8_t> &&frame, int width, int height, int stride, const LUT &lut,
+                                 StripCallback callback, std::function<void()> on_finished) {
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        // built here so that the LUT is never touched from another thread
+        if (!renderer || renderer_hash != lut.Hash) {
+            renderer = std::make_shared<const CpuStillRenderer>(lut);
+            renderer_hash = lut.Hash;
+        }
+        cpu_busy++;
+        queue.push_back({std::move(frame), width, height, stride, renderer, std::move(callback), std::move(on_finished)});
+    }
+    cv.notify_all();
+}
+
+void CaptureScheduler::ReportGpu(Clock::time_point submitted, int width, int height) {
+    std::unique_lock<std::mutex> lock(mutex);
+    Clock::time_point now = Clock::now();
+    // a queued capture only starts once the one before it is done
+    std::chrono::duration<float> elapsed = now - std::max(submitted, gpu_last_done);
+    gpu_last_done = now;
+    gpu_rate += (elapsed.count() / Megapixels(width, height) - gpu_rate) * rate_weight;
+    gpu_stats.Captures++;
+    gpu_stats.Seconds += elapsed.count();
+}
+
+bool CaptureScheduler::IsCpuBusy() {
+    std::unique_lock<std::mutex> lock(mutex);
+    return cpu_busy > 0;
+}
+
+RouteStats CaptureScheduler::GetStats(CaptureRoute route) {
+    std::unique_lock<std::mutex> lock(mutex);
+    return route == CaptureRoute::CPU ? cpu_stats : gpu_stats;
+}
+
+void CaptureScheduler::Loop() {
+    while (true) {
+        CpuRequest request;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [this]{ return !queue.empty() || shutdown; });
+            if (queue.empty()) {
+                return;
+            }
+            request = std::move(queue.front());
+            queue.pop_front();
+        }
+
+        auto start_time = Clock::now();
+        std::vector<unsigned char> strip(static_cast<size_t>(request.width) * strip_rows * 3);
+        for (int row = 0; row < request.height; row += strip_rows) {
+            int num_rows = std::min(strip_rows, request.height - row);
+            pool.ParallelFor(row, row + num_rows, [&](int begin, int end) {
+                request.renderer->RenderRows(request.frame.data(), request.width, request.height, request.stride,
+                                             strip.data(), begin, end, row);
+            });
+            request.callback(row, num_rows, strip.data(), static_cast<size_t>(request.width) * num_rows * 3);
+        }
+        std::chrono::duration<float> elapsed = Clock::now() - start_time;
+        request.frame = std::vector<uint8_t>();
+        if (request.on_finished) {
+            request.on_finished();
+        }
+        LOG << "Developed capture on the CPU in " << elapsed.count() << "s\n";
+
+        std::unique_lock<std::mutex> lock(mutex);
+        cpu_busy--;
+        cpu_rate += (elapsed.count() / Megapixels(request.width, request.height) - cpu_rate) * rate_weight;
+        cpu_stats.Captures++;
+        cpu_stats.Seconds += elapsed.count();
+    }
+}
@@ -0,0 +1,98 @@
+#ifndef CAPTURESCHEDULER_HPP
+#define CAPTURESCHEDULER_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <CpuStillRenderer.hpp>
+#include <Lut.hpp>
+#include <ThreadPool.hpp>
+
+enum class CaptureRoute {
+    GPU,  // the capture thread, or the main context without one
+    CPU,  // CpuStillRenderer on the scheduler's cores
+    DEFER // stored raw, the idle scheduler develops it later
+};
+
+enum class RoutePolicy {
+    GPU_ONLY,
+    CPU_ONLY,
+    HYBRID
+};
+
+struct RouteStats {
+    int Captures = 0;
+    float Seconds = 0.0f; // rendering only, queueing excluded
+};
+
+/* decides where a single capture is developed. the GPU is the fast path, but during a burst it is busy with the
+   viewfinder and the captures queued before, while most CPU cores have nothing to do. the scheduler keeps a
+   running estimate of seconds per megapixel for both and, in HYBRID, sends a capture to whichever is expected to
+   finish it first counting what is already queued there. a capture neither can finish before its deadline is
+   stored raw instead. the CPU side renders strips on a thread pool and hands them on like the capture thread
+   does, its output matches the GPU within a few levels */
+class CaptureScheduler {
+public:
+    using StripCallback = std::function<void(int first_row, int num_rows, void *data, size_t size)>;
+    using Clock = std::chrono::steady_clock;
+
+private:
+    struct CpuRequest {
+        std::vector<uint8_t> frame;
+        int width, height, stride;
+        std::shared_ptr<const CpuStillRenderer> renderer;
+        StripCallback callback;
+        std::function<void()> on_finished;
+    };
+
+    RoutePolicy policy;
+    ThreadPool pool;
+    std::thread thread;
+    std::deque<CpuRequest> queue;
+    int cpu_busy = 0; // queued or rendering
+    bool shutdown = false;
+    std::mutex mutex;
+    std::condition_variable cv;
+
+    uint64_t renderer_hash = 0;
+    std::shared_ptr<const CpuStillRenderer> renderer; // kept for the next capture with the same LUT
+
+    // seconds per megapixel, seeded with rough Pi 4 figures until the first captures are measured
+    float gpu_rate = 0.05f;
+    float cpu_rate = 0.25f;
+    Clock::time_point gpu_last_done;
+    RouteStats gpu_stats;
+    RouteStats cpu_stats;
+
+    const int max_cpu_captures = 2; // a camera frame each
+    const int strip_rows = 64;
+    const float rate_weight = 0.3f; // share of a new measurement in the estimate
+
+    void Loop();
+    static float Megapixels(int width, int height);
+
+public:
+    // num_threads cores render CPU captures, the scheduler thread is one of them
+    CaptureScheduler(RoutePolicy policy, unsigned int num_threads = 3);
+    ~CaptureScheduler();
+
+    // gpu_depth counts the captures queued on or rendering on the GPU, a negative one means it takes none now
+    CaptureRoute Choose(int width, int height, int gpu_depth, Clock::time_point deadline);
+
+    // renders frame with lut on the CPU, callback and on_finished run on the scheduler thread
+    void SubmitCpu(std::vector<uint8_t> &&frame, int width, int height, int stride, const LUT &lut,
+                   StripCallback callback, std::function<void()> on_finished);
+    // a GPU capture submitted at submitted is done, feeds the estimate
+    void ReportGpu(Clock::time_point submitted, int width, int height);
+
+    bool IsCpuBusy();
+    RouteStats GetStats(CaptureRoute route);
+};
+
+#endif // CAPTURESCHEDULER_HPP
@@ -0,0 +1,398 @@
+#include <CaptureStorage.hpp>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <set>
+#include <fcntl.h>
+#include <sys/statvfs.h>
+#include <unistd.h>
+#include <log.hpp>
+
+StorageFile::StorageFile(CaptureStorage &storage, std::string path, int fd)
+    : storage(storage), path(std::move(path)), fd(fd), blocks(CaptureStorage::blocks_per_file),
+      start_time(std::chrono::steady_clock::now()) {
+    temp_path = this->path + ".part";
+#ifdef HAVE_LIBURING
+    // one ring per file, deep enough for every block in flight at once
+    use_ring = storage.use_uring && io_uring_queue_init(CaptureStorage::blocks_per_file, &ring, 0) == 0;
+#endif
+}
+
+StorageFile::~StorageFile() {
+    if (!closed) {
+        WaitAll();
+        close(fd);
+        unlink(temp_path.c_str());
+    }
+#ifdef HAVE_LIBURING
+    if (use_ring) {
+        io_uring_queue_exit(&ring);
+    }
+#endif
+    for (Block &block : blocks) {
+        free(block.data);
+    }
+}
+
+void StorageFile::SubmitBlock(Block &block) {
+    block.submitted = true;
+    block.in_flight.store(true, std::memory_order_relaxed);
+    off_t block_offset = offset;
+    offset += block.used;
+
+#ifdef HAVE_LIBURING
+    if (use_ring) {
+        // never more blocks in flight than ring entries, so there always is a free sqe
+        io_uring_sqe *sqe = io_uring_get_sqe(&ring);
+        io_uring_prep_write(sqe, fd, block.data, block.used, block_offset);
+        io_uring_sqe_set_data(sqe, &block);
+        io_uring_submit(&ring);
+        return;
+    }
+#endif
+    {
+        std::unique_lock<std::mutex> lock(storage.io_mutex);
+        storage.io_queue.push_back({fd, &block, block_offset});
+    }
+    storage.io_cv.notify_one();
+}
+
+void StorageFile::WaitBlock(Block &block) {
+#ifdef HAVE_LIBURING
+    if (use_ring) {
+        // completions can arrive for any of our blocks, mark them done until this one is. the others are retired
+        // when Append comes around to them or the file is closed
+        while (block.in_flight.load(std::memory_order_acquire)) {
+            io_uring_cqe *cqe;
+            int ret = io_uring_wait_cqe(&ring, &cqe);
+            if (ret == -EINTR) {
+                continue;
+            }
+            if (ret < 0) {
+                block.result = ret;
+                block.in_flight.store(false, std::memory_order_release);
+                break;
+            }
+            Block *done = static_cast<Block *>(io_uring_cqe_get_data(cqe));
+            done->result = cqe->res;
+            done->in_flight.store(false, std::memory_order_release);
+            io_uring_cqe_seen(&ring, cqe);
+        }
+    }
+#endif
+    {
+        std::unique_lock<std::mutex> lock(storage.io_mutex);
+        storage.io_done_cv.wait(lock, [&]{ return !block.in_flight.load(std::memory_order_acquire); });
+    }
+    RetireBlock(block);
+}
+
+// a written block: report a failed write and make the block free for new data
+void StorageFile::RetireBlock(Block &block) {
+    if (block.result != static_cast<ssize_t>(block.used)) {
+        if (!failed) {
+            LOG_ERR << "Write to " << temp_path << " failed: " << strerror(block.result < 0 ? -block.result : EIO) << std::endl;
+        }
+        failed = true;
+    }
+    block.used = 0;
+    block.submitted = false;
+}
+
+void StorageFile::WaitAll() {
+    for (Block &block : blocks) {
+        if (block.submitted) {
+            WaitBlock(block);
+        }
+    }
+}
+
+bool StorageFile::Append(const void *data, size_t size) {
+    const unsigned char *src = static_cast<const unsigned char *>(data);
+    while (size > 0 && !failed) {
+        Block &block = blocks[current];
+        if (block.submitted) {
+            // still written from the last time round, or done without anyone having looked at the result yet
+            WaitBlock(block);
+            continue;
+        }
+        if (!block.data && posix_memalign(reinterpret_cast<void **>(&block.data), 4096, CaptureStorage::block_size) != 0) {
+            block.data = nullptr;
+            failed = true;
+            break;
+        }
+
+        size_t n = std::min(size, CaptureStorage::block_size - block.used);
+        memcpy(block.data + block.used, src, n);
+        block.used += n;
+        src += n;
+        size -= n;
+
+        if (block.used == CaptureStorage::block_size) {
+            SubmitBlock(block);
+            current = (current + 1) % blocks.size();
+        }
+    }
+    return !failed;
+}
+
+size_t StorageFile::Close(DurableCallback on_durable) {
+    Block &last = blocks[current];
+    if (!failed && !last.submitted && last.used > 0) {
+        SubmitBlock(last);
+    }
+    WaitAll();
+#ifdef HAVE_LIBURING
+    if (use_ring) {
+        io_uring_queue_exit(&ring);
+        use_ring = false;
+    }
+#endif
+    closed = true;
+
+    // hand back whatever the preallocation reserved beyond the real size
+    if (!failed && ftruncate(fd, offset) != 0) {
+        failed = true;
+    }
+    std::chrono::duration<float> write_time = std::chrono::steady_clock::now() - start_time;
+
+    if (failed) {
+        LOG_ERR << "Failed to write " << path << std::endl;
+        close(fd);
+        unlink(temp_path.c_str());
+        if (on_durable) {
+            on_durable({path, false, 0, write_time.count(), write_time.count()});
+        }
+        return 0;
+    }
+
+    storage.QueueSync({fd, temp_path, path, static_cast<size_t>(offset), start_time, write_time.count(), std::move(on_durable)});
+    return offset;
+}
+
+CaptureStorage::CaptureStorage(std::string dir, uint64_t min_free_bytes)
+    : output_dir(std::move(dir)), pending_dir(output_dir + "pending/"), min_free_bytes(min_free_bytes) {
+    for (const std::string &path : {output_dir, pending_dir}) {
+        std::error_code ec;
+        std::filesystem::create_directories(path, ec);
+        if (ec) {
+            LOG_ERR << "Failed to create capture dir " << path << ": " << ec.message() << std::endl;
+        }
+    }
+    ScanExistingCaptures();
+
+#ifdef HAVE_LIBURING
+    // kernels can be built without io_uring or have it disabled by policy
+    io_uring probe;
+    if (io_uring_queue_init(blocks_per_file, &probe, 0) == 0) {
+        io_uring_queue_exit(&probe);
+        use_uring = true;
+    }
+#endif
+    LOG << "Capture storage writes through " << (use_uring ? "io_uring" : "pwrite") << ", "
+        << GetFreeBytes() / (1 << 20) << " MB free\n";
+
+    io_thread = std::thread(&CaptureStorage::IoLoop, this);
+    sync_thread = std::thread(&CaptureStorage::SyncLoop, this);
+}
+
+CaptureStorage::~CaptureStorage() {
+    Sync();
+    {
+        std::unique_lock<std::mutex> lock(io_mutex);
+        std::unique_lock<std::mutex> sync_lock(sync_mutex);
+        shutdown = true;
+    }
+    io_cv.notify_all();
+    sync_cv.notify_all();
+    io_thread.join();
+    sync_thread.join();
+}
+
+// continue numbering after the highest capture already on disk, so restarts never overwrite earlier shots.
+// undeveloped captures keep their number when they are developed, so they count too. files still carrying
+// the temporary suffix never became durable and are dropped
+void CaptureStorage::ScanExistingCaptures() {
+    for (const std::string &dir : {output_dir, pending_dir}) {
+        std::error_code ec;
+        for (const auto &entry : std::filesystem::directory_iterator(dir, ec)) {
+            if (entry.path().extension() == ".part") {
+                LOG << "Removing incomplete " << entry.path().string() << std::endl;
+                std::filesystem::remove(entry.path(), ec);
+                continue;
+            }
+            int sequence;
+            if (sscanf(entry.path().filename().c_str(), "capture-%d", &sequence) == 1 && sequence >= next_sequence) {
+                next_sequence = sequence + 1;
+            }
+        }
+    }
+}
+
+std::string CaptureStorage::NextPath(const std::string &tag, const char *extension, bool pending) {
+    std::unique_lock<std::mutex> lock(naming_mutex);
+    char name[32];
+    snprintf(name, sizeof(name), "capture-%04d", next_sequence++);
+    return (pending ? pending_dir : output_dir) + name + (tag.empty() ? "" : "-" + tag) + extension;
+}
+
+uint64_t CaptureStorage::GetFreeBytes() {
+    struct statvfs fs;
+    if (statvfs(output_dir.c_str(), &fs) != 0) {
+        return 0;
+    }
+    return static_cast<uint64_t>(fs.f_bavail) * fs.f_frsize;
+}
+
+bool CaptureStorage::HasSpace(uint64_t bytes) {
+    return GetFreeBytes() >= bytes + min_free_bytes;
+}
+
+std::unique_ptr<StorageFile> CaptureStorage::Create(const std::string &path, size_t expected_size) {
+    if (!HasSpace(expected_size)) {
+        LOG_ERR << "Not enough space for " << path << ", " << GetFreeBytes() / (1 << 20) << " MB free" << std::endl;
+        return nullptr;
+    }
+
+    std::string temp_path = path + ".part";
+    int fd = open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        LOG_ERR << "Failed to open " << temp_path << " for writing: " << strerror(errno) << std::endl;
+        return nullptr;
+    }
+
+    // reserve the space in one go without changing the size, Close trims what is left over.
+    // file systems without fallocate just allocate as the blocks arrive
+    if (expected_size > 0 && fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, expected_size) != 0 && errno == ENOSPC) {
+        LOG_ERR << "Not enough space for " << path << std::endl;
+        close(fd);
+        unlink(temp_path.c_str());
+        return nullptr;
+    }
+
+    return std::unique_ptr<StorageFile>(new StorageFile(*this, path, fd));
+}
+
+void CaptureStorage::IoLoop() {
+    while (true) {
+        WriteRequest request;
+        {
+            std::unique_lock<std::mutex> lock(io_mutex);
+            io_cv.wait(lock, [this]{ return !io_queue.empty() || shutdown; });
+            if (io_queue.empty()) {
+                return;
+            }
+            request = io_queue.front();
+            io_queue.pop_front();
+        }
+
+        const StorageFile::Block &block = *request.block;
+        ssize_t result = 0;
+        while (static_cast<size_t>(result) < block.used) {
+            ssize_t n = pwrite(request.fd, block.data + result, block.used - result, request.offset + result);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                result = n < 0 ? -errno : result;
+                break;
+            }
+            result += n;
+        }
+
+        {
+            std::unique_lock<std::mutex> lock(io_mutex);
+            request.block->result = result;
+            request.block->in_flight.store(false, std::memory_order_release);
+        }
+        io_done_cv.notify_all();
+    }
+}
+
+void CaptureStorage::QueueSync(SyncRequest &&request) {
+    {
+        std::unique_lock<std::mutex> lock(sync_mutex);
+        sync_queue.push_back(std::move(request));
+    }
+    sync_cv.notify_all();
+}
+
+void CaptureStorage::SyncLoop() {
+    while (true) {
+        std::vector<SyncRequest> batch;
+        {
+            std::unique_lock<std::mutex> lock(sync_mutex);
+            sync_cv.wait(lock, [this]{ return !sync_queue.empty() || shutdown; });
+            if (sync_queue.empty()) {
+                return;
+            }
+            // give the next captures of a burst the chance to share this sync
+            sync_cv.wait_for(lock, sync_delay, [this]{ return sync_queue.size() >= sync_batch || shutdown; });
+            batch.swap(sync_queue);
+            syncing = batch.size();
+        }
+
+        // data first, then the names, then the directories holding the names
+        std::vector<bool> ok(batch.size());
+        std::set<std::string> dirs;
+        for (size_t i = 0; i < batch.size(); i++) {
+            SyncRequest &request = batch[i];
+            ok[i] = fdatasync(request.fd) == 0;
+            ok[i] = close(request.fd) == 0 && ok[i];
+            ok[i] = ok[i] && rename(request.temp_path.c_str(), request.path.c_str()) == 0;
+            if (ok[i]) {
+                dirs.insert(std::filesystem::path(request.path).parent_path().string());
+            }
+            else {
+                LOG_ERR << "Failed to sync " << request.path << ": " << strerror(errno) << std::endl;
+                unlink(request.temp_path.c_str());
+            }
+        }
+        for (const std::string &dir : dirs) {
+            int dir_fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if (dir_fd >= 0) {
+                fsync(dir_fd);
+                close(dir_fd);
+            }
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < batch.size(); i++) {
+            SyncRequest &request = batch[i];
+            std::chrono::duration<float> durable_time = now - request.start_time;
+            DurableResult result{request.path, ok[i], ok[i] ? request.bytes : 0, request.write_seconds, durable_time.count()};
+            if (ok[i]) {
+                float megabytes = request.bytes / float(1 << 20);
+                LOG << "Stored " << request.path << ": " << megabytes << " MB at " << megabytes / request.write_seconds
+                    << " MB/s, durable after " << result.DurableSeconds << "s (" << batch.size() << " in sync)\n";
+                std::unique_lock<std::mutex> lock(sync_mutex);
+                stats.Files++;
+                stats.Bytes += request.bytes;
+                stats.WriteSeconds += request.write_seconds;
+                stats.DurableSeconds += result.DurableSeconds;
+            }
+            if (request.on_durable) {
+                request.on_durable(result);
+            }
+        }
+
+        {
+            std::unique_lock<std::mutex> lock(sync_mutex);
+            syncing = 0;
+        }
+        synced_cv.notify_all();
+    }
+}
+
+void CaptureStorage::Sync() {
+    std::unique_lock<std::mutex> lock(sync_mutex);
+    synced_cv.wait(lock, [this]{ return sync_queue.empty() && syncing == 0; });
+}
+
+StorageStats CaptureStorage::GetStats() {
+    std::unique_lock<std::mutex> lock(sync_mutex);
+    return stats;
+}
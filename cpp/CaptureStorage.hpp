@@ -0,0 +1,173 @@
+#ifndef CAPTURESTORAGE_HPP
+#define CAPTURESTORAGE_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/types.h>
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+// reported once a file is on the card for good
+struct DurableResult {
+    std::string Path;
+    bool Success;
+    size_t Bytes;
+    float WriteSeconds;   // Create until the last block was written
+    float DurableSeconds; // Create until fsynced and renamed into place
+};
+
+struct StorageStats {
+    size_t Files = 0;
+    size_t Bytes = 0;
+    float WriteSeconds = 0.0f;
+    float DurableSeconds = 0.0f;
+};
+
+class CaptureStorage;
+
+/* one file being written. appends are gathered into large page aligned blocks that go to the kernel at aligned
+   offsets while the caller produces the next ones. the file is written under a temporary name and only appears
+   under its own once it is durable, so nobody ever sees a partial capture */
+class StorageFile {
+    friend class CaptureStorage;
+
+public:
+    using DurableCallback = std::function<void(const DurableResult &)>;
+
+private:
+    // in_flight is cleared by whichever thread completes the write, with a release after setting result, so
+    // result can be read once in_flight reads false. submitted stays set until the file thread has checked the
+    // result and freed the block for new data
+    struct Block {
+        unsigned char *data = nullptr;
+        size_t used = 0;
+        bool submitted = false;
+        std::atomic<bool> in_flight{false};
+        ssize_t result = 0;
+    };
+
+    CaptureStorage &storage;
+    std::string path;
+    std::string temp_path;
+    int fd;
+    off_t offset = 0; // bytes handed to the kernel so far
+    bool failed = false;
+    bool closed = false;
+    std::vector<Block> blocks;
+    size_t current = 0;
+    std::chrono::steady_clock::time_point start_time;
+#ifdef HAVE_LIBURING
+    io_uring ring;
+    bool use_ring = false;
+#endif
+
+    StorageFile(CaptureStorage &storage, std::string path, int fd);
+    void SubmitBlock(Block &block);
+    void WaitBlock(Block &block);
+    void RetireBlock(Block &block);
+    void WaitAll();
+
+public:
+    StorageFile(const StorageFile &) = delete;
+    StorageFile &operator=(const StorageFile &) = delete;
+    // a file that was never closed is discarded
+    ~StorageFile();
+
+    bool Append(const void *data, size_t size);
+    // finishes writing and hands the file to the batched fsync, returns the size or 0 on failure.
+    // on_durable runs on the sync thread
+    size_t Close(DurableCallback on_durable = nullptr);
+
+    const std::string &GetPath() const { return path; }
+};
+
+/* where captures end up on the card: sequential names that survive restarts, free space checks before
+   anything is written, and the write path itself. data goes out through io_uring when the build has liburing
+   and the kernel allows it, otherwise through a pwrite thread. files are preallocated to their expected size
+   so the card gets long contiguous runs, and fsyncs are batched: a closed file waits up to sync_delay for
+   others to share the journal commit and directory sync with */
+class CaptureStorage {
+    friend class StorageFile;
+
+private:
+    std::string output_dir;
+    std::string pending_dir;
+    uint64_t min_free_bytes;
+    std::mutex naming_mutex;
+    int next_sequence = 1;
+
+    static constexpr size_t block_size = 1 << 20;
+    static constexpr size_t blocks_per_file = 4;
+    bool use_uring = false;
+
+    // pwrite fallback
+    struct WriteRequest {
+        int fd;
+        StorageFile::Block *block;
+        off_t offset;
+    };
+    std::thread io_thread;
+    std::deque<WriteRequest> io_queue;
+    std::mutex io_mutex;
+    std::condition_variable io_cv;      // io thread waits for requests
+    std::condition_variable io_done_cv; // files wait for their blocks
+
+    // batched fsync
+    struct SyncRequest {
+        int fd;
+        std::string temp_path;
+        std::string path;
+        size_t bytes;
+        std::chrono::steady_clock::time_point start_time;
+        float write_seconds;
+        StorageFile::DurableCallback on_durable;
+    };
+    std::thread sync_thread;
+    std::vector<SyncRequest> sync_queue;
+    size_t syncing = 0;
+    std::mutex sync_mutex;
+    std::condition_variable sync_cv;
+    std::condition_variable synced_cv;
+    StorageStats stats;
+    const std::chrono::milliseconds sync_delay{250};
+    const size_t sync_batch = 4;
+
+    bool shutdown = false;
+
+    void ScanExistingCaptures();
+    void IoLoop();
+    void SyncLoop();
+    void QueueSync(SyncRequest &&request);
+
+public:
+    // min_free_bytes is kept free on the card for everything else
+    CaptureStorage(std::string output_dir, uint64_t min_free_bytes = 64ull << 20);
+    ~CaptureStorage();
+
+    // reserves the next capture-NNNN[-tag] name, in the pending directory for raw captures
+    std::string NextPath(const std::string &tag, const char *extension, bool pending = false);
+    uint64_t GetFreeBytes();
+    bool HasSpace(uint64_t bytes);
+
+    // nullptr when the card is too full for expected_size or the file cannot be created
+    std::unique_ptr<StorageFile> Create(const std::string &path, size_t expected_size);
+    // blocks until every closed file is durable
+    void Sync();
+
+    StorageStats GetStats();
+    const std::string &GetOutputDir() const { return output_dir; }
+    const std::string &GetPendingDir() const { return pending_dir; }
+};
+
+#endif // CAPTURESTORAGE_HPP
@@ -0,0 +1,332 @@
+#include <CaptureWriter.hpp>
+#include <chrono>
+#include <cstring>
+#include <log.hpp>
+#include <Trace.hpp>
+
+bool CaptureStream::Push(const void *data, size_t size, int num_rows) {
+    StreamStrip strip;
+    strip.rows.assign(static_cast<const unsigned char *>(data), static_cast<const unsigned char *>(data) + size);
+    strip.num_rows = num_rows;
+
+    std::unique_lock<std::mutex> lock(mutex);
+    cv.wait(lock, [this]{ return strips.size() < max_strips || cancelled || aborted; });
+    if (cancelled || finished || aborted) {
+        return false;
+    }
+    strips.push_back(std::move(strip));
+    cv.notify_all();
+    return true;
+}
+
+bool CaptureStream::TryPush(const void *data, size_t size, int num_rows) {
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (strips.size() >= max_strips || cancelled || finished || aborted) {
+            return false;
+        }
+    }
+    // only the producer adds strips, the room checked above is still there after the copy
+    return Push(data, size, num_rows);
+}
+
+void CaptureStream::Finish() {
+    std::unique_lock<std::mutex> lock(mutex);
+    finished = true;
+    cv.notify_all();
+}
+
+void CaptureStream::Abort() {
+    std::unique_lock<std::mutex> lock(mutex);
+    aborted = true;
+    strips.clear();
+    cv.notify_all();
+}
+
+bool CaptureStream::IsAborted() {
+    std::unique_lock<std::mutex> lock(mutex);
+    return aborted;
+}
+
+bool CaptureStream::Pop(StreamStrip &strip) {
+    std::unique_lock<std::mutex> lock(mutex);
+    cv.wait(lock, [this]{ return !strips.empty() || finished || cancelled || aborted; });
+    if (cancelled || aborted || strips.empty()) {
+        return false;
+    }
+    strip = std::move(strips.front());
+    strips.pop_front();
+    cv.notify_all();
+    return true;
+}
+
+void CaptureStream::Cancel() {
+    std::unique_lock<std::mutex> lock(mutex);
+    cancelled = true;
+    strips.clear();
+    cv.notify_all();
+}
+
+CaptureWriter::CaptureWriter(std::string dir, size_t max_pending, unsigned int num_workers, size_t max_raw_pending)
+    : storage(std::move(dir)), max_pending(max_pending), max_raw_pending(max_raw_pending) {
+    for (unsigned int i = 0; i < num_workers; i++) {
+        workers.emplace_back(&CaptureWriter::WorkerLoop, this, false);
+    }
+    raw_worker = std::thread(&CaptureWriter::WorkerLoop, this, true);
+}
+
+CaptureWriter::~CaptureWriter() {
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        shutdown = true;
+    }
+    work_cv.notify_all();
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+    raw_worker.join();
+}
+
+const char *CaptureWriter::GetExtension(CaptureFormat format) {
+    return format == CaptureFormat::JPEG ? ".jpg" : ".png";
+}
+
+std::string CaptureWriter::NextPath(const EncodeJob &job) {
+    if (!job.Path.empty()) {
+        return job.Path;
+    }
+    if (job.Layout == PixelLayout::RAW_YUV420) {
+        return storage.NextPath(job.Tag, ".raw", true);
+    }
+    return storage.NextPath(job.Tag, GetExtension(job.Format));
+}
+
+void CaptureWriter::Submit(EncodeJob &&job) {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (pending >= max_pending) {
+        LOG << "Capture writer full, waiting for encode\n";
+    }
+    space_cv.wait(lock, [this]{ return pending < max_pending; });
+
+    pending++;
+    pending_jobs.Set(pending);
+    queue.emplace_back(NextPath(job), std::move(job));
+    work_cv.notify_all();
+}
+
+bool CaptureWriter::TrySubmit(EncodeJob &job) {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (pending >= max_pending) {
+        rejected_jobs.Add();
+        return false;
+    }
+
+    pending++;
+    pending_jobs.Set(pending);
+    queue.emplace_back(NextPath(job), std::move(job));
+    work_cv.notify_all();
+    return true;
+}
+
+bool CaptureWriter::SubmitRaw(EncodeJob &job) {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (raw_pending >= max_raw_pending) {
+        rejected_raw.Add();
+        return false;
+    }
+
+    raw_pending++;
+    pending_raw.Set(raw_pending);
+    raw_queue.emplace_back(NextPath(job), std::move(job));
+    work_cv.notify_all();
+    return true;
+}
+
+std::shared_ptr<CaptureStream> CaptureWriter::SubmitStream(EncodeJob &&job) {
+    // a few strips of slack let the readback run ahead while the encoder starts on a strip
+    job.Stream = std::make_shared<CaptureStream>(4);
+    std::shared_ptr<CaptureStream> stream = job.Stream;
+    Submit(std::move(job));
+    return stream;
+}
+
+std::shared_ptr<CaptureStream> CaptureWriter::TrySubmitStream(EncodeJob &job, size_t max_strips) {
+    job.Stream = std::make_shared<CaptureStream>(max_strips);
+    std::shared_ptr<CaptureStream> stream = job.Stream;
+    if (!TrySubmit(job)) {
+        job.Stream.reset();
+        return nullptr;
+    }
+    return stream;
+}
+
+void CaptureWriter::Flush() {
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        space_cv.wait(lock, [this]{ return pending == 0 && raw_pending == 0; });
+    }
+    storage.Sync();
+}
+
+size_t CaptureWriter::GetPending() {
+    std::unique_lock<std::mutex> lock(mutex);
+    return pending;
+}
+
+size_t CaptureWriter::GetPendingRaw() {
+    std::unique_lock<std::mutex> lock(mutex);
+    return raw_pending;
+}
+
+void CaptureWriter::SetPngOptions(const PngOptions &options) {
+    std::unique_lock<std::mutex> lock(mutex);
+    png_options = options;
+}
+
+void CaptureWriter::SetJpegOptions(const JpegOptions &options) {
+    std::unique_lock<std::mutex> lock(mutex);
+    jpeg_options = options;
+}
+
+void CaptureWriter::WorkerLoop(bool raw) {
+    Tracer::SetThreadName(raw ? "raw writer" : "encoder");
+    std::deque<std::pair<std::string, EncodeJob>> &jobs = raw ? raw_queue : queue;
+    while (true) {
+        std::pair<std::string, EncodeJob> item;
+        PngOptions png;
+        JpegOptions jpeg;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            work_cv.wait(lock, [this, &jobs]{ return !jobs.empty() || shutdown; });
+            if (jobs.empty()) {
+                return;
+            }
+            item = std::move(jobs.front());
+            jobs.pop_front();
+            png = png_options;
+            jpeg = jpeg_options;
+        }
+
+        EncodeJob &job = item.second;
+        auto start_time = std::chrono::steady_clock::now();
+
+        // a rough upper bound, it only sizes the preallocation
+        size_t expected_size = static_cast<size_t>(job.Width) * job.Height * job.Channels;
+        if (job.Layout == PixelLayout::RAW_YUV420) {
+            expected_size = GetRawCaptureSize(job.Pixels);
+        }
+        else if (job.Format == CaptureFormat::JPEG) {
+            expected_size /= 4;
+        }
+
+        std::unique_ptr<StorageFile> file = storage.Create(item.first, expected_size);
+        bool encoded = file && Encode(job, png, jpeg, *file);
+        Tracer::Complete(raw ? "raw write" : job.Format == CaptureFormat::JPEG ? "JPEG encode" : "PNG encode", start_time, std::chrono::steady_clock::now());
+        std::chrono::duration<float> elapsed = std::chrono::steady_clock::now() - start_time;
+
+        encode_time.Record(std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+
+        EncodeResult result{item.first, false, elapsed.count(), 0, elapsed.count()};
+        // release the frame before signalling, so a blocked Submit never sees more than max_pending frames alive
+        job.Pixels = std::vector<unsigned char>();
+
+        if (job.Stream) {
+            // nothing reads the stream any more, let the producer through
+            job.Stream->Cancel();
+            job.Stream.reset();
+        }
+
+        auto on_complete = std::move(job.OnComplete);
+        if (encoded) {
+            // a failed Close reports through the callback as well
+            file->Close([result, on_complete](const DurableResult &durable) mutable {
+                result.Success = durable.Success;
+                result.Bytes = durable.Bytes;
+                result.DurableSeconds = durable.DurableSeconds;
+                if (on_complete) {
+                    on_complete(result);
+                }
+            });
+        }
+        else {
+            LOG_ERR << "Failed to write " << result.Path << std::endl;
+            failed_writes.Add();
+            file.reset();
+            if (on_complete) {
+                on_complete(result);
+            }
+        }
+
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            if (raw) {
+                raw_pending--;
+                pending_raw.Set(raw_pending);
+            }
+            else {
+                pending--;
+                pending_jobs.Set(pending);
+            }
+        }
+        space_cv.notify_all();
+    }
+}
+
+bool CaptureWriter::Encode(EncodeJob &job, const PngOptions &png, const JpegOptions &jpeg, StorageFile &file) {
+    auto sink = [&](const void *data, size_t size) {
+        return file.Append(data, size);
+    };
+
+    if (job.Stream) {
+        return EncodeStream(job, png, jpeg, file);
+    }
+
+    size_t stride = static_cast<size_t>(job.Width) * job.Channels;
+    if (job.Layout == PixelLayout::RAW_YUV420) {
+        job.Raw.Width = job.Width;
+        job.Raw.Height = job.Height;
+        job.Raw.Format = static_cast<int>(job.Format);
+        return WriteRawCapture(job.Raw, job.Pixels, sink);
+    }
+    if (job.Layout == PixelLayout::YUV420) {
+        const unsigned char *y = job.Pixels.data();
+        const unsigned char *cb = y + static_cast<size_t>(job.Width) * job.Height;
+        const unsigned char *cr = cb + static_cast<size_t>(job.Width / 2) * (job.Height / 2);
+        return job.Format == CaptureFormat::JPEG && jpeg_writer.WriteYUV420(y, cb, cr, job.Width, job.Height, jpeg, sink);
+    }
+    if (job.Format == CaptureFormat::JPEG) {
+        return jpeg_writer.Write(job.Pixels.data(), job.Width, job.Height, job.Channels, stride, jpeg, sink);
+    }
+    return png_writer.Write(job.Pixels.data(), job.Width, job.Height, job.Channels, stride, png, sink);
+}
+
+bool CaptureWriter::EncodeStream(EncodeJob &job, const PngOptions &png, const JpegOptions &jpeg, StorageFile &file) {
+    auto sink = [&](const void *data, size_t size) {
+        return file.Append(data, size);
+    };
+
+    CaptureStream &stream = *job.Stream;
+    CaptureStream::StreamStrip strip;
+    bool ok = true;
+    if (job.Format == CaptureFormat::JPEG) {
+        JpegStream encoder(encode_pool, job.Width, job.Height, job.Channels, job.Layout == PixelLayout::YUV420, jpeg, sink);
+        while (ok && stream.Pop(strip)) {
+            ok = encoder.AddRows(std::move(strip.rows), strip.num_rows);
+        }
+        ok = !stream.IsAborted() && ok;
+        ok = encoder.Finish() && ok;
+    }
+    else if (job.Layout == PixelLayout::INTERLEAVED) {
+        PngStream encoder(encode_pool, job.Width, job.Height, job.Channels, png, sink);
+        while (ok && stream.Pop(strip)) {
+            ok = encoder.AddRows(strip.rows.data(), strip.num_rows, static_cast<size_t>(job.Width) * job.Channels);
+        }
+        ok = !stream.IsAborted() && ok;
+        ok = encoder.Finish() && ok;
+    }
+    else {
+        LOG_ERR << "PNG captures can not be streamed as YUV" << std::endl;
+        ok = false;
+    }
+    return ok;
+}
@@ -0,0 +1,161 @@
+#ifndef CAPTUREWRITER_HPP
+#define CAPTUREWRITER_HPP
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <CaptureStorage.hpp>
+#include <JpegWriter.hpp>
+#include <Metrics.hpp>
+#include <PngWriter.hpp>
+#include <RawCapture.hpp>
+#include <ThreadPool.hpp>
+
+enum class CaptureFormat {
+    PNG,
+    JPEG
+};
+
+enum class PixelLayout {
+    INTERLEAVED, // Channels bytes per pixel
+    YUV420,      // full range planes as StillCaptureRenderYUV reads them back, JPEG only
+    RAW_YUV420   // undeveloped camera frame, stored to the pending directory with Raw and developed later
+};
+
+struct EncodeResult {
+    std::string Path;
+    bool Success;
+    float EncodeSeconds;
+    size_t Bytes;
+    float DurableSeconds; // encode start until the file was synced
+};
+
+/* rows of a capture handed over while the rest of it is still being read back. Push copies a strip and blocks
+   while max_strips are waiting for the encoder, so the producer never gets more than that ahead. producers on the
+   main loop use TryPush, which never waits */
+class CaptureStream {
+    friend class CaptureWriter;
+
+private:
+    struct StreamStrip {
+        std::vector<unsigned char> rows;
+        int num_rows;
+    };
+
+    std::deque<StreamStrip> strips;
+    size_t max_strips;
+    bool finished = false;
+    bool cancelled = false;
+    bool aborted = false;
+    std::mutex mutex;
+    std::condition_variable cv;
+
+    // false once the stream is finished and drained, or cancelled or aborted
+    bool Pop(StreamStrip &strip);
+    // the encoder gave up, Push drops everything from now on
+    void Cancel();
+
+public:
+    explicit CaptureStream(size_t max_strips) : max_strips(max_strips) {}
+
+    // strips in order from the top. false when the capture failed and the rest can be skipped
+    bool Push(const void *data, size_t size, int num_rows);
+    // like Push, false instead of waiting when max_strips are still queued
+    bool TryPush(const void *data, size_t size, int num_rows);
+    // after the last strip
+    void Finish();
+    // instead of Finish when the producer failed. the encoder fails the capture, nothing short is stored
+    void Abort();
+    bool IsAborted();
+};
+
+// One finished capture. pixels are moved in and owned by the writer until the file is written
+struct EncodeJob {
+    std::vector<unsigned char> Pixels;
+    int Width;
+    int Height;
+    int Channels;
+    CaptureFormat Format;
+    std::string Tag; // appended to the file name, e.g. the LUT of a multi-look export
+    std::function<void(const EncodeResult &)> OnComplete; // runs once the file is durable, on the storage sync thread
+    PixelLayout Layout = PixelLayout::INTERLEAVED;
+    RawCaptureInfo Raw;   // RAW_YUV420 only, size and format are taken from the job
+    std::string Path;     // written here instead of under the next capture name
+    std::shared_ptr<CaptureStream> Stream; // rows arrive through the stream instead of in Pixels
+};
+
+/* encodes and saves captures off the main loop so the viewfinder keeps running during the PNG/JPEG
+   encode. the number of captures in flight is bounded: Submit blocks once max_pending jobs are queued or being
+   encoded, which caps memory at max_pending full frames. producers that hold something shared while they hand a
+   capture over, like the readback of a multi-look export, use TrySubmit instead. undeveloped frames have a queue
+   and a thread of their own, so storing one never waits behind an encode and SubmitRaw never blocks */
+class CaptureWriter {
+private:
+    CaptureStorage storage;
+    size_t max_pending;
+    size_t pending = 0;     // queued plus currently encoding
+    size_t max_raw_pending;
+    size_t raw_pending = 0; // raw frames queued plus the one being written
+    MetricGauge &pending_jobs = Metrics::GetGauge("writer.pending_jobs");
+    MetricGauge &pending_raw = Metrics::GetGauge("writer.pending_raw");
+    MetricCounter &rejected_raw = Metrics::GetCounter("writer.rejected_raw");
+    MetricCounter &rejected_jobs = Metrics::GetCounter("writer.rejected_jobs");
+    LatencyHistogram &encode_time = Metrics::GetHistogram("writer.encode_us");
+    MetricCounter &failed_writes = Metrics::GetCounter("writer.failed_writes");
+    std::deque<std::pair<std::string, EncodeJob>> queue; // <output path, job>
+    std::deque<std::pair<std::string, EncodeJob>> raw_queue;
+    std::vector<std::thread> workers;
+    std::thread raw_worker;
+    std::mutex mutex;
+    std::condition_variable work_cv;   // workers wait for jobs
+    std::condition_variable space_cv;  // producers wait for room, Flush waits for empty
+    bool shutdown = false;
+    ThreadPool encode_pool; // strips of every capture in flight, shared by all writer threads
+    PngWriter png_writer{encode_pool};
+    JpegWriter jpeg_writer{encode_pool};
+    PngOptions png_options;
+    JpegOptions jpeg_options;
+
+    void WorkerLoop(bool raw);
+    std::string NextPath(const EncodeJob &job);
+    bool Encode(EncodeJob &job, const PngOptions &png, const JpegOptions &jpeg, StorageFile &file);
+    bool EncodeStream(EncodeJob &job, const PngOptions &png, const JpegOptions &jpeg, StorageFile &file);
+
+public:
+    CaptureWriter(std::string output_dir, size_t max_pending, unsigned int num_workers, size_t max_raw_pending = 2);
+    ~CaptureWriter();
+
+    // blocks while the writer is full
+    void Submit(EncodeJob &&job);
+    // never blocks, returns false and leaves job untouched when the writer is full
+    bool TrySubmit(EncodeJob &job);
+    // a RAW_YUV420 job, stored by the raw thread. never blocks, returns false and leaves job untouched when
+    // max_raw_pending frames are still waiting for storage
+    bool SubmitRaw(EncodeJob &job);
+    // like Submit, with the rows to follow through the returned stream. encoding starts with the first strip,
+    // so only a few strips are ever in memory. Layout INTERLEAVED, or YUV420 for JPEG
+    std::shared_ptr<CaptureStream> SubmitStream(EncodeJob &&job);
+    // like TrySubmit, nullptr when the writer is full. max_strips is how far the producer may run ahead of the
+    // encoder, a producer that must never wait passes the number of strips in the whole capture
+    std::shared_ptr<CaptureStream> TrySubmitStream(EncodeJob &job, size_t max_strips = 4);
+    // blocks until everything submitted so far is durable
+    void Flush();
+
+    size_t GetPending();
+    size_t GetPendingRaw();
+    const std::string &GetOutputDir() const { return storage.GetOutputDir(); }
+    const std::string &GetPendingDir() const { return storage.GetPendingDir(); }
+    StorageStats GetStorageStats() { return storage.GetStats(); }
+    static const char *GetExtension(CaptureFormat format);
+
+    // apply to jobs that start encoding after the call
+    void SetPngOptions(const PngOptions &options);
+    void SetJpegOptions(const JpegOptions &options);
+};
+
+#endif // CAPTUREWRITER_HPP
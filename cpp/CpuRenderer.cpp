@@ -0,0 +1,293 @@
+#include <CpuRenderer.hpp>
+#include <YuvConvert.hpp>
+#include <LutCube.hpp>
+#include <algorithm>
+#include <cmath>
+#include <log.hpp>
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+namespace {
+
+// nodes per axis of the viewfinder's copy of a LUT, small enough for the cube to stay in cache
+const int viewfinder_lut_side = 33;
+// a band of screen rows handed to one thread, in row pairs so chroma rows are never shared
+const int band_pairs = 8;
+
+} // namespace
+
+/* taps of count output samples spread over source_size source samples, at texel centres like GL_LINEAR and clamped
+   at the edges. reversed runs the output the other way across the source */
+std::vector<CpuRenderer::Tap> CpuRenderer::MakeTaps(int count, int source_size, bool reversed) {
+    std::vector<Tap> taps(count);
+    for (int i = 0; i < count; i++) {
+        float t = (i + 0.5f) / count;
+        if (reversed) {
+            t = 1.0f - t;
+        }
+        float pos = t * source_size - 0.5f;
+        int index = static_cast<int>(std::floor(pos));
+        int weight = static_cast<int>(std::lround((pos - index) * 256.0f));
+        if (index < 0) {
+            index = 0;
+            weight = 0;
+        }
+        else if (index >= source_size - 1) {
+            index = source_size - 2;
+            weight = 256;
+        }
+        taps[i] = {index, weight};
+    }
+    return taps;
+}
+
+/* rows [row_begin, row_end) of a plane turned onto the screen: screen rows walk across the source columns and
+   screen columns down the source rows, as the viewfinder quad does with trans_mat */
+void CpuRenderer::ResamplePlane(const unsigned char *src, int src_stride, const std::vector<Tap> &row_taps,
+                                const std::vector<Tap> &column_taps, unsigned char *dst, int dst_width,
+                                int row_begin, int row_end) {
+    for (int row = row_begin; row < row_end; row++) {
+        const unsigned char *column = src + row_taps[row].index;
+        const int wx = row_taps[row].weight;
+        unsigned char *out = dst + static_cast<size_t>(row) * dst_width;
+        for (int x = 0; x < dst_width; x++) {
+            const unsigned char *p = column + static_cast<size_t>(column_taps[x].index) * src_stride;
+            const int wy = column_taps[x].weight;
+            int top = p[0] * (256 - wx) + p[1] * wx;
+            int bottom = p[src_stride] * (256 - wx) + p[src_stride + 1] * wx;
+            out[x] = static_cast<unsigned char>((top * (256 - wy) + bottom * wy + 32768) >> 16);
+        }
+    }
+}
+
+bool CpuRenderer::Initialize() {
+    if (!LoadLutLibrary()) {
+        return false;
+    }
+    if (lut_library.GetNumLuts() == 0) {
+        LOG_ERR << "No LUTs to render with" << std::endl;
+        return false;
+    }
+
+    // the screen is screen_height wide and screen_width high, see ViewfinderRender
+    luma_row_taps = MakeTaps(screen_width, viewfinder_width, true);
+    luma_column_taps = MakeTaps(screen_height, viewfinder_height, false);
+    chroma_row_taps = MakeTaps(screen_width / 2, viewfinder_width / 2, true);
+    chroma_column_taps = MakeTaps(screen_height / 2, viewfinder_height / 2, false);
+    screen_y.resize(static_cast<size_t>(screen_width) * screen_height);
+    screen_u.resize(screen_y.size() / 4);
+    screen_v.resize(screen_y.size() / 4);
+    screen_rgba.resize(screen_y.size() * 4);
+
+    InitFreetype();
+    SwitchLUT(0);
+    LOG << "Rendering on the CPU, " << GetYuvKernelName(GetYuvKernel()) << " YUV kernel" << std::endl;
+    return true;
+}
+
+void CpuRenderer::InitFreetype() {
+    FT_Library ft;
+    if (FT_Init_FreeType(&ft))
+    {
+        LOG_ERR << "Could not init FreeType Library" << std::endl;
+        return;
+    }
+
+    FT_Face face;
+    if (FT_New_Face(ft, font_path.c_str(), 0, &face))
+    {
+        LOG_ERR << "Failed to load font" << std::endl;
+        FT_Done_FreeType(ft);
+        return;
+    }
+
+    FT_Set_Pixel_Sizes(face, 0, 24);
+
+    // same first 128 ASCII characters as the GL glyph textures, kept as coverage bitmaps
+    for (unsigned char c = 0; c < 128; c++)
+    {
+        if (FT_Load_Char(face, c, FT_LOAD_RENDER))
+        {
+            LOG_ERR << "Failed to load Glyph" << std::endl;
+            continue;
+        }
+        const FT_Bitmap &bitmap = face->glyph->bitmap;
+        Glyph glyph;
+        glyph.Width = bitmap.width;
+        glyph.Rows = bitmap.rows;
+        glyph.Left = face->glyph->bitmap_left;
+        glyph.Top = face->glyph->bitmap_top;
+        glyph.Advance = face->glyph->advance.x >> 6;
+        glyph.Bitmap.resize(static_cast<size_t>(glyph.Width) * glyph.Rows);
+        for (int y = 0; y < glyph.Rows; y++) {
+            std::copy_n(bitmap.buffer + y * bitmap.pitch, glyph.Width, glyph.Bitmap.begin() + y * glyph.Width);
+        }
+        glyphs[c] = std::move(glyph);
+    }
+
+    FT_Done_Face(face);
+    FT_Done_FreeType(ft);
+}
+
+void CpuRenderer::SwitchLUT(int index) {
+    lut_idx = index;
+    const LUT &lut = lut_library.GetLut(index);
+    if (lut.Monochrome) {
+        viewfinder_engine.reset();
+        return;
+    }
+
+    // tetrahedral on a 33^3 copy, the preview trades the last bit of accuracy for frame rate. stills use the LUT
+    // as it is
+    std::vector<unsigned char> nodes = ResampleLUT(lut, viewfinder_lut_side);
+    LUT small = lut;
+    small.Data = nodes.data();
+    small.Size = viewfinder_lut_side;
+    viewfinder_engine.reset(new LutEngine(small, LutInterpolation::TETRAHEDRAL));
+}
+
+void CpuRenderer::SetContactSheet(bool enabled) {
+    if (enabled) {
+        LOG_ERR << "No contact sheet on the CPU renderer" << std::endl;
+    }
+}
+
+bool CpuRenderer::IsContactSheet() {
+    return false;
+}
+
+// screen rows [2 * pair_begin, 2 * pair_end) of a viewfinder frame into screen_rgba
+void CpuRenderer::RenderViewfinderRows(const unsigned char *frame, int stride, bool monochrome, int pair_begin, int pair_end) {
+    const int row_begin = pair_begin * 2;
+    const int row_end = pair_end * 2;
+    const int rgba_stride = screen_height * 4;
+    ResamplePlane(frame, stride, luma_row_taps, luma_column_taps, screen_y.data(), screen_height, row_begin, row_end);
+
+    if (monochrome) {
+        const unsigned char *tone_curve = lut_library.GetLut(lut_idx).ToneCurve.data();
+        for (int row = row_begin; row < row_end; row++) {
+            const unsigned char *in = screen_y.data() + static_cast<size_t>(row) * screen_height;
+            unsigned char *out = screen_rgba.data() + static_cast<size_t>(row) * rgba_stride;
+            for (int x = 0; x < screen_height; x++) {
+                unsigned char tone = tone_curve[in[x]];
+                out[x*4 + 0] = tone;
+                out[x*4 + 1] = tone;
+                out[x*4 + 2] = tone;
+                out[x*4 + 3] = 255;
+            }
+        }
+        return;
+    }
+
+    const unsigned char *u_plane = frame + static_cast<size_t>(stride) * viewfinder_height;
+    const unsigned char *v_plane = u_plane + static_cast<size_t>(stride / 2) * (viewfinder_height / 2);
+    ResamplePlane(u_plane, stride / 2, chroma_row_taps, chroma_column_taps, screen_u.data(), screen_height / 2, pair_begin, pair_end);
+    ResamplePlane(v_plane, stride / 2, chroma_row_taps, chroma_column_taps, screen_v.data(), screen_height / 2, pair_begin, pair_end);
+
+    /* XRGB8888 lays the colour out as B, G, R, so the LUT sees it swizzled exactly like texture(clut,
+       orig_color.bgr) in viewfinder_fs.glsl, and its R, G, B, 255 lands in the bytes the GL readback has */
+    YuvFrame screen_frame{screen_y.data(), screen_u.data(), screen_v.data(), screen_height, screen_width,
+                          screen_height, screen_height / 2, YuvLayout::I420};
+    ConvertYuvToRgb(screen_frame, screen_rgba.data(), rgba_stride, RgbFormat::XRGB8888, YuvMatrix::BT601,
+                    YuvRange::FULL, row_begin, row_end);
+    viewfinder_engine->ApplyRows(screen_rgba.data(), rgba_stride, screen_rgba.data(), rgba_stride, screen_height,
+                                 4, row_begin, row_end);
+}
+
+void CpuRenderer::ViewfinderRender(std::vector<uint8_t> &vec_frame, int stride, std::function<void(void* data, size_t size)> callback) {
+    bool monochrome = lut_library.GetLut(lut_idx).Monochrome;
+    worker_pool.ParallelFor(0, screen_width / 2, [&](int begin, int end) {
+        RenderViewfinderRows(vec_frame.data(), stride, monochrome, begin, end);
+    }, band_pairs);
+
+    RenderText(lut_library.GetLut(lut_idx).Name, 10.0f, 10.0f, 1.0f, glm::vec3(0.5, 0.8f, 0.2f));
+
+    if (callback) {
+        callback(screen_rgba.data(), screen_rgba.size());
+    }
+}
+
+// renderers for exactly these LUTs, the ones the last still used are kept and the others built
+void CpuRenderer::KeepStillRenderers(const std::vector<int> &luts) {
+    std::map<int, std::unique_ptr<CpuStillRenderer>> renderers;
+    for (int lut : luts) {
+        auto it = still_renderers.find(lut);
+        if (it != still_renderers.end()) {
+            renderers[lut] = std::move(it->second);
+        }
+        else if (!renderers[lut]) {
+            renderers[lut].reset(new CpuStillRenderer(lut_library.GetLut(lut)));
+        }
+    }
+    still_renderers = std::move(renderers);
+}
+
+// renders a still with the LUT at lut_index into still_rgb, after KeepStillRenderers with it
+void CpuRenderer::RenderStill(std::vector<uint8_t> &cap_frame, int stride, int lut_index) {
+    still_rgb.resize(static_cast<size_t>(test_width) * test_height * 3);
+    const CpuStillRenderer &renderer = *still_renderers.at(lut_index);
+    worker_pool.ParallelFor(0, test_height, [&](int begin, int end) {
+        renderer.RenderRows(cap_frame.data(), test_width, test_height, stride, still_rgb.data(), begin, end);
+    }, 16);
+}
+
+void CpuRenderer::StillCaptureRender(std::vector<uint8_t> &cap_frame, int stride, std::function<void(void* data, size_t size)> callback) {
+    KeepStillRenderers({lut_idx});
+    RenderStill(cap_frame, stride, lut_idx);
+    if (callback) {
+        callback(still_rgb.data(), still_rgb.size());
+    }
+}
+
+void CpuRenderer::StillCaptureRenderMulti(std::vector<uint8_t> &cap_frame, int stride, const std::vector<int> &looks, std::function<void(int look, void* data, size_t size)> callback) {
+    KeepStillRenderers(looks);
+    for (size_t i = 0; i < looks.size(); i++) {
+        RenderStill(cap_frame, stride, looks[i]);
+        if (callback) {
+            callback(i, still_rgb.data(), still_rgb.size());
+        }
+    }
+}
+
+/* blends the glyphs into screen_rgba where the GL text projection puts them: text x runs down the screen rows and
+   text y along the columns, glyphs upright in the landscape view */
+void CpuRenderer::RenderText(std::string text, float x, float y, float scale, glm::vec3 color) {
+    const int rgba_stride = screen_height * 4;
+    const int colour[3] = {static_cast<int>(color.x * 255.0f + 0.5f), static_cast<int>(color.y * 255.0f + 0.5f),
+                           static_cast<int>(color.z * 255.0f + 0.5f)};
+
+    for (char c : text) {
+        auto it = glyphs.find(c);
+        if (it == glyphs.end()) {
+            continue;
+        }
+        const Glyph &glyph = it->second;
+
+        float xpos = x + glyph.Left * scale;
+        float ypos = y - (glyph.Rows - glyph.Top) * scale;
+        float w = glyph.Width * scale;
+        float h = glyph.Rows * scale;
+
+        int row_begin = std::max(0, static_cast<int>(std::ceil(xpos - 0.5f)));
+        int row_end = std::min(screen_width, static_cast<int>(std::ceil(xpos + w - 0.5f)));
+        int column_begin = std::max(0, static_cast<int>(std::ceil(ypos - 0.5f)));
+        int column_end = std::min(screen_height, static_cast<int>(std::ceil(ypos + h - 0.5f)));
+        for (int row = row_begin; row < row_end; row++) {
+            int gx = std::min(glyph.Width - 1, static_cast<int>((row + 0.5f - xpos) / scale));
+            unsigned char *out = screen_rgba.data() + static_cast<size_t>(row) * rgba_stride;
+            for (int column = column_begin; column < column_end; column++) {
+                // bitmap rows run from the top of the glyph, which is the high end of text y
+                int gy = std::min(glyph.Rows - 1, static_cast<int>((ypos + h - column - 0.5f) / scale));
+                int alpha = glyph.Bitmap[static_cast<size_t>(gy) * glyph.Width + gx];
+                if (alpha == 0) {
+                    continue;
+                }
+                unsigned char *p = out + column * 4;
+                for (int i = 0; i < 3; i++) {
+                    p[i] = static_cast<unsigned char>((colour[i] * alpha + p[i] * (255 - alpha) + 127) / 255);
+                }
+            }
+        }
+        x += glyph.Advance * scale;
+    }
+}
@@ -0,0 +1,62 @@
+#ifndef CPURENDERER_HPP
+#define CPURENDERER_HPP
+
+#include <map>
+#include <memory>
+#include <Renderer.hpp>
+#include <CpuStillRenderer.hpp>
+#include <LutEngine.hpp>
+
+/* the render API without a GPU. the viewfinder is turned and scaled onto the screen like the viewfinder quad, with
+   bilinear taps in fixed point, converted by the SIMD YUV kernels and looked up by LutEngine, in bands of rows
+   across the worker pool. its bytes are what ShaderManager reads back for the dumb buffer, LUT sampled with the
+   colour swizzled the way viewfinder_fs.glsl does. stills go through CpuStillRenderer, the CPU port of the still
+   shaders. no contact sheet */
+class CpuRenderer : public Renderer {
+private:
+    // a bilinear tap between two neighbouring samples, weight of the second one out of 256
+    struct Tap {
+        int index;
+        int weight;
+    };
+
+    struct Glyph {
+        std::vector<unsigned char> Bitmap;
+        int Width;
+        int Rows;
+        int Left;    // offset from the pen to the left of the bitmap
+        int Top;     // offset from the baseline to the top of the bitmap
+        int Advance; // in pixels
+    };
+
+    // the viewfinder resampled to the screen, as an I420 frame screen_height wide and screen_width high
+    std::vector<unsigned char> screen_y, screen_u, screen_v;
+    std::vector<unsigned char> screen_rgba;
+    std::vector<Tap> luma_row_taps, luma_column_taps;     // per screen row and screen column
+    std::vector<Tap> chroma_row_taps, chroma_column_taps; // the same for the half size chroma
+    std::unique_ptr<LutEngine> viewfinder_engine;         // colour LUTs only
+    std::map<int, std::unique_ptr<CpuStillRenderer>> still_renderers; // per LUT of the last still, single or multi-look
+    std::vector<unsigned char> still_rgb;
+    std::map<char, Glyph> glyphs;
+
+    static std::vector<Tap> MakeTaps(int count, int source_size, bool reversed);
+    static void ResamplePlane(const unsigned char *, int, const std::vector<Tap> &, const std::vector<Tap> &,
+                              unsigned char *, int, int, int);
+    void RenderViewfinderRows(const unsigned char *, int, bool, int, int);
+    void KeepStillRenderers(const std::vector<int> &);
+    void RenderStill(std::vector<uint8_t> &, int, int);
+    void InitFreetype();
+
+public:
+    bool Initialize() override;
+
+    void SwitchLUT(int) override;
+    void SetContactSheet(bool) override;
+    bool IsContactSheet() override;
+    void ViewfinderRender(std::vector<uint8_t> &, int, std::function<void(void*, size_t)>) override;
+    void StillCaptureRender(std::vector<uint8_t> &, int, std::function<void(void*, size_t)>) override;
+    void StillCaptureRenderMulti(std::vector<uint8_t> &, int, const std::vector<int> &, std::function<void(int, void*, size_t)>) override;
+    void RenderText(std::string, float, float, float, glm::vec3) override;
+}; // CpuRenderer
+
+#endif // CPURENDERER_HPP
@@ -0,0 +1,103 @@
+#include <CpuStillRenderer.hpp>
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+// GL_LINEAR sample positions in a half resolution plane for luma sample x, clamped at the edges
+struct ChromaTap {
+    int i0, i1;
+    float frac;
+};
+
+ChromaTap ChromaTapFor(int x, int chroma_size) {
+    // texel centres line up at x/2 - 0.25 in chroma texels
+    float pos = x * 0.5f - 0.25f;
+    int i0 = static_cast<int>(std::floor(pos));
+    ChromaTap tap;
+    tap.frac = pos - i0;
+    tap.i0 = std::clamp(i0, 0, chroma_size - 1);
+    tap.i1 = std::clamp(i0 + 1, 0, chroma_size - 1);
+    return tap;
+}
+
+inline unsigned char ToByte(float x) {
+    return static_cast<unsigned char>(std::clamp(x, 0.0f, 1.0f) * 255.0f + 0.5f);
+}
+
+} // namespace
+
+CpuStillRenderer::CpuStillRenderer(const LUT &lut)
+    : monochrome(lut.Monochrome), tone_curve(lut.ToneCurve) {
+    if (!monochrome) {
+        cube.reset(new LutCube(lut.Data, lut.Size));
+    }
+}
+
+void CpuStillRenderer::RenderRows(const unsigned char *frame, int width, int height, int stride, unsigned char *rgb,
+                                  int row_begin, int row_end, int rgb_first_row) const {
+    const int chroma_width = width / 2;
+    const int chroma_height = height / 2;
+    const int chroma_stride = stride / 2;
+    const unsigned char *y_plane = frame;
+    const unsigned char *u_plane = y_plane + static_cast<size_t>(stride) * height;
+    const unsigned char *v_plane = u_plane + static_cast<size_t>(chroma_stride) * chroma_height;
+    const float scale = 1.0f / 255.0f;
+
+    /* the shader looks the colour up without remapping it onto texel centres, so the 3D texture sees
+       rgb * size - 0.5 texels where LutCube samples rgb * (size - 1) nodes. rescale to land on the same spot */
+    const float lut_size = cube ? static_cast<float>(cube->GetSize()) : 2.0f;
+    const Vec4f texel_scale = Splat4f(lut_size / (lut_size - 1.0f));
+    const Vec4f texel_offset = Splat4f(0.5f / (lut_size - 1.0f));
+
+    std::vector<ChromaTap> column_taps;
+    if (!monochrome) {
+        column_taps.resize(width);
+        for (int x = 0; x < width; x++) {
+            column_taps[x] = ChromaTapFor(x, chroma_width);
+        }
+    }
+
+    for (int row = row_begin; row < row_end; row++) {
+        // the still vertex shader turns the frame by 180 degrees, output row 0 is the last sensor row
+        const int src_y = height - 1 - row;
+        const unsigned char *y_row = y_plane + static_cast<size_t>(src_y) * stride;
+        unsigned char *out = rgb + static_cast<size_t>(row - rgb_first_row) * width * 3;
+
+        if (monochrome) {
+            for (int x = 0; x < width; x++) {
+                unsigned char tone = tone_curve[y_row[width - 1 - x]];
+                out[x*3 + 0] = out[x*3 + 1] = out[x*3 + 2] = tone;
+            }
+            continue;
+        }
+
+        ChromaTap row_tap = ChromaTapFor(src_y, chroma_height);
+        const unsigned char *u0 = u_plane + static_cast<size_t>(row_tap.i0) * chroma_stride;
+        const unsigned char *u1 = u_plane + static_cast<size_t>(row_tap.i1) * chroma_stride;
+        const unsigned char *v0 = v_plane + static_cast<size_t>(row_tap.i0) * chroma_stride;
+        const unsigned char *v1 = v_plane + static_cast<size_t>(row_tap.i1) * chroma_stride;
+        const float fy = row_tap.frac;
+
+        for (int x = 0; x < width; x++) {
+            const int src_x = width - 1 - x;
+            const ChromaTap &tap = column_taps[src_x];
+            float u_top = u0[tap.i0] + (u0[tap.i1] - u0[tap.i0]) * tap.frac;
+            float u_bottom = u1[tap.i0] + (u1[tap.i1] - u1[tap.i0]) * tap.frac;
+            float v_top = v0[tap.i0] + (v0[tap.i1] - v0[tap.i0]) * tap.frac;
+            float v_bottom = v1[tap.i0] + (v1[tap.i1] - v1[tap.i0]) * tap.frac;
+
+            float y = y_row[src_x] * scale;
+            float u = (u_top + (u_bottom - u_top) * fy) * scale - 0.5f;
+            float v = (v_top + (v_bottom - v_top) * fy) * scale - 0.5f;
+
+            // same BT.601 matrix as the shader
+            Vec4f colour = Clamp4f(Set4f(y + 1.4020f * v, y - 0.3441f * u - 0.7141f * v, y + 1.7720f * u, 0.0f), 0.0f, 1.0f);
+            float graded[4];
+            Store4f(graded, cube->Sample(colour * texel_scale - texel_offset));
+            out[x*3 + 0] = ToByte(graded[0]);
+            out[x*3 + 1] = ToByte(graded[1]);
+            out[x*3 + 2] = ToByte(graded[2]);
+        }
+    }
+}
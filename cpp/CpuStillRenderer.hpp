@@ -0,0 +1,29 @@
+#ifndef CPUSTILLRENDERER_HPP
+#define CPUSTILLRENDERER_HPP
+
+#include <memory>
+#include <vector>
+#include <Lut.hpp>
+#include <LutCube.hpp>
+
+/* CPU port of stillcapture_fs.glsl and stillcapture_mono_fs.glsl, for developing captures away from the GL
+   thread. follows the GPU path step by step: bilinear chroma, full range BT.601, the 180 degree turn of the
+   still vertex shader, then a trilinear 3D lookup or the tone curve of a monochrome LUT. output is packed RGB888
+   like StillCaptureRender reads back */
+class CpuStillRenderer {
+private:
+    bool monochrome;
+    std::vector<unsigned char> tone_curve;
+    std::unique_ptr<LutCube> cube; // colour LUTs only
+
+public:
+    // copies what it needs, lut may go away afterwards
+    explicit CpuStillRenderer(const LUT &lut);
+
+    // renders output rows [row_begin, row_end) of a YUV420 camera frame into rgb, which holds the output rows from
+    // rgb_first_row on, width*3 bytes each
+    void RenderRows(const unsigned char *frame, int width, int height, int stride, unsigned char *rgb,
+                    int row_begin, int row_end, int rgb_first_row = 0) const;
+};
+
+#endif // CPUSTILLRENDERER_HPP
@@ -7,6 +7,9 @@
 #include <cstring>
 #include <condition_variable>
 #include <log.hpp>
+#include <Trace.hpp>
+#include <PerfCounters.hpp>
+#include <Metrics.hpp>
 
 /* instead of implementing a synchronous queue, allow for camera processor thread to continuously update 
    frame data. this avoids the possibility of the camera thread overflowing the queue. order is less important for the 
@@ -18,31 +21,46 @@ private:
     std::pair<bool, std::vector<uint8_t>> capture_data; // <data available, pointer to data>
     std::mutex mutex;
     std::condition_variable cv;
-    bool shutdown;
+    bool shutdown = false;
+    // viewfinder frames replaced before the main loop took them, and whether one is waiting now
+    MetricCounter &dropped_frames = Metrics::GetCounter("frame_manager.dropped_frames");
+    MetricGauge &pending_frames = Metrics::GetGauge("frame_manager.pending_frames");
 
 public:
     FrameManager() {}
     
     void update(const void* ptr, size_t size) {
+        TRACE_SCOPE("frame copy");
         std::unique_lock<std::mutex> lock(mutex);
 
+		if (frame_data.first) {
+			dropped_frames.Add();
+		}
 		if (frame_data.second.size() != size) {
 			frame_data.second.resize(size);
 		}
 
-		memcpy(frame_data.second.data(), ptr, size);
+		{
+			PerfScope perf(PerfStage::FRAME_COPY);
+			memcpy(frame_data.second.data(), ptr, size);
+		}
         frame_data.first = true; // indicate that new data is available
+        pending_frames.Set(1);
         cv.notify_one();
     }
     
     void update_capture(const void *ptr, size_t size) {
+        TRACE_SCOPE("capture copy");
         std::unique_lock<std::mutex> lock(mutex);
 
         if (capture_data.second.size() != size) {
             capture_data.second.resize(size);
         }
 
-        memcpy(capture_data.second.data(), ptr, size);
+        {
+            PerfScope perf(PerfStage::FRAME_COPY);
+            memcpy(capture_data.second.data(), ptr, size);
+        }
         capture_data.first = true;
     }
 
@@ -52,6 +70,7 @@ public:
     }
 
     bool swap_buffers(std::vector<uint8_t> &vector_in) {
+        TRACE_SCOPE("frame wait");
         std::unique_lock<std::mutex> lock(mutex);
         cv.wait(lock, [this]{ return frame_data.first || shutdown; });
         if (shutdown) {
@@ -60,6 +79,7 @@ public:
 
         frame_data.second.swap(vector_in);
         frame_data.first = false; // processed this data
+        pending_frames.Set(0);
         return true;
     }
 
@@ -73,6 +93,7 @@ public:
         std::unique_lock<std::mutex> lock(mutex);
         frame_data.first = false;
         frame_data.second.clear();
+        pending_frames.Set(0);
     }
 
     void Stop() {
@@ -0,0 +1,196 @@
+#include <IdleScheduler.hpp>
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <log.hpp>
+
+namespace {
+
+int64_t SteadyNow() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+std::string ReadFirstLine(const std::filesystem::path &path) {
+    std::ifstream file(path);
+    std::string line;
+    std::getline(file, line);
+    return line;
+}
+
+} // namespace
+
+IdleScheduler::IdleScheduler(CaptureWriter &writer, LutLookup find_lut)
+    : writer(writer), find_lut(std::move(find_lut)), last_interaction(SteadyNow()) {
+    thread = std::thread(&IdleScheduler::Loop, this);
+}
+
+IdleScheduler::~IdleScheduler() {
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        shutdown = true;
+    }
+    interrupted = true;
+    cv.notify_all();
+    thread.join();
+
+    // the writer still calls back into us for captures it is encoding
+    std::unique_lock<std::mutex> lock(mutex);
+    cv.wait(lock, [this]{ return in_flight.empty(); });
+}
+
+void IdleScheduler::NotifyInteraction() {
+    last_interaction = SteadyNow();
+    interrupted = true;
+}
+
+void IdleScheduler::Wake() {
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        wake = true;
+    }
+    cv.notify_all();
+}
+
+void IdleScheduler::Loop() {
+    // never compete with the viewfinder or the shutter path for a core
+    setpriority(PRIO_PROCESS, syscall(SYS_gettid), 19);
+
+    while (true) {
+        {
+            // idle time passes without anyone telling us, so poll as well
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait_for(lock, std::chrono::seconds(1), [this]{ return shutdown || wake; });
+            wake = false;
+            if (shutdown) {
+                return;
+            }
+        }
+
+        while (IsIdle()) {
+            std::string path = NextPending();
+            if (path.empty() || !Develop(path)) {
+                break;
+            }
+        }
+    }
+}
+
+bool IdleScheduler::IsIdle() {
+    std::chrono::nanoseconds since(SteadyNow() - last_interaction.load());
+    if (since >= idle_delay) {
+        return true;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    if (now - charging_checked >= charging_poll) {
+        charging = IsCharging();
+        charging_checked = now;
+    }
+    return charging && since >= charging_delay;
+}
+
+// any battery charging or full, or any external supply online
+bool IdleScheduler::IsCharging() {
+    std::error_code ec;
+    for (const auto &entry : std::filesystem::directory_iterator("/sys/class/power_supply", ec)) {
+        std::string type = ReadFirstLine(entry.path() / "type");
+        if (type == "Battery") {
+            std::string status = ReadFirstLine(entry.path() / "status");
+            if (status == "Charging" || status == "Full") {
+                return true;
+            }
+        }
+        else if (ReadFirstLine(entry.path() / "online") == "1") {
+            return true;
+        }
+    }
+    return false;
+}
+
+// oldest raw capture that is neither being encoded nor known to fail
+std::string IdleScheduler::NextPending() {
+    std::vector<std::string> candidates;
+    std::error_code ec;
+    for (const auto &entry : std::filesystem::directory_iterator(writer.GetPendingDir(), ec)) {
+        if (entry.path().extension() == ".raw") {
+            candidates.push_back(entry.path().string());
+        }
+    }
+    std::sort(candidates.begin(), candidates.end());
+
+    std::unique_lock<std::mutex> lock(mutex);
+    for (const std::string &path : candidates) {
+        if (!in_flight.count(path) && !failed.count(path)) {
+            return path;
+        }
+    }
+    return "";
+}
+
+bool IdleScheduler::Develop(const std::string &path) {
+    // anything from here on cancels this capture
+    interrupted = false;
+    if (!IsIdle()) {
+        return false;
+    }
+
+    RawCaptureInfo info;
+    std::vector<unsigned char> frame;
+    const LUT *lut = nullptr;
+    if (ReadRawCapture(path, info, frame)) {
+        lut = find_lut(info.LutHash, info.LutName);
+        if (!lut) {
+            LOG_ERR << "LUT " << info.LutName << " of " << path << " is not installed" << std::endl;
+        }
+    }
+    if (!lut) {
+        std::unique_lock<std::mutex> lock(mutex);
+        failed.insert(path);
+        return true;
+    }
+
+    if (!renderer || renderer_hash != lut->Hash) {
+        renderer.reset(new CpuStillRenderer(*lut));
+        renderer_hash = lut->Hash;
+    }
+
+    auto start_time = std::chrono::steady_clock::now();
+    std::vector<unsigned char> rgb(static_cast<size_t>(info.Width) * info.Height * 3);
+    for (int row = 0; row < info.Height; row += strip_rows) {
+        if (interrupted) {
+            LOG << "Developing " << path << " interrupted" << std::endl;
+            return false;
+        }
+        renderer->RenderRows(frame.data(), info.Width, info.Height, info.Stride, rgb.data(), row, std::min(row + strip_rows, info.Height));
+    }
+    frame = std::vector<unsigned char>();
+    std::chrono::duration<float> elapsed = std::chrono::steady_clock::now() - start_time;
+    LOG << "Developed " << path << " with " << lut->Name << " in " << elapsed.count() << "s\n";
+
+    CaptureFormat format = static_cast<CaptureFormat>(info.Format);
+    EncodeJob job{std::move(rgb), info.Width, info.Height, 3, format, "", [this, path](const EncodeResult &result) {
+        // the raw capture is only dropped once its developed version is on disk
+        if (result.Success) {
+            std::remove(path.c_str());
+            LOG << "Saved " << result.Path << " (" << result.Bytes << " bytes) in " << result.EncodeSeconds << "s\n";
+        }
+        std::unique_lock<std::mutex> lock(mutex);
+        in_flight.erase(path);
+        if (!result.Success) {
+            failed.insert(path);
+        }
+        cv.notify_all();
+    }};
+    job.Path = writer.GetOutputDir() + std::filesystem::path(path).stem().string() + CaptureWriter::GetExtension(format);
+
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        in_flight.insert(path);
+    }
+    writer.Submit(std::move(job));
+    return true;
+}
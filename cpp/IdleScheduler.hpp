@@ -0,0 +1,69 @@
+#ifndef IDLESCHEDULER_HPP
+#define IDLESCHEDULER_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <CaptureWriter.hpp>
+#include <CpuStillRenderer.hpp>
+#include <Lut.hpp>
+
+/* develops raw captures from the writer's pending directory in the background: LUT on the CPU, then the
+   regular encode through the CaptureWriter under the capture's own number. it only runs while nobody touches
+   the camera for idle_delay, or after a short grace period while the device is charging, and every user
+   interaction cancels the capture being developed at the next strip of rows. a cancelled capture stays
+   pending and starts over at the next idle period. the thread runs at the lowest CPU priority */
+class IdleScheduler {
+public:
+    // the LUT a capture was shot with, nullptr when it is no longer installed
+    using LutLookup = std::function<const LUT *(uint64_t hash, const std::string &name)>;
+
+private:
+    CaptureWriter &writer;
+    LutLookup find_lut;
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool shutdown = false;
+    bool wake = false;
+    std::set<std::string> in_flight; // developed, waiting for the writer
+    std::set<std::string> failed;    // skipped until restart
+    std::atomic<int64_t> last_interaction; // steady clock nanoseconds
+    std::atomic<bool> interrupted{false};
+
+    uint64_t renderer_hash = 0;
+    std::unique_ptr<CpuStillRenderer> renderer; // kept for the next capture with the same LUT
+
+    bool charging = false;
+    std::chrono::steady_clock::time_point charging_checked;
+
+    const std::chrono::seconds idle_delay{10};
+    const std::chrono::seconds charging_delay{2};
+    const std::chrono::seconds charging_poll{10};
+    const int strip_rows = 16; // rows between interruption checks
+
+    void Loop();
+    bool IsIdle();
+    static bool IsCharging();
+    std::string NextPending();
+    // false when an interaction cancelled it, the capture is then still pending
+    bool Develop(const std::string &path);
+
+public:
+    IdleScheduler(CaptureWriter &writer, LutLookup find_lut);
+    ~IdleScheduler();
+
+    // touch, shutter or anything else the user does. cheap, call it from the main loop on every event
+    void NotifyInteraction();
+    // a raw capture was submitted
+    void Wake();
+};
+
+#endif // IDLESCHEDULER_HPP
@@ -0,0 +1,452 @@
+#include <JpegWriter.hpp>
+#include <algorithm>
+#include <csetjmp>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <jpeglib.h>
+#include <log.hpp>
+
+// either an interleaved image or three 4:2:0 planes
+struct JpegSource {
+    int width;
+    int height;
+    int channels;
+    const unsigned char *pixels = nullptr;
+    size_t stride = 0;
+    const unsigned char *planes[3] = {nullptr, nullptr, nullptr};
+    int plane_widths[3] = {0, 0, 0};
+};
+
+namespace {
+
+struct ErrorManager {
+    jpeg_error_mgr pub;
+    jmp_buf jump;
+};
+
+// libjpeg exits the process on errors by default, unwind back into EncodeStrip instead
+void ErrorExit(j_common_ptr cinfo) {
+    char message[JMSG_LENGTH_MAX];
+    cinfo->err->format_message(cinfo, message);
+    LOG_ERR << "libjpeg: " << message << std::endl;
+    longjmp(reinterpret_cast<ErrorManager *>(cinfo->err)->jump, 1);
+}
+
+struct Strip {
+    int first_row;
+    int num_rows;
+    unsigned char *data = nullptr; // malloc'd by jpeg_mem_dest
+    unsigned long size = 0;
+    bool ok = false;
+};
+
+// feeds rows [first_row, first_row + num_rows) of an interleaved image
+void WriteInterleavedRows(jpeg_compress_struct &cinfo, const JpegSource &source, const Strip &strip) {
+    std::vector<unsigned char> row_buffer;
+    while (cinfo.next_scanline < cinfo.image_height) {
+        const unsigned char *row = source.pixels + (strip.first_row + cinfo.next_scanline) * source.stride;
+#ifndef JCS_EXTENSIONS
+        if (source.channels == 4) {
+            row_buffer.resize(source.width * 3);
+            for (int x = 0; x < source.width; x++) {
+                row_buffer[x*3 + 0] = row[x*4 + 0];
+                row_buffer[x*3 + 1] = row[x*4 + 1];
+                row_buffer[x*3 + 2] = row[x*4 + 2];
+            }
+            row = row_buffer.data();
+        }
+#endif
+        JSAMPROW row_pointer = const_cast<JSAMPROW>(row);
+        jpeg_write_scanlines(&cinfo, &row_pointer, 1);
+    }
+}
+
+/* feeds the planes of a 4:2:0 image straight to the DCT, skipping colour conversion and downsampling. libjpeg
+   takes one iMCU row (16 luma, 8 chroma rows) per call and reads every component padded to whole blocks, so
+   rows past the bottom repeat the last row and rows narrower than the padded width go through a scratch copy */
+void WriteRawRows(jpeg_compress_struct &cinfo, const JpegSource &source, const Strip &strip) {
+    std::vector<unsigned char> scratch[3];
+    std::vector<JSAMPROW> rows[3];
+    for (int c = 0; c < 3; c++) {
+        int rows_per_call = cinfo.comp_info[c].v_samp_factor * DCTSIZE;
+        int padded_width = cinfo.comp_info[c].width_in_blocks * DCTSIZE;
+        rows[c].resize(rows_per_call);
+        if (padded_width > source.plane_widths[c]) {
+            scratch[c].resize(static_cast<size_t>(padded_width) * rows_per_call);
+        }
+    }
+
+    int first_y = strip.first_row;
+    while (cinfo.next_scanline < cinfo.image_height) {
+        for (int c = 0; c < 3; c++) {
+            int scale = c == 0 ? 1 : 2;
+            int plane_width = source.plane_widths[c];
+            int plane_height = (source.height + scale - 1) / scale;
+            int first = (first_y + static_cast<int>(cinfo.next_scanline)) / scale;
+            for (size_t r = 0; r < rows[c].size(); r++) {
+                const unsigned char *src = source.planes[c] + static_cast<size_t>(std::min<int>(first + r, plane_height - 1)) * plane_width;
+                if (scratch[c].empty()) {
+                    rows[c][r] = const_cast<JSAMPROW>(src);
+                    continue;
+                }
+                int padded_width = cinfo.comp_info[c].width_in_blocks * DCTSIZE;
+                unsigned char *dst = scratch[c].data() + r * padded_width;
+                memcpy(dst, src, plane_width);
+                memset(dst + plane_width, src[plane_width - 1], padded_width - plane_width);
+                rows[c][r] = dst;
+            }
+        }
+        JSAMPARRAY planes[3] = {rows[0].data(), rows[1].data(), rows[2].data()};
+        jpeg_write_raw_data(&cinfo, planes, cinfo.max_v_samp_factor * DCTSIZE);
+    }
+}
+
+// encodes rows [first_row, first_row + num_rows) as a complete JPEG
+bool EncodeStrip(const JpegSource &source, const JpegOptions &options, unsigned int restart_interval, Strip &strip) {
+    jpeg_compress_struct cinfo;
+    ErrorManager error;
+    cinfo.err = jpeg_std_error(&error.pub);
+    error.pub.error_exit = ErrorExit;
+
+    if (setjmp(error.jump)) {
+        jpeg_destroy_compress(&cinfo);
+        free(strip.data);
+        strip.data = nullptr;
+        return false;
+    }
+
+    jpeg_create_compress(&cinfo);
+    jpeg_mem_dest(&cinfo, &strip.data, &strip.size);
+
+    cinfo.image_width = source.width;
+    cinfo.image_height = strip.num_rows;
+    cinfo.input_components = source.channels;
+    if (source.planes[0]) {
+        cinfo.in_color_space = JCS_YCbCr;
+    }
+    else if (source.channels == 1) {
+        cinfo.in_color_space = JCS_GRAYSCALE;
+    }
+    else {
+#ifdef JCS_EXTENSIONS
+        cinfo.in_color_space = source.channels == 4 ? JCS_EXT_RGBX : JCS_RGB;
+#else
+        cinfo.in_color_space = JCS_RGB;
+        cinfo.input_components = 3;
+#endif
+    }
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, options.quality, TRUE);
+    // every strip has to share the default Huffman tables, per strip optimised tables could not be joined
+    cinfo.optimize_coding = FALSE;
+    cinfo.dct_method = options.fast_dct ? JDCT_IFAST : JDCT_ISLOW;
+    cinfo.restart_interval = restart_interval;
+    // jpeg_set_defaults already picks 2x2 luma, 1x1 chroma sampling, which is the layout of the planes
+    cinfo.raw_data_in = source.planes[0] ? TRUE : FALSE;
+
+    jpeg_start_compress(&cinfo, TRUE);
+    if (source.planes[0]) {
+        WriteRawRows(cinfo, source, strip);
+    }
+    else {
+        WriteInterleavedRows(cinfo, source, strip);
+    }
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+    return true;
+}
+
+size_t WriteToFile(const std::string &path, const std::function<bool(const JpegWriter::Sink &)> &write) {
+    FILE *file = fopen(path.c_str(), "wb");
+    if (!file) {
+        LOG_ERR << "Failed to open " << path << " for writing" << std::endl;
+        return 0;
+    }
+
+    size_t written = 0;
+    bool ok = write([&](const void *data, size_t size) {
+        written += size;
+        return fwrite(data, 1, size, file) == size;
+    });
+
+    if (fclose(file) != 0 || !ok) {
+        remove(path.c_str());
+        return 0;
+    }
+    return written;
+}
+
+// finds the start of frame and the first byte after the SOS header, false if the headers are malformed
+bool FindSegments(const unsigned char *data, size_t size, size_t &sof_pos, size_t &scan_start) {
+    size_t pos = 2; // skip SOI
+    sof_pos = 0;
+    while (pos + 4 <= size) {
+        if (data[pos] != 0xFF) {
+            return false;
+        }
+        unsigned char marker = data[pos + 1];
+        size_t length = (data[pos + 2] << 8) | data[pos + 3];
+        if (marker == 0xC0 || marker == 0xC1) {
+            sof_pos = pos;
+        }
+        if (marker == 0xDA) {
+            scan_start = pos + 2 + length;
+            return sof_pos != 0 && scan_start <= size;
+        }
+        pos += 2 + length;
+    }
+    return false;
+}
+
+} // namespace
+
+bool JpegWriter::Write(const unsigned char *pixels, int width, int height, int channels, size_t stride,
+                       const JpegOptions &options, const Sink &sink) {
+    if (channels != 1 && channels != 3 && channels != 4) {
+        LOG_ERR << "JPEG writer does not support " << channels << " channels" << std::endl;
+        return false;
+    }
+
+    JpegSource source;
+    source.width = width;
+    source.height = height;
+    source.channels = channels;
+    source.pixels = pixels;
+    source.stride = stride;
+    return Encode(source, options, sink);
+}
+
+bool JpegWriter::WriteYUV420(const unsigned char *y, const unsigned char *cb, const unsigned char *cr, int width, int height,
+                             const JpegOptions &options, const Sink &sink) {
+    JpegSource source;
+    source.width = width;
+    source.height = height;
+    source.channels = 3;
+    source.planes[0] = y;
+    source.planes[1] = cb;
+    source.planes[2] = cr;
+    source.plane_widths[0] = width;
+    source.plane_widths[1] = source.plane_widths[2] = (width + 1) / 2;
+    return Encode(source, options, sink);
+}
+
+bool JpegWriter::Encode(const JpegSource &source, const JpegOptions &options, const Sink &sink) {
+    const int width = source.width;
+    const int height = source.height;
+
+    // 4:2:0 colour has 16x16 MCUs, greyscale 8x8
+    const int mcu_size = source.channels == 1 ? 8 : 16;
+    const int mcus_per_row = (width + mcu_size - 1) / mcu_size;
+
+    int strip_rows = height;
+    if (options.parallel) {
+        strip_rows = options.strip_rows;
+        if (strip_rows <= 0) {
+            int target_strips = (pool.GetNumThreads() + 1) * 2;
+            strip_rows = (height + target_strips - 1) / target_strips;
+        }
+        strip_rows = std::max(mcu_size, (strip_rows + mcu_size - 1) / mcu_size * mcu_size);
+    }
+
+    std::vector<Strip> strips;
+    for (int row = 0; row < height; row += strip_rows) {
+        Strip strip;
+        strip.first_row = row;
+        strip.num_rows = std::min(strip_rows, height - row);
+        strips.push_back(strip);
+    }
+    unsigned int restart_interval = strips.size() > 1 ? mcus_per_row * (strip_rows / mcu_size) : 0;
+
+    pool.ParallelFor(0, strips.size(), [&](int begin, int end) {
+        for (int s = begin; s < end; s++) {
+            strips[s].ok = EncodeStrip(source, options, restart_interval, strips[s]);
+        }
+    });
+
+    bool ok = true;
+    std::vector<size_t> scan_starts(strips.size());
+    size_t sof_pos = 0;
+    for (size_t s = 0; s < strips.size() && ok; s++) {
+        size_t strip_sof;
+        ok = strips[s].ok && strips[s].size >= 4 && FindSegments(strips[s].data, strips[s].size, strip_sof, scan_starts[s]);
+        if (s == 0) {
+            sof_pos = strip_sof;
+        }
+    }
+
+    if (ok) {
+        // the first strip's headers describe the whole image once its height is patched
+        unsigned char *first = strips[0].data;
+        first[sof_pos + 5] = height >> 8;
+        first[sof_pos + 6] = height & 0xFF;
+
+        // everything but the trailing EOI of each strip, then the restart marker that separates it from the next
+        ok = sink(first, strips[0].size - 2);
+        for (size_t s = 1; s < strips.size() && ok; s++) {
+            unsigned char restart[2] = {0xFF, static_cast<unsigned char>(0xD0 + ((s - 1) & 7))};
+            ok = sink(restart, 2) && sink(strips[s].data + scan_starts[s], strips[s].size - 2 - scan_starts[s]);
+        }
+        static const unsigned char eoi[2] = {0xFF, 0xD9};
+        ok = ok && sink(eoi, 2);
+    }
+    else {
+        LOG_ERR << "Failed to encode JPEG strips" << std::endl;
+    }
+
+    for (Strip &strip : strips) {
+        free(strip.data);
+    }
+    return ok;
+}
+
+struct JpegStream::PendingStrip {
+    std::vector<unsigned char> rows;
+    Strip encoded;
+    bool done = false;
+};
+
+JpegStream::JpegStream(ThreadPool &pool, int width, int height, int channels, bool yuv420, const JpegOptions &options, Sink sink)
+    : pool(pool), sink(std::move(sink)), options(options), width(width), height(height), channels(yuv420 ? 3 : channels),
+      yuv420(yuv420), max_outstanding(pool.GetNumThreads() + 2) {
+    if (this->channels != 1 && this->channels != 3 && this->channels != 4) {
+        LOG_ERR << "JPEG writer does not support " << channels << " channels" << std::endl;
+        ok = false;
+    }
+}
+
+JpegStream::~JpegStream() {
+    // encode tasks still point at this stream
+    std::unique_lock<std::mutex> lock(mutex);
+    cv.wait(lock, [this]{
+        return std::all_of(strips.begin(), strips.end(), [](const std::shared_ptr<PendingStrip> &strip) { return strip->done; });
+    });
+}
+
+bool JpegStream::AddRows(std::vector<unsigned char> &&rows, int num_rows) {
+    if (!ok) {
+        return false;
+    }
+
+    const int mcu_size = channels == 1 ? 8 : 16;
+    if (rows_added == 0) {
+        // the first strip fixes the restart interval for all of them
+        strip_rows = num_rows;
+        int num_strips = (height + strip_rows - 1) / strip_rows;
+        restart_interval = num_strips > 1 ? (width + mcu_size - 1) / mcu_size * (strip_rows / mcu_size) : 0;
+    }
+    bool last = rows_added + num_rows == height;
+    bool valid = num_rows > 0 && rows_added + num_rows <= height &&
+                 (last ? num_rows <= strip_rows : num_rows == strip_rows && strip_rows % mcu_size == 0);
+    if (!valid) {
+        LOG_ERR << "JPEG stream can not join a strip of " << num_rows << " rows at row " << rows_added << std::endl;
+        ok = false;
+        return false;
+    }
+
+    auto strip = std::make_shared<PendingStrip>();
+    strip->rows = std::move(rows);
+    strip->encoded.first_row = 0;
+    strip->encoded.num_rows = num_rows;
+    rows_added += num_rows;
+    strips.push_back(strip);
+
+    pool.Submit([this, strip] {
+        JpegSource source;
+        source.width = width;
+        source.height = strip->encoded.num_rows;
+        source.channels = channels;
+        if (yuv420) {
+            int chroma_width = (width + 1) / 2;
+            size_t y_size = static_cast<size_t>(width) * source.height;
+            size_t chroma_size = static_cast<size_t>(chroma_width) * ((source.height + 1) / 2);
+            source.planes[0] = strip->rows.data();
+            source.planes[1] = source.planes[0] + y_size;
+            source.planes[2] = source.planes[1] + chroma_size;
+            source.plane_widths[0] = width;
+            source.plane_widths[1] = source.plane_widths[2] = chroma_width;
+        }
+        else {
+            source.pixels = strip->rows.data();
+            source.stride = static_cast<size_t>(width) * channels;
+        }
+        bool encoded = EncodeStrip(source, options, restart_interval, strip->encoded);
+        strip->rows = std::vector<unsigned char>();
+
+        // notify under the lock, the stream may be destroyed as soon as the last strip is seen done
+        std::unique_lock<std::mutex> lock(mutex);
+        strip->encoded.ok = encoded;
+        strip->done = true;
+        cv.notify_all();
+    });
+
+    // write whatever is finished, and hold the caller back once too many strips are in memory
+    return WriteStrips(strips.size() > max_outstanding ? 1 : 0);
+}
+
+// writes finished strips in order, waiting for the first min_strips of them
+bool JpegStream::WriteStrips(size_t min_strips) {
+    for (size_t written = 0; !strips.empty(); written++) {
+        std::shared_ptr<PendingStrip> strip = strips.front();
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            if (written < min_strips) {
+                cv.wait(lock, [&]{ return strip->done; });
+            }
+            else if (!strip->done) {
+                break;
+            }
+        }
+        strips.pop_front();
+
+        Strip &encoded = strip->encoded;
+        size_t sof_pos, scan_start;
+        ok = ok && encoded.ok && encoded.size >= 4 && FindSegments(encoded.data, encoded.size, sof_pos, scan_start);
+        if (ok && strips_written == 0) {
+            // the first strip's headers describe the whole image once its height is patched
+            encoded.data[sof_pos + 5] = height >> 8;
+            encoded.data[sof_pos + 6] = height & 0xFF;
+            ok = sink(encoded.data, encoded.size - 2);
+        }
+        else if (ok) {
+            unsigned char restart[2] = {0xFF, static_cast<unsigned char>(0xD0 + ((strips_written - 1) & 7))};
+            ok = sink(restart, 2) && sink(encoded.data + scan_start, encoded.size - 2 - scan_start);
+        }
+        strips_written++;
+        free(encoded.data);
+        encoded.data = nullptr;
+    }
+    return ok;
+}
+
+bool JpegStream::Finish() {
+    if (ok && rows_added != height) {
+        LOG_ERR << "JPEG stream finished after " << rows_added << " of " << height << " rows" << std::endl;
+        ok = false;
+    }
+    // every strip has to be out of the pool before this returns, even after a failure
+    WriteStrips(strips.size());
+    static const unsigned char eoi[2] = {0xFF, 0xD9};
+    if (ok) {
+        ok = sink(eoi, 2);
+    }
+    if (!ok) {
+        LOG_ERR << "Failed to encode JPEG strips" << std::endl;
+    }
+    return ok;
+}
+
+size_t JpegWriter::WriteFile(const std::string &path, const unsigned char *pixels, int width, int height, int channels,
+                             size_t stride, const JpegOptions &options) {
+    return WriteToFile(path, [&](const Sink &sink) {
+        return Write(pixels, width, height, channels, stride, options, sink);
+    });
+}
+
+size_t JpegWriter::WriteFileYUV420(const std::string &path, const unsigned char *y, const unsigned char *cb, const unsigned char *cr,
+                                   int width, int height, const JpegOptions &options) {
+    return WriteToFile(path, [&](const Sink &sink) {
+        return WriteYUV420(y, cb, cr, width, height, options, sink);
+    });
+}
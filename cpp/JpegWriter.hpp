@@ -0,0 +1,95 @@
+#ifndef JPEGWRITER_HPP
+#define JPEGWRITER_HPP
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <ThreadPool.hpp>
+
+struct JpegOptions {
+    int quality = 92;
+    bool parallel = true;  // encode row strips on the pool and join them with restart markers
+    int strip_rows = 0;    // rows per strip, rounded up to whole MCU rows. 0 picks from the thread count
+    bool fast_dct = false; // integer fast DCT, slightly less accurate
+};
+
+struct JpegSource;
+
+/* JPEG encoder on libjpeg(-turbo), which brings the SIMD colour conversion, DCT and quantisation. for parallel
+   encoding the image is cut into strips of whole MCU rows, every strip is encoded as its own baseline JPEG with
+   the same tables, and the entropy coded segments are joined with RSTn markers under the first strip's headers.
+   restart_interval is set to one strip's worth of MCUs, so decoders reset the DC predictors exactly where each
+   strip encoder started from zero */
+class JpegWriter {
+public:
+    using Sink = std::function<bool(const void *data, size_t size)>;
+
+private:
+    ThreadPool &pool;
+
+    bool Encode(const JpegSource &source, const JpegOptions &options, const Sink &sink);
+
+public:
+    explicit JpegWriter(ThreadPool &pool) : pool(pool) {}
+
+    // channels 1, 3 or 4 (grey, RGB, RGBX), stride in bytes between rows
+    bool Write(const unsigned char *pixels, int width, int height, int channels, size_t stride,
+               const JpegOptions &options, const Sink &sink);
+
+    // full range 4:2:0 planes, chroma planes (width+1)/2 wide. skips colour conversion and downsampling entirely
+    bool WriteYUV420(const unsigned char *y, const unsigned char *cb, const unsigned char *cr, int width, int height,
+                     const JpegOptions &options, const Sink &sink);
+
+    // return the file size, 0 on failure
+    size_t WriteFile(const std::string &path, const unsigned char *pixels, int width, int height, int channels,
+                     size_t stride, const JpegOptions &options = JpegOptions());
+    size_t WriteFileYUV420(const std::string &path, const unsigned char *y, const unsigned char *cb, const unsigned char *cr,
+                           int width, int height, const JpegOptions &options = JpegOptions());
+};
+
+/* the strip encoder for images that arrive in row strips from the top. every strip is encoded on the pool as
+   soon as it arrives and the results are joined in order like the strips of JpegWriter::Write, so every strip
+   but the last needs the same number of rows, a multiple of the MCU height (16 rows, 8 for greyscale) */
+class JpegStream {
+public:
+    using Sink = JpegWriter::Sink;
+
+private:
+    struct PendingStrip;
+
+    ThreadPool &pool;
+    Sink sink;
+    JpegOptions options;
+    int width;
+    int height;
+    int channels;
+    bool yuv420;
+    int rows_added = 0;
+    int strip_rows = 0; // set by the first strip
+    unsigned int restart_interval = 0;
+    int strips_written = 0;
+    std::deque<std::shared_ptr<PendingStrip>> strips; // not written yet
+    size_t max_outstanding;
+    bool ok = true;
+    std::mutex mutex;
+    std::condition_variable cv;
+
+    bool WriteStrips(size_t min_strips);
+
+public:
+    // interleaved rows with channels 1, 3 or 4, or with yuv420 full range planes: each strip is then its rows
+    // of Y followed by the (rows+1)/2 rows of Cb and of Cr, chroma rows (width+1)/2 wide
+    JpegStream(ThreadPool &pool, int width, int height, int channels, bool yuv420, const JpegOptions &options, Sink sink);
+    ~JpegStream();
+
+    // takes the rows, they are encoded on the pool after the call returns
+    bool AddRows(std::vector<unsigned char> &&rows, int num_rows);
+    bool Finish();
+};
+
+#endif // JPEGWRITER_HPP
@@ -0,0 +1,93 @@
+#ifndef LATENCYHISTOGRAM_HPP
+#define LATENCYHISTOGRAM_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+
+/* latency distribution in microseconds with HDR-style buckets: exact below 16us, then every power of two split
+   into 16 linear steps, so any value is off by at most 1/16 and the whole range up to hours fits in a few KB.
+   Record is a couple of relaxed atomic adds and safe from any thread, reads see a slightly racy but consistent
+   enough picture for statistics */
+class LatencyHistogram {
+private:
+    static const int sub_bits = 4;
+    static const int sub_buckets = 1 << sub_bits;
+    static const int max_exponent = 40;
+    static const int num_buckets = sub_buckets + (max_exponent - sub_bits) * sub_buckets;
+
+    std::atomic<uint64_t> buckets[num_buckets] = {};
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> sum{0};
+    std::atomic<uint64_t> max{0};
+
+    static int BucketOf(uint64_t value) {
+        if (value < static_cast<uint64_t>(sub_buckets)) {
+            return static_cast<int>(value);
+        }
+        int exponent = 63 - __builtin_clzll(value);
+        if (exponent >= max_exponent) {
+            return num_buckets - 1;
+        }
+        int sub = static_cast<int>(value >> (exponent - sub_bits)) & (sub_buckets - 1);
+        return sub_buckets + (exponent - sub_bits) * sub_buckets + sub;
+    }
+
+    // smallest value that lands in bucket
+    static uint64_t BucketStart(int bucket) {
+        if (bucket < sub_buckets) {
+            return bucket;
+        }
+        int exponent = (bucket - sub_buckets) / sub_buckets + sub_bits;
+        uint64_t sub = (bucket - sub_buckets) % sub_buckets;
+        return (static_cast<uint64_t>(sub_buckets) + sub) << (exponent - sub_bits);
+    }
+
+public:
+    void Record(uint64_t microseconds) {
+        buckets[BucketOf(microseconds)].fetch_add(1, std::memory_order_relaxed);
+        count.fetch_add(1, std::memory_order_relaxed);
+        sum.fetch_add(microseconds, std::memory_order_relaxed);
+        uint64_t previous = max.load(std::memory_order_relaxed);
+        while (microseconds > previous && !max.compare_exchange_weak(previous, microseconds, std::memory_order_relaxed)) {
+        }
+    }
+
+    uint64_t GetCount() const { return count.load(std::memory_order_relaxed); }
+    uint64_t GetMax() const { return max.load(std::memory_order_relaxed); }
+    double GetMean() const {
+        uint64_t n = GetCount();
+        return n ? static_cast<double>(sum.load(std::memory_order_relaxed)) / n : 0.0;
+    }
+
+    // value below which the fraction p of the recorded values fall, the middle of its bucket
+    uint64_t GetPercentile(double p) const {
+        uint64_t n = GetCount();
+        if (n == 0) {
+            return 0;
+        }
+        uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(p * n + 0.5));
+        uint64_t seen = 0;
+        for (int i = 0; i < num_buckets; i++) {
+            seen += buckets[i].load(std::memory_order_relaxed);
+            if (seen >= rank) {
+                uint64_t start = BucketStart(i);
+                uint64_t end = i + 1 < num_buckets ? BucketStart(i + 1) : start + 1;
+                return std::min(GetMax(), start + (end - start) / 2);
+            }
+        }
+        return GetMax();
+    }
+
+    // not atomic against concurrent Record, a value recorded meanwhile may be half counted
+    void Reset() {
+        for (auto &bucket : buckets) {
+            bucket.store(0, std::memory_order_relaxed);
+        }
+        count.store(0, std::memory_order_relaxed);
+        sum.store(0, std::memory_order_relaxed);
+        max.store(0, std::memory_order_relaxed);
+    }
+};
+
+#endif // LATENCYHISTOGRAM_HPP
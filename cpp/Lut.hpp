@@ -0,0 +1,30 @@
+#ifndef LUT_HPP
+#define LUT_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Holds LUT data and name
+struct LUT {
+    std::string Name;
+    unsigned char * Data;   // Size^3 RGB triples, red fastest (same layout as the 3D texture)
+    int Size;               // nodes per axis
+    uint64_t Hash;          // content hash, keys baked LUTs on disk
+    bool Monochrome = false;            // output is grey and depends on luma only
+    std::vector<unsigned char> ToneCurve; // 256 entry luma response, set when Monochrome
+};
+
+// FNV-1a, seeded so that hashes can be chained
+inline uint64_t HashBytes(const void *data, size_t size, uint64_t seed = 14695981039346656037ull) {
+    const unsigned char *bytes = static_cast<const unsigned char *>(data);
+    uint64_t hash = seed;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+#endif // LUT_HPP
@@ -0,0 +1,65 @@
+#include <LutCache.hpp>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include "stb_image.h"
+#include "stb_image_write.h"
+#include <log.hpp>
+#include <PerfCounters.hpp>
+
+LutCache::LutCache(std::string dir) : cache_dir(std::move(dir)) {
+    std::error_code ec;
+    std::filesystem::create_directories(cache_dir, ec);
+    if (ec) {
+        LOG_ERR << "Failed to create LUT cache dir " << cache_dir << ": " << ec.message() << std::endl;
+    }
+}
+
+std::string LutCache::GetPath(uint64_t key) {
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.png", static_cast<unsigned long long>(key));
+    return cache_dir + name;
+}
+
+bool LutCache::Load(uint64_t key, int size, std::vector<unsigned char> &data) {
+    std::string path = GetPath(key);
+    if (!std::filesystem::exists(path)) {
+        return false;
+    }
+
+    int width, height, channels;
+    unsigned char *pixels;
+    {
+        PerfScope perf(PerfStage::LUT_DECODE);
+        pixels = stbi_load(path.c_str(), &width, &height, &channels, 3);
+    }
+    if (!pixels) {
+        LOG_ERR << "Failed to load cached LUT " << path << std::endl;
+        return false;
+    }
+    if (width != size * size || height != size) {
+        LOG_ERR << "Cached LUT " << path << " has unexpected size " << width << "x" << height << std::endl;
+        stbi_image_free(pixels);
+        return false;
+    }
+
+    data.assign(pixels, pixels + static_cast<size_t>(width) * height * 3);
+    stbi_image_free(pixels);
+    return true;
+}
+
+void LutCache::Store(uint64_t key, int size, const std::vector<unsigned char> &data) {
+    // write next to the final name and rename, so a crash never leaves a truncated entry behind
+    std::string path = GetPath(key);
+    std::string tmp_path = path + ".tmp";
+    if (!stbi_write_png(tmp_path.c_str(), size * size, size, 3, data.data(), size * size * 3)) {
+        LOG_ERR << "Failed to write cached LUT " << tmp_path << std::endl;
+        return;
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(tmp_path, path, ec);
+    if (ec) {
+        LOG_ERR << "Failed to move cached LUT into place: " << ec.message() << std::endl;
+    }
+}
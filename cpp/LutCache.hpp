@@ -0,0 +1,23 @@
+#ifndef LUTCACHE_HPP
+#define LUTCACHE_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/* on-disk store for baked LUTs (composites, generated film models). each entry is a PNG named after its key,
+   laid out as size*size x size so it can also be dropped into the LUT directory as-is */
+class LutCache {
+private:
+    std::string cache_dir;
+
+    std::string GetPath(uint64_t key);
+
+public:
+    LutCache(std::string dir);
+
+    bool Load(uint64_t key, int size, std::vector<unsigned char> &data);
+    void Store(uint64_t key, int size, const std::vector<unsigned char> &data);
+};
+
+#endif // LUTCACHE_HPP
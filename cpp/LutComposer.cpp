@@ -0,0 +1,59 @@
+#include <LutComposer.hpp>
+#include <LutCube.hpp>
+#include <chrono>
+#include <log.hpp>
+
+uint64_t LutComposer::GetChainHash(const std::vector<const LUT *> &chain, int size) {
+    uint64_t hash = HashBytes(&size, sizeof(size));
+    for (const LUT *lut : chain) {
+        hash = HashBytes(&lut->Hash, sizeof(lut->Hash), hash);
+    }
+    return hash;
+}
+
+std::vector<unsigned char> LutComposer::Compose(const std::vector<const LUT *> &chain, int size) {
+    std::vector<unsigned char> out;
+    uint64_t key = GetChainHash(chain, size);
+    if (cache.Load(key, size, out)) {
+        LOG << "Loaded composite LUT from cache (" << chain.size() << " stages)\n";
+        return out;
+    }
+
+    auto start_time = std::chrono::steady_clock::now();
+
+    std::vector<LutCube> cubes;
+    cubes.reserve(chain.size());
+    for (const LUT *lut : chain) {
+        cubes.emplace_back(lut->Data, lut->Size);
+    }
+
+    out.resize(static_cast<size_t>(size) * size * size * 3);
+    const float step = 1.0f / (size - 1);
+
+    // one blue slice per work item, each slice is size^2 independent nodes
+    pool.ParallelFor(0, size, [&](int b_begin, int b_end) {
+        float rgb[4];
+        for (int b = b_begin; b < b_end; b++) {
+            for (int g = 0; g < size; g++) {
+                unsigned char *dst = out.data() + (static_cast<size_t>(b) * size * size + g * size) * 3;
+                for (int r = 0; r < size; r++) {
+                    Vec4f color = Set4f(r * step, g * step, b * step, 0.0f);
+                    for (const LutCube &cube : cubes) {
+                        color = cube.Sample(color);
+                    }
+                    Store4f(rgb, Clamp4f(color, 0.0f, 1.0f) * Splat4f(255.0f) + Splat4f(0.5f));
+                    dst[r*3 + 0] = static_cast<unsigned char>(rgb[0]);
+                    dst[r*3 + 1] = static_cast<unsigned char>(rgb[1]);
+                    dst[r*3 + 2] = static_cast<unsigned char>(rgb[2]);
+                }
+            }
+        }
+    });
+
+    std::chrono::duration<float> elapsed = std::chrono::steady_clock::now() - start_time;
+    LOG << "Composed " << chain.size() << " LUTs at " << size << "^3 in " << elapsed.count() << "s on "
+        << pool.GetNumThreads() << " threads\n";
+
+    cache.Store(key, size, out);
+    return out;
+}
@@ -0,0 +1,26 @@
+#ifndef LUTCOMPOSER_HPP
+#define LUTCOMPOSER_HPP
+
+#include <vector>
+#include <Lut.hpp>
+#include <LutCache.hpp>
+#include <ThreadPool.hpp>
+
+/* bakes a chain of LUTs (e.g. negative stock -> print stock -> user grade) into a single LUT, so the shaders
+   keep doing one 3D fetch per pixel no matter how many looks are stacked. every node of the output grid is
+   pushed through the whole chain in float, so there is no 8 bit rounding between stages */
+class LutComposer {
+private:
+    ThreadPool &pool;
+    LutCache &cache;
+
+public:
+    LutComposer(ThreadPool &pool, LutCache &cache) : pool(pool), cache(cache) {}
+
+    static uint64_t GetChainHash(const std::vector<const LUT *> &chain, int size);
+
+    // applies chain[0] first, returns size^3 RGB triples in the same layout as LUT::Data
+    std::vector<unsigned char> Compose(const std::vector<const LUT *> &chain, int size);
+};
+
+#endif // LUTCOMPOSER_HPP
@@ -0,0 +1,125 @@
+#include <LutCube.hpp>
+#include <cmath>
+#include <cstdlib>
+
+LutCube::LutCube(const unsigned char *data, int size)
+    : size(size), nodes(static_cast<size_t>(size) * size * size * 4) {
+    size_t num_nodes = static_cast<size_t>(size) * size * size;
+    for (size_t i = 0; i < num_nodes; i++) {
+        nodes[i*4 + 0] = data[i*3 + 0];
+        nodes[i*4 + 1] = data[i*3 + 1];
+        nodes[i*4 + 2] = data[i*3 + 2];
+        nodes[i*4 + 3] = 0;
+    }
+}
+
+Vec4f LutCube::Sample(Vec4f rgb) const {
+    float pos[4];
+    Store4f(pos, Clamp4f(rgb, 0.0f, 1.0f) * Splat4f(static_cast<float>(size - 1)));
+
+    int idx[3];
+    float frac[3];
+    for (int c = 0; c < 3; c++) {
+        idx[c] = std::min(static_cast<int>(pos[c]), size - 2);
+        frac[c] = pos[c] - idx[c];
+    }
+
+    const size_t stride_g = static_cast<size_t>(size) * 4;
+    const size_t stride_b = stride_g * size;
+    const unsigned char *p = nodes.data() + idx[2]*stride_b + idx[1]*stride_g + idx[0]*4;
+
+    Vec4f fr = Splat4f(frac[0]);
+    Vec4f c00 = Lerp4f(LoadBytes4f(p), LoadBytes4f(p + 4), fr);
+    Vec4f c10 = Lerp4f(LoadBytes4f(p + stride_g), LoadBytes4f(p + stride_g + 4), fr);
+    Vec4f c01 = Lerp4f(LoadBytes4f(p + stride_b), LoadBytes4f(p + stride_b + 4), fr);
+    Vec4f c11 = Lerp4f(LoadBytes4f(p + stride_b + stride_g), LoadBytes4f(p + stride_b + stride_g + 4), fr);
+
+    Vec4f fg = Splat4f(frac[1]);
+    return Lerp4f(Lerp4f(c00, c10, fg), Lerp4f(c01, c11, fg), Splat4f(frac[2])) * Splat4f(1.0f / 255.0f);
+}
+
+void DetectMonochrome(LUT &lut) {
+    const int size = lut.Size;
+    const int max_error = 4; // in 8 bit steps, roughly what trilinear filtering of the 3D texture gets wrong anyway
+    const unsigned char *data = lut.Data;
+
+    // reject colour LUTs cheaply before building anything
+    size_t num_nodes = static_cast<size_t>(size) * size * size;
+    for (size_t i = 0; i < num_nodes; i++) {
+        const unsigned char *p = data + i*3;
+        if (std::abs(p[0] - p[1]) > 2 || std::abs(p[1] - p[2]) > 2) {
+            lut.Monochrome = false;
+            return;
+        }
+    }
+
+    LutCube cube(data, size);
+    float curve[256];
+    for (int i = 0; i < 256; i++) {
+        float grey[4];
+        Store4f(grey, cube.Sample(Splat4f(i / 255.0f)));
+        curve[i] = (grey[0] + grey[1] + grey[2]) * (255.0f / 3.0f);
+    }
+
+    /* the axes are weighted in the LUT's own order, red fastest, which is how stillcapture_fs.glsl and LutCube
+       sample it. the tone curve replaces that lookup with Y straight from the sensor, so a monochrome viewfinder
+       and capture match the colour capture. viewfinder_fs.glsl is the odd one out: its .bgr swizzle feeds blue
+       into the red axis, so there the 3D lookup of the same LUT weights blue 0.299 and red 0.114 */
+    const float step = 1.0f / (size - 1);
+    for (int b = 0; b < size; b++) {
+        for (int g = 0; g < size; g++) {
+            for (int r = 0; r < size; r++) {
+                float luma = (0.299f * r + 0.587f * g + 0.114f * b) * step * 255.0f;
+                int lo = std::min(static_cast<int>(luma), 254);
+                float frac = luma - lo;
+                float expected = curve[lo] + (curve[lo + 1] - curve[lo]) * frac;
+
+                const unsigned char *p = data + (static_cast<size_t>(b) * size * size + g * size + r) * 3;
+                if (std::fabs(p[1] - expected) > max_error) {
+                    lut.Monochrome = false;
+                    return;
+                }
+            }
+        }
+    }
+
+    lut.Monochrome = true;
+    lut.ToneCurve.resize(256);
+    for (int i = 0; i < 256; i++) {
+        lut.ToneCurve[i] = static_cast<unsigned char>(std::min(255.0f, std::max(0.0f, curve[i] + 0.5f)));
+    }
+}
+
+std::vector<unsigned char> ResampleLUT(const LUT &lut, int size) {
+    std::vector<unsigned char> out(static_cast<size_t>(size) * size * size * 3);
+    const int src_size = lut.Size;
+    const float scale = static_cast<float>(src_size - 1) / (size - 1);
+
+    int idx[3];
+    float frac[3];
+    for (int b = 0; b < size; b++) {
+        for (int g = 0; g < size; g++) {
+            for (int r = 0; r < size; r++) {
+                int node[3] = {r, g, b};
+                for (int c = 0; c < 3; c++) {
+                    float pos = node[c] * scale;
+                    idx[c] = std::min(static_cast<int>(pos), src_size - 2);
+                    frac[c] = pos - idx[c];
+                }
+
+                unsigned char *dst = out.data() + (static_cast<size_t>(b) * size * size + g * size + r) * 3;
+                for (int c = 0; c < 3; c++) {
+                    float value = 0.0f;
+                    for (int corner = 0; corner < 8; corner++) {
+                        int dr = corner & 1, dg = (corner >> 1) & 1, db = corner >> 2;
+                        float weight = (dr ? frac[0] : 1.0f - frac[0]) * (dg ? frac[1] : 1.0f - frac[1]) * (db ? frac[2] : 1.0f - frac[2]);
+                        size_t src = (static_cast<size_t>(idx[2] + db) * src_size * src_size + (idx[1] + dg) * src_size + idx[0] + dr) * 3;
+                        value += weight * lut.Data[src + c];
+                    }
+                    dst[c] = static_cast<unsigned char>(std::min(255.0f, value + 0.5f));
+                }
+            }
+        }
+    }
+    return out;
+}
@@ -0,0 +1,33 @@
+#ifndef LUTCUBE_HPP
+#define LUTCUBE_HPP
+
+#include <vector>
+#include <Simd.hpp>
+#include <Lut.hpp>
+
+/* copy of an RGB8 LUT for evaluating it on the CPU. nodes are interleaved RGBA bytes (alpha unused) so each
+   corner of a trilinear lookup is a single 32 bit load, widened to floats of 0-255. bytes hold the LUT exactly
+   and keep a 144^3 capture LUT at 12 MB, a quarter of float nodes */
+class LutCube {
+private:
+    int size;
+    std::vector<unsigned char> nodes;
+
+public:
+    LutCube(const unsigned char *data, int size);
+
+    // trilinear lookup of rgb in [0,1], lane 3 of the result is unspecified
+    Vec4f Sample(Vec4f rgb) const;
+
+    int GetSize() const { return size; }
+    const unsigned char *GetNodes() const { return nodes.data(); }
+};
+
+// marks black and white stocks so they can skip the chroma planes and the 3D lookup. a LUT qualifies when
+// every node is grey and matches its own grey-axis response at the node's BT.601 luma
+void DetectMonochrome(LUT &lut);
+
+// trilinear resample of a LUT onto a size^3 grid, used for thumbnails
+std::vector<unsigned char> ResampleLUT(const LUT &lut, int size);
+
+#endif // LUTCUBE_HPP
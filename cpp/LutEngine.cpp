@@ -0,0 +1,108 @@
+#include <LutEngine.hpp>
+#include <algorithm>
+#include <cstring>
+
+LutEngine::LutEngine(const LUT &lut, LutInterpolation interpolation)
+    : cube(lut.Data, lut.Size), interpolation(interpolation), stride_g(lut.Size * 4), stride_b(lut.Size * lut.Size * 4) {
+}
+
+template <LutInterpolation I>
+void LutEngine::ApplyQuad(const unsigned char *src, unsigned char *dst, int channels) const {
+    const int size = cube.GetSize();
+    const unsigned char *nodes = cube.GetNodes();
+
+    float in[3][4];
+    for (int i = 0; i < 4; i++) {
+        for (int c = 0; c < 3; c++) {
+            in[c][i] = src[i*channels + c];
+        }
+    }
+
+    // texel coordinates of 4 pixels per channel, byte / 255 * size - 0.5 clamped to the edge nodes
+    const Vec4f scale = Splat4f(size / 255.0f);
+    const Vec4f half = Splat4f(0.5f);
+    const Vec4f last_cell = Splat4f(static_cast<float>(size - 2));
+    float frac[3][4];
+    int cells[3][4];
+    for (int c = 0; c < 3; c++) {
+        Vec4f pos = Clamp4f(Load4f(in[c]) * scale - half, 0.0f, static_cast<float>(size - 1));
+        Vec4f cell = Min4f(Trunc4f(pos), last_cell);
+        Store4f(frac[c], pos - cell);
+        // the node offset is summed in ints, a float stops holding every offset once the cube passes 2^24 floats
+        StoreTrunc4i(cells[c], cell);
+    }
+
+    for (int i = 0; i < 4; i++) {
+        const unsigned char *p = nodes + cells[0][i] * 4 + cells[1][i] * stride_g + cells[2][i] * stride_b;
+        const float fr = frac[0][i];
+        const float fg = frac[1][i];
+        const float fb = frac[2][i];
+        Vec4f colour;
+
+        if (I == LutInterpolation::TRILINEAR) {
+            Vec4f vr = Splat4f(fr);
+            Vec4f c00 = Lerp4f(LoadBytes4f(p), LoadBytes4f(p + 4), vr);
+            Vec4f c10 = Lerp4f(LoadBytes4f(p + stride_g), LoadBytes4f(p + stride_g + 4), vr);
+            Vec4f c01 = Lerp4f(LoadBytes4f(p + stride_b), LoadBytes4f(p + stride_b + 4), vr);
+            Vec4f c11 = Lerp4f(LoadBytes4f(p + stride_b + stride_g), LoadBytes4f(p + stride_b + stride_g + 4), vr);
+            Vec4f vg = Splat4f(fg);
+            colour = Lerp4f(Lerp4f(c00, c10, vg), Lerp4f(c01, c11, vg), Splat4f(fb));
+        }
+        else {
+            // walk from the near corner along the axes in order of decreasing fraction
+            float f[3] = {fr, fg, fb};
+            int step[3] = {4, stride_g, stride_b};
+            if (f[0] < f[1]) { std::swap(f[0], f[1]); std::swap(step[0], step[1]); }
+            if (f[1] < f[2]) { std::swap(f[1], f[2]); std::swap(step[1], step[2]); }
+            if (f[0] < f[1]) { std::swap(f[0], f[1]); std::swap(step[0], step[1]); }
+
+            Vec4f c0 = LoadBytes4f(p);
+            Vec4f c1 = LoadBytes4f(p + step[0]);
+            Vec4f c2 = LoadBytes4f(p + step[0] + step[1]);
+            Vec4f c3 = LoadBytes4f(p + step[0] + step[1] + step[2]);
+            colour = c0 + (c1 - c0) * Splat4f(f[0]) + (c2 - c1) * Splat4f(f[1]) + (c3 - c2) * Splat4f(f[2]);
+        }
+
+        int bytes[4];
+        // nodes are bytes, the blend already is in levels
+        StoreTrunc4i(bytes, Clamp4f(colour + half, 0.0f, 255.0f));
+        unsigned char *out = dst + i*channels;
+        out[0] = bytes[0];
+        out[1] = bytes[1];
+        out[2] = bytes[2];
+        if (channels == 4) {
+            out[3] = src[i*channels + 3];
+        }
+    }
+}
+
+void LutEngine::ApplyRows(const unsigned char *src, int src_stride, unsigned char *dst, int dst_stride, int width,
+                          int channels, int row_begin, int row_end) const {
+    auto apply = interpolation == LutInterpolation::TETRAHEDRAL ? &LutEngine::ApplyQuad<LutInterpolation::TETRAHEDRAL>
+                                                                : &LutEngine::ApplyQuad<LutInterpolation::TRILINEAR>;
+    for (int row = row_begin; row < row_end; row++) {
+        const unsigned char *in = src + static_cast<size_t>(row) * src_stride;
+        unsigned char *out = dst + static_cast<size_t>(row) * dst_stride;
+        int x = 0;
+        for (; x + 4 <= width; x += 4) {
+            (this->*apply)(in + x*channels, out + x*channels, channels);
+        }
+        if (x < width) {
+            // the last pixels go through a padded quad
+            unsigned char tail_in[16] = {};
+            unsigned char tail_out[16];
+            size_t tail_bytes = static_cast<size_t>(width - x) * channels;
+            std::memcpy(tail_in, in + x*channels, tail_bytes);
+            (this->*apply)(tail_in, tail_out, channels);
+            std::memcpy(out + x*channels, tail_out, tail_bytes);
+        }
+    }
+}
+
+void LutEngine::Apply(ThreadPool &pool, const unsigned char *src, int src_stride, unsigned char *dst, int dst_stride,
+                      int width, int height, int channels) const {
+    int band_rows = std::max(1, tile_bytes / std::max(1, width * channels));
+    pool.ParallelFor(0, height, [&](int begin, int end) {
+        ApplyRows(src, src_stride, dst, dst_stride, width, channels, begin, end);
+    }, band_rows);
+}
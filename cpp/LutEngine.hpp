@@ -0,0 +1,45 @@
+#ifndef LUTENGINE_HPP
+#define LUTENGINE_HPP
+
+#include <Lut.hpp>
+#include <LutCube.hpp>
+#include <ThreadPool.hpp>
+
+enum class LutInterpolation {
+    TRILINEAR,  // 8 nodes, what the 3D texture does
+    TETRAHEDRAL // 4 nodes, cheaper and keeps the grey axis exactly on the LUT's own greys
+};
+
+/* applies a loaded LUT to 8 bit RGB or RGBA images on the CPU, the hot loop of every path that does not go
+   through the GPU. coordinates land where the 3D texture would sample them (colour * size - 0.5 texels, clamped
+   to the edge nodes), so trilinear output matches the shaders. nodes are LutCube's interleaved RGBA bytes, one
+   node is one 32 bit load and nothing is gathered: the coordinate math runs on 4 pixels per vector, the node
+   blend on the channels of one pixel. images are split across the pool in bands of at least tile_bytes, so
+   threads never write the same cache lines and the LUT stays resident next to the band being worked on */
+class LutEngine {
+private:
+    LutCube cube;
+    LutInterpolation interpolation;
+    int stride_g;
+    int stride_b;
+
+    static constexpr int tile_bytes = 32 << 10;
+
+    template <LutInterpolation I>
+    void ApplyQuad(const unsigned char *src, unsigned char *dst, int channels) const;
+
+public:
+    // copies the LUT, it may go away afterwards
+    LutEngine(const LUT &lut, LutInterpolation interpolation = LutInterpolation::TRILINEAR);
+
+    // rows [row_begin, row_end) of width pixels with channels 3 or 4, alpha is copied. src and dst may be the same
+    void ApplyRows(const unsigned char *src, int src_stride, unsigned char *dst, int dst_stride, int width,
+                   int channels, int row_begin, int row_end) const;
+    // the whole image across pool, the calling thread works as well
+    void Apply(ThreadPool &pool, const unsigned char *src, int src_stride, unsigned char *dst, int dst_stride,
+               int width, int height, int channels) const;
+
+    LutInterpolation GetInterpolation() const { return interpolation; }
+};
+
+#endif // LUTENGINE_HPP
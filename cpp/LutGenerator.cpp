@@ -0,0 +1,181 @@
+#include <LutGenerator.hpp>
+#include <Simd.hpp>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <log.hpp>
+
+namespace {
+
+// bump whenever the model math changes so stale bakes are not picked up from the cache
+const uint32_t model_version = 1;
+
+// curve tables cover mixed linear exposure in [0, curve_range], enough headroom for crosstalk gains above 1
+const int curve_table_size = 16384;
+const float curve_range = 4.0f;
+
+float EvaluateCurve(const FilmCurve &curve, float linear) {
+    if (linear <= 0.0f) {
+        return curve.black;
+    }
+    float x = std::log2(linear / 0.18f) + curve.exposure;
+    float slope = curve.contrast * (x < 0.0f ? curve.toe : curve.shoulder);
+    float s = 1.0f / (1.0f + std::exp2(-slope * x));
+    return curve.black + (curve.white - curve.black) * s;
+}
+
+bool ParseCurveKey(const std::string &key, FilmModel &model, float value) {
+    static const char *channels[3] = {"red.", "green.", "blue."};
+    for (int c = 0; c < 3; c++) {
+        std::string prefix = channels[c];
+        if (key.compare(0, prefix.size(), prefix) != 0) {
+            continue;
+        }
+        std::string field = key.substr(prefix.size());
+        FilmCurve &curve = model.curves[c];
+        if (field == "exposure") curve.exposure = value;
+        else if (field == "contrast") curve.contrast = value;
+        else if (field == "toe") curve.toe = value;
+        else if (field == "shoulder") curve.shoulder = value;
+        else if (field == "black") curve.black = value;
+        else if (field == "white") curve.white = value;
+        else return false;
+        return true;
+    }
+    return false;
+}
+
+} // namespace
+
+bool FilmModel::Load(const std::string &path, FilmModel &model) {
+    std::ifstream infile(path);
+    if (!infile.is_open()) {
+        LOG_ERR << "Failed to open film model " << path << "\n";
+        return false;
+    }
+
+    std::string line;
+    int line_num = 0;
+    while (std::getline(infile, line)) {
+        line_num++;
+        line = line.substr(0, line.find('#'));
+        size_t eq = line.find('=');
+        if (eq == std::string::npos) {
+            continue;
+        }
+
+        std::string key;
+        std::istringstream(line.substr(0, eq)) >> key;
+        std::istringstream values(line.substr(eq + 1));
+
+        if (key == "crosstalk") {
+            for (int i = 0; i < 9; i++) {
+                if (!(values >> model.crosstalk[i])) {
+                    LOG_ERR << path << ":" << line_num << ": crosstalk needs 9 values\n";
+                    return false;
+                }
+            }
+            continue;
+        }
+
+        float value;
+        if (!(values >> value)) {
+            LOG_ERR << path << ":" << line_num << ": missing value for " << key << "\n";
+            return false;
+        }
+
+        if (key == "saturation") model.saturation = value;
+        else if (key == "saturation_highlights") model.saturation_highlights = value;
+        else if (!ParseCurveKey(key, model, value)) {
+            LOG_ERR << path << ":" << line_num << ": unknown key " << key << "\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+uint64_t LutGenerator::GetModelHash(const FilmModel &model, int size) {
+    uint64_t hash = HashBytes(&model_version, sizeof(model_version));
+    hash = HashBytes(&size, sizeof(size), hash);
+    for (const FilmCurve &curve : model.curves) {
+        float fields[6] = {curve.exposure, curve.contrast, curve.toe, curve.shoulder, curve.black, curve.white};
+        hash = HashBytes(fields, sizeof(fields), hash);
+    }
+    hash = HashBytes(model.crosstalk, sizeof(model.crosstalk), hash);
+    hash = HashBytes(&model.saturation, sizeof(model.saturation), hash);
+    hash = HashBytes(&model.saturation_highlights, sizeof(model.saturation_highlights), hash);
+    return hash;
+}
+
+std::vector<unsigned char> LutGenerator::Bake(const FilmModel &model, int size) {
+    std::vector<unsigned char> out;
+    uint64_t key = GetModelHash(model, size);
+    if (cache.Load(key, size, out)) {
+        LOG << "Loaded film model bake from cache\n";
+        return out;
+    }
+
+    auto start_time = std::chrono::steady_clock::now();
+
+    // all transcendental math goes into 1D tables up front, the per node work is then a matrix, lerps and a blend
+    std::vector<float> decode(size);
+    for (int i = 0; i < size; i++) {
+        decode[i] = std::pow(static_cast<float>(i) / (size - 1), 2.2f);
+    }
+
+    // the curves map linear exposure straight to display values (middle grey lands on 0.5), like a print would
+    std::vector<float> curves[3];
+    for (int c = 0; c < 3; c++) {
+        curves[c].resize(curve_table_size + 1);
+        for (int i = 0; i <= curve_table_size; i++) {
+            float linear = curve_range * i / curve_table_size;
+            curves[c][i] = std::min(1.0f, std::max(0.0f, EvaluateCurve(model.curves[c], linear)));
+        }
+    }
+
+    const float *m = model.crosstalk;
+    const Vec4f col_r = Set4f(m[0], m[3], m[6], 0.0f);
+    const Vec4f col_g = Set4f(m[1], m[4], m[7], 0.0f);
+    const Vec4f col_b = Set4f(m[2], m[5], m[8], 0.0f);
+    const float table_scale = curve_table_size / curve_range;
+
+    out.resize(static_cast<size_t>(size) * size * size * 3);
+    pool.ParallelFor(0, size, [&](int b_begin, int b_end) {
+        float lanes[4];
+        for (int b = b_begin; b < b_end; b++) {
+            Vec4f lin_b = col_b * Splat4f(decode[b]);
+            for (int g = 0; g < size; g++) {
+                Vec4f lin_gb = lin_b + col_g * Splat4f(decode[g]);
+                unsigned char *dst = out.data() + (static_cast<size_t>(b) * size * size + g * size) * 3;
+                for (int r = 0; r < size; r++) {
+                    Vec4f mixed = lin_gb + col_r * Splat4f(decode[r]);
+
+                    Store4f(lanes, Clamp4f(mixed * Splat4f(table_scale), 0.0f, curve_table_size - 1.0f));
+                    for (int c = 0; c < 3; c++) {
+                        int idx = static_cast<int>(lanes[c]);
+                        float frac = lanes[c] - idx;
+                        lanes[c] = curves[c][idx] + (curves[c][idx + 1] - curves[c][idx]) * frac;
+                    }
+                    Vec4f color = Load4f(lanes);
+
+                    float luma = 0.299f * lanes[0] + 0.587f * lanes[1] + 0.114f * lanes[2];
+                    float sat = model.saturation + (model.saturation_highlights - model.saturation) * luma;
+                    Vec4f luma4 = Splat4f(luma);
+                    color = luma4 + (color - luma4) * Splat4f(sat);
+
+                    Store4f(lanes, Clamp4f(color, 0.0f, 1.0f) * Splat4f(255.0f) + Splat4f(0.5f));
+                    dst[r*3 + 0] = static_cast<unsigned char>(lanes[0]);
+                    dst[r*3 + 1] = static_cast<unsigned char>(lanes[1]);
+                    dst[r*3 + 2] = static_cast<unsigned char>(lanes[2]);
+                }
+            }
+        }
+    });
+
+    std::chrono::duration<float> elapsed = std::chrono::steady_clock::now() - start_time;
+    LOG << "Baked film model at " << size << "^3 in " << elapsed.count() << "s on " << pool.GetNumThreads() << " threads\n";
+
+    cache.Store(key, size, out);
+    return out;
+}
@@ -0,0 +1,51 @@
+#ifndef LUTGENERATOR_HPP
+#define LUTGENERATOR_HPP
+
+#include <string>
+#include <vector>
+#include <Lut.hpp>
+#include <LutCache.hpp>
+#include <ThreadPool.hpp>
+
+// Characteristic curve of one dye layer: a sigmoid over log2 exposure around middle grey,
+// with separate slopes below (toe) and above (shoulder) the midpoint
+struct FilmCurve {
+    float exposure = 0.0f;  // stops added before the curve
+    float contrast = 1.0f;  // slope at middle grey
+    float toe = 1.0f;       // slope multiplier for the shadows
+    float shoulder = 1.0f;  // slope multiplier for the highlights
+    float black = 0.0f;     // output at zero exposure
+    float white = 1.0f;     // output at infinite exposure
+};
+
+/* parametric film response. input is decoded to linear light, mixed by the crosstalk matrix (layer interimage
+   effects), pushed through the per channel curves and finally re-saturated around luma */
+struct FilmModel {
+    FilmCurve curves[3];
+    float crosstalk[9] = {1.0f, 0.0f, 0.0f,
+                          0.0f, 1.0f, 0.0f,
+                          0.0f, 0.0f, 1.0f}; // row major, output channel per row
+    float saturation = 1.0f;             // saturation in the shadows and midtones
+    float saturation_highlights = 1.0f;  // saturation reached at full brightness
+
+    // key = value text file, see config/film/example.film
+    static bool Load(const std::string &path, FilmModel &model);
+};
+
+/* bakes a FilmModel into the LUT layout SwitchLUT uploads. results are cached by parameter hash,
+   so a parameter change costs exactly one bake */
+class LutGenerator {
+private:
+    ThreadPool &pool;
+    LutCache &cache;
+
+public:
+    LutGenerator(ThreadPool &pool, LutCache &cache) : pool(pool), cache(cache) {}
+
+    static uint64_t GetModelHash(const FilmModel &model, int size);
+
+    // returns size^3 RGB triples in the same layout as LUT::Data
+    std::vector<unsigned char> Bake(const FilmModel &model, int size);
+};
+
+#endif // LUTGENERATOR_HPP
@@ -0,0 +1,143 @@
+#include <LutLibrary.hpp>
+#include "stb_image.h"
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <log.hpp>
+#include <PerfCounters.hpp>
+#include <LutComposer.hpp>
+#include <LutCube.hpp>
+#include <LutGenerator.hpp>
+
+bool LutLibrary::Load(ThreadPool &pool, LutCache &cache) {
+    // load lut image
+    int lut_width = 0, lut_height = 0, lut_nrChannels;
+    for (const auto & entry : std::filesystem::directory_iterator(lut_dir)) {
+        LUT new_lut;
+        new_lut.Name = entry.path().stem();
+        {
+            PerfScope perf(PerfStage::LUT_DECODE);
+            new_lut.Data = stbi_load(entry.path().c_str(), &lut_width, &lut_height, &lut_nrChannels, 0);
+        }
+
+        LOG << "Loading texture: " << new_lut.Name << "\n";
+        if (!new_lut.Data)
+        {
+            LOG << "Failed to load texture" << std::endl;
+            return false;
+        }
+
+        new_lut.Size = static_cast<int>(std::round(std::cbrt(lut_width * lut_height)));
+        new_lut.Hash = HashBytes(new_lut.Data, static_cast<size_t>(lut_width) * lut_height * 3);
+        DetectMonochrome(new_lut);
+        if (new_lut.Monochrome) {
+            LOG << new_lut.Name << " is monochrome, using tone curve path\n";
+        }
+        luts.push_back(new_lut);
+    }
+
+    // TODO: This assumes that the LUT size is the same every time. confirm if this is true
+    lut_side = luts.empty() ? default_lut_side : static_cast<int>(std::round(std::cbrt(lut_width * lut_height)));
+
+    // generated looks first, so stacks can build on them
+    LoadFilmModels(pool, cache);
+    LoadStacks(pool, cache);
+    return true;
+}
+
+// Each file in the film dir describes a FilmModel that is baked into a LUT named after the file
+void LutLibrary::LoadFilmModels(ThreadPool &pool, LutCache &cache) {
+    if (!std::filesystem::is_directory(film_dir)) {
+        return;
+    }
+
+    LutGenerator generator(pool, cache);
+    for (const auto & entry : std::filesystem::directory_iterator(film_dir)) {
+        FilmModel model;
+        if (!FilmModel::Load(entry.path(), model)) {
+            continue;
+        }
+
+        LOG << "Generating film model: " << entry.path().stem() << "\n";
+        baked_luts.push_back(generator.Bake(model, lut_side));
+
+        LUT new_lut;
+        new_lut.Name = entry.path().stem();
+        new_lut.Data = baked_luts.back().data();
+        new_lut.Size = lut_side;
+        new_lut.Hash = LutGenerator::GetModelHash(model, lut_side);
+        DetectMonochrome(new_lut);
+        luts.push_back(new_lut);
+    }
+}
+
+// Each file in the stack dir lists LUT names, one per line, applied top to bottom. The chain is baked into one
+// LUT named after the file, which then shows up in SwitchLUT like any other
+void LutLibrary::LoadStacks(ThreadPool &pool, LutCache &cache) {
+    if (!std::filesystem::is_directory(stack_dir)) {
+        return;
+    }
+
+    LutComposer composer(pool, cache);
+    for (const auto & entry : std::filesystem::directory_iterator(stack_dir)) {
+        std::ifstream infile(entry.path());
+        std::vector<const LUT *> chain;
+        std::string line;
+        bool valid = true;
+        while (std::getline(infile, line)) {
+            if (line.empty()) {
+                continue;
+            }
+            auto it = std::find_if(luts.begin(), luts.end(), [&](const LUT &lut) { return lut.Name == line; });
+            if (it == luts.end()) {
+                LOG_ERR << "Stack " << entry.path().stem() << " references unknown LUT " << line << std::endl;
+                valid = false;
+                break;
+            }
+            chain.push_back(&(*it));
+        }
+
+        if (!valid || chain.empty()) {
+            continue;
+        }
+
+        LOG << "Composing LUT stack: " << entry.path().stem() << "\n";
+        baked_luts.push_back(composer.Compose(chain, lut_side));
+
+        LUT new_lut;
+        new_lut.Name = entry.path().stem();
+        new_lut.Data = baked_luts.back().data();
+        new_lut.Size = lut_side;
+        new_lut.Hash = LutComposer::GetChainHash(chain, lut_side);
+        DetectMonochrome(new_lut);
+        luts.push_back(new_lut);
+    }
+}
+
+int LutLibrary::GetNumLuts() const {
+    return luts.size();
+}
+
+std::string LutLibrary::GetLutName(int index) const {
+    return luts[index].Name;
+}
+
+const LUT &LutLibrary::GetLut(int index) const {
+    return luts[index];
+}
+
+// index of the LUT with this content hash, else of the first one with this name, -1 if neither is loaded
+int LutLibrary::FindLut(uint64_t hash, const std::string &name) const {
+    for (size_t i = 0; i < luts.size(); i++) {
+        if (luts[i].Hash == hash) {
+            return i;
+        }
+    }
+    for (size_t i = 0; i < luts.size(); i++) {
+        if (luts[i].Name == name) {
+            return i;
+        }
+    }
+    return -1;
+}
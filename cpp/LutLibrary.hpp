@@ -0,0 +1,41 @@
+#ifndef LUTLIBRARY_HPP
+#define LUTLIBRARY_HPP
+
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <string>
+#include <vector>
+#include <Lut.hpp>
+#include <LutCache.hpp>
+#include <ThreadPool.hpp>
+
+/* every LUT the camera offers, in SwitchLUT order: the LUT images, then LUTs baked from film models, then stacks
+   built from both. the renderers and the batch tool load the same one, so indices and hashes mean the same to
+   all of them. LUTs stay where they are once loaded */
+class LutLibrary {
+private:
+    std::string lut_dir = std::string(std::getenv("HOME")) + "/codac/lut/";
+    std::string stack_dir = std::string(std::getenv("HOME")) + "/codac/stack/";
+    std::string film_dir = std::string(std::getenv("HOME")) + "/codac/film/";
+    std::vector<LUT> luts;
+    std::deque<std::vector<unsigned char>> baked_luts; // backing storage for LUTs built at startup
+    int lut_side = 0;
+    const int default_lut_side = 144; // used for generated LUTs when no LUT images are installed
+
+    void LoadStacks(ThreadPool &, LutCache &);
+    void LoadFilmModels(ThreadPool &, LutCache &);
+
+public:
+    // bakes on pool and through cache. false when a LUT image fails to load
+    bool Load(ThreadPool &, LutCache &);
+
+    const std::vector<LUT> &GetLuts() const { return luts; }
+    int GetSide() const { return lut_side; }
+    int GetNumLuts() const;
+    std::string GetLutName(int) const;
+    const LUT &GetLut(int) const;
+    int FindLut(uint64_t, const std::string &) const;
+}; // LutLibrary
+
+#endif // LUTLIBRARY_HPP
@@ -0,0 +1,244 @@
+#include <Metrics.hpp>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <log.hpp>
+
+namespace {
+
+struct Registry {
+    std::mutex mutex;
+    std::map<std::string, std::unique_ptr<MetricCounter>> counters;
+    std::map<std::string, std::unique_ptr<MetricGauge>> gauges;
+    std::map<std::string, std::unique_ptr<LatencyHistogram>> histograms;
+    std::vector<std::pair<std::string, std::function<std::string()>>> sections; // <title, section>
+
+    // the reporter, only its thread and StartReporting/StopReporting touch these
+    std::mutex report_mutex;
+    std::condition_variable report_cv;
+    std::thread reporter;
+    bool stopping = false;
+    std::chrono::seconds interval{0};
+    FILE *file = nullptr;
+    int socket_fd = -1;
+    sockaddr_un socket_address;
+};
+
+// never destroyed, metrics are updated from threads that may outlive the statics at exit
+Registry &GetRegistry() {
+    static Registry *registry = new Registry;
+    return *registry;
+}
+
+template <typename Metric>
+Metric &Find(Registry &registry, std::map<std::string, std::unique_ptr<Metric>> &metrics, const std::string &name) {
+    std::unique_lock<std::mutex> lock(registry.mutex);
+    std::unique_ptr<Metric> &metric = metrics[name];
+    if (!metric) {
+        metric.reset(new Metric());
+    }
+    return *metric;
+}
+
+unsigned long long Percentile(const LatencyHistogram &histogram, double p) {
+    return static_cast<unsigned long long>(histogram.GetPercentile(p));
+}
+
+// with the registry locked
+std::string FormatSummary(Registry &registry) {
+    std::string summary;
+    char line[200];
+    for (const auto &counter : registry.counters) {
+        snprintf(line, sizeof(line), "%-32s %llu\n", counter.first.c_str(), static_cast<unsigned long long>(counter.second->Get()));
+        summary += line;
+    }
+    for (const auto &gauge : registry.gauges) {
+        snprintf(line, sizeof(line), "%-32s %lld\n", gauge.first.c_str(), static_cast<long long>(gauge.second->Get()));
+        summary += line;
+    }
+    for (const auto &entry : registry.histograms) {
+        const LatencyHistogram &histogram = *entry.second;
+        if (histogram.GetCount() == 0) {
+            continue;
+        }
+        snprintf(line, sizeof(line), "%-32s %llu, p50/p95/p99 %llu/%llu/%llu us, max %llu us\n", entry.first.c_str(),
+                 static_cast<unsigned long long>(histogram.GetCount()), Percentile(histogram, 0.50),
+                 Percentile(histogram, 0.95), Percentile(histogram, 0.99), static_cast<unsigned long long>(histogram.GetMax()));
+        summary += line;
+    }
+    return summary;
+}
+
+// with the registry locked. metric names are code, they need no escaping
+std::string FormatJson(Registry &registry) {
+    char value[160];
+    snprintf(value, sizeof(value), "{\"time\":%lld", static_cast<long long>(
+        std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count()));
+    std::string json = value;
+
+    json += ",\"counters\":{";
+    const char *separator = "";
+    for (const auto &counter : registry.counters) {
+        snprintf(value, sizeof(value), "%s\"%s\":%llu", separator, counter.first.c_str(), static_cast<unsigned long long>(counter.second->Get()));
+        json += value;
+        separator = ",";
+    }
+    json += "},\"gauges\":{";
+    separator = "";
+    for (const auto &gauge : registry.gauges) {
+        snprintf(value, sizeof(value), "%s\"%s\":%lld", separator, gauge.first.c_str(), static_cast<long long>(gauge.second->Get()));
+        json += value;
+        separator = ",";
+    }
+    json += "},\"histograms\":{";
+    separator = "";
+    for (const auto &entry : registry.histograms) {
+        const LatencyHistogram &histogram = *entry.second;
+        snprintf(value, sizeof(value), "%s\"%s\":{\"count\":%llu,\"p50\":%llu,\"p95\":%llu,\"p99\":%llu,\"max\":%llu}", separator,
+                 entry.first.c_str(), static_cast<unsigned long long>(histogram.GetCount()), Percentile(histogram, 0.50),
+                 Percentile(histogram, 0.95), Percentile(histogram, 0.99), static_cast<unsigned long long>(histogram.GetMax()));
+        json += value;
+        separator = ",";
+    }
+    json += "}}\n";
+    return json;
+}
+
+void Report(Registry &registry) {
+    std::string summary;
+    std::string json;
+    std::vector<std::pair<std::string, std::function<std::string()>>> sections;
+    {
+        std::unique_lock<std::mutex> lock(registry.mutex);
+        summary = FormatSummary(registry);
+        json = FormatJson(registry);
+        for (auto &entry : registry.histograms) {
+            entry.second->Reset();
+        }
+        sections = registry.sections;
+    }
+    LOG << "Metrics:\n" << summary << std::flush;
+    // outside the lock, a section may well look up metrics of its own
+    for (const auto &section : sections) {
+        std::string text = section.second();
+        if (!text.empty()) {
+            LOG << section.first << ":\n" << text << std::flush;
+        }
+    }
+
+    if (registry.file) {
+        fputs(json.c_str(), registry.file);
+        fflush(registry.file);
+    }
+    if (registry.socket_fd >= 0) {
+        // nobody listening is fine, the numbers are in the log either way
+        sendto(registry.socket_fd, json.data(), json.size(), MSG_DONTWAIT | MSG_NOSIGNAL,
+               reinterpret_cast<const sockaddr*>(&registry.socket_address), sizeof(registry.socket_address));
+    }
+}
+
+void ReporterLoop(Registry &registry) {
+    std::unique_lock<std::mutex> lock(registry.report_mutex);
+    while (!registry.report_cv.wait_for(lock, registry.interval, [&registry]{ return registry.stopping; })) {
+        lock.unlock();
+        Report(registry);
+        lock.lock();
+    }
+}
+
+} // namespace
+
+MetricCounter &Metrics::GetCounter(const std::string &name) {
+    Registry &registry = GetRegistry();
+    return Find(registry, registry.counters, name);
+}
+
+MetricGauge &Metrics::GetGauge(const std::string &name) {
+    Registry &registry = GetRegistry();
+    return Find(registry, registry.gauges, name);
+}
+
+LatencyHistogram &Metrics::GetHistogram(const std::string &name) {
+    Registry &registry = GetRegistry();
+    return Find(registry, registry.histograms, name);
+}
+
+void Metrics::AddReportSection(const std::string &title, std::function<std::string()> section) {
+    Registry &registry = GetRegistry();
+    std::unique_lock<std::mutex> lock(registry.mutex);
+    registry.sections.emplace_back(title, std::move(section));
+}
+
+std::string Metrics::Summary() {
+    Registry &registry = GetRegistry();
+    std::unique_lock<std::mutex> lock(registry.mutex);
+    return FormatSummary(registry);
+}
+
+void Metrics::StartReporting(std::chrono::seconds interval, const std::string &target) {
+    Registry &registry = GetRegistry();
+    if (registry.reporter.joinable()) {
+        return;
+    }
+
+    const std::string unix_prefix = "unix:";
+    if (target.compare(0, unix_prefix.size(), unix_prefix) == 0) {
+        std::string path = target.substr(unix_prefix.size());
+        memset(&registry.socket_address, 0, sizeof(registry.socket_address));
+        registry.socket_address.sun_family = AF_UNIX;
+        if (path.empty() || path.size() >= sizeof(registry.socket_address.sun_path)) {
+            LOG_ERR << "Metrics socket path " << path << " does not fit a unix socket address\n";
+        }
+        else {
+            strncpy(registry.socket_address.sun_path, path.c_str(), sizeof(registry.socket_address.sun_path) - 1);
+            registry.socket_fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+            if (registry.socket_fd < 0) {
+                LOG_ERR << "Cannot create the metrics socket: " << strerror(errno) << "\n";
+            }
+        }
+    }
+    else if (!target.empty()) {
+        registry.file = fopen(target.c_str(), "a");
+        if (!registry.file) {
+            LOG_ERR << "Cannot open metrics export " << target << ": " << strerror(errno) << "\n";
+        }
+    }
+
+    registry.interval = interval;
+    registry.stopping = false;
+    registry.reporter = std::thread(ReporterLoop, std::ref(registry));
+}
+
+void Metrics::StopReporting() {
+    Registry &registry = GetRegistry();
+    if (!registry.reporter.joinable()) {
+        return;
+    }
+    {
+        std::unique_lock<std::mutex> lock(registry.report_mutex);
+        registry.stopping = true;
+    }
+    registry.report_cv.notify_all();
+    registry.reporter.join();
+
+    Report(registry);
+    if (registry.file) {
+        fclose(registry.file);
+        registry.file = nullptr;
+    }
+    if (registry.socket_fd >= 0) {
+        close(registry.socket_fd);
+        registry.socket_fd = -1;
+    }
+}
@@ -0,0 +1,56 @@
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <LatencyHistogram.hpp>
+
+// a running total, like frames seen or dropped
+class MetricCounter {
+private:
+    std::atomic<uint64_t> value{0};
+
+public:
+    void Add(uint64_t n = 1) { value.fetch_add(n, std::memory_order_relaxed); }
+    uint64_t Get() const { return value.load(std::memory_order_relaxed); }
+};
+
+// a level that goes up and down, like a queue depth
+class MetricGauge {
+private:
+    std::atomic<int64_t> value{0};
+
+public:
+    void Set(int64_t level) { value.store(level, std::memory_order_relaxed); }
+    void Add(int64_t n) { value.fetch_add(n, std::memory_order_relaxed); }
+    int64_t Get() const { return value.load(std::memory_order_relaxed); }
+};
+
+/* named counters, gauges and latency histograms for the whole process. looking one up takes a lock, so components
+   do it once and keep the reference, updating it is a relaxed atomic add. the reporter logs a summary every
+   interval, percentiles over that interval with the histograms starting over afterwards, and exports the same
+   numbers as one JSON object per line, appended to a file or sent as a datagram to unix:<path> */
+class Metrics {
+public:
+    // the same name gives the same metric. references stay valid until the process exits
+    static MetricCounter &GetCounter(const std::string &name);
+    static MetricGauge &GetGauge(const std::string &name);
+    static LatencyHistogram &GetHistogram(const std::string &name);
+
+    // every metric, one line each, histograms as count, p50/p95/p99 and max in microseconds
+    static std::string Summary();
+
+    // logged under title after every report, on the reporter thread. meant for numbers kept elsewhere that report
+    // what happened since the last call, an empty string skips the section
+    static void AddReportSection(const std::string &title, std::function<std::string()> section);
+
+    // no target only logs. a target that can not be opened is reported and left out
+    static void StartReporting(std::chrono::seconds interval, const std::string &target);
+    // reports what the last interval collected and stops
+    static void StopReporting();
+};
+
+#endif // METRICS_HPP
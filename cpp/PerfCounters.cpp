@@ -0,0 +1,254 @@
+#include <PerfCounters.hpp>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <log.hpp>
+
+std::atomic<bool> PerfCounters::enabled{true};
+
+const char *GetPerfStageName(PerfStage stage) {
+    switch (stage) {
+    case PerfStage::FRAME_COPY: return "frame copy";
+    case PerfStage::DRM_COPY: return "DRM copy";
+    case PerfStage::PNG_ENCODE: return "PNG encode";
+    case PerfStage::LUT_DECODE: return "LUT decode";
+    }
+    return "unknown";
+}
+
+const char *GetPerfCounterName(PerfCounter counter) {
+    switch (counter) {
+    case PerfCounter::CYCLES: return "cycles";
+    case PerfCounter::INSTRUCTIONS: return "instructions";
+    case PerfCounter::CACHE_MISSES: return "cache misses";
+    case PerfCounter::BUS_ACCESSES: return "bus accesses";
+    }
+    return "unknown";
+}
+
+namespace {
+
+struct StageTotals {
+    std::atomic<uint64_t> runs{0};
+    std::atomic<uint64_t> values[num_perf_counters] = {};
+};
+
+struct StageValues {
+    uint64_t runs = 0;
+    uint64_t values[num_perf_counters] = {};
+};
+
+StageTotals stage_totals[num_perf_stages];
+std::atomic<unsigned> counted{0}; // bit per counter some thread could open
+std::atomic<bool> reported{false};
+
+// the totals at the previous IntervalSummary
+std::mutex interval_mutex;
+StageValues interval_start[num_perf_stages];
+
+StageValues LoadTotals(int stage) {
+    StageValues loaded;
+    loaded.runs = stage_totals[stage].runs.load(std::memory_order_relaxed);
+    for (int i = 0; i < num_perf_counters; i++) {
+        loaded.values[i] = stage_totals[stage].values[i].load(std::memory_order_relaxed);
+    }
+    return loaded;
+}
+
+// one line per stage that ran
+std::string FormatSummary(const StageValues (&stages)[num_perf_stages]) {
+    std::string summary;
+    unsigned mask = counted.load(std::memory_order_relaxed);
+    char line[256];
+    for (int s = 0; s < num_perf_stages; s++) {
+        uint64_t runs = stages[s].runs;
+        if (runs == 0) {
+            continue;
+        }
+        const uint64_t *values = stages[s].values;
+        uint64_t cycles = values[static_cast<int>(PerfCounter::CYCLES)];
+        uint64_t instructions = values[static_cast<int>(PerfCounter::INSTRUCTIONS)];
+        uint64_t misses = values[static_cast<int>(PerfCounter::CACHE_MISSES)];
+        int length = snprintf(line, sizeof(line), "%-10s %6llu runs, per run %llu cycles", GetPerfStageName(static_cast<PerfStage>(s)),
+                              static_cast<unsigned long long>(runs), static_cast<unsigned long long>(cycles / runs));
+        if (mask & (1u << static_cast<int>(PerfCounter::INSTRUCTIONS)) && length > 0 && length < static_cast<int>(sizeof(line))) {
+            length += snprintf(line + length, sizeof(line) - length, ", %llu instructions, IPC %.2f",
+                               static_cast<unsigned long long>(instructions / runs), cycles ? static_cast<double>(instructions) / cycles : 0.0);
+        }
+        if (mask & (1u << static_cast<int>(PerfCounter::CACHE_MISSES)) && length > 0 && length < static_cast<int>(sizeof(line))) {
+            length += snprintf(line + length, sizeof(line) - length, ", %llu cache misses (%.1f per 1k instructions)",
+                               static_cast<unsigned long long>(misses / runs), instructions ? misses * 1000.0 / instructions : 0.0);
+        }
+        if (mask & (1u << static_cast<int>(PerfCounter::BUS_ACCESSES)) && length > 0 && length < static_cast<int>(sizeof(line))) {
+            snprintf(line + length, sizeof(line) - length, ", %llu bus accesses",
+                     static_cast<unsigned long long>(values[static_cast<int>(PerfCounter::BUS_ACCESSES)] / runs));
+        }
+        summary += line;
+        summary += "\n";
+    }
+    return summary;
+}
+
+void ReportOnce(const std::string &message) {
+    if (!reported.exchange(true)) {
+        LOG << message << std::endl;
+    }
+}
+
+int OpenCounter(PerfCounter counter, int group) {
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    switch (counter) {
+    case PerfCounter::CYCLES: attr.config = PERF_COUNT_HW_CPU_CYCLES; break;
+    case PerfCounter::INSTRUCTIONS: attr.config = PERF_COUNT_HW_INSTRUCTIONS; break;
+    case PerfCounter::CACHE_MISSES: attr.config = PERF_COUNT_HW_CACHE_MISSES; break;
+    case PerfCounter::BUS_ACCESSES:
+#if defined(__aarch64__) || defined(__arm__)
+        // BUS_ACCESS, a common event of the ARMv7 and ARMv8 PMUs without a generic perf name
+        attr.type = PERF_TYPE_RAW;
+        attr.config = 0x19;
+#else
+        attr.config = PERF_COUNT_HW_BUS_CYCLES;
+#endif
+        break;
+    }
+    // user space only, which perf_event_paranoid 2, the default, still allows for a thread's own counters
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, group, PERF_FLAG_FD_CLOEXEC));
+}
+
+/* one thread's counters as one group, so they are scheduled onto the PMU together and read with one syscall */
+class ThreadGroup {
+private:
+    bool opened = false;
+    int fds[num_perf_counters];
+    int slots[num_perf_counters]; // position in the group's read, -1 for counters this core does not have
+    int num_slots = 0;
+
+    void Open() {
+        opened = true;
+        for (int i = 0; i < num_perf_counters; i++) {
+            fds[i] = -1;
+            slots[i] = -1;
+        }
+        // cycles lead, without them the rest says little
+        fds[0] = OpenCounter(PerfCounter::CYCLES, -1);
+        if (fds[0] < 0) {
+            int error = errno;
+            if (error == EACCES || error == EPERM) {
+                std::ifstream paranoid("/proc/sys/kernel/perf_event_paranoid");
+                std::string level;
+                paranoid >> level;
+                ReportOnce("Hardware counters not permitted, perf_event_paranoid is " + level);
+            }
+            else {
+                ReportOnce(std::string("No hardware counters: ") + strerror(error));
+            }
+            return;
+        }
+        slots[0] = num_slots++;
+        unsigned mask = 1;
+        std::string names = GetPerfCounterName(PerfCounter::CYCLES);
+        for (int i = 1; i < num_perf_counters; i++) {
+            fds[i] = OpenCounter(static_cast<PerfCounter>(i), fds[0]);
+            if (fds[i] >= 0) {
+                slots[i] = num_slots++;
+                mask |= 1u << i;
+                names += std::string(", ") + GetPerfCounterName(static_cast<PerfCounter>(i));
+            }
+        }
+        counted.fetch_or(mask, std::memory_order_relaxed);
+        ReportOnce("Hardware counters: " + names);
+    }
+
+public:
+    ~ThreadGroup() {
+        if (!opened) {
+            return;
+        }
+        for (int fd : fds) {
+            if (fd >= 0) {
+                close(fd);
+            }
+        }
+    }
+
+    bool Read(PerfCounters::Sample &sample) {
+        if (!opened) {
+            Open();
+        }
+        if (fds[0] < 0) {
+            return false;
+        }
+        uint64_t data[3 + num_perf_counters];
+        ssize_t expected = static_cast<ssize_t>((3 + num_slots) * sizeof(uint64_t));
+        if (read(fds[0], data, sizeof(data)) < expected) {
+            return false;
+        }
+        sample.time_enabled = data[1];
+        sample.time_running = data[2];
+        for (int i = 0; i < num_perf_counters; i++) {
+            sample.values[i] = slots[i] >= 0 ? data[3 + slots[i]] : 0;
+        }
+        return true;
+    }
+};
+
+} // namespace
+
+void PerfCounters::SetEnabled(bool enable) {
+    enabled.store(enable, std::memory_order_relaxed);
+}
+
+bool PerfCounters::Read(Sample &sample) {
+    static thread_local ThreadGroup group;
+    return group.Read(sample);
+}
+
+void PerfCounters::Record(PerfStage stage, const Sample &start, const Sample &end) {
+    uint64_t enabled_time = end.time_enabled - start.time_enabled;
+    uint64_t running_time = end.time_running - start.time_running;
+    if (running_time == 0) {
+        // multiplexed off the PMU for the whole stage, nothing to scale from
+        return;
+    }
+    // when other users of the PMU had it part of the time, extrapolate like perf stat does
+    double scale = running_time < enabled_time ? static_cast<double>(enabled_time) / running_time : 1.0;
+    StageTotals &totals = stage_totals[static_cast<int>(stage)];
+    for (int i = 0; i < num_perf_counters; i++) {
+        totals.values[i].fetch_add(static_cast<uint64_t>((end.values[i] - start.values[i]) * scale), std::memory_order_relaxed);
+    }
+    totals.runs.fetch_add(1, std::memory_order_relaxed);
+}
+
+std::string PerfCounters::Summary() {
+    StageValues stages[num_perf_stages];
+    for (int s = 0; s < num_perf_stages; s++) {
+        stages[s] = LoadTotals(s);
+    }
+    return FormatSummary(stages);
+}
+
+std::string PerfCounters::IntervalSummary() {
+    std::unique_lock<std::mutex> lock(interval_mutex);
+    StageValues stages[num_perf_stages];
+    for (int s = 0; s < num_perf_stages; s++) {
+        // a run recorded between the loads lands in this interval or the next one, it is never lost
+        StageValues totals = LoadTotals(s);
+        stages[s].runs = totals.runs - interval_start[s].runs;
+        for (int i = 0; i < num_perf_counters; i++) {
+            stages[s].values[i] = totals.values[i] - interval_start[s].values[i];
+        }
+        interval_start[s] = totals;
+    }
+    return FormatSummary(stages);
+}
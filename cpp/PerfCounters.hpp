@@ -0,0 +1,75 @@
+#ifndef PERFCOUNTERS_HPP
+#define PERFCOUNTERS_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+enum class PerfStage {
+    FRAME_COPY,  // FrameManager copying camera buffers out
+    DRM_COPY,    // viewfinder frames into the dumb buffer
+    PNG_ENCODE,  // deflate of one strip, on whichever thread runs it. filtering is left out, it is cheap
+    LUT_DECODE   // LUT images and cached cubes read from disk
+};
+
+enum class PerfCounter {
+    CYCLES,
+    INSTRUCTIONS,
+    CACHE_MISSES,
+    BUS_ACCESSES  // the PMU's BUS_ACCESS event on ARM, bus cycles elsewhere. not on every core
+};
+
+static const int num_perf_stages = 4;
+static const int num_perf_counters = 4;
+
+const char *GetPerfStageName(PerfStage);
+const char *GetPerfCounterName(PerfCounter);
+
+/* hardware counters around the CPU-bound stages, to tell compute from memory stalls where wall time can not. every
+   thread opens its own perf_event_open group on the first stage it runs, counting user space only, and a stage adds
+   the group's deltas between its start and end to that stage's totals. where the kernel has no PMU or
+   perf_event_paranoid forbids it, this is said once and every scope turns into a no-op */
+class PerfCounters {
+public:
+    struct Sample {
+        uint64_t values[num_perf_counters];
+        uint64_t time_enabled;
+        uint64_t time_running;
+    };
+
+    static void SetEnabled(bool);
+    static bool IsEnabled() { return enabled.load(std::memory_order_relaxed); }
+    // the counting thread's counters, false when it has none
+    static bool Read(Sample &);
+    static void Record(PerfStage, const Sample &start, const Sample &end);
+    // per stage averages, IPC and misses per thousand instructions, one line each. empty without counters
+    static std::string Summary();
+    // the same over the runs since the previous call, for the metrics reporter. empty when nothing ran
+    static std::string IntervalSummary();
+
+private:
+    static std::atomic<bool> enabled;
+};
+
+// the enclosing scope as a run of stage
+class PerfScope {
+private:
+    PerfStage stage;
+    bool counting;
+    PerfCounters::Sample start;
+
+public:
+    explicit PerfScope(PerfStage stage) : stage(stage) {
+        counting = PerfCounters::IsEnabled() && PerfCounters::Read(start);
+    }
+    ~PerfScope() {
+        PerfCounters::Sample end;
+        if (counting && PerfCounters::Read(end)) {
+            PerfCounters::Record(stage, start, end);
+        }
+    }
+    PerfScope(const PerfScope &) = delete;
+    PerfScope &operator=(const PerfScope &) = delete;
+};
+
+#endif // PERFCOUNTERS_HPP
@@ -1,9 +1,13 @@
 #include <PiCamera.hpp>
+#include <atomic>
+#include <chrono>
 #include <cstdlib>
 #include <sys/mman.h>
 #include <linux/dma-buf.h>
 #include <sys/ioctl.h>
 #include <log.hpp>
+#include <Trace.hpp>
+#include <Metrics.hpp>
 
 std::map<libcamera::FrameBuffer *, std::vector<libcamera::Span<uint8_t>>> PiCamera::mapped_buffers;
 std::shared_ptr<libcamera::Camera> PiCamera::camera;
@@ -11,6 +15,18 @@ std::unique_ptr<libcamera::CameraConfiguration> PiCamera::config;
 std::shared_ptr<FrameManager> PiCamera::frame_manager;
 CaptureMode PiCamera::capture_mode;
 
+namespace {
+MetricCounter &completed_requests = Metrics::GetCounter("camera.completed_requests");
+MetricCounter &cancelled_requests = Metrics::GetCounter("camera.cancelled_requests");
+// from RequestCapture until the still frame is in the FrameManager
+LatencyHistogram &capture_latency = Metrics::GetHistogram("camera.capture_latency_us");
+std::atomic<int64_t> capture_requested_us{0}; // set on the main thread, read on the camera's
+
+int64_t NowMicroseconds() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+}
+
 PiCamera::PiCamera(int vf_width, int vf_height, int sc_width, int sc_height) {
     viewfinder_width = vf_width;
     viewfinder_height = vf_height;
@@ -50,6 +66,7 @@ void PiCamera::Initialize() {
 
 void PiCamera::RequestCapture() {
     capture_mode = eCaptureRequested;
+    capture_requested_us = NowMicroseconds();
    
     camera->queueRequest(stillcapture_requests[0].get());
 
@@ -185,8 +202,13 @@ void PiCamera::CreateRequests() {
 
 void PiCamera::requestComplete(libcamera::Request *request)
 {
-    if (request->status() == libcamera::Request::RequestCancelled)
+    Tracer::SetThreadName("camera");
+    TRACE_SCOPE("request complete");
+    if (request->status() == libcamera::Request::RequestCancelled) {
+        cancelled_requests.Add();
         return;
+    }
+    completed_requests.Add();
 
 
     struct dma_buf_sync dma_sync {};
@@ -229,6 +251,7 @@ void PiCamera::requestComplete(libcamera::Request *request)
             std::vector<libcamera::Span<uint8_t>> mapped_span = mapped_buffers[stillcapture_buffer];
             frame_manager->update_capture(mapped_span[0].data(), mapped_span[0].size());
             capture_mode = eCaptureAvailable; // indicate capture is available
+            capture_latency.Record(NowMicroseconds() - capture_requested_us);
         }
     }
 
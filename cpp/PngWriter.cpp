@@ -0,0 +1,459 @@
+#include <PngWriter.hpp>
+#include <algorithm>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <zlib.h>
+#include <log.hpp>
+#include <PerfCounters.hpp>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+const int deflate_window = 32768;
+
+// out = a - b bytewise, the core of the Sub and Up filters
+void SubtractBytes(const unsigned char *a, const unsigned char *b, unsigned char *out, size_t n) {
+    size_t i = 0;
+#if defined(__ARM_NEON)
+    for (; i + 16 <= n; i += 16) {
+        vst1q_u8(out + i, vsubq_u8(vld1q_u8(a + i), vld1q_u8(b + i)));
+    }
+#elif defined(__SSE2__)
+    for (; i + 16 <= n; i += 16) {
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i));
+        __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), _mm_sub_epi8(va, vb));
+    }
+#endif
+    for (; i < n; i++) {
+        out[i] = a[i] - b[i];
+    }
+}
+
+// the usual "minimum sum of absolute differences" heuristic, bytes read as signed
+uint64_t SumAbs(const unsigned char *data, size_t n) {
+    uint64_t sum = 0;
+    size_t i = 0;
+#if defined(__ARM_NEON)
+    uint32x4_t acc = vdupq_n_u32(0);
+    for (; i + 16 <= n; i += 16) {
+        uint8x16_t v = vld1q_u8(data + i);
+        uint8x16_t neg = vreinterpretq_u8_s8(vnegq_s8(vreinterpretq_s8_u8(v)));
+        acc = vpadalq_u16(acc, vpaddlq_u8(vminq_u8(v, neg)));
+    }
+    sum += vgetq_lane_u32(acc, 0) + vgetq_lane_u32(acc, 1) + vgetq_lane_u32(acc, 2) + vgetq_lane_u32(acc, 3);
+#elif defined(__SSE2__)
+    __m128i acc = _mm_setzero_si128();
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+        __m128i mag = _mm_min_epu8(v, _mm_sub_epi8(zero, v));
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(mag, zero));
+    }
+    sum += static_cast<uint64_t>(_mm_cvtsi128_si32(acc)) + static_cast<uint64_t>(_mm_cvtsi128_si32(_mm_srli_si128(acc, 8)));
+#endif
+    for (; i < n; i++) {
+        sum += std::min<int>(data[i], 256 - data[i]);
+    }
+    return sum;
+}
+
+inline unsigned char Paeth(int a, int b, int c) {
+    int p = a + b - c;
+    int pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+    if (pa <= pb && pa <= pc) return a;
+    return pb <= pc ? b : c;
+}
+
+// filters one row into out (without the filter type byte). prev is a zero row for the first image row
+void FilterRow(int type, const unsigned char *row, const unsigned char *prev, int bpp, size_t n, unsigned char *out) {
+    switch (type) {
+    case 0:
+        memcpy(out, row, n);
+        break;
+    case 1:
+        memcpy(out, row, bpp);
+        SubtractBytes(row + bpp, row, out + bpp, n - bpp);
+        break;
+    case 2:
+        SubtractBytes(row, prev, out, n);
+        break;
+    case 3:
+        for (int i = 0; i < bpp; i++) {
+            out[i] = row[i] - (prev[i] >> 1);
+        }
+        for (size_t i = bpp; i < n; i++) {
+            out[i] = row[i] - ((row[i - bpp] + prev[i]) >> 1);
+        }
+        break;
+    case 4:
+        for (int i = 0; i < bpp; i++) {
+            out[i] = row[i] - prev[i];
+        }
+        for (size_t i = bpp; i < n; i++) {
+            out[i] = row[i] - Paeth(row[i - bpp], prev[i], prev[i - bpp]);
+        }
+        break;
+    }
+}
+
+void PutBE32(unsigned char *dst, uint32_t value) {
+    dst[0] = value >> 24;
+    dst[1] = value >> 16;
+    dst[2] = value >> 8;
+    dst[3] = value;
+}
+
+struct Strip {
+    int first_row;
+    int num_rows;
+    std::vector<unsigned char> compressed;
+    uLong adler;
+    bool ok;
+};
+
+// one filter per strip, chosen on a handful of sample rows instead of trying all five on every row.
+// row(i) is row i of the strip, prev the row above the first one
+template <typename RowFn>
+int ChooseFilter(RowFn row, const unsigned char *prev, int num_rows, int bpp, size_t row_bytes, unsigned char *scratch) {
+    uint64_t best_cost = UINT64_MAX;
+    int best = 0;
+    int sample_step = std::max(1, num_rows / 4);
+    for (int type = 0; type < 5; type++) {
+        uint64_t cost = 0;
+        for (int i = 0; i < num_rows; i += sample_step) {
+            FilterRow(type, row(i), i == 0 ? prev : row(i - 1), bpp, row_bytes, scratch);
+            cost += SumAbs(scratch, row_bytes);
+        }
+        if (cost < best_cost) {
+            best_cost = cost;
+            best = type;
+        }
+    }
+    return best;
+}
+
+// deflates a strip of filtered rows as raw, byte aligned blocks. only the last strip carries the final block bit.
+// dict is the data just before in
+bool DeflateStrip(const unsigned char *in, size_t in_size, const unsigned char *dict, size_t dict_size, bool last,
+                  int level, std::vector<unsigned char> &out, uLong &adler) {
+    PerfScope perf(PerfStage::PNG_ENCODE);
+    adler = adler32(adler32(0, nullptr, 0), in, in_size);
+
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (deflateInit2(&zs, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return false;
+    }
+    if (dict_size > 0) {
+        deflateSetDictionary(&zs, dict, dict_size);
+    }
+
+    out.resize(deflateBound(&zs, in_size) + 16);
+    zs.next_in = const_cast<unsigned char *>(in);
+    zs.avail_in = in_size;
+    zs.next_out = out.data();
+    zs.avail_out = out.size();
+
+    int ret = deflate(&zs, last ? Z_FINISH : Z_SYNC_FLUSH);
+    bool ok = last ? ret == Z_STREAM_END : (ret == Z_OK && zs.avail_in == 0 && zs.avail_out > 0);
+    out.resize(zs.total_out);
+    deflateEnd(&zs);
+    return ok;
+}
+
+// writes one chunk made of up to three consecutive pieces, so strips never get copied to prepend headers
+bool WriteChunk(const PngWriter::Sink &sink, const char *type, const unsigned char *p0, size_t n0,
+                const unsigned char *p1 = nullptr, size_t n1 = 0, const unsigned char *p2 = nullptr, size_t n2 = 0) {
+    unsigned char header[8];
+    PutBE32(header, static_cast<uint32_t>(n0 + n1 + n2));
+    memcpy(header + 4, type, 4);
+
+    // crc32 with a null buffer returns the initial value instead of passing crc through, so skip empty pieces
+    uLong crc = crc32(0, header + 4, 4);
+    const unsigned char *pieces[3] = {p0, p1, p2};
+    size_t sizes[3] = {n0, n1, n2};
+    for (int i = 0; i < 3; i++) {
+        if (sizes[i] > 0) {
+            crc = crc32(crc, pieces[i], sizes[i]);
+        }
+    }
+    unsigned char footer[4];
+    PutBE32(footer, crc);
+
+    return sink(header, 8) && (n0 == 0 || sink(p0, n0)) && (n1 == 0 || sink(p1, n1)) &&
+           (n2 == 0 || sink(p2, n2)) && sink(footer, 4);
+}
+
+
+bool WriteHeader(const PngWriter::Sink &sink, int width, int height, int channels) {
+    static const unsigned char signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    if (!sink(signature, sizeof(signature))) {
+        return false;
+    }
+
+    unsigned char ihdr[13];
+    PutBE32(ihdr, width);
+    PutBE32(ihdr + 4, height);
+    ihdr[8] = 8; // bit depth
+    ihdr[9] = channels == 4 ? 6 : (channels == 3 ? 2 : 0);
+    ihdr[10] = ihdr[11] = ihdr[12] = 0;
+    return WriteChunk(sink, "IHDR", ihdr, sizeof(ihdr));
+}
+
+// zlib header: deflate with a 32K window, FLEVEL from the compression level, FCHECK makes it a multiple of 31
+void ZlibHeader(int level, unsigned char header[2]) {
+    int flevel = level < 2 ? 0 : (level < 6 ? 1 : (level == 6 ? 2 : 3));
+    header[0] = 0x78;
+    header[1] = static_cast<unsigned char>(flevel << 6);
+    header[1] += 31 - ((header[0] * 256 + header[1]) % 31);
+}
+
+} // namespace
+
+bool PngWriter::Write(const unsigned char *pixels, int width, int height, int channels, size_t stride,
+                      const PngOptions &options, const Sink &sink) {
+    if (channels != 1 && channels != 3 && channels != 4) {
+        LOG_ERR << "PNG writer does not support " << channels << " channels" << std::endl;
+        return false;
+    }
+
+    const size_t row_bytes = static_cast<size_t>(width) * channels;
+    const size_t filtered_row = row_bytes + 1;
+
+    int strip_rows = options.strip_rows;
+    if (strip_rows <= 0) {
+        // a few strips per thread balances the load, much smaller strips start to cost ratio
+        int target_strips = (pool.GetNumThreads() + 1) * 4;
+        strip_rows = std::max(16, (height + target_strips - 1) / target_strips);
+    }
+
+    std::vector<Strip> strips;
+    for (int row = 0; row < height; row += strip_rows) {
+        strips.push_back({row, std::min(strip_rows, height - row), {}, 0, false});
+    }
+
+    // pass 1: filter. strips are filtered up front so every strip can be primed with the bytes before it
+    std::vector<unsigned char> filtered(filtered_row * height);
+    std::vector<unsigned char> zero_row(row_bytes, 0);
+    pool.ParallelFor(0, strips.size(), [&](int begin, int end) {
+        std::vector<unsigned char> scratch(row_bytes);
+        for (int s = begin; s < end; s++) {
+            const Strip &strip = strips[s];
+            auto source_row = [&](int row) { return pixels + static_cast<size_t>(row) * stride; };
+            auto prev_row = [&](int row) { return row == 0 ? zero_row.data() : source_row(row - 1); };
+
+            int filter = options.filter;
+            if (filter < 0) {
+                filter = ChooseFilter([&](int i) { return source_row(strip.first_row + i); }, prev_row(strip.first_row),
+                                      strip.num_rows, channels, row_bytes, scratch.data());
+            }
+
+            for (int row = strip.first_row; row < strip.first_row + strip.num_rows; row++) {
+                unsigned char *dst = filtered.data() + row * filtered_row;
+                dst[0] = filter;
+                FilterRow(filter, source_row(row), prev_row(row), channels, row_bytes, dst + 1);
+            }
+        }
+    });
+
+    // pass 2: deflate every strip, primed with the window before it
+    pool.ParallelFor(0, strips.size(), [&](int begin, int end) {
+        for (int s = begin; s < end; s++) {
+            Strip &strip = strips[s];
+            const unsigned char *in = filtered.data() + strip.first_row * filtered_row;
+            size_t dict_size = options.share_dictionary ? std::min<size_t>(deflate_window, in - filtered.data()) : 0;
+            bool last = s + 1 == static_cast<int>(strips.size());
+            strip.ok = DeflateStrip(in, strip.num_rows * filtered_row, in - dict_size, dict_size, last, options.level,
+                                    strip.compressed, strip.adler);
+        }
+    });
+
+    uLong adler = adler32(0, nullptr, 0);
+    for (const Strip &strip : strips) {
+        if (!strip.ok) {
+            LOG_ERR << "Failed to deflate PNG strip at row " << strip.first_row << std::endl;
+            return false;
+        }
+        adler = adler32_combine(adler, strip.adler, strip.num_rows * filtered_row);
+    }
+
+    if (!WriteHeader(sink, width, height, channels)) {
+        return false;
+    }
+
+    unsigned char zlib_header[2];
+    ZlibHeader(options.level, zlib_header);
+    unsigned char zlib_trailer[4];
+    PutBE32(zlib_trailer, adler);
+
+    for (size_t s = 0; s < strips.size(); s++) {
+        const Strip &strip = strips[s];
+        bool first = s == 0;
+        bool last = s + 1 == strips.size();
+        if (!WriteChunk(sink, "IDAT", zlib_header, first ? 2 : 0, strip.compressed.data(), strip.compressed.size(),
+                        zlib_trailer, last ? 4 : 0)) {
+            return false;
+        }
+    }
+
+    return WriteChunk(sink, "IEND", nullptr, 0);
+}
+
+struct PngStream::PendingStrip {
+    std::vector<unsigned char> filtered;
+    std::vector<unsigned char> compressed;
+    uLong adler = 0;
+    bool last = false;
+    bool done = false;
+    bool ok = false;
+};
+
+PngStream::PngStream(ThreadPool &pool, int width, int height, int channels, const PngOptions &options, Sink sink)
+    : pool(pool), sink(std::move(sink)), options(options), width(width), height(height), channels(channels),
+      row_bytes(static_cast<size_t>(width) * channels), prev_row(row_bytes, 0), adler(adler32(0, nullptr, 0)) {
+    if (channels != 1 && channels != 3 && channels != 4) {
+        LOG_ERR << "PNG writer does not support " << channels << " channels" << std::endl;
+        ok = false;
+    }
+    max_outstanding = pool.GetNumThreads() + 2;
+}
+
+PngStream::~PngStream() {
+    // deflate tasks still point at this stream
+    std::unique_lock<std::mutex> lock(mutex);
+    cv.wait(lock, [this]{
+        return std::all_of(strips.begin(), strips.end(), [](const std::shared_ptr<PendingStrip> &strip) { return strip->done; });
+    });
+}
+
+bool PngStream::AddRows(const unsigned char *rows, int num_rows, size_t stride) {
+    if (!ok) {
+        return false;
+    }
+    if (num_rows <= 0 || rows_added + num_rows > height) {
+        LOG_ERR << "PNG stream got " << num_rows << " rows past row " << rows_added << " of " << height << std::endl;
+        ok = false;
+        return false;
+    }
+    if (rows_added == 0 && !WriteHeader(sink, width, height, channels)) {
+        ok = false;
+        return false;
+    }
+
+    // filtering is cheap next to deflate, it runs right here and frees the caller's rows
+    const size_t filtered_row = row_bytes + 1;
+    auto strip = std::make_shared<PendingStrip>();
+    strip->filtered.resize(filtered_row * num_rows);
+    auto source_row = [&](int i) { return rows + static_cast<size_t>(i) * stride; };
+    std::vector<unsigned char> scratch(row_bytes);
+    int filter = options.filter;
+    if (filter < 0) {
+        filter = ChooseFilter(source_row, prev_row.data(), num_rows, channels, row_bytes, scratch.data());
+    }
+    for (int i = 0; i < num_rows; i++) {
+        unsigned char *dst = strip->filtered.data() + i * filtered_row;
+        dst[0] = filter;
+        FilterRow(filter, source_row(i), i == 0 ? prev_row.data() : source_row(i - 1), channels, row_bytes, dst + 1);
+    }
+    memcpy(prev_row.data(), source_row(num_rows - 1), row_bytes);
+
+    rows_added += num_rows;
+    strip->last = rows_added == height;
+    std::shared_ptr<PendingStrip> previous = options.share_dictionary ? last_strip : nullptr;
+    last_strip = strip;
+    strips.push_back(strip);
+
+    int level = options.level;
+    pool.Submit([this, strip, previous, level] {
+        const unsigned char *dict = nullptr;
+        size_t dict_size = 0;
+        if (previous) {
+            dict_size = std::min<size_t>(deflate_window, previous->filtered.size());
+            dict = previous->filtered.data() + previous->filtered.size() - dict_size;
+        }
+        bool deflated = DeflateStrip(strip->filtered.data(), strip->filtered.size(), dict, dict_size, strip->last, level,
+                                     strip->compressed, strip->adler);
+        // notify under the lock, the stream may be destroyed as soon as the last strip is seen done
+        std::unique_lock<std::mutex> lock(mutex);
+        strip->ok = deflated;
+        strip->done = true;
+        cv.notify_all();
+    });
+
+    // write whatever is finished, and hold the caller back once too many strips are in memory
+    return WriteStrips(strips.size() > max_outstanding ? 1 : 0);
+}
+
+// writes finished strips in order, waiting for the first min_strips of them
+bool PngStream::WriteStrips(size_t min_strips) {
+    unsigned char zlib_header[2];
+    ZlibHeader(options.level, zlib_header);
+
+    for (size_t written = 0; !strips.empty(); written++) {
+        std::shared_ptr<PendingStrip> strip = strips.front();
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            if (written < min_strips) {
+                cv.wait(lock, [&]{ return strip->done; });
+            }
+            else if (!strip->done) {
+                break;
+            }
+        }
+        strips.pop_front();
+
+        if (!strip->ok) {
+            LOG_ERR << "Failed to deflate PNG strip" << std::endl;
+            ok = false;
+        }
+        size_t in_size = strip->filtered.size();
+        adler = adler32_combine(adler, strip->adler, in_size);
+        unsigned char zlib_trailer[4];
+        PutBE32(zlib_trailer, adler);
+        ok = ok && WriteChunk(sink, "IDAT", zlib_header, first_idat ? 2 : 0, strip->compressed.data(), strip->compressed.size(),
+                              zlib_trailer, strip->last ? 4 : 0);
+        first_idat = false;
+        strip->compressed = std::vector<unsigned char>();
+    }
+    return ok;
+}
+
+bool PngStream::Finish() {
+    if (ok && rows_added != height) {
+        LOG_ERR << "PNG stream finished after " << rows_added << " of " << height << " rows" << std::endl;
+        ok = false;
+    }
+    // every strip has to be out of the pool before this returns, even after a failure
+    WriteStrips(strips.size());
+    return ok && WriteChunk(sink, "IEND", nullptr, 0);
+}
+
+size_t PngWriter::WriteFile(const std::string &path, const unsigned char *pixels, int width, int height, int channels,
+                            size_t stride, const PngOptions &options) {
+    FILE *file = fopen(path.c_str(), "wb");
+    if (!file) {
+        LOG_ERR << "Failed to open " << path << " for writing" << std::endl;
+        return 0;
+    }
+
+    size_t written = 0;
+    bool ok = Write(pixels, width, height, channels, stride, options, [&](const void *data, size_t size) {
+        written += size;
+        return fwrite(data, 1, size, file) == size;
+    });
+
+    if (fclose(file) != 0 || !ok) {
+        remove(path.c_str());
+        return 0;
+    }
+    return written;
+}
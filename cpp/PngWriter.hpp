@@ -0,0 +1,86 @@
+#ifndef PNGWRITER_HPP
+#define PNGWRITER_HPP
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <ThreadPool.hpp>
+
+struct PngOptions {
+    int level = 2;               // zlib level. 2 already beats stb on size at a quarter of the time
+    int strip_rows = 0;          // rows per independently deflated strip, 0 picks from the thread count
+    int filter = -1;             // PNG filter type 0-4 for every row, -1 picks one per strip
+    bool share_dictionary = true; // prime each strip with the tail of the previous one, costs nothing in parallelism
+};
+
+/* PNG encoder that filters and deflates row strips in parallel, the way pigz splits gzip streams. every strip
+   is deflated as raw blocks ending on a byte boundary (sync flush), so the compressed strips concatenate into
+   one valid zlib stream, and the per strip adler32s are combined for the trailer. each strip ends up as its
+   own IDAT chunk */
+class PngWriter {
+public:
+    // receives the encoded file in order, returns false to abort
+    using Sink = std::function<bool(const void *data, size_t size)>;
+
+private:
+    ThreadPool &pool;
+
+public:
+    explicit PngWriter(ThreadPool &pool) : pool(pool) {}
+
+    // channels 1, 3 or 4 (grey, RGB, RGBA), stride in bytes between rows
+    bool Write(const unsigned char *pixels, int width, int height, int channels, size_t stride,
+               const PngOptions &options, const Sink &sink);
+
+    // returns the file size, 0 on failure
+    size_t WriteFile(const std::string &path, const unsigned char *pixels, int width, int height, int channels,
+                     size_t stride, const PngOptions &options = PngOptions());
+};
+
+/* the same encoding for images that arrive in row strips from the top, e.g. straight out of a readback. each
+   strip is filtered on the calling thread and deflated on the pool while the next ones arrive, finished strips
+   go to the sink in order. only a few strips are in memory at any time: AddRows waits for the oldest one once
+   more than the pool can work on are outstanding */
+class PngStream {
+public:
+    using Sink = PngWriter::Sink;
+
+private:
+    struct PendingStrip;
+
+    ThreadPool &pool;
+    Sink sink;
+    PngOptions options;
+    int width;
+    int height;
+    int channels;
+    size_t row_bytes;
+    int rows_added = 0;
+    std::vector<unsigned char> prev_row;          // last row of the previous strip, for the Up/Avg/Paeth filters
+    std::shared_ptr<PendingStrip> last_strip;     // dictionary for the next strip
+    std::deque<std::shared_ptr<PendingStrip>> strips; // not written yet
+    size_t max_outstanding;
+    unsigned long adler;
+    bool first_idat = true;
+    bool ok = true;
+    std::mutex mutex;
+    std::condition_variable cv;
+
+    bool WriteStrips(size_t min_strips);
+
+public:
+    PngStream(ThreadPool &pool, int width, int height, int channels, const PngOptions &options, Sink sink);
+    ~PngStream();
+
+    // rows are only read during the call
+    bool AddRows(const unsigned char *rows, int num_rows, size_t stride);
+    // waits for the last strips and ends the file, false if anything failed on the way
+    bool Finish();
+};
+
+#endif // PNGWRITER_HPP
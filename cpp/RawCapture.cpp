@@ -0,0 +1,93 @@
+#include <RawCapture.hpp>
+#include <cstdio>
+#include <cstring>
+#include <log.hpp>
+
+namespace {
+
+const char raw_magic[8] = {'C', 'O', 'D', 'A', 'C', 'R', 'A', 'W'};
+const uint32_t raw_version = 1;
+
+// native byte order, the files never leave the device undeveloped
+struct RawHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t width;
+    uint32_t height;
+    uint32_t stride;
+    uint32_t format;
+    uint64_t lut_hash;
+    int64_t timestamp;
+    uint64_t frame_size;
+    char lut_name[64];
+    uint8_t reserved[8];
+};
+static_assert(sizeof(RawHeader) == 128, "raw capture header layout changed");
+
+// a YUV420 frame with the given stride has to fit in frame_size
+bool ValidFrameSize(const RawHeader &header) {
+    uint64_t luma = static_cast<uint64_t>(header.stride) * header.height;
+    return header.width > 0 && header.height > 0 && header.stride >= header.width && header.frame_size >= luma + luma / 2;
+}
+
+} // namespace
+
+bool WriteRawCapture(const RawCaptureInfo &info, const std::vector<unsigned char> &frame,
+                     const std::function<bool(const void *data, size_t size)> &sink) {
+    RawHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, raw_magic, sizeof(raw_magic));
+    header.version = raw_version;
+    header.header_size = sizeof(RawHeader);
+    header.width = info.Width;
+    header.height = info.Height;
+    header.stride = info.Stride;
+    header.format = info.Format;
+    header.lut_hash = info.LutHash;
+    header.timestamp = info.Timestamp;
+    header.frame_size = frame.size();
+    strncpy(header.lut_name, info.LutName.c_str(), sizeof(header.lut_name) - 1);
+
+    if (!ValidFrameSize(header)) {
+        LOG_ERR << "Raw capture frame does not match " << info.Width << "x" << info.Height << " stride " << info.Stride << std::endl;
+        return false;
+    }
+    return sink(&header, sizeof(header)) && sink(frame.data(), frame.size());
+}
+
+size_t GetRawCaptureSize(const std::vector<unsigned char> &frame) {
+    return sizeof(RawHeader) + frame.size();
+}
+
+bool ReadRawCapture(const std::string &path, RawCaptureInfo &info, std::vector<unsigned char> &frame) {
+    FILE *file = fopen(path.c_str(), "rb");
+    if (!file) {
+        LOG_ERR << "Failed to open " << path << std::endl;
+        return false;
+    }
+
+    RawHeader header;
+    bool ok = fread(&header, sizeof(header), 1, file) == 1 && memcmp(header.magic, raw_magic, sizeof(raw_magic)) == 0 &&
+              header.version == raw_version && header.header_size == sizeof(RawHeader) && ValidFrameSize(header);
+    if (ok) {
+        frame.resize(header.frame_size);
+        ok = fread(frame.data(), 1, frame.size(), file) == frame.size();
+    }
+    fclose(file);
+
+    if (!ok) {
+        LOG_ERR << path << " is not a raw capture or is truncated" << std::endl;
+        return false;
+    }
+
+    header.lut_name[sizeof(header.lut_name) - 1] = '\0';
+    info.Width = header.width;
+    info.Height = header.height;
+    info.Stride = header.stride;
+    info.Format = header.format;
+    info.LutHash = header.lut_hash;
+    info.LutName = header.lut_name;
+    info.Timestamp = header.timestamp;
+    return true;
+}
@@ -0,0 +1,30 @@
+#ifndef RAWCAPTURE_HPP
+#define RAWCAPTURE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+// everything needed to develop a stored camera frame later, the way the GPU would have at the shutter press
+struct RawCaptureInfo {
+    int Width = 0;
+    int Height = 0;
+    int Stride = 0;         // luma row stride of the camera frame, chroma rows are Stride / 2
+    int Format = 0;         // CaptureFormat the capture gets developed to
+    uint64_t LutHash = 0;   // LUT selected at the shutter press
+    std::string LutName;    // fallback when no loaded LUT matches the hash any more
+    int64_t Timestamp = 0;  // unix seconds of the shutter press
+};
+
+/* undeveloped captures: a fixed 128 byte header followed by the YUV420 camera frame exactly as it came off the
+   sensor, planes and stride included */
+
+// hands the header and then the frame to sink, which returns false to abort
+bool WriteRawCapture(const RawCaptureInfo &info, const std::vector<unsigned char> &frame,
+                     const std::function<bool(const void *data, size_t size)> &sink);
+size_t GetRawCaptureSize(const std::vector<unsigned char> &frame);
+bool ReadRawCapture(const std::string &path, RawCaptureInfo &info, std::vector<unsigned char> &frame);
+
+#endif // RAWCAPTURE_HPP
@@ -0,0 +1,215 @@
+#include <RenderTimer.hpp>
+#include <EGL/egl.h>
+#include <cstdio>
+#include <cstring>
+#include <log.hpp>
+#include <Trace.hpp>
+
+const char *GetRenderPathName(RenderPath path) {
+    switch (path) {
+    case RenderPath::VIEWFINDER: return "viewfinder";
+    case RenderPath::STILL: return "still";
+    }
+    return "unknown";
+}
+
+const char *GetRenderStageName(RenderStage stage) {
+    switch (stage) {
+    case RenderStage::PLANE_UPLOAD: return "plane upload";
+    case RenderStage::LUT_DRAW: return "LUT draw";
+    case RenderStage::TEXT_OVERLAY: return "text overlay";
+    case RenderStage::READ_PIXELS: return "glReadPixels";
+    case RenderStage::MAP_UNMAP: return "map/unmap";
+    }
+    return "unknown";
+}
+
+std::string RenderTimings::Summary() {
+    std::string summary;
+    char line[160];
+    for (int p = 0; p < num_render_paths; p++) {
+        for (int s = 0; s < num_render_stages; s++) {
+            RenderPath path = static_cast<RenderPath>(p);
+            RenderStage stage = static_cast<RenderStage>(s);
+            LatencyHistogram &cpu_histogram = GetCpu(path, stage);
+            LatencyHistogram &gpu_histogram = GetGpu(path, stage);
+            if (cpu_histogram.GetCount() == 0) {
+                continue;
+            }
+            int length = snprintf(line, sizeof(line), "%-10s %-12s %6llu frames, CPU p50/p95/p99 %llu/%llu/%llu us",
+                                  GetRenderPathName(path), GetRenderStageName(stage),
+                                  static_cast<unsigned long long>(cpu_histogram.GetCount()),
+                                  static_cast<unsigned long long>(cpu_histogram.GetPercentile(0.50)),
+                                  static_cast<unsigned long long>(cpu_histogram.GetPercentile(0.95)),
+                                  static_cast<unsigned long long>(cpu_histogram.GetPercentile(0.99)));
+            if (gpu_histogram.GetCount() > 0 && length > 0 && length < static_cast<int>(sizeof(line))) {
+                snprintf(line + length, sizeof(line) - length, ", GPU %llu/%llu/%llu us",
+                         static_cast<unsigned long long>(gpu_histogram.GetPercentile(0.50)),
+                         static_cast<unsigned long long>(gpu_histogram.GetPercentile(0.95)),
+                         static_cast<unsigned long long>(gpu_histogram.GetPercentile(0.99)));
+            }
+            summary += line;
+            summary += "\n";
+        }
+    }
+    return summary;
+}
+
+void RenderTimer::Initialize() {
+    const char *version = reinterpret_cast<const char*>(glGetString(GL_VERSION));
+    const char *extensions = reinterpret_cast<const char*>(glGetString(GL_EXTENSIONS));
+    bool es = version && strstr(version, "OpenGL ES");
+    if (es && extensions && strstr(extensions, "GL_EXT_disjoint_timer_query")) {
+        query_counter = reinterpret_cast<PFNGLQUERYCOUNTEREXTPROC>(eglGetProcAddress("glQueryCounterEXT"));
+        get_query_result = reinterpret_cast<PFNGLGETQUERYOBJECTUI64VEXTPROC>(eglGetProcAddress("glGetQueryObjectui64vEXT"));
+        disjoint_queries = true;
+    }
+    else if (!es && extensions && strstr(extensions, "GL_ARB_timer_query")) {
+        query_counter = reinterpret_cast<PFNGLQUERYCOUNTEREXTPROC>(eglGetProcAddress("glQueryCounter"));
+        get_query_result = reinterpret_cast<PFNGLGETQUERYOBJECTUI64VEXTPROC>(eglGetProcAddress("glGetQueryObjectui64v"));
+    }
+    gpu_queries = query_counter && get_query_result;
+    if (disjoint_queries) {
+        // reading the flag clears it, start from a clean slate
+        GLint disjoint;
+        glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+    }
+    LOG << "Render stage timing: " << (gpu_queries ? "GPU timer queries" : "CPU only") << std::endl;
+}
+
+// one timestamp, stage is what it ends or -1
+void RenderTimer::Point(int stage) {
+    if (!frame) {
+        return;
+    }
+    if (frame->used == static_cast<int>(frame->queries.size())) {
+        GLuint query;
+        glGenQueries(1, &query);
+        frame->queries.push_back(query);
+        frame->stages.push_back(-1);
+    }
+    frame->stages[frame->used] = stage;
+    query_counter(frame->queries[frame->used], GL_TIMESTAMP_EXT);
+    frame->used++;
+}
+
+// records every frame whose timestamps are in, oldest first, and stops at the first that is not
+void RenderTimer::Collect() {
+    if (!gpu_queries) {
+        return;
+    }
+    for (int i = 0; i < max_frames_in_flight; i++) {
+        Frame &oldest = frames[(next_frame + i) % max_frames_in_flight];
+        if (!oldest.pending) {
+            continue;
+        }
+        GLuint available = 0;
+        glGetQueryObjectuiv(oldest.queries[oldest.used - 1], GL_QUERY_RESULT_AVAILABLE_EXT, &available);
+        if (!available) {
+            return;
+        }
+
+        GLint disjoint = 0;
+        if (disjoint_queries) {
+            glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+        }
+        if (disjoint) {
+            // the clock jumped somewhere in the frames still out, none of them can be trusted
+            for (Frame &out : frames) {
+                if (out.pending) {
+                    out.pending = false;
+                    dropped++;
+                }
+            }
+            return;
+        }
+
+        uint64_t stage_ns[num_render_stages] = {};
+        bool marked[num_render_stages] = {};
+        GLuint64 previous = 0;
+        for (int point = 0; point < oldest.used; point++) {
+            GLuint64 timestamp;
+            get_query_result(oldest.queries[point], GL_QUERY_RESULT_EXT, &timestamp);
+            int stage = oldest.stages[point];
+            if (point > 0 && stage >= 0 && timestamp >= previous) {
+                stage_ns[stage] += timestamp - previous;
+                marked[stage] = true;
+            }
+            previous = timestamp;
+        }
+        for (int stage = 0; stage < num_render_stages; stage++) {
+            if (marked[stage] && stage != static_cast<int>(RenderStage::MAP_UNMAP)) {
+                timings.GetGpu(oldest.path, static_cast<RenderStage>(stage)).Record(stage_ns[stage] / 1000);
+            }
+        }
+        oldest.pending = false;
+    }
+}
+
+void RenderTimer::Begin(RenderPath path) {
+    Collect();
+    in_frame = true;
+    current_path = path;
+    frame = nullptr;
+    if (gpu_queries) {
+        Frame &slot = frames[next_frame];
+        if (slot.pending) {
+            // the GPU is more than max_frames_in_flight behind, keep this frame's CPU times only
+            dropped++;
+        }
+        else {
+            frame = &slot;
+            frame->path = path;
+            frame->used = 0;
+            frame->pending = true;
+            next_frame = (next_frame + 1) % max_frames_in_flight;
+        }
+    }
+    for (int stage = 0; stage < num_render_stages; stage++) {
+        cpu_ns[stage] = 0;
+        cpu_marked[stage] = false;
+    }
+    Point(-1);
+    last_point = Clock::now();
+}
+
+void RenderTimer::Mark(RenderStage stage) {
+    if (!in_frame) {
+        return;
+    }
+    Clock::time_point now = Clock::now();
+    int index = static_cast<int>(stage);
+    cpu_ns[index] += std::chrono::duration_cast<std::chrono::nanoseconds>(now - last_point).count();
+    cpu_marked[index] = true;
+    Tracer::Complete(GetRenderStageName(stage), last_point, now);
+    Point(index);
+    last_point = Clock::now();
+}
+
+void RenderTimer::Resume() {
+    if (!in_frame) {
+        return;
+    }
+    Point(-1);
+    last_point = Clock::now();
+}
+
+void RenderTimer::End() {
+    if (!in_frame) {
+        return;
+    }
+    for (int stage = 0; stage < num_render_stages; stage++) {
+        if (cpu_marked[stage]) {
+            timings.GetCpu(current_path, static_cast<RenderStage>(stage)).Record(cpu_ns[stage] / 1000);
+        }
+    }
+    if (frame && frame->used < 2) {
+        frame->pending = false;
+    }
+    else if (frame) {
+        // the last timestamp would otherwise sit in the command stream until the next frame's readback
+        glFlush();
+    }
+    frame = nullptr;
+    in_frame = false;
+}
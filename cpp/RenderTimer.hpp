@@ -0,0 +1,99 @@
+#ifndef RENDERTIMER_HPP
+#define RENDERTIMER_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <GLES3/gl3.h>
+#include <GLES2/gl2ext.h>
+#include <LatencyHistogram.hpp>
+
+enum class RenderPath {
+    VIEWFINDER,
+    STILL
+};
+
+enum class RenderStage {
+    PLANE_UPLOAD, // camera planes into their textures
+    LUT_DRAW,     // the LUT pass, packing passes included
+    TEXT_OVERLAY,
+    READ_PIXELS,  // glReadPixels into pack buffers
+    MAP_UNMAP     // mapping the pack buffers, waiting for the readback. CPU time only
+};
+
+static const int num_render_paths = 2;
+static const int num_render_stages = 5;
+
+const char *GetRenderPathName(RenderPath);
+const char *GetRenderStageName(RenderStage);
+
+/* time per frame spent in each stage of each render path, in microseconds. the CPU histograms hold what the render
+   thread spent issuing a stage, the GPU ones what the GPU spent between its start and end, when timer queries are
+   there. every RenderTimer of a renderer records into the same RenderTimings */
+class RenderTimings {
+private:
+    LatencyHistogram cpu[num_render_paths][num_render_stages];
+    LatencyHistogram gpu[num_render_paths][num_render_stages];
+
+public:
+    LatencyHistogram &GetCpu(RenderPath path, RenderStage stage) { return cpu[static_cast<int>(path)][static_cast<int>(stage)]; }
+    LatencyHistogram &GetGpu(RenderPath path, RenderStage stage) { return gpu[static_cast<int>(path)][static_cast<int>(stage)]; }
+    // p50/p95/p99 of every stage that was timed, one line each
+    std::string Summary();
+};
+
+/* brackets the stages of a frame with GPU timestamps from EXT_disjoint_timer_query, or ARB_timer_query on desktop
+   GL, and CPU timestamps always. a frame is Begin, a Mark at the end of every stage and End. Mark measures from
+   the previous Mark, Resume moves that start without recording, for callbacks in the middle of a stage. a stage
+   marked several times in a frame, like the reads of a strip readback, is recorded once with the sum. GPU results
+   are picked up a few frames later in Begin, never waited for, and frames that overlap a disjoint event are
+   dropped. one per context, on the thread that context is current on */
+class RenderTimer {
+private:
+    using Clock = std::chrono::steady_clock;
+    static const int max_frames_in_flight = 4;
+
+    struct Frame {
+        RenderPath path;
+        bool pending = false;
+        int used = 0;               // queries used this frame, one per point
+        std::vector<GLuint> queries;
+        std::vector<int> stages;    // stage a point ends, -1 for Begin and Resume
+    };
+
+    RenderTimings &timings;
+    bool gpu_queries = false;
+    bool disjoint_queries = false; // only the EXT can report disjoint events
+    PFNGLQUERYCOUNTEREXTPROC query_counter = nullptr;
+    PFNGLGETQUERYOBJECTUI64VEXTPROC get_query_result = nullptr;
+
+    Frame frames[max_frames_in_flight];
+    int next_frame = 0;
+    bool in_frame = false;          // between Begin and End
+    RenderPath current_path;
+    Frame *frame = nullptr;         // gets the current frame's timestamps, nullptr when it only gets CPU times
+    Clock::time_point last_point;
+    uint64_t cpu_ns[num_render_stages];
+    bool cpu_marked[num_render_stages];
+    uint64_t dropped = 0;
+
+    void Point(int);
+    void Collect();
+
+public:
+    explicit RenderTimer(RenderTimings &timings) : timings(timings) {}
+
+    // with the context current, picks GPU timestamps when the context has them
+    void Initialize();
+    bool HasGpuQueries() const { return gpu_queries; }
+    // frames whose GPU times were lost to a full ring or a disjoint event
+    uint64_t GetDropped() const { return dropped; }
+
+    void Begin(RenderPath);
+    void Mark(RenderStage);
+    void Resume();
+    void End();
+};
+
+#endif // RENDERTIMER_HPP
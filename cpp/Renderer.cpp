@@ -0,0 +1,39 @@
+#include <Renderer.hpp>
+
+int Renderer::GetStillCaptureHeight() {
+    return test_height;
+}
+
+int Renderer::GetStillCaptureWidth() {
+    return test_width;
+}
+
+int Renderer::GetViewfinderHeight() {
+    return viewfinder_height;
+}
+
+int Renderer::GetViewfinderWidth() {
+    return viewfinder_width;
+}
+
+bool Renderer::LoadLutLibrary() {
+    bool loaded = lut_library.Load(worker_pool, lut_cache);
+    lut_side = lut_library.GetSide();
+    return loaded;
+}
+
+int Renderer::GetNumLuts() {
+    return lut_library.GetNumLuts();
+}
+
+std::string Renderer::GetLutName(int index) {
+    return lut_library.GetLutName(index);
+}
+
+const LUT &Renderer::GetLut(int index) {
+    return lut_library.GetLut(index);
+}
+
+int Renderer::FindLut(uint64_t hash, const std::string &name) {
+    return lut_library.FindLut(hash, name);
+}
@@ -0,0 +1,67 @@
+#ifndef RENDERER_HPP
+#define RENDERER_HPP
+
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <string>
+#include <vector>
+#include <LutCache.hpp>
+#include <LutLibrary.hpp>
+#include <ThreadPool.hpp>
+#include <glm/glm.hpp>
+
+/* what the main loop renders through: the viewfinder, stills and the LUT they are developed with. ShaderManager
+   does it with EGL and GLES on the GPU, CpuRenderer on the CPU for boards without a usable GPU and headless
+   machines. both load the LutLibrary at Initialize */
+class Renderer {
+protected:
+    std::string cache_dir = std::string(std::getenv("HOME")) + "/codac/cache/";
+    std::string font_path = "/home/andrew/codac/font/LibertinusSerifDisplay-Regular.ttf";
+    LutLibrary lut_library;
+    ThreadPool worker_pool;
+    LutCache lut_cache{cache_dir};
+    int lut_idx = 0;
+    int lut_side = 0;
+
+    int test_width = 2592;
+    int test_height = 1944;
+    int viewfinder_width = 800;
+    int viewfinder_height = 600;
+    const int screen_width = 640;
+    const int screen_height = 480;
+
+    // false when a LUT image fails to load
+    bool LoadLutLibrary();
+
+public:
+    virtual ~Renderer() = default;
+
+    // false when this backend can not run here, nothing else may be called then
+    virtual bool Initialize() = 0;
+
+    virtual void SwitchLUT(int) = 0;
+    virtual void SetContactSheet(bool) = 0;
+    virtual bool IsContactSheet() = 0;
+
+    // callback gets screen_width*screen_height RGBA pixels laid out for the dumb buffer, 480 wide and 640 high
+    virtual void ViewfinderRender(std::vector<uint8_t> &, int, std::function<void(void*, size_t)>) = 0;
+    // callback gets test_width*test_height tightly packed RGB888 pixels
+    virtual void StillCaptureRender(std::vector<uint8_t> &, int, std::function<void(void*, size_t)>) = 0;
+    // the same once per LUT in looks, callback gets the position in looks with each
+    virtual void StillCaptureRenderMulti(std::vector<uint8_t> &, int, const std::vector<int> &, std::function<void(int, void*, size_t)>) = 0;
+
+    // text on the viewfinder frame being rendered, in the screen's landscape coordinates
+    virtual void RenderText(std::string, float, float, float, glm::vec3) = 0;
+
+    int GetStillCaptureHeight();
+    int GetStillCaptureWidth();
+    int GetViewfinderHeight();
+    int GetViewfinderWidth();
+    int GetNumLuts();
+    std::string GetLutName(int);
+    const LUT &GetLut(int);
+    int FindLut(uint64_t, const std::string &);
+}; // Renderer
+
+#endif // RENDERER_HPP
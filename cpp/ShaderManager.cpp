@@ -1,25 +1,12 @@
 #include <ShaderManager.hpp>
-#include "stb_image.h"
 #include <gbm.h>
 #include <fcntl.h>
+#include <EGL/eglext.h>
 #include <Drm.hpp>
 #include <cmath>
-
-int ShaderManager::GetStillCaptureHeight() {
-    return test_height;
-}
-
-int ShaderManager::GetStillCaptureWidth() {
-    return test_width;
-}
-
-int ShaderManager::GetViewfinderHeight() {
-    return viewfinder_height;
-}
-
-int ShaderManager::GetViewfinderWidth() {
-    return viewfinder_width;
-}
+#include <algorithm>
+#include <LutCube.hpp>
+#include <Trace.hpp>
 
 void ShaderManager::CheckGlCompileErrors(GLuint shader)
 {
@@ -33,14 +20,29 @@ void ShaderManager::CheckGlCompileErrors(GLuint shader)
     }
 }
 
-void ShaderManager::Initialize() {
-    InitOpenGL();
+// false when there is no display or EGL context to render with, the GL objects are left alone then
+bool ShaderManager::Initialize() {
+    if (!InitOpenGL()) {
+        return false;
+    }
+    pack_rgb = test_width % 4 == 0;
+    if (!pack_rgb) {
+        LOG << "Capture width " << test_width << " is not a multiple of 4, RGB captures are read back as RGBA\n";
+    }
+    main_targets.timer.reset(new RenderTimer(render_timings));
+    main_targets.timer->Initialize();
     InitTransformationMatrix();
     InitCaptureProgram();
     InitViewfinderProgram();
     TestProgram();
+    InitMonochromePrograms();
+    InitContactSheetProgram();
+    InitMultiLookProgram();
+    InitPackPrograms();
     BindTextures();
     InitFreetype();
+    InitCaptureThread();
+    return true;
 }
 
 void ShaderManager::ValidateProgram(GLuint program) {
@@ -64,26 +66,14 @@ void ShaderManager::ValidateProgram(GLuint program) {
 }
 
 void ShaderManager::LoadLUTs() {
-    // load lut image 
-    std::vector<std::filesystem::path> lut_files;
-    for (const auto & entry : std::filesystem::directory_iterator(lut_dir)) {
-        LUT new_lut;
-        new_lut.Name = entry.path().stem();
-        new_lut.Data = stbi_load(entry.path().c_str(), &lut_width, &lut_height, &lut_nrChannels, 0); 
-
-        lut_data.push_back(new_lut);
-
-        LOG << "Loading texture: " << new_lut.Name << "\n";
-        if (!new_lut.Data)
-        {
-            LOG << "Failed to load texture" << std::endl;
-            return;
-        }
+    if (!LoadLutLibrary()) {
+        return;
     }
+    size_t lut_size = static_cast<size_t>(lut_side) * lut_side * lut_side * 3; // 3D RGB
 
-    size_t lut_size = lut_width * lut_height * 3; // 3D RGBA
-    // TODO: This assumes that the LUT size is the same every time. confirm if this is true
-    int lut_side = static_cast<int>(std::cbrt(lut_width * lut_height));
+    for (const LUT &lut : lut_library.GetLuts()) {
+        lut_thumbnails.push_back(ResampleLUT(lut, thumb_size));
+    }
 
     // if first time, setup lut texture
     if (!glIsTexture(lut_texture)) {
@@ -98,6 +88,18 @@ void ShaderManager::LoadLUTs() {
         glBindTexture(GL_TEXTURE_3D, 0);
     }
 
+    // if first time, setup 256x1 tone curve texture for monochrome LUTs (GLES has no 1D textures)
+    if (!glIsTexture(tone_curve_texture)) {
+        glGenTextures(1, &tone_curve_texture);
+        glActiveTexture(GL_TEXTURE9);
+        glBindTexture(GL_TEXTURE_2D, tone_curve_texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, 256, 1, 0, GL_RED, GL_UNSIGNED_BYTE, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    }
+
     // if first time, setup pbo for lut 
     if (!glIsBuffer(lut_pbo)) { 
         glGenBuffers(1, &lut_pbo);
@@ -108,21 +110,74 @@ void ShaderManager::LoadLUTs() {
 }
 
 void ShaderManager::SwitchLUT(int index) {
+    TRACE_SCOPE("switch LUT");
+    std::unique_lock<std::mutex> lock(lut_mutex);
+    // captures keep the LUT they started with, the switch happens once they are done
+    if (lut_in_use > 0 || tiled.active) {
+        pending_lut = index;
+        return;
+    }
+    pending_lut = -1;
+
+    // the capture context may still be sampling the textures about to change
+    if (capture_fence) {
+        glWaitSync(capture_fence, 0, GL_TIMEOUT_IGNORED);
+        glDeleteSync(capture_fence);
+        capture_fence = nullptr;
+    }
 
     lut_idx = index;
-    size_t lut_size = lut_width * lut_height * 3; // 3D RGBA
-    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, lut_pbo);
-    void* ptr = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, lut_size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
-    if (ptr) {
-        memcpy(ptr, lut_data[index].Data, lut_size);
-        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
 
-        glBindTexture(GL_TEXTURE_3D, lut_texture);
-        glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, 144, 144, 144, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
-        glBindTexture(GL_TEXTURE_3D, 0);
-        //stbi_image_free(lut_data);
+    if (contact_sheet) {
+        UpdateContactSheetAtlas();
     }
-    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    // monochrome stocks only need their tone curve, the 3D texture is left untouched
+    if (lut_library.GetLut(index).Monochrome) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glActiveTexture(GL_TEXTURE9);
+        glBindTexture(GL_TEXTURE_2D, tone_curve_texture);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 256, 1, GL_RED, GL_UNSIGNED_BYTE, lut_library.GetLut(index).ToneCurve.data());
+    }
+    else {
+        size_t lut_size = static_cast<size_t>(lut_side) * lut_side * lut_side * 3; // 3D RGB
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, lut_pbo);
+        void* ptr = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, lut_size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        if (ptr) {
+            memcpy(ptr, lut_library.GetLut(index).Data, lut_size);
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+            glBindTexture(GL_TEXTURE_3D, lut_texture);
+            glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, lut_side, lut_side, lut_side, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+            glBindTexture(GL_TEXTURE_3D, 0);
+            //stbi_image_free(lut_data);
+        }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+
+    // the next capture waits for this upload on the GPU
+    if (capture_context != EGL_NO_CONTEXT) {
+        if (lut_fence) {
+            glDeleteSync(lut_fence);
+        }
+        lut_fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        glFlush();
+    }
+}
+
+// Runs a LUT switch that had to wait for captures, once none needs the current LUT any more
+void ShaderManager::ApplyPendingLut() {
+    int index;
+    {
+        std::unique_lock<std::mutex> lock(lut_mutex);
+        if (pending_lut < 0 || lut_in_use > 0 || tiled.active) {
+            return;
+        }
+        index = pending_lut;
+    }
+    SwitchLUT(index);
 }
 
 GLuint ShaderManager::LoadShader(GLenum shader_type, const std::string &filename) {
@@ -152,7 +207,36 @@ GLuint ShaderManager::LoadShader(GLenum shader_type, const std::string &filename
     return shader;
 }
 
-int ShaderManager::InitOpenGL() {
+// Shares the quad VAO, so aPos/aTexCoord are bound to the locations TestProgram set it up with
+GLuint ShaderManager::CreateProgram(const std::string &vs_path, const std::string &fs_path) {
+    GLuint new_program = glCreateProgram();
+    GLuint new_vert = LoadShader(GL_VERTEX_SHADER, vs_path);
+    GLuint new_frag = LoadShader(GL_FRAGMENT_SHADER, fs_path);
+
+    glAttachShader(new_program, new_frag);
+    glAttachShader(new_program, new_vert);
+    glBindAttribLocation(new_program, quad_pos_loc, "aPos");
+    glBindAttribLocation(new_program, quad_uv_loc, "aTexCoord");
+    glLinkProgram(new_program);
+
+    GLint linked = GL_FALSE;
+    glGetProgramiv(new_program, GL_LINK_STATUS, &linked);
+    if (linked == GL_FALSE) {
+        GLchar infoLog[512];
+        glGetProgramInfoLog(new_program, 512, NULL, infoLog);
+        LOG_ERR << "ERROR: Program link failed for " << fs_path << ": " << infoLog << std::endl;
+    }
+
+    glDeleteShader(new_frag);
+    glDeleteShader(new_vert);
+    return new_program;
+}
+
+bool ShaderManager::InitOpenGL() {
+    if (headless) {
+        return InitHeadlessOpenGL();
+    }
+
     /* OpenGL stuff */
     int major, minor;
     //GLuint program, vert, frag;
@@ -163,7 +247,7 @@ int ShaderManager::InitOpenGL() {
     {
         fprintf(stderr, "Unable to get EGL display\n");
         close(device);
-        return -1;
+        return false;
     }
     if (eglInitialize(display, &major, &minor) == EGL_FALSE)
     {
@@ -171,7 +255,7 @@ int ShaderManager::InitOpenGL() {
                 eglGetErrorStr());
         eglTerminate(display);
         gbmClean();
-        return EXIT_FAILURE;
+        return false;
     }
 
     // Make sure that we can use OpenGL in this EGL app.
@@ -189,7 +273,7 @@ int ShaderManager::InitOpenGL() {
         fprintf(stderr, "Failed to get EGL configs! Error: %s\n", eglGetErrorStr());
         eglTerminate(display);
         gbmClean();
-        return EXIT_FAILURE;
+        return false;
     }
 
     // I am not exactly sure why the EGL config must match the GBM format.
@@ -201,7 +285,7 @@ int ShaderManager::InitOpenGL() {
         eglTerminate(display);
         gbm_surface_destroy(gbmSurface);
         gbm_device_destroy(gbmDevice);
-        return EXIT_FAILURE;
+        return false;
     }
 
     context = eglCreateContext(display, configs[configIndex], EGL_NO_CONTEXT, contextAttribs);
@@ -210,7 +294,7 @@ int ShaderManager::InitOpenGL() {
         fprintf(stderr, "Failed to create EGL context! Error: %s\n", eglGetErrorStr());
         eglTerminate(display);
         gbmClean();
-        return EXIT_FAILURE;
+        return false;
     }
 
     surface = eglCreateWindowSurface(display, configs[configIndex], (EGLNativeWindowType) gbmSurface, NULL);
@@ -220,9 +304,10 @@ int ShaderManager::InitOpenGL() {
         eglDestroyContext(display, context);
         eglTerminate(display);
         gbmClean();
-        return EXIT_FAILURE;
+        return false;
     }
 
+    egl_config = configs[configIndex];
     free(configs);
     eglMakeCurrent(display, surface, surface, context);
     // Set GL Viewport size, always needed!
@@ -242,10 +327,110 @@ int ShaderManager::InitOpenGL() {
         eglDestroySurface(display, surface);
         eglTerminate(display);
         gbmClean();
-        return EXIT_FAILURE;
+        return false;
+    }
+
+    return true;
+}
+
+/* Headless: no DRM master, connector or GBM surface, the viewfinder and captures render into framebuffer objects
+   anyway. The display comes from Mesa's surfaceless platform, which even llvmpipe offers, or else from GBM on a
+   render node, which needs no display either. The context is made current without a surface where
+   EGL_KHR_surfaceless_context allows, on a small pbuffer otherwise */
+bool ShaderManager::InitHeadlessOpenGL() {
+    int major, minor;
+    const char *client_extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+    auto get_platform_display = reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(eglGetProcAddress("eglGetPlatformDisplayEXT"));
+
+    display = EGL_NO_DISPLAY;
+    surface = EGL_NO_SURFACE;
+    context = EGL_NO_CONTEXT;
+    if (get_platform_display && client_extensions && strstr(client_extensions, "EGL_MESA_platform_surfaceless")) {
+        display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+    }
+    if (display == EGL_NO_DISPLAY) {
+        render_node = open(render_node_path.c_str(), O_RDWR | O_CLOEXEC);
+        if (render_node < 0) {
+            LOG_ERR << "No surfaceless EGL platform and no render node at " << render_node_path << "\n";
+            return false;
+        }
+        render_gbm = gbm_create_device(render_node);
+        if (render_gbm) {
+            display = eglGetDisplay(reinterpret_cast<EGLNativeDisplayType>(render_gbm));
+        }
+    }
+    if (display == EGL_NO_DISPLAY) {
+        LOG_ERR << "Unable to get a headless EGL display\n";
+        ReleaseHeadlessDisplay();
+        return false;
+    }
+    if (eglInitialize(display, &major, &minor) == EGL_FALSE) {
+        LOG_ERR << "Failed to initialize headless EGL! Error: " << eglGetErrorStr() << "\n";
+        ReleaseHeadlessDisplay();
+        return false;
+    }
+
+    // same API and context as on the display, so the pipeline under test is the one the camera runs
+    eglBindAPI(EGL_OPENGL_API);
+    printf("Initialized headless EGL version: %d.%d (%s)\n", major, minor, render_gbm ? render_node_path.c_str() : "surfaceless");
+
+    EGLint num_configs;
+    if (!eglChooseConfig(display, headlessConfigAttribs, &egl_config, 1, &num_configs) || num_configs < 1) {
+        LOG_ERR << "No headless EGL config! Error: " << eglGetErrorStr() << "\n";
+        ReleaseHeadlessDisplay();
+        return false;
+    }
+
+    context = eglCreateContext(display, egl_config, EGL_NO_CONTEXT, contextAttribs);
+    if (context == EGL_NO_CONTEXT) {
+        LOG_ERR << "Failed to create headless EGL context! Error: " << eglGetErrorStr() << "\n";
+        ReleaseHeadlessDisplay();
+        return false;
+    }
+
+    const char *extensions = eglQueryString(display, EGL_EXTENSIONS);
+    if (!extensions || !strstr(extensions, "EGL_KHR_surfaceless_context")) {
+        static const EGLint pbuffer_attribs[] = {EGL_WIDTH, 16, EGL_HEIGHT, 16, EGL_NONE};
+        surface = eglCreatePbufferSurface(display, egl_config, pbuffer_attribs);
+        if (surface == EGL_NO_SURFACE) {
+            LOG_ERR << "Failed to create headless pbuffer! Error: " << eglGetErrorStr() << "\n";
+            ReleaseHeadlessDisplay();
+            return false;
+        }
+    }
+    if (eglMakeCurrent(display, surface, surface, context) == EGL_FALSE) {
+        LOG_ERR << "Failed to make the headless context current! Error: " << eglGetErrorStr() << "\n";
+        ReleaseHeadlessDisplay();
+        return false;
     }
+    printf("GL renderer: %s\n", reinterpret_cast<const char*>(glGetString(GL_RENDERER)));
+    return true;
+}
 
-    return 1;
+// Undoes InitHeadlessOpenGL, from wherever it got to
+void ShaderManager::ReleaseHeadlessDisplay() {
+    if (display != EGL_NO_DISPLAY) {
+        // the capture thread destroys its own context on the way out
+        eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        if (context != EGL_NO_CONTEXT) {
+            eglDestroyContext(display, context);
+            context = EGL_NO_CONTEXT;
+        }
+        if (surface != EGL_NO_SURFACE) {
+            eglDestroySurface(display, surface);
+            surface = EGL_NO_SURFACE;
+        }
+        eglTerminate(display);
+        display = EGL_NO_DISPLAY;
+    }
+    if (render_gbm) {
+        gbm_device_destroy(render_gbm);
+        render_gbm = nullptr;
+    }
+    if (render_node >= 0) {
+        close(render_node);
+        render_node = -1;
+    }
 }
 
 void ShaderManager::InitTransformationMatrix() {
@@ -330,6 +515,12 @@ void ShaderManager::BindTextures() {
     glBindTexture(GL_TEXTURE_2D, vf_u_texture);
     glActiveTexture(GL_TEXTURE8);
     glBindTexture(GL_TEXTURE_2D, vf_v_texture);
+    glActiveTexture(GL_TEXTURE9);
+    glBindTexture(GL_TEXTURE_2D, tone_curve_texture);
+    glActiveTexture(GL_TEXTURE10);
+    glBindTexture(GL_TEXTURE_3D, lut_atlas_texture);
+    glActiveTexture(GL_TEXTURE15);
+    glBindTexture(GL_TEXTURE_2D, dstTex);
 
     LOG << "after binding textures: " << glGetError() << std::endl;
 }
@@ -338,11 +529,14 @@ void ShaderManager::TestProgram() {
     // run GL program?
     glGenVertexArrays(1,&vao);
     glBindVertexArray(vao);
+    main_targets.vao = vao;
     glGenBuffers(1,&vbo);
     glBindBuffer(GL_ARRAY_BUFFER,vbo);
     glBufferData(GL_ARRAY_BUFFER,sizeof(quad),quad,GL_STATIC_DRAW);
     GLint posLoc = glGetAttribLocation(program,"aPos");
     GLint uvLoc = glGetAttribLocation(program,"aTexCoord");
+    quad_pos_loc = posLoc;
+    quad_uv_loc = uvLoc;
     glVertexAttribPointer(posLoc,2,GL_FLOAT,GL_FALSE,4*sizeof(float),(void*)0);
     glEnableVertexAttribArray(posLoc);
     glVertexAttribPointer(uvLoc,2,GL_FLOAT,GL_FALSE,4*sizeof(float),(void*)(2*sizeof(float)));
@@ -352,7 +546,167 @@ void ShaderManager::TestProgram() {
     LOG << "after running gL program: " << glGetError() << std::endl;
 }
 
+void ShaderManager::InitMonochromePrograms() {
+    // Viewfinder and still capture variants that read only the Y plane through the tone curve
+    mono_program = CreateProgram(viewfinder_vs_path, viewfinder_mono_fs_path);
+    glUseProgram(mono_program);
+    glUniform1i(glGetUniformLocation(mono_program, "yTexture"), 6);
+    glUniform1i(glGetUniformLocation(mono_program, "toneCurve"), 9);
+    glUniformMatrix4fv(glGetUniformLocation(mono_program, "transform"), 1, GL_FALSE, glm::value_ptr(trans_mat));
+
+    mono_yuv2rgb_program = CreateProgram(stillcapture_vs_path, stillcapture_mono_fs_path);
+    glUseProgram(mono_yuv2rgb_program);
+    glUniform1i(glGetUniformLocation(mono_yuv2rgb_program, "yTexture"), 2);
+    glUniform1i(glGetUniformLocation(mono_yuv2rgb_program, "toneCurve"), 9);
+    glUniformMatrix4fv(glGetUniformLocation(mono_yuv2rgb_program, "rotate"), 1, GL_FALSE, glm::value_ptr(rot_mat));
+    glUniform4f(glGetUniformLocation(mono_yuv2rgb_program, "texRegion"), 0.0f, 0.0f, 1.0f, 1.0f);
+
+    LOG << "after monochrome programs: " << glGetError() << std::endl;
+}
+
+void ShaderManager::InitContactSheetProgram() {
+    contact_program = CreateProgram(contact_vs_path, contact_fs_path);
+    glUseProgram(contact_program);
+    glUniform1i(glGetUniformLocation(contact_program, "yTexture"), 6);
+    glUniform1i(glGetUniformLocation(contact_program, "uTexture"), 7);
+    glUniform1i(glGetUniformLocation(contact_program, "vTexture"), 8);
+    glUniform1i(glGetUniformLocation(contact_program, "lutAtlas"), 10);
+    glUniform1f(glGetUniformLocation(contact_program, "thumbSize"), static_cast<float>(thumb_size));
+    glUniform1i(glGetUniformLocation(contact_program, "atlasCols"), atlas_cols);
+    glUniformMatrix4fv(glGetUniformLocation(contact_program, "transform"), 1, GL_FALSE, glm::value_ptr(trans_mat));
+
+    // all resident thumbnails live in one 3D texture, atlas_cols x atlas_cols blocks of thumb_size^3
+    glGenTextures(1, &lut_atlas_texture);
+    glActiveTexture(GL_TEXTURE10);
+    glBindTexture(GL_TEXTURE_3D, lut_atlas_texture);
+    glTexImage3D(GL_TEXTURE_3D, 0, GL_RGB8, thumb_size * atlas_cols, thumb_size * atlas_cols, thumb_size, 0, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+
+    LOG << "after contact sheet program: " << glGetError() << std::endl;
+}
+
+// Uploads the page of thumbnails that contains the selected LUT, only when the page changes
+void ShaderManager::UpdateContactSheetAtlas() {
+    int page_size = contact_grid * contact_grid;
+    int first = (lut_idx / page_size) * page_size;
+
+    glUseProgram(contact_program);
+    glUniform1i(glGetUniformLocation(contact_program, "selectedTile"), lut_idx - first);
+    if (first == contact_first) {
+        return;
+    }
+
+    contact_first = first;
+    contact_tiles = std::min(page_size, GetNumLuts() - first);
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glActiveTexture(GL_TEXTURE10);
+    glBindTexture(GL_TEXTURE_3D, lut_atlas_texture);
+    for (int tile = 0; tile < contact_tiles; tile++) {
+        int x = (tile % atlas_cols) * thumb_size;
+        int y = (tile / atlas_cols) * thumb_size;
+        glTexSubImage3D(GL_TEXTURE_3D, 0, x, y, 0, thumb_size, thumb_size, thumb_size, GL_RGB, GL_UNSIGNED_BYTE, lut_thumbnails[first + tile].data());
+    }
+    LOG << "Contact sheet showing LUTs " << first << " to " << first + contact_tiles - 1 << "\n";
+}
+
+void ShaderManager::SetContactSheet(bool enabled) {
+    contact_sheet = enabled;
+    if (!enabled) {
+        return;
+    }
+
+    // smallest square grid that fits every LUT, capped by the atlas
+    int num_luts = GetNumLuts();
+    contact_grid = 2;
+    while (contact_grid < atlas_cols && contact_grid * contact_grid < num_luts) {
+        contact_grid++;
+    }
+    contact_first = -1;
+
+    glUseProgram(contact_program);
+    glUniform1i(glGetUniformLocation(contact_program, "gridSize"), contact_grid);
+    UpdateContactSheetAtlas();
+}
+
+bool ShaderManager::IsContactSheet() {
+    return contact_sheet;
+}
+
+void ShaderManager::InitMultiLookProgram() {
+    multi_program = CreateProgram(stillcapture_vs_path, stillcapture_multi_fs_path);
+    glUseProgram(multi_program);
+    glUniform1i(glGetUniformLocation(multi_program, "yTexture"), 2);
+    glUniform1i(glGetUniformLocation(multi_program, "uTexture"), 3);
+    glUniform1i(glGetUniformLocation(multi_program, "vTexture"), 4);
+    glUniformMatrix4fv(glGetUniformLocation(multi_program, "rotate"), 1, GL_FALSE, glm::value_ptr(rot_mat));
+    glUniform4f(glGetUniformLocation(multi_program, "texRegion"), 0.0f, 0.0f, 1.0f, 1.0f);
+
+    // one 3D texture per look on units 11-14, filled on demand so only looks that get used cost memory
+    glGenTextures(max_looks, look_textures);
+    for (int i = 0; i < max_looks; i++) {
+        std::string name = "clut" + std::to_string(i);
+        glUniform1i(glGetUniformLocation(multi_program, name.c_str()), 11 + i);
+
+        glActiveTexture(GL_TEXTURE11 + i);
+        glBindTexture(GL_TEXTURE_3D, look_textures[i]);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    }
+
+    // second pack buffer so the readback of one look overlaps the callback of the previous one
+    glGenBuffers(1, &look_pbo);
+    if (!tiled_capture) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, look_pbo);
+        glBufferData(GL_PIXEL_PACK_BUFFER, test_width * test_height * (pack_rgb ? 3 : 4), nullptr, GL_DYNAMIC_READ);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+
+    LOG << "after multi-look program: " << glGetError() << std::endl;
+}
+
+void ShaderManager::InitPackPrograms() {
+    // the packing passes read the rendered capture straight from dstTex, bound on unit 15 in BindTextures
+    pack_rgb_program = CreateProgram(pack_vs_path, pack_rgb_fs_path);
+    glUseProgram(pack_rgb_program);
+    glUniform1i(glGetUniformLocation(pack_rgb_program, "rgbImage"), 15);
+
+    pack_y_program = CreateProgram(pack_vs_path, pack_y_fs_path);
+    glUseProgram(pack_y_program);
+    glUniform1i(glGetUniformLocation(pack_y_program, "rgbImage"), 15);
+
+    pack_chroma_program = CreateProgram(pack_vs_path, pack_chroma_fs_path);
+    glUseProgram(pack_chroma_program);
+    glUniform1i(glGetUniformLocation(pack_chroma_program, "rgbImage"), 15);
+
+    LOG << "after pack programs: " << glGetError() << std::endl;
+}
+
 void ShaderManager::InitCaptureProgram() {
+    // stills the GPU cannot hold in one texture are rendered in tiles, the plane textures then only hold one tile
+    GLint max_texture_size = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_texture_size);
+    tiled_capture = force_tiled_capture || test_width > max_texture_size || test_height > max_texture_size;
+    plane_width = test_width;
+    plane_height = test_height;
+    if (tiled_capture) {
+        tile_width = std::min(capture_tile_width, test_width);
+        tile_height = std::min(capture_tile_height, test_height);
+        plane_width = std::min(tile_width + 2*tile_margin, test_width);
+        plane_height = std::min(tile_height + 2*tile_margin, test_height);
+        LOG << "Still capture " << test_width << "x" << test_height << " rendered in " << tile_width << "x" << tile_height
+            << " tiles, GL_MAX_TEXTURE_SIZE " << max_texture_size << std::endl;
+    }
+
     // Create shader program for YUV to RGB conversion
     yuv2rgb_program = glCreateProgram();
     yuv2rgb_vert = LoadShader(GL_VERTEX_SHADER, stillcapture_vs_path.c_str());
@@ -394,6 +748,7 @@ void ShaderManager::InitCaptureProgram() {
 
     LOG << "yuv texture locs: " << sc_yTextureLoc << ", " << sc_uTextureLoc << ", " << sc_vTextureLoc << ", " << lutTextureLoc << ", " << rot_loc << std::endl;
     glUniformMatrix4fv(rot_loc, 1, GL_FALSE, glm::value_ptr(rot_mat));
+    glUniform4f(glGetUniformLocation(yuv2rgb_program, "texRegion"), 0.0f, 0.0f, 1.0f, 1.0f);
 
     ValidateProgram(yuv2rgb_program);
     
@@ -401,34 +756,39 @@ void ShaderManager::InitCaptureProgram() {
     LOG << "Using yuv program: " << glGetError() << std::endl;
 
     // setup texture for YUV input images from camera for stillcapture
-    glGenTextures(1, &sc_y_texture);
-    glBindTexture(GL_TEXTURE_2D, sc_y_texture);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, test_width, test_height, 0, GL_RED, GL_UNSIGNED_BYTE, nullptr);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glBindTexture(GL_TEXTURE_2D, 0);
-
-    glGenTextures(1, &sc_u_texture);
-    glBindTexture(GL_TEXTURE_2D, sc_u_texture);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, test_width/2, test_height/2, 0, GL_RED, GL_UNSIGNED_BYTE, nullptr);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glBindTexture(GL_TEXTURE_2D, 0);
-
-    glGenTextures(1, &sc_v_texture);
-    glBindTexture(GL_TEXTURE_2D, sc_v_texture);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, test_width/2, test_height/2, 0, GL_RED, GL_UNSIGNED_BYTE, nullptr);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glBindTexture(GL_TEXTURE_2D, 0);
+    unsigned int plane_textures[3];
+    CreateStillPlaneTextures(plane_textures);
+    sc_y_texture = plane_textures[0];
+    sc_u_texture = plane_textures[1];
+    sc_v_texture = plane_textures[2];
 
-    // setup pbo for output image (to file)
+    // setup pbo for output image (to file), packed RGB888. tiles are read back a band at a time instead
     glGenBuffers(1, &rgb_pbo);
-    glBindBuffer(GL_PIXEL_PACK_BUFFER, rgb_pbo);
-    glBufferData(GL_PIXEL_PACK_BUFFER, test_width * test_height * 4, nullptr, GL_DYNAMIC_READ);
-    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0); // unbind
+    if (!tiled_capture) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, rgb_pbo);
+        glBufferData(GL_PIXEL_PACK_BUFFER, test_width * test_height * (pack_rgb ? 3 : 4), nullptr, GL_DYNAMIC_READ);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0); // unbind
+    }
+
 
+}
 
+// Still Y, U and V textures of plane_width x plane_height. chroma is clamped at the frame edges, which is also what
+// lets tiles that end there line up with the rest
+void ShaderManager::CreateStillPlaneTextures(unsigned int textures[3]) {
+    glGenTextures(3, textures);
+    for (int i = 0; i < 3; i++) {
+        int width = i == 0 ? plane_width : plane_width/2;
+        int height = i == 0 ? plane_height : plane_height/2;
+        GLint filter = i == 0 ? GL_NEAREST : GL_LINEAR;
+        glBindTexture(GL_TEXTURE_2D, textures[i]);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, width, height, 0, GL_RED, GL_UNSIGNED_BYTE, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
 }
 
 void ShaderManager::InitViewfinderProgram() {
@@ -511,12 +871,17 @@ void ShaderManager::InitViewfinderProgram() {
     glGenFramebuffers(1, &dstFBO);
     glBindFramebuffer(GL_FRAMEBUFFER, dstFBO);
 
+    // a tiled capture renders one tile at a time, the viewfinder still needs the whole screen
+    int target_width = tiled_capture ? std::max(tile_width, screen_height) : test_width;
+    int target_height = tiled_capture ? std::max(tile_height, screen_width) : test_height;
     glGenTextures(1, &dstTex);
     glBindTexture(GL_TEXTURE_2D, dstTex);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, test_width, test_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, target_width, target_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
     glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, dstTex, 0);
+    main_targets.target_fbo = dstFBO;
+    main_targets.target_texture = dstTex;
     if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
         switch(glCheckFramebufferStatus(GL_FRAMEBUFFER)) {
 
@@ -547,11 +912,21 @@ void ShaderManager::InitViewfinderProgram() {
 
 // TODO: ViewfinderRender for some reason produces the image in BGR as opposed to RGB. this is compensated for in the shader, but should understand why this is happening
 void ShaderManager::ViewfinderRender(std::vector<uint8_t> &vec_frame, int stride, std::function<void(void* data, size_t size)> callback) {
+    TRACE_SCOPE("viewfinder render");
+    ApplyPendingLut();
 
     int u_offset = stride*viewfinder_height;
     int v_offset = u_offset + stride*viewfinder_height/4;
+    bool monochrome = lut_library.GetLut(lut_idx).Monochrome && !contact_sheet;
+    RenderTimer &timer = *main_targets.timer;
+    timer.Begin(RenderPath::VIEWFINDER);
  
-    glUseProgram(program);
+    if (contact_sheet) {
+        glUseProgram(contact_program);
+    }
+    else {
+        glUseProgram(monochrome ? mono_program : program);
+    }
 
     glPixelStorei(GL_UNPACK_ROW_LENGTH, stride);
     glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
@@ -559,15 +934,19 @@ void ShaderManager::ViewfinderRender(std::vector<uint8_t> &vec_frame, int stride
     glActiveTexture(GL_TEXTURE6);
     glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, viewfinder_width, viewfinder_height, GL_RED, GL_UNSIGNED_BYTE, vec_frame.data());
 
-    glPixelStorei(GL_UNPACK_ROW_LENGTH, stride/2);
+    // monochrome shader never reads chroma, skip uploading it
+    if (!monochrome) {
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, stride/2);
 
-    glActiveTexture(GL_TEXTURE7);
-    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, viewfinder_width/2, viewfinder_height/2, GL_RED, GL_UNSIGNED_BYTE, vec_frame.data() + u_offset);
+        glActiveTexture(GL_TEXTURE7);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, viewfinder_width/2, viewfinder_height/2, GL_RED, GL_UNSIGNED_BYTE, vec_frame.data() + u_offset);
 
-    glActiveTexture(GL_TEXTURE8);
-    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, viewfinder_width/2, viewfinder_height/2, GL_RED, GL_UNSIGNED_BYTE, vec_frame.data() + v_offset);
+        glActiveTexture(GL_TEXTURE8);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, viewfinder_width/2, viewfinder_height/2, GL_RED, GL_UNSIGNED_BYTE, vec_frame.data() + v_offset);
+    }
 
     glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    timer.Mark(RenderStage::PLANE_UPLOAD);
 
 
     // Render to Framebuffer
@@ -576,21 +955,34 @@ void ShaderManager::ViewfinderRender(std::vector<uint8_t> &vec_frame, int stride
     glViewport(0,0,screen_height,screen_width);
 
     glBindVertexArray(vao);
-    glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+    if (contact_sheet) {
+        // every tile in one instanced draw, the planes above are shared by all of them
+        glClear(GL_COLOR_BUFFER_BIT);
+        glDrawArraysInstanced(GL_TRIANGLE_FAN, 0, 4, contact_tiles);
+    }
+    else {
+        glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+    }
+    timer.Mark(RenderStage::LUT_DRAW);
 
-    RenderText(lut_data[lut_idx].Name, 10.0f, 10.0f, 1.0f, glm::vec3(0.5, 0.8f, 0.2f));
+    RenderText(lut_library.GetLut(lut_idx).Name, 10.0f, 10.0f, 1.0f, glm::vec3(0.5, 0.8f, 0.2f));
     glUseProgram(program);
+    timer.Mark(RenderStage::TEXT_OVERLAY);
 
     // Read Framebuffer for DRM preview
     glBindBuffer(GL_PIXEL_PACK_BUFFER, output_pbo[read_index]);
     glReadPixels(0, 0, screen_height, screen_width, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+    timer.Mark(RenderStage::READ_PIXELS);
     void* ptr = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, screen_width * screen_height * 4, GL_MAP_READ_BIT);
+    timer.Mark(RenderStage::MAP_UNMAP);
 
     // use callback function to move memory out, then unmap buffer
     if (ptr && callback) {
         callback(ptr, screen_width * screen_height * 4);
+        timer.Resume();
         glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
         glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        timer.Mark(RenderStage::MAP_UNMAP);
     }
     else {
         // report error with callback
@@ -598,57 +990,855 @@ void ShaderManager::ViewfinderRender(std::vector<uint8_t> &vec_frame, int stride
     }
     
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    timer.End();
     IncReadWriteIndex();
 }
 
 
-void ShaderManager::StillCaptureRender(std::vector<uint8_t> &cap_frame, int stride, std::function<void(void* data, size_t size)> callback) {
+void ShaderManager::UploadStillCapturePlanes(std::vector<uint8_t> &cap_frame, int stride, bool chroma) {
+    UploadStillCaptureWindow(cap_frame.data(), stride, chroma, 0, 0, test_width, test_height, 0, 0);
+}
+
+// Uploads the width x height window at x, y of the camera frame to tex_x, tex_y of the still plane textures. all of
+// them even, so the chroma window covers exactly the same part
+void ShaderManager::UploadStillCaptureWindow(const uint8_t *cap_frame, int stride, bool chroma, int x, int y, int width, int height, int tex_x, int tex_y) {
 
-    int u_offset = stride*GetStillCaptureHeight();
-    int v_offset = u_offset + stride*GetStillCaptureHeight()/4;
+    size_t u_offset = static_cast<size_t>(stride)*GetStillCaptureHeight();
+    size_t v_offset = u_offset + static_cast<size_t>(stride)*GetStillCaptureHeight()/4;
+    size_t chroma_offset = static_cast<size_t>(y/2)*(stride/2) + x/2;
  
     glPixelStorei(GL_UNPACK_ROW_LENGTH, stride);
     glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
 
     glActiveTexture(GL_TEXTURE2);
-    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, test_width, test_height, GL_RED, GL_UNSIGNED_BYTE, cap_frame.data());
+    glTexSubImage2D(GL_TEXTURE_2D, 0, tex_x, tex_y, width, height, GL_RED, GL_UNSIGNED_BYTE, cap_frame + static_cast<size_t>(y)*stride + x);
 
-    glPixelStorei(GL_UNPACK_ROW_LENGTH, stride/2);
+    if (chroma) {
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, stride/2);
 
-    glActiveTexture(GL_TEXTURE3);
-    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, test_width/2, test_height/2, GL_RED, GL_UNSIGNED_BYTE, cap_frame.data() + u_offset);
+        glActiveTexture(GL_TEXTURE3);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, tex_x/2, tex_y/2, width/2, height/2, GL_RED, GL_UNSIGNED_BYTE, cap_frame + u_offset + chroma_offset);
 
-    glActiveTexture(GL_TEXTURE4);
-    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, test_width/2, test_height/2, GL_RED, GL_UNSIGNED_BYTE, cap_frame.data() + v_offset);
+        glActiveTexture(GL_TEXTURE4);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, tex_x/2, tex_y/2, width/2, height/2, GL_RED, GL_UNSIGNED_BYTE, cap_frame + v_offset + chroma_offset);
+    }
 
     glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+}
+
+// Renders the capture through the current LUT into the target of targets
+void ShaderManager::DrawStillCapture(std::vector<uint8_t> &cap_frame, int stride, CaptureTargets &targets) {
+
+    bool monochrome = lut_library.GetLut(lut_idx).Monochrome;
+    UploadStillCapturePlanes(cap_frame, stride, !monochrome);
+    targets.timer->Mark(RenderStage::PLANE_UPLOAD);
     
-    glUseProgram(yuv2rgb_program);
+    glUseProgram(monochrome ? mono_yuv2rgb_program : yuv2rgb_program);
     LOG << "Use program: " << glGetError() << std::endl;
 
 
-    glBindFramebuffer(GL_FRAMEBUFFER, dstFBO);
+    glBindFramebuffer(GL_FRAMEBUFFER, targets.target_fbo);
     glViewport(0,0,test_width,test_height);
 
-    glBindVertexArray(vao);
+    glBindVertexArray(targets.vao);
+    glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+    targets.timer->Mark(RenderStage::LUT_DRAW);
+}
+
+// Packs an RGBA capture texture into tightly packed RGB888 rows and leaves the packing framebuffer bound for
+// reading RGBReadWidth() texels a row. Without pack_rgb the framebuffer reads the RGBA source itself
+void ShaderManager::PackRGB(unsigned int source_texture, CaptureTargets &targets) {
+    if (!pack_rgb) {
+        if (targets.rgb_pack_fbo == 0) {
+            glGenFramebuffers(1, &targets.rgb_pack_fbo);
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, targets.rgb_pack_fbo);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, source_texture, 0);
+        return;
+    }
+
+    // first use, setup the 3/4 width packing target
+    if (targets.rgb_pack_fbo == 0) {
+        glGenFramebuffers(1, &targets.rgb_pack_fbo);
+        glBindFramebuffer(GL_FRAMEBUFFER, targets.rgb_pack_fbo);
+        // unit 0 is free, binding here leaves the still plane textures in place
+        glActiveTexture(GL_TEXTURE0);
+        glGenTextures(1, &targets.rgb_pack_texture);
+        glBindTexture(GL_TEXTURE_2D, targets.rgb_pack_texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, test_width * 3 / 4, test_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, targets.rgb_pack_texture, 0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            LOG_ERR << "RGB pack framebuffer incomplete: 0x" << std::hex << glCheckFramebufferStatus(GL_FRAMEBUFFER) << std::dec << "\n";
+        }
+    }
+
+    if (source_texture != targets.target_texture) {
+        glActiveTexture(GL_TEXTURE15);
+        glBindTexture(GL_TEXTURE_2D, source_texture);
+    }
+
+    glUseProgram(pack_rgb_program);
+    glBindFramebuffer(GL_FRAMEBUFFER, targets.rgb_pack_fbo);
+    glViewport(0, 0, test_width * 3 / 4, test_height);
+    glBindVertexArray(targets.vao);
     glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
 
+    if (source_texture != targets.target_texture) {
+        glBindTexture(GL_TEXTURE_2D, targets.target_texture);
+    }
+    targets.timer->Mark(RenderStage::LUT_DRAW);
+}
+
+int ShaderManager::RGBReadWidth() const {
+    return pack_rgb ? test_width * 3 / 4 : test_width;
+}
+
+// RGB888 of pixels mapped from a PackRGB readback. an RGBA readback is repacked into the targets' scratch buffer
+void *ShaderManager::UnpackedRGB(void *mapped, size_t pixels, CaptureTargets &targets) {
+    if (pack_rgb) {
+        return mapped;
+    }
+    targets.rgb_scratch.resize(pixels * 3);
+    const uint8_t *rgba = static_cast<const uint8_t*>(mapped);
+    uint8_t *rgb = targets.rgb_scratch.data();
+    for (size_t i = 0; i < pixels; i++) {
+        rgb[i * 3] = rgba[i * 4];
+        rgb[i * 3 + 1] = rgba[i * 4 + 1];
+        rgb[i * 3 + 2] = rgba[i * 4 + 2];
+    }
+    return rgb;
+}
+
+// callback gets test_width*test_height tightly packed RGB888 pixels
+void ShaderManager::StillCaptureRender(std::vector<uint8_t> &cap_frame, int stride, std::function<void(void* data, size_t size)> callback) {
+    TRACE_SCOPE("still render");
+    if (tiled_capture) {
+        LOG_ERR << "Still captures are rendered in tiles\n";
+        return;
+    }
+
+    RenderTimer &timer = *main_targets.timer;
+    timer.Begin(RenderPath::STILL);
+    DrawStillCapture(cap_frame, stride, main_targets);
+    PackRGB(dstTex, main_targets);
+
     // Read Framebuffer
-    glBindBuffer(GL_PIXEL_PACK_BUFFER, rgb_pbo); // TODO: new pbo for captured frame data?
-    glReadPixels(0, 0, test_width, test_height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
-    //ptr = (GLubyte*) glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
-    void *ptr = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, test_width * test_height * 4, GL_MAP_READ_BIT);
+    size_t pixels = static_cast<size_t>(test_width) * test_height;
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, rgb_pbo);
+    glReadPixels(0, 0, RGBReadWidth(), test_height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+    timer.Mark(RenderStage::READ_PIXELS);
+    void *ptr = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, pixels * (pack_rgb ? 3 : 4), GL_MAP_READ_BIT);
+    timer.Mark(RenderStage::MAP_UNMAP);
 
     if (ptr && callback) {
-        callback(ptr, test_width*test_height*4);
+        callback(UnpackedRGB(ptr, pixels, main_targets), pixels * 3);
+        timer.Resume();
         glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
         glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        timer.Mark(RenderStage::MAP_UNMAP);
     }
     else {
         // report error with callback
         LOG_ERR << "StillCapture Callback\n";
     }
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    timer.End();
+}
+
+// Repacks the rendered capture into full range 4:2:0 planes: four luma values per texel in yuv_fbo[0], four Cb and
+// four Cr values per texel in the two attachments of yuv_fbo[1]
+void ShaderManager::PackYUV(CaptureTargets &targets) {
+    // first use, setup the packing targets
+    if (targets.yuv_fbo[0] == 0) {
+        glGenFramebuffers(2, targets.yuv_fbo);
+        // unit 0 is free, binding here leaves the still plane textures in place
+        glActiveTexture(GL_TEXTURE0);
+        glGenTextures(3, targets.yuv_textures);
+        int sizes[3][2] = {{test_width/4, test_height}, {test_width/8, test_height/2}, {test_width/8, test_height/2}};
+        for (int i = 0; i < 3; i++) {
+            glBindTexture(GL_TEXTURE_2D, targets.yuv_textures[i]);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, sizes[i][0], sizes[i][1], 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        }
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, targets.yuv_fbo[0]);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, targets.yuv_textures[0], 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, targets.yuv_fbo[1]);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, targets.yuv_textures[1], 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, targets.yuv_textures[2], 0);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            LOG_ERR << "YUV framebuffer incomplete: 0x" << std::hex << glCheckFramebufferStatus(GL_FRAMEBUFFER) << std::dec << "\n";
+        }
+    }
+
+    // the target texture is on unit 15 and only read here, the packing passes never render into dstFBO
+    glBindVertexArray(targets.vao);
+    glUseProgram(pack_y_program);
+    glBindFramebuffer(GL_FRAMEBUFFER, targets.yuv_fbo[0]);
+    glViewport(0, 0, test_width/4, test_height);
+    glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+
+    GLenum draw_buffers[2] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+    glUseProgram(pack_chroma_program);
+    glBindFramebuffer(GL_FRAMEBUFFER, targets.yuv_fbo[1]);
+    glDrawBuffers(2, draw_buffers);
+    glViewport(0, 0, test_width/8, test_height/2);
+    glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+    targets.timer->Mark(RenderStage::LUT_DRAW);
+}
+
+// Same render as StillCaptureRender, then repacked on the GPU into full range 4:2:0 planes. callback gets
+// Y (width x height) followed by Cb and Cr (width/2 x height/2 each), 1.5 bytes per pixel instead of 4
+bool ShaderManager::StillCaptureRenderYUV(std::vector<uint8_t> &cap_frame, int stride, std::function<void(void* data, size_t size)> callback) {
+    TRACE_SCOPE("still render YUV");
+    if (tiled_capture) {
+        LOG_ERR << "Still captures are rendered in tiles\n";
+        return false;
+    }
+    if (test_width % 8 != 0 || test_height % 2 != 0) {
+        LOG_ERR << "YUV capture output needs a width divisible by 8 and an even height\n";
+        return false;
+    }
+
+    if (yuv_pbo == 0) {
+        glGenBuffers(1, &yuv_pbo);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, yuv_pbo);
+        glBufferData(GL_PIXEL_PACK_BUFFER, test_width * test_height * 3 / 2, nullptr, GL_DYNAMIC_READ);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+
+    RenderTimer &timer = *main_targets.timer;
+    timer.Begin(RenderPath::STILL);
+    DrawStillCapture(cap_frame, stride, main_targets);
+    PackYUV(main_targets);
+
+    // all three planes land back to back in one pack buffer
+    size_t y_size = static_cast<size_t>(test_width) * test_height;
+    size_t chroma_size = y_size / 4;
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, yuv_pbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, main_targets.yuv_fbo[0]);
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glReadPixels(0, 0, test_width/4, test_height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, main_targets.yuv_fbo[1]);
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glReadPixels(0, 0, test_width/8, test_height/2, GL_RGBA, GL_UNSIGNED_BYTE, reinterpret_cast<void*>(y_size));
+    glReadBuffer(GL_COLOR_ATTACHMENT1);
+    glReadPixels(0, 0, test_width/8, test_height/2, GL_RGBA, GL_UNSIGNED_BYTE, reinterpret_cast<void*>(y_size + chroma_size));
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    timer.Mark(RenderStage::READ_PIXELS);
+
+    void *ptr = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, y_size + 2*chroma_size, GL_MAP_READ_BIT);
+    timer.Mark(RenderStage::MAP_UNMAP);
+    bool rendered = ptr && callback;
+    if (rendered) {
+        callback(ptr, y_size + 2*chroma_size);
+        timer.Resume();
+    }
+    else {
+        LOG_ERR << "StillCaptureYUV readback failed\n";
+    }
+    if (ptr) {
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        timer.Mark(RenderStage::MAP_UNMAP);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    timer.End();
+    return rendered;
+}
+
+// Same render as StillCaptureRender or StillCaptureRenderYUV, read back in horizontal strips of strip_rows through
+// a ring of pack buffers. While callback works on one strip the next ones are already on their way, so the caller
+// never holds more than a strip and encoding overlaps the readback. callback gets the first output row, the number
+// of rows and either packed RGB888 rows or the strip's Y rows followed by its Cb and Cr rows.
+// strip_rows has to be even for YUV. false when not every strip reached callback, the capture is incomplete then
+bool ShaderManager::StillCaptureRenderStrips(std::vector<uint8_t> &cap_frame, int stride, bool yuv, int strip_rows, std::function<void(int, int, void*, size_t)> callback) {
+    if (tiled_capture) {
+        LOG_ERR << "Still captures are rendered in tiles\n";
+        return false;
+    }
+    return RenderStrips(cap_frame, stride, yuv, strip_rows, callback, main_targets);
+}
+
+bool ShaderManager::RenderStrips(std::vector<uint8_t> &cap_frame, int stride, bool yuv, int strip_rows, const std::function<void(int, int, void*, size_t)> &callback, CaptureTargets &targets) {
+    TRACE_SCOPE("still render strips");
+    if (yuv && (test_width % 8 != 0 || test_height % 2 != 0 || strip_rows % 2 != 0)) {
+        LOG_ERR << "YUV capture strips need a width divisible by 8 and an even height and strip height\n";
+        return false;
+    }
+
+    if (targets.strip_pbo[0] == 0 || targets.strip_pbo_rows != strip_rows) {
+        if (targets.strip_pbo[0] == 0) {
+            glGenBuffers(num_strip_buffers, targets.strip_pbo);
+        }
+        for (int i = 0; i < num_strip_buffers; i++) {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, targets.strip_pbo[i]);
+            glBufferData(GL_PIXEL_PACK_BUFFER, static_cast<size_t>(test_width) * strip_rows * (pack_rgb ? 3 : 4), nullptr, GL_DYNAMIC_READ);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        targets.strip_pbo_rows = strip_rows;
+    }
+
+    RenderTimer &timer = *targets.timer;
+    timer.Begin(RenderPath::STILL);
+    DrawStillCapture(cap_frame, stride, targets);
+    if (yuv) {
+        PackYUV(targets);
+    }
+    else {
+        PackRGB(targets.target_texture, targets);
+    }
+
+    const int num_strips = (test_height + strip_rows - 1) / strip_rows;
+    auto strip_height = [&](int strip) {
+        return std::min(strip_rows, test_height - strip * strip_rows);
+    };
+    auto strip_size = [&](int strip) {
+        size_t rows = static_cast<size_t>(test_width) * strip_height(strip);
+        return yuv ? rows * 3 / 2 : rows * 3;
+    };
+    // queues the copy of one strip into its pack buffer, glReadPixels returns without waiting for it
+    auto read_strip = [&](int strip) {
+        int first_row = strip * strip_rows;
+        int rows = strip_height(strip);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, targets.strip_pbo[strip % num_strip_buffers]);
+        if (yuv) {
+            size_t y_size = static_cast<size_t>(test_width) * rows;
+            glBindFramebuffer(GL_FRAMEBUFFER, targets.yuv_fbo[0]);
+            glReadBuffer(GL_COLOR_ATTACHMENT0);
+            glReadPixels(0, first_row, test_width/4, rows, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+            glBindFramebuffer(GL_FRAMEBUFFER, targets.yuv_fbo[1]);
+            glReadBuffer(GL_COLOR_ATTACHMENT0);
+            glReadPixels(0, first_row/2, test_width/8, rows/2, GL_RGBA, GL_UNSIGNED_BYTE, reinterpret_cast<void*>(y_size));
+            glReadBuffer(GL_COLOR_ATTACHMENT1);
+            glReadPixels(0, first_row/2, test_width/8, rows/2, GL_RGBA, GL_UNSIGNED_BYTE, reinterpret_cast<void*>(y_size + y_size/4));
+            glReadBuffer(GL_COLOR_ATTACHMENT0);
+        }
+        else {
+            glBindFramebuffer(GL_FRAMEBUFFER, targets.rgb_pack_fbo);
+            glReadPixels(0, first_row, RGBReadWidth(), rows, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+        }
+        timer.Mark(RenderStage::READ_PIXELS);
+    };
+
+    for (int strip = 0; strip < std::min(num_strip_buffers, num_strips); strip++) {
+        read_strip(strip);
+    }
+    bool complete = true;
+    for (int strip = 0; strip < num_strips; strip++) {
+        size_t size = strip_size(strip);
+        size_t pixels = static_cast<size_t>(test_width) * strip_height(strip);
+        bool rgba = !yuv && !pack_rgb;
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, targets.strip_pbo[strip % num_strip_buffers]);
+        void *ptr = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, rgba ? pixels * 4 : size, GL_MAP_READ_BIT);
+        timer.Mark(RenderStage::MAP_UNMAP);
+        if (!ptr || !callback) {
+            // report error with callback
+            LOG_ERR << "StillCaptureStrips Callback\n";
+            complete = false;
+            break;
+        }
+        callback(strip * strip_rows, strip_height(strip), rgba ? UnpackedRGB(ptr, pixels, targets) : ptr, size);
+        timer.Resume();
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        timer.Mark(RenderStage::MAP_UNMAP);
+
+        // the buffer is free again, send the strip num_strip_buffers ahead into it
+        if (strip + num_strip_buffers < num_strips) {
+            read_strip(strip + num_strip_buffers);
+        }
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    timer.End();
+    return complete;
+}
+
+// Renders one capture through up to max_looks LUTs. The planes are uploaded and sampled once and every look
+// is written to its own colour attachment. callback gets the position in luts and the packed RGB888 pixels of that look
+void ShaderManager::StillCaptureRenderMulti(std::vector<uint8_t> &cap_frame, int stride, const std::vector<int> &luts, std::function<void(int, void*, size_t)> callback) {
+    TRACE_SCOPE("still render multi");
+    if (tiled_capture) {
+        LOG_ERR << "Still captures are rendered in tiles\n";
+        return;
+    }
+    int num_looks = std::min(static_cast<int>(luts.size()), max_looks);
+    if (num_looks < static_cast<int>(luts.size())) {
+        LOG_ERR << "Multi-look capture supports " << max_looks << " looks, dropping " << luts.size() - num_looks << "\n";
+    }
+    if (num_looks == 0) {
+        return;
+    }
+
+    // first use, setup the look framebuffer
+    if (look_fbo == 0) {
+        glGenFramebuffers(1, &look_fbo);
+        glBindFramebuffer(GL_FRAMEBUFFER, look_fbo);
+        // unit 0 is free, binding here leaves the still plane textures in place
+        glActiveTexture(GL_TEXTURE0);
+        glGenTextures(max_looks, look_output_textures);
+        for (int i = 0; i < max_looks; i++) {
+            glBindTexture(GL_TEXTURE_2D, look_output_textures[i]);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, test_width, test_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_TEXTURE_2D, look_output_textures[i], 0);
+        }
+        glBindTexture(GL_TEXTURE_2D, 0);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            LOG_ERR << "Multi-look framebuffer incomplete: 0x" << std::hex << glCheckFramebufferStatus(GL_FRAMEBUFFER) << std::dec << "\n";
+        }
+    }
+
+    // refresh resident LUTs that changed since the last multi-look capture
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (int i = 0; i < num_looks; i++) {
+        if (look_lut_index[i] == luts[i]) {
+            continue;
+        }
+        const LUT &lut = lut_library.GetLut(luts[i]);
+        glActiveTexture(GL_TEXTURE11 + i);
+        glTexImage3D(GL_TEXTURE_3D, 0, GL_RGB, lut.Size, lut.Size, lut.Size, 0, GL_RGB, GL_UNSIGNED_BYTE, lut.Data);
+        look_lut_index[i] = luts[i];
+    }
+
+    // the resident LUT refresh above is left out, it is not there most of the time
+    RenderTimer &timer = *main_targets.timer;
+    timer.Begin(RenderPath::STILL);
+    UploadStillCapturePlanes(cap_frame, stride, true);
+    timer.Mark(RenderStage::PLANE_UPLOAD);
+
+    glUseProgram(multi_program);
+    glUniform1i(glGetUniformLocation(multi_program, "numLooks"), num_looks);
+
+    GLenum draw_buffers[max_looks];
+    for (int i = 0; i < max_looks; i++) {
+        draw_buffers[i] = i < num_looks ? GL_COLOR_ATTACHMENT0 + i : GL_NONE;
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, look_fbo);
+    glDrawBuffers(max_looks, draw_buffers);
+    glViewport(0,0,test_width,test_height);
+
+    glBindVertexArray(vao);
+    glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+    timer.Mark(RenderStage::LUT_DRAW);
+
+    // ping-pong between two pack buffers: look i+1 is being packed and read back while look i is handed to the callback
+    size_t pixels = static_cast<size_t>(test_width) * test_height;
+    unsigned int pbos[2] = {rgb_pbo, look_pbo};
+    PackRGB(look_output_textures[0], main_targets);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos[0]);
+    glReadPixels(0, 0, RGBReadWidth(), test_height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+    timer.Mark(RenderStage::READ_PIXELS);
+
+    for (int i = 0; i < num_looks; i++) {
+        if (i + 1 < num_looks) {
+            PackRGB(look_output_textures[i + 1], main_targets);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos[(i + 1) % 2]);
+            glReadPixels(0, 0, RGBReadWidth(), test_height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+            timer.Mark(RenderStage::READ_PIXELS);
+        }
+
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos[i % 2]);
+        void *ptr = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, pixels * (pack_rgb ? 3 : 4), GL_MAP_READ_BIT);
+        timer.Mark(RenderStage::MAP_UNMAP);
+        if (ptr && callback) {
+            callback(i, UnpackedRGB(ptr, pixels, main_targets), pixels * 3);
+            timer.Resume();
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+            timer.Mark(RenderStage::MAP_UNMAP);
+        }
+        else {
+            // report error with callback
+            LOG_ERR << "StillCaptureMulti Callback\n";
+        }
+    }
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    timer.End();
+}
+
+ShaderManager::~ShaderManager() {
+    if (capture_thread.joinable()) {
+        {
+            std::unique_lock<std::mutex> lock(capture_mutex);
+            capture_shutdown = true;
+        }
+        capture_cv.notify_all();
+        capture_thread.join();
+    }
+    if (headless) {
+        ReleaseHeadlessDisplay();
+    }
+}
+
+void ShaderManager::SetCaptureThread(bool enabled) {
+    use_capture_thread = enabled;
+}
+
+void ShaderManager::SetHeadless(bool enabled) {
+    headless = enabled;
+}
+
+bool ShaderManager::IsHeadless() {
+    return headless;
+}
+
+RenderTimings &ShaderManager::GetRenderTimings() {
+    return render_timings;
+}
+
+// Creates the capture context next to the main one and starts its thread. Without surfaceless contexts, or with
+// tiled captures that interleave with the viewfinder anyway, captures stay on the main context
+void ShaderManager::InitCaptureThread() {
+    if (!use_capture_thread || tiled_capture) {
+        return;
+    }
+    const char *extensions = eglQueryString(display, EGL_EXTENSIONS);
+    if (!extensions || !strstr(extensions, "EGL_KHR_surfaceless_context")) {
+        LOG_ERR << "No EGL_KHR_surfaceless_context, captures render on the main context\n";
+        return;
+    }
+
+    capture_context = eglCreateContext(display, egl_config, context, contextAttribs);
+    if (capture_context == EGL_NO_CONTEXT) {
+        LOG_ERR << "Failed to create capture context: " << eglGetErrorStr() << "\n";
+        return;
+    }
+
+    // the current LUT went up before there was anyone to wait for it
+    lut_fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glFlush();
+    capture_thread = std::thread(&ShaderManager::CaptureThreadLoop, this);
+}
+
+// Renders cap_frame on the capture thread and reads it back in strips like StillCaptureRenderStrips, callback and
+// on_finished run on that thread, on_finished with false when the capture did not make it through every strip.
+// The current LUT is kept until the capture is done. Returns false without a capture thread, the caller renders on
+// the main context then
+bool ShaderManager::SubmitCapture(std::vector<uint8_t> &&cap_frame, int stride, bool yuv, int strip_rows, std::function<void(int, int, void*, size_t)> callback, std::function<void(bool)> on_finished) {
+    if (capture_context == EGL_NO_CONTEXT) {
+        return false;
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(lut_mutex);
+        lut_in_use++;
+    }
+    {
+        std::unique_lock<std::mutex> lock(capture_mutex);
+        capture_queue.push_back({std::move(cap_frame), stride, yuv, strip_rows, std::move(callback), std::move(on_finished)});
+        capture_queue_depth.Set(capture_queue.size());
+    }
+    capture_cv.notify_all();
+    return true;
+}
+
+// false when single captures are rendered on the main context, SubmitCapture refuses them then
+bool ShaderManager::HasCaptureThread() {
+    return capture_context != EGL_NO_CONTEXT;
+}
+
+bool ShaderManager::IsCaptureBusy() {
+    return GetCaptureQueueDepth() > 0;
+}
+
+// captures submitted to the capture thread and not done yet, the one being rendered included
+int ShaderManager::GetCaptureQueueDepth() {
+    std::unique_lock<std::mutex> lock(lut_mutex);
+    return lut_in_use;
+}
+
+void ShaderManager::CaptureThreadLoop() {
+    Tracer::SetThreadName("capture render");
+    // the bound API is per thread
+    eglBindAPI(EGL_OPENGL_API);
+    bool current = eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, capture_context);
+    if (!current) {
+        LOG_ERR << "Capture context can not be made current: " << eglGetErrorStr() << "\n";
+    }
+    else {
+        // everything that is not shared: the quad's vertex array, plane textures and the render target
+        glGenVertexArrays(1, &thread_targets.vao);
+        glBindVertexArray(thread_targets.vao);
+        glBindBuffer(GL_ARRAY_BUFFER, vbo);
+        glVertexAttribPointer(quad_pos_loc, 2, GL_FLOAT, GL_FALSE, 4*sizeof(float), (void*)0);
+        glEnableVertexAttribArray(quad_pos_loc);
+        glVertexAttribPointer(quad_uv_loc, 2, GL_FLOAT, GL_FALSE, 4*sizeof(float), (void*)(2*sizeof(float)));
+        glEnableVertexAttribArray(quad_uv_loc);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        glActiveTexture(GL_TEXTURE0);
+        CreateStillPlaneTextures(thread_plane_textures);
+        glGenFramebuffers(1, &thread_targets.target_fbo);
+        glBindFramebuffer(GL_FRAMEBUFFER, thread_targets.target_fbo);
+        glGenTextures(1, &thread_targets.target_texture);
+        glBindTexture(GL_TEXTURE_2D, thread_targets.target_texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, test_width, test_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, thread_targets.target_texture, 0);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            LOG_ERR << "Capture thread framebuffer incomplete: 0x" << std::hex << glCheckFramebufferStatus(GL_FRAMEBUFFER) << std::dec << "\n";
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        // same units as on the main context, the shared programs have their samplers set to them
+        for (int i = 0; i < 3; i++) {
+            glActiveTexture(GL_TEXTURE2 + i);
+            glBindTexture(GL_TEXTURE_2D, thread_plane_textures[i]);
+        }
+        glActiveTexture(GL_TEXTURE15);
+        glBindTexture(GL_TEXTURE_2D, thread_targets.target_texture);
+        thread_targets.timer.reset(new RenderTimer(render_timings));
+        thread_targets.timer->Initialize();
+        LOG << "Capture thread ready: " << glGetError() << std::endl;
+    }
+
+    while (true) {
+        CaptureRequest request;
+        {
+            std::unique_lock<std::mutex> lock(capture_mutex);
+            capture_cv.wait(lock, [this]{ return !capture_queue.empty() || capture_shutdown; });
+            if (capture_queue.empty()) {
+                break;
+            }
+            request = std::move(capture_queue.front());
+            capture_queue.pop_front();
+            capture_queue_depth.Set(capture_queue.size());
+        }
+
+        auto start_time = std::chrono::steady_clock::now();
+        GLsync fence = nullptr;
+        bool rendered = false;
+        if (current) {
+            {
+                // the GPU waits for the last LUT upload, this thread does not
+                std::unique_lock<std::mutex> lock(lut_mutex);
+                if (lut_fence) {
+                    glWaitSync(lut_fence, 0, GL_TIMEOUT_IGNORED);
+                }
+            }
+            // binding again is what makes the other context's changes visible here
+            glActiveTexture(GL_TEXTURE1);
+            glBindTexture(GL_TEXTURE_3D, lut_texture);
+            glActiveTexture(GL_TEXTURE9);
+            glBindTexture(GL_TEXTURE_2D, tone_curve_texture);
+
+            rendered = RenderStrips(request.frame, request.stride, request.yuv, request.strip_rows, request.callback, thread_targets);
+            fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            glFlush();
+        }
+
+        {
+            std::unique_lock<std::mutex> lock(lut_mutex);
+            if (fence) {
+                if (capture_fence) {
+                    glDeleteSync(capture_fence);
+                }
+                capture_fence = fence;
+            }
+            lut_in_use--;
+        }
+
+        request.frame = std::vector<uint8_t>();
+        if (request.on_finished) {
+            request.on_finished(rendered);
+        }
+        Tracer::Complete("capture thread render", start_time, std::chrono::steady_clock::now());
+        capture_render_time.Record(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start_time).count());
+        std::chrono::duration<float> elapsed = std::chrono::steady_clock::now() - start_time;
+        LOG << "Capture rendered on the capture thread in " << elapsed.count() << "s" << std::endl;
+    }
+
+    if (current) {
+        eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    }
+    eglDestroyContext(display, capture_context);
+}
+
+void ShaderManager::SetTiledCapture(bool force) {
+    force_tiled_capture = force;
+}
+
+bool ShaderManager::IsTiledCapture() {
+    return tiled_capture;
+}
+
+bool ShaderManager::IsTiledCaptureActive() {
+    return tiled.active;
+}
+
+// Starts rendering a still in tiles, ContinueTiledCapture does the actual work a few tiles at a time. The frame
+// stays with the capture until it is done. callback gets every finished band of tile_height rows from the top as
+// packed RGB888, on_finished runs after the last band or when the capture is abandoned
+bool ShaderManager::BeginTiledCapture(std::vector<uint8_t> &&cap_frame, int stride, std::function<void(int, int, void*, size_t)> callback, std::function<void()> on_finished) {
+    if (!tiled_capture || tiled.active) {
+        LOG_ERR << "No tiled capture possible now\n";
+        return false;
+    }
+    if (test_width % 4 != 0 || test_height % 2 != 0) {
+        LOG_ERR << "Tiled capture needs a width divisible by 4 and an even height\n";
+        return false;
+    }
+
+    // first use, setup the tile packing target and the band the tiles are copied into
+    if (tile_pack_fbo == 0) {
+        glGenFramebuffers(1, &tile_pack_fbo);
+        glBindFramebuffer(GL_FRAMEBUFFER, tile_pack_fbo);
+        // unit 0 is free, binding here leaves the still plane textures in place
+        glActiveTexture(GL_TEXTURE0);
+        glGenTextures(1, &tile_pack_texture);
+        glBindTexture(GL_TEXTURE_2D, tile_pack_texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, tile_width * 3 / 4, tile_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, tile_pack_texture, 0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            LOG_ERR << "Tile pack framebuffer incomplete: 0x" << std::hex << glCheckFramebufferStatus(GL_FRAMEBUFFER) << std::dec << "\n";
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        glGenBuffers(1, &band_pbo);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, band_pbo);
+        glBufferData(GL_PIXEL_PACK_BUFFER, static_cast<size_t>(test_width) * tile_height * 3, nullptr, GL_DYNAMIC_READ);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+
+    tiled.frame = std::move(cap_frame);
+    tiled.stride = stride;
+    tiled.monochrome = lut_library.GetLut(lut_idx).Monochrome;
+    tiled.tiles_x = (test_width + tile_width - 1) / tile_width;
+    tiled.tiles_y = (test_height + tile_height - 1) / tile_height;
+    tiled.next_tile = 0;
+    tiled.callback = std::move(callback);
+    tiled.on_finished = std::move(on_finished);
+    tiled.start_time = std::chrono::steady_clock::now();
+    tiled.active = true;
+    LOG << "Tiled capture of " << tiled.tiles_x * tiled.tiles_y << " tiles started" << std::endl;
+    return true;
+}
+
+// Renders tiles until the next one would not fit into budget any more, at least one per call. Returns true while
+// tiles are left
+bool ShaderManager::ContinueTiledCapture(std::chrono::microseconds budget) {
+    if (!tiled.active) {
+        return false;
+    }
+
+    auto start_time = std::chrono::steady_clock::now();
+    int num_tiles = tiled.tiles_x * tiled.tiles_y;
+    while (tiled.next_tile < num_tiles) {
+        auto tile_start = std::chrono::steady_clock::now();
+        RenderTile(tiled.next_tile);
+
+        // wait for the GPU, a budget that only covers submitting the draws would still eat the next viewfinder frame
+        GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+        glDeleteSync(fence);
+        tiled.next_tile++;
+        std::chrono::duration<float> tile_time = std::chrono::steady_clock::now() - tile_start;
+        tiled.tile_seconds = tiled.tile_seconds == 0.0f ? tile_time.count() : 0.8f * tiled.tile_seconds + 0.2f * tile_time.count();
+
+        // the last tile of a band completes its rows
+        if (tiled.next_tile % tiled.tiles_x == 0) {
+            int first_row = (tiled.next_tile / tiled.tiles_x - 1) * tile_height;
+            int rows = std::min(tile_height, test_height - first_row);
+            size_t size = static_cast<size_t>(test_width) * rows * 3;
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, band_pbo);
+            void *ptr = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+            if (!ptr) {
+                LOG_ERR << "Tiled capture band readback failed\n";
+                glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+                EndTiledCapture();
+                return false;
+            }
+            tiled.callback(first_row, rows, ptr, size);
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        }
+
+        std::chrono::duration<float> elapsed = std::chrono::steady_clock::now() - start_time;
+        if (elapsed.count() + tiled.tile_seconds > std::chrono::duration<float>(budget).count()) {
+            break;
+        }
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    if (tiled.next_tile < num_tiles) {
+        return true;
+    }
+    EndTiledCapture();
+    return false;
+}
+
+// Renders one tile of the still through the current LUT, packs it into RGB888 rows and copies them to their place
+// in the band buffer. Only the source window of the tile plus a margin for the chroma taps is uploaded
+void ShaderManager::RenderTile(int tile) {
+    TRACE_SCOPE("render tile");
+    int out_x = (tile % tiled.tiles_x) * tile_width;
+    int out_y = (tile / tiled.tiles_x) * tile_height;
+    int width = std::min(tile_width, test_width - out_x);
+    int height = std::min(tile_height, test_height - out_y);
+
+    // the still vertex shader turns the frame by 180 degrees, the tile comes from the opposite corner of the frame
+    int src_x = test_width - out_x - width;
+    int src_y = test_height - out_y - height;
+    int x0 = std::max(0, src_x - tile_margin);
+    int y0 = std::max(0, src_y - tile_margin);
+    int x1 = std::min(test_width, src_x + width + tile_margin);
+    int y1 = std::min(test_height, src_y + height + tile_margin);
+    // a window that ends at the frame edge ends at the texture edge as well, so the clamp there is the same as in
+    // a full frame render
+    int tex_x = x1 == test_width ? plane_width - (x1 - x0) : 0;
+    int tex_y = y1 == test_height ? plane_height - (y1 - y0) : 0;
+    UploadStillCaptureWindow(tiled.frame.data(), tiled.stride, !tiled.monochrome, x0, y0, x1 - x0, y1 - y0, tex_x, tex_y);
+
+    GLuint still_program = tiled.monochrome ? mono_yuv2rgb_program : yuv2rgb_program;
+    glUseProgram(still_program);
+    glUniform4f(glGetUniformLocation(still_program, "texRegion"),
+                static_cast<float>(src_x - x0 + tex_x) / plane_width, static_cast<float>(src_y - y0 + tex_y) / plane_height,
+                static_cast<float>(width) / plane_width, static_cast<float>(height) / plane_height);
+    glBindFramebuffer(GL_FRAMEBUFFER, dstFBO);
+    glViewport(0, 0, width, height);
+    glBindVertexArray(vao);
+    glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+
+    // dstTex is on unit 15 for the packing pass, as in PackRGB
+    glUseProgram(pack_rgb_program);
+    glBindFramebuffer(GL_FRAMEBUFFER, tile_pack_fbo);
+    glViewport(0, 0, width * 3 / 4, height);
+    glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, band_pbo);
+    glPixelStorei(GL_PACK_ROW_LENGTH, test_width * 3 / 4);
+    glReadPixels(0, 0, width * 3 / 4, height, GL_RGBA, GL_UNSIGNED_BYTE, reinterpret_cast<void*>(static_cast<size_t>(out_x) * 3));
+    glPixelStorei(GL_PACK_ROW_LENGTH, 0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+void ShaderManager::EndTiledCapture() {
+    std::chrono::duration<float> elapsed = std::chrono::steady_clock::now() - tiled.start_time;
+    LOG << "Tiled capture done after " << tiled.next_tile << " tiles in " << elapsed.count() << "s" << std::endl;
+
+    tiled.active = false;
+    tiled.frame = std::vector<uint8_t>();
+    tiled.callback = nullptr;
+    if (tiled.on_finished) {
+        tiled.on_finished();
+        tiled.on_finished = nullptr;
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    ApplyPendingLut();
 }
 
 void ShaderManager::IncReadWriteIndex() {
@@ -656,10 +1846,6 @@ void ShaderManager::IncReadWriteIndex() {
     read_index = (read_index + 1) % num_buffers; 
 }
 
-int ShaderManager::GetNumLuts() {
-    return lut_data.size();
-}
-
 void ShaderManager::InitFreetype() {
     FT_Library ft;
     if (FT_Init_FreeType(&ft))
@@ -669,7 +1855,7 @@ void ShaderManager::InitFreetype() {
     }
 
     FT_Face face;
-    if (FT_New_Face(ft, "/home/andrew/codac/font/LibertinusSerifDisplay-Regular.ttf", 0, &face))
+    if (FT_New_Face(ft, font_path.c_str(), 0, &face))
     {
         LOG_ERR << "Failed to load font" << std::endl;  
         return;
@@ -2,16 +2,25 @@
 #define SHADERMANAGER_HPP
 
 #include <string>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 #include <filesystem>
 #include <cstdlib>
 #include <fstream>
 #include <sstream>
 #include <functional>
 #include <map>
+#include <memory>
+#include <deque>
 #include <EGL/egl.h>
 #include <GLES3/gl3.h>
 #include <log.hpp>
 #include <vector>
+#include <RenderTimer.hpp>
+#include <Metrics.hpp>
+#include <Renderer.hpp>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
@@ -26,18 +35,99 @@ struct Character {
     unsigned int Advance;   // Horizontal offset to advance to next glyph
 };
 
-// Holds LUT data and name
-struct LUT {
-    std::string Name;
-    unsigned char * Data;
-};
+struct gbm_device;
 
-class ShaderManager {
+class ShaderManager : public Renderer {
 
 private:
     int test_nrChannels;
     unsigned int dstFBO, dstTex;
     unsigned int lut_texture;
+    unsigned int tone_curve_texture;
+    unsigned int lut_atlas_texture;
+    static const int max_looks = 4;
+    unsigned int look_textures[max_looks];     // resident LUTs for multi-look capture
+    int look_lut_index[max_looks] = {-1, -1, -1, -1};
+    unsigned int look_fbo = 0;
+    unsigned int look_output_textures[max_looks];
+    unsigned int look_pbo;
+    unsigned int yuv_pbo = 0;
+    static const int num_strip_buffers = 3;
+
+    // what a still capture renders into and reads back through. framebuffers and vertex arrays are not shared
+    // between contexts, so the capture thread has a set of its own
+    struct CaptureTargets {
+        unsigned int vao = 0;
+        unsigned int target_fbo = 0, target_texture = 0;   // the RGBA render, read on unit 15 by the pack passes
+        unsigned int rgb_pack_fbo = 0, rgb_pack_texture = 0;
+        unsigned int yuv_fbo[2] = {0, 0};                  // Y target, Cb/Cr targets
+        unsigned int yuv_textures[3];
+        unsigned int strip_pbo[num_strip_buffers] = {0, 0, 0}; // ring for strip readback
+        int strip_pbo_rows = 0;
+        std::vector<uint8_t> rgb_scratch;                 // RGB888 rows repacked from an RGBA readback
+        std::unique_ptr<RenderTimer> timer;               // timer queries are per context as well
+    };
+    CaptureTargets main_targets; // dstFBO and dstTex, shared with the viewfinder
+    RenderTimings render_timings; // both contexts' stage times
+
+    /* single captures render on a thread with its own context, shared with the main one, so the viewfinder keeps
+       going meanwhile. only the programs, the quad and the LUT textures are shared, the thread uploads into its own
+       plane textures. the LUT textures stay as they are while any capture still needs them, a switch in the
+       meantime waits. fences order the two contexts on the GPU: a capture waits for the last LUT upload and the
+       next LUT upload waits for the last capture */
+    struct CaptureRequest {
+        std::vector<uint8_t> frame;
+        int stride;
+        bool yuv;
+        int strip_rows;
+        std::function<void(int, int, void*, size_t)> callback;
+        std::function<void(bool)> on_finished; // false when the capture was not rendered in full
+    };
+    bool use_capture_thread = true;
+    EGLConfig egl_config;
+    EGLContext capture_context = EGL_NO_CONTEXT;
+    std::thread capture_thread;
+    std::deque<CaptureRequest> capture_queue;
+    bool capture_shutdown = false;
+    std::mutex capture_mutex;
+    std::condition_variable capture_cv;
+    CaptureTargets thread_targets;
+    unsigned int thread_plane_textures[3];
+    std::mutex lut_mutex;          // guards everything below and the contents of the shared LUT textures
+    int lut_in_use = 0;            // captures submitted and not rendered yet
+    MetricGauge &capture_queue_depth = Metrics::GetGauge("shader.capture_queue_depth");
+    LatencyHistogram &capture_render_time = Metrics::GetHistogram("shader.capture_render_us");
+    int pending_lut = -1;          // LUT switch held back until no capture needs the current one
+    GLsync lut_fence = nullptr;    // last LUT upload on the main context
+    GLsync capture_fence = nullptr; // last capture on the capture context
+
+    // stills larger than one texture, or all of them when forced, are rendered in tiles between viewfinder frames.
+    // the still plane textures then hold one tile plus its margin and dstTex one tile
+    bool tiled_capture = false;
+    bool force_tiled_capture = false;
+    // the RGB packing pass turns 4 RGBA texels into 3, which needs a width divisible by 4. other widths are read
+    // back as RGBA and the alpha is dropped on the CPU
+    bool pack_rgb = true;
+    const int capture_tile_width = 1024;
+    const int capture_tile_height = 256;  // a band of rows is handed on at a time, keep it a multiple of 16
+    static const int tile_margin = 2;     // luma pixels around a tile, one chroma texel for the bilinear taps
+    int tile_width = 0, tile_height = 0;
+    int plane_width = 0, plane_height = 0; // size of the still Y texture
+    unsigned int tile_pack_fbo = 0;
+    unsigned int tile_pack_texture;
+    unsigned int band_pbo;
+    struct TiledCapture {
+        bool active = false;
+        std::vector<uint8_t> frame;
+        int stride = 0;
+        bool monochrome = false;
+        int tiles_x = 0, tiles_y = 0;
+        int next_tile = 0;
+        float tile_seconds = 0.0f;  // running estimate of one tile, GPU time included
+        std::chrono::steady_clock::time_point start_time;
+        std::function<void(int, int, void*, size_t)> callback;
+        std::function<void()> on_finished;
+    } tiled;
     unsigned int test_texture;
     unsigned int input_pbo[3];
     unsigned int lut_pbo;
@@ -52,17 +142,35 @@ private:
     GLuint text_vao, text_vbo;
     GLuint program, vert, frag;
     GLuint yuv2rgb_program, yuv2rgb_vert, yuv2rgb_frag;
+    GLuint mono_program, mono_yuv2rgb_program;
+    GLuint contact_program;
+    GLuint multi_program;
+    GLuint pack_rgb_program, pack_y_program, pack_chroma_program;
+    GLint quad_pos_loc, quad_uv_loc;
     EGLDisplay display;
     EGLSurface surface;
     EGLContext context;
-    int lut_width, lut_height, lut_depth, lut_nrChannels;
-    std::string lut_dir = std::string(std::getenv("HOME")) + "/codac/lut/";
-    std::vector<LUT> lut_data;
-    int lut_idx;
+
+    // headless: no connector or window surface, everything renders into the FBOs it renders into anyway
+    bool headless = false;
+    std::string render_node_path = "/dev/dri/renderD128";
+    int render_node = -1;                         // only when the surfaceless platform is missing
+    struct gbm_device *render_gbm = nullptr;
+
+    std::vector<std::vector<unsigned char>> lut_thumbnails; // thumb_size^3 copy of every LUT for the contact sheet
     std::string viewfinder_vs_path = std::string(std::getenv("HOME")) + "/codac/shader/viewfinder_vs.glsl";
     std::string viewfinder_fs_path = std::string(std::getenv("HOME")) + "/codac/shader/viewfinder_fs.glsl";
     std::string stillcapture_vs_path = std::string(std::getenv("HOME")) + "/codac/shader/stillcapture_vs.glsl";
     std::string stillcapture_fs_path = std::string(std::getenv("HOME")) + "/codac/shader/stillcapture_fs.glsl";
+    std::string viewfinder_mono_fs_path = std::string(std::getenv("HOME")) + "/codac/shader/viewfinder_mono_fs.glsl";
+    std::string stillcapture_mono_fs_path = std::string(std::getenv("HOME")) + "/codac/shader/stillcapture_mono_fs.glsl";
+    std::string contact_vs_path = std::string(std::getenv("HOME")) + "/codac/shader/contactsheet_vs.glsl";
+    std::string contact_fs_path = std::string(std::getenv("HOME")) + "/codac/shader/contactsheet_fs.glsl";
+    std::string stillcapture_multi_fs_path = std::string(std::getenv("HOME")) + "/codac/shader/stillcapture_multi_fs.glsl";
+    std::string pack_vs_path = std::string(std::getenv("HOME")) + "/codac/shader/pack_vs.glsl";
+    std::string pack_rgb_fs_path = std::string(std::getenv("HOME")) + "/codac/shader/pack_rgb_fs.glsl";
+    std::string pack_y_fs_path = std::string(std::getenv("HOME")) + "/codac/shader/pack_y_fs.glsl";
+    std::string pack_chroma_fs_path = std::string(std::getenv("HOME")) + "/codac/shader/pack_chroma_fs.glsl";
     std::string text_vs_path = std::string(std::getenv("HOME")) + "/codac/shader/text_vs.glsl";
     std::string text_fs_path = std::string(std::getenv("HOME")) + "/codac/shader/text_fs.glsl";
 
@@ -71,12 +179,14 @@ private:
     int read_index = 1;
     int write_index = 0;
     int lut_index = 0;
-    int test_width = 2592;
-    int test_height = 1944;
-    int viewfinder_width = 800;
-    int viewfinder_height = 600;
-    const int screen_width = 640;
-    const int screen_height = 480;
+
+    // contact sheet shows up to atlas_cols^2 LUTs at once, one instance per tile
+    const int thumb_size = 33;
+    const int atlas_cols = 4;
+    bool contact_sheet = false;
+    int contact_grid = 2;
+    int contact_tiles = 0;
+    int contact_first = -1;
 
     glm::mat4 trans_mat;
     glm::mat4 rot_mat;
@@ -91,6 +201,15 @@ private:
         EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
         EGL_NONE};
 
+    // the surfaceless platform only has pbuffer configs, and a pbuffer is the fallback without surfaceless contexts
+    static inline const EGLint headlessConfigAttribs[] = {
+        EGL_RED_SIZE, 8,
+        EGL_GREEN_SIZE, 8,
+        EGL_BLUE_SIZE, 8,
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
+        EGL_NONE};
+
     static inline const EGLint contextAttribs[] = {
         EGL_CONTEXT_CLIENT_VERSION, 2,
         EGL_NONE};
@@ -107,11 +226,32 @@ private:
     static const char *eglGetErrorStr();
     static void ValidateProgram(GLuint);
 
-    int InitOpenGL();
+    bool InitOpenGL();
+    bool InitHeadlessOpenGL();
+    void ReleaseHeadlessDisplay();
     void InitTransformationMatrix();
     void InitCaptureProgram();
     void InitViewfinderProgram();
     void TestProgram();
+    void InitMonochromePrograms();
+    void InitContactSheetProgram();
+    void UpdateContactSheetAtlas();
+    void InitMultiLookProgram();
+    void InitPackPrograms();
+    void UploadStillCapturePlanes(std::vector<uint8_t> &, int, bool);
+    void CreateStillPlaneTextures(unsigned int[3]);
+    void DrawStillCapture(std::vector<uint8_t> &, int, CaptureTargets &);
+    void PackRGB(unsigned int, CaptureTargets &);
+    int RGBReadWidth() const;
+    void *UnpackedRGB(void *, size_t, CaptureTargets &);
+    void PackYUV(CaptureTargets &);
+    bool RenderStrips(std::vector<uint8_t> &, int, bool, int, const std::function<void(int, int, void*, size_t)> &, CaptureTargets &);
+    void InitCaptureThread();
+    void CaptureThreadLoop();
+    void ApplyPendingLut();
+    void UploadStillCaptureWindow(const uint8_t *, int, bool, int, int, int, int, int, int);
+    void RenderTile(int);
+    void EndTiledCapture();
     void BindTextures();
     void InitFreetype();
     void IncReadWriteIndex();
@@ -121,23 +261,49 @@ public:
         rot_mat = glm::mat4(1.0f);
 
     }
+    ~ShaderManager();
     
-    void Initialize();
+    bool Initialize() override;
 
-    void SwitchLUT(int);
+    void SwitchLUT(int) override;
+    void SetContactSheet(bool) override;
+    bool IsContactSheet() override;
     void LoadLUTs();
     GLuint LoadShader(GLenum, const std::string &);
-    void ViewfinderRender(std::vector<uint8_t> &, int, std::function<void(void*, size_t)>);
-    void StillCaptureRender(std::vector<uint8_t> &, int, std::function<void(void*, size_t)>); 
+    GLuint CreateProgram(const std::string &, const std::string &);
+    void ViewfinderRender(std::vector<uint8_t> &, int, std::function<void(void*, size_t)>) override;
+    void StillCaptureRender(std::vector<uint8_t> &, int, std::function<void(void*, size_t)>) override;
+    // false when the capture was not rendered and the callback never called: tiled captures, an output size the
+    // packing can not handle or a failed readback
+    bool StillCaptureRenderYUV(std::vector<uint8_t> &, int, std::function<void(void*, size_t)>);
+    bool StillCaptureRenderStrips(std::vector<uint8_t> &, int, bool, int, std::function<void(int, int, void*, size_t)>);
+    void StillCaptureRenderMulti(std::vector<uint8_t> &, int, const std::vector<int> &, std::function<void(int, void*, size_t)>) override;
 
-    // Font Management
-    void RenderText(std::string, float, float, float, glm::vec3);
+    // Single captures on the capture thread, see SubmitCapture. SetCaptureThread(false) keeps them on the main
+    // context and has to come before Initialize
+    void SetCaptureThread(bool);
+    bool SubmitCapture(std::vector<uint8_t> &&, int, bool, int, std::function<void(int, int, void*, size_t)>, std::function<void(bool)>);
+    bool IsCaptureBusy();
+    int GetCaptureQueueDepth();
+    bool HasCaptureThread();
+
+    // Renders without a display, on Mesa's surfaceless platform or a render node, so the GL pipeline runs on
+    // machines without a monitor or GPU under the software rasterizer. has to come before Initialize
+    void SetHeadless(bool);
+    bool IsHeadless();
+
+    // Tiled still capture, see BeginTiledCapture. SetTiledCapture forces it and has to come before Initialize
+    void SetTiledCapture(bool);
+    bool IsTiledCapture();
+    bool IsTiledCaptureActive();
+    bool BeginTiledCapture(std::vector<uint8_t> &&, int, std::function<void(int, int, void*, size_t)>, std::function<void()>);
+    bool ContinueTiledCapture(std::chrono::microseconds);
 
-    int GetStillCaptureHeight();
-    int GetStillCaptureWidth();
-    int GetViewfinderHeight();
-    int GetViewfinderWidth();
-    int GetNumLuts();
+    // per stage times of viewfinder frames and stills rendered so far, tiled captures are not timed
+    RenderTimings &GetRenderTimings();
+
+    // Font Management
+    void RenderText(std::string, float, float, float, glm::vec3) override;
 }; // ShaderManager 
 
 #endif // SHADERMANAGER_HPP
@@ -0,0 +1,182 @@
+#ifndef SIMD_HPP
+#define SIMD_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/* 4 wide float vector for the CPU LUT paths. NEON on the Pi, SSE2 on x86 build machines, plain floats otherwise.
+   LUT nodes are stored as interleaved RGBA bytes so one node is one 32 bit load, widened, and no gathers are needed */
+struct Vec4f {
+#if defined(__ARM_NEON)
+    float32x4_t v;
+#elif defined(__SSE2__)
+    __m128 v;
+#else
+    float v[4];
+#endif
+};
+
+inline Vec4f Load4f(const float *ptr) {
+    Vec4f r;
+#if defined(__ARM_NEON)
+    r.v = vld1q_f32(ptr);
+#elif defined(__SSE2__)
+    r.v = _mm_loadu_ps(ptr);
+#else
+    for (int i = 0; i < 4; i++) r.v[i] = ptr[i];
+#endif
+    return r;
+}
+
+// 4 bytes as floats 0-255
+inline Vec4f LoadBytes4f(const unsigned char *ptr) {
+    uint32_t word;
+    std::memcpy(&word, ptr, sizeof(word));
+    Vec4f r;
+#if defined(__ARM_NEON)
+    uint16x8_t words = vmovl_u8(vreinterpret_u8_u32(vdup_n_u32(word)));
+    r.v = vcvtq_f32_u32(vmovl_u16(vget_low_u16(words)));
+#elif defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    __m128i bytes = _mm_cvtsi32_si128(static_cast<int>(word));
+    r.v = _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(bytes, zero), zero));
+#else
+    for (int i = 0; i < 4; i++) r.v[i] = ptr[i];
+#endif
+    return r;
+}
+
+inline void Store4f(float *ptr, Vec4f a) {
+#if defined(__ARM_NEON)
+    vst1q_f32(ptr, a.v);
+#elif defined(__SSE2__)
+    _mm_storeu_ps(ptr, a.v);
+#else
+    for (int i = 0; i < 4; i++) ptr[i] = a.v[i];
+#endif
+}
+
+inline Vec4f Splat4f(float x) {
+    Vec4f r;
+#if defined(__ARM_NEON)
+    r.v = vdupq_n_f32(x);
+#elif defined(__SSE2__)
+    r.v = _mm_set1_ps(x);
+#else
+    for (int i = 0; i < 4; i++) r.v[i] = x;
+#endif
+    return r;
+}
+
+inline Vec4f Set4f(float x, float y, float z, float w) {
+    float tmp[4] = {x, y, z, w};
+    return Load4f(tmp);
+}
+
+inline Vec4f operator+(Vec4f a, Vec4f b) {
+    Vec4f r;
+#if defined(__ARM_NEON)
+    r.v = vaddq_f32(a.v, b.v);
+#elif defined(__SSE2__)
+    r.v = _mm_add_ps(a.v, b.v);
+#else
+    for (int i = 0; i < 4; i++) r.v[i] = a.v[i] + b.v[i];
+#endif
+    return r;
+}
+
+inline Vec4f operator-(Vec4f a, Vec4f b) {
+    Vec4f r;
+#if defined(__ARM_NEON)
+    r.v = vsubq_f32(a.v, b.v);
+#elif defined(__SSE2__)
+    r.v = _mm_sub_ps(a.v, b.v);
+#else
+    for (int i = 0; i < 4; i++) r.v[i] = a.v[i] - b.v[i];
+#endif
+    return r;
+}
+
+inline Vec4f operator*(Vec4f a, Vec4f b) {
+    Vec4f r;
+#if defined(__ARM_NEON)
+    r.v = vmulq_f32(a.v, b.v);
+#elif defined(__SSE2__)
+    r.v = _mm_mul_ps(a.v, b.v);
+#else
+    for (int i = 0; i < 4; i++) r.v[i] = a.v[i] * b.v[i];
+#endif
+    return r;
+}
+
+inline Vec4f Min4f(Vec4f a, Vec4f b) {
+    Vec4f r;
+#if defined(__ARM_NEON)
+    r.v = vminq_f32(a.v, b.v);
+#elif defined(__SSE2__)
+    r.v = _mm_min_ps(a.v, b.v);
+#else
+    for (int i = 0; i < 4; i++) r.v[i] = std::min(a.v[i], b.v[i]);
+#endif
+    return r;
+}
+
+inline Vec4f Max4f(Vec4f a, Vec4f b) {
+    Vec4f r;
+#if defined(__ARM_NEON)
+    r.v = vmaxq_f32(a.v, b.v);
+#elif defined(__SSE2__)
+    r.v = _mm_max_ps(a.v, b.v);
+#else
+    for (int i = 0; i < 4; i++) r.v[i] = std::max(a.v[i], b.v[i]);
+#endif
+    return r;
+}
+
+inline Vec4f Clamp4f(Vec4f a, float lo, float hi) {
+    return Min4f(Max4f(a, Splat4f(lo)), Splat4f(hi));
+}
+
+// towards zero, exact for |a| < 2^31
+inline Vec4f Trunc4f(Vec4f a) {
+    Vec4f r;
+#if defined(__ARM_NEON)
+    r.v = vcvtq_f32_s32(vcvtq_s32_f32(a.v));
+#elif defined(__SSE2__)
+    r.v = _mm_cvtepi32_ps(_mm_cvttps_epi32(a.v));
+#else
+    for (int i = 0; i < 4; i++) r.v[i] = static_cast<float>(static_cast<int>(a.v[i]));
+#endif
+    return r;
+}
+
+// converts towards zero and stores 4 ints
+inline void StoreTrunc4i(int *ptr, Vec4f a) {
+#if defined(__ARM_NEON)
+    vst1q_s32(ptr, vcvtq_s32_f32(a.v));
+#elif defined(__SSE2__)
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(ptr), _mm_cvttps_epi32(a.v));
+#else
+    for (int i = 0; i < 4; i++) ptr[i] = static_cast<int>(a.v[i]);
+#endif
+}
+
+// a + (b - a) * t
+inline Vec4f Lerp4f(Vec4f a, Vec4f b, Vec4f t) {
+#if defined(__ARM_NEON) && defined(__aarch64__)
+    Vec4f r;
+    r.v = vfmaq_f32(a.v, vsubq_f32(b.v, a.v), t.v);
+    return r;
+#else
+    return a + (b - a) * t;
+#endif
+}
+
+#endif // SIMD_HPP
@@ -0,0 +1,126 @@
+#ifndef THREADPOOL_HPP
+#define THREADPOOL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+/* fixed set of worker threads shared by the CPU-side LUT work. ParallelFor splits a range into chunks, and the
+   calling thread works on chunks too, so it finishes even when every worker is busy with something else */
+class ThreadPool {
+private:
+    std::vector<std::thread> workers;
+    std::queue<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool shutdown = false;
+
+    struct ForState {
+        std::function<void(int, int)> fn;
+        std::atomic<int> next_chunk{0};
+        std::atomic<int> done_chunks{0};
+        int num_chunks;
+        int begin, end, chunk_size;
+        std::mutex mutex;
+        std::condition_variable cv;
+    };
+
+    static void RunChunks(ForState &state) {
+        int chunk;
+        while ((chunk = state.next_chunk.fetch_add(1)) < state.num_chunks) {
+            int chunk_begin = state.begin + chunk * state.chunk_size;
+            int chunk_end = std::min(chunk_begin + state.chunk_size, state.end);
+            state.fn(chunk_begin, chunk_end);
+
+            if (state.done_chunks.fetch_add(1) + 1 == state.num_chunks) {
+                std::unique_lock<std::mutex> lock(state.mutex);
+                state.cv.notify_all();
+            }
+        }
+    }
+
+    void WorkerLoop() {
+        while (true) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait(lock, [this]{ return !tasks.empty() || shutdown; });
+                if (shutdown && tasks.empty()) {
+                    return;
+                }
+                task = std::move(tasks.front());
+                tasks.pop();
+            }
+            task();
+        }
+    }
+
+public:
+    explicit ThreadPool(unsigned int num_threads = std::thread::hardware_concurrency()) {
+        if (num_threads == 0) {
+            num_threads = 1;
+        }
+        for (unsigned int i = 0; i < num_threads; i++) {
+            workers.emplace_back(&ThreadPool::WorkerLoop, this);
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            shutdown = true;
+        }
+        cv.notify_all();
+        for (std::thread &worker : workers) {
+            worker.join();
+        }
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    void Submit(std::function<void()> task) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            tasks.push(std::move(task));
+        }
+        cv.notify_one();
+    }
+
+    // calls fn(chunk_begin, chunk_end) over [begin, end) and blocks until every chunk is done
+    void ParallelFor(int begin, int end, std::function<void(int, int)> fn, int min_chunk = 1) {
+        if (end <= begin) {
+            return;
+        }
+
+        auto state = std::make_shared<ForState>();
+        int count = end - begin;
+        int target_chunks = static_cast<int>(workers.size()) * 4;
+        state->fn = std::move(fn);
+        state->begin = begin;
+        state->end = end;
+        state->chunk_size = std::max(min_chunk, (count + target_chunks - 1) / target_chunks);
+        state->num_chunks = (count + state->chunk_size - 1) / state->chunk_size;
+
+        int helpers = std::min(static_cast<int>(workers.size()), state->num_chunks - 1);
+        for (int i = 0; i < helpers; i++) {
+            Submit([state]{ RunChunks(*state); });
+        }
+        RunChunks(*state);
+
+        std::unique_lock<std::mutex> lock(state->mutex);
+        state->cv.wait(lock, [&]{ return state->done_chunks.load() == state->num_chunks; });
+    }
+
+    unsigned int GetNumThreads() {
+        return workers.size();
+    }
+};
+
+#endif // THREADPOOL_HPP
@@ -42,6 +42,7 @@ public:
             struct input_event ev;
             rc = libevdev_next_event(dev, LIBEVDEV_READ_FLAG_NORMAL, &ev);
             if (rc == LIBEVDEV_READ_STATUS_SUCCESS) {
+                interaction = true;
                 if (ev.type == EV_KEY && ev.code == BTN_TOUCH) { 
                     if (ev.value == 1)
                         HandleTouchDown();
@@ -83,6 +84,31 @@ public:
         prev_shader = false;
         return curr_prev_shader;
     }
+
+    bool ProcessContactSheet() {
+        bool curr_contact_sheet = contact_sheet;
+        contact_sheet = false;
+        return curr_contact_sheet;
+    }
+
+    bool ProcessMultiLook() {
+        bool curr_multi_look = multi_look;
+        multi_look = false;
+        return curr_multi_look;
+    }
+
+    bool ProcessCaptureFormat() {
+        bool curr_capture_format = capture_format;
+        capture_format = false;
+        return curr_capture_format;
+    }
+
+    // any input at all since the last call, gestures or not
+    bool ProcessInteraction() {
+        bool curr_interaction = interaction;
+        interaction = false;
+        return curr_interaction;
+    }
        
 
 
@@ -93,10 +119,16 @@ private:
     ScreenPosition touchdown_pos;
     ScreenPosition touchup_pos;
     std::chrono::time_point<std::chrono::system_clock> last_release;
+    std::chrono::time_point<std::chrono::system_clock> last_press;
     const std::chrono::milliseconds cooldown = std::chrono::milliseconds(100);
+    const std::chrono::milliseconds long_press = std::chrono::milliseconds(600);
     bool photo_request = false;
     bool next_shader = false;
     bool prev_shader = false;
+    bool contact_sheet = false;
+    bool multi_look = false;
+    bool capture_format = false;
+    bool interaction = false;
 
     enum TouchState {
         RELEASED,
@@ -139,6 +171,7 @@ private:
         std::chrono::duration<float> elapsed_ms = std::chrono::system_clock::now() - last_release;
         if (touch_state == TouchState::RELEASED && elapsed_ms > cooldown) {
             touch_state = TouchState::PRESSED;
+            last_press = std::chrono::system_clock::now();
         }
     }
 
@@ -149,7 +182,12 @@ private:
     
     void ProcessTouchState() {
         if (touch_state == TouchState::TRIGGERED && drag_direction == DragDirection::NONE) {
-            RequestPhoto();
+            if (std::chrono::system_clock::now() - last_press >= long_press) {
+                ToggleCaptureFormat();
+            }
+            else {
+                RequestPhoto();
+            }
             touch_state = TouchState::RELEASED;
             last_release = std::chrono::system_clock::now();
         }
@@ -164,10 +202,12 @@ private:
             last_release = std::chrono::system_clock::now();
         }
         else if (touch_state == TouchState::TRIGGERED && drag_direction == DragDirection::UP) {
+            ToggleContactSheet();
             touch_state = TouchState::RELEASED;
             last_release = std::chrono::system_clock::now();
         }
         else if (touch_state == TouchState::TRIGGERED && drag_direction == DragDirection::DOWN) {
+            ToggleMultiLook();
             touch_state = TouchState::RELEASED;
             last_release = std::chrono::system_clock::now();
         }
@@ -186,6 +226,18 @@ private:
         prev_shader = true;
     }
 
+    void ToggleContactSheet() {
+        contact_sheet = true;
+    }
+
+    void ToggleMultiLook() {
+        multi_look = true;
+    }
+
+    void ToggleCaptureFormat() {
+        capture_format = true;
+    }
+
     void DetectDirection(ScreenPosition initial_pos, ScreenPosition final_pos) {
         int delta_x = final_pos.pos_x - initial_pos.pos_x;
         int delta_y = final_pos.pos_y - initial_pos.pos_y;
@@ -0,0 +1,265 @@
+#include <Trace.hpp>
+#include <algorithm>
+#include <cstdio>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <log.hpp>
+
+std::atomic<bool> Tracer::enabled{true};
+
+namespace {
+
+int64_t ToNanoseconds(Tracer::Clock::time_point time) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+}
+
+/* written by one thread and read by a dump at any time, every field on its own so neither ever blocks. sequence
+   works like a seqlock: 2 * index + 1 while event index is being written into the slot, 2 * index + 2 once it is
+   complete. a reader keeps a copy only when it saw the same complete value before and after */
+struct TraceEvent {
+    std::atomic<uint64_t> sequence{0};
+    std::atomic<const char*> name{nullptr};
+    std::atomic<int64_t> start{0};     // ns on Tracer::Clock
+    std::atomic<int64_t> duration{0};  // ns, -1 for an instant event
+};
+
+struct EventCopy {
+    const char *name;
+    int64_t start;
+    int64_t duration;
+};
+
+struct ThreadEvents {
+    int tid;
+    const char *name;
+    std::vector<EventCopy> events;
+};
+
+/* one thread's events. at 30 frames a second and a dozen spans each the main thread fills it in about twenty
+   seconds, quieter threads hold much longer */
+class ThreadRing {
+private:
+    static const uint64_t capacity = 1 << 13;
+    TraceEvent events[capacity];
+    std::atomic<uint64_t> head{0}; // events ever pushed, the next one goes to head % capacity
+
+public:
+    int tid = 0;
+    std::atomic<const char*> name{nullptr};
+
+    void Push(const char *event_name, int64_t start, int64_t duration) {
+        uint64_t index = head.load(std::memory_order_relaxed);
+        TraceEvent &event = events[index % capacity];
+        // marked as being written before any field changes, the fence keeps the field stores behind it
+        event.sequence.store(2 * index + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        event.name.store(event_name, std::memory_order_relaxed);
+        event.start.store(start, std::memory_order_relaxed);
+        event.duration.store(duration, std::memory_order_relaxed);
+        event.sequence.store(2 * index + 2, std::memory_order_release);
+        head.store(index + 1, std::memory_order_release);
+    }
+
+    // events that ended at since or later. the writer keeps going meanwhile, a slot it was writing or rewrote
+    // during the copy is dropped, so no event is ever a mix of two
+    void Snapshot(int64_t since, std::vector<EventCopy> &out) const {
+        uint64_t end = head.load(std::memory_order_acquire);
+        uint64_t begin = end > capacity ? end - capacity : 0;
+        for (uint64_t i = begin; i < end; i++) {
+            const TraceEvent &event = events[i % capacity];
+            uint64_t sequence = event.sequence.load(std::memory_order_acquire);
+            if (sequence != 2 * i + 2) {
+                continue;
+            }
+            EventCopy copy{event.name.load(std::memory_order_relaxed), event.start.load(std::memory_order_relaxed),
+                           event.duration.load(std::memory_order_relaxed)};
+            // the field loads stay ahead of the check
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (event.sequence.load(std::memory_order_relaxed) != sequence) {
+                continue;
+            }
+            if (copy.name && copy.start + std::max<int64_t>(copy.duration, 0) >= since) {
+                out.push_back(copy);
+            }
+        }
+    }
+};
+
+struct Registry {
+    std::mutex mutex;
+    std::vector<std::shared_ptr<ThreadRing>> rings; // kept after their threads are gone, their events still count
+
+    std::string dump_dir;
+    std::chrono::milliseconds dump_window{0};
+    std::chrono::seconds dump_interval{0};
+    Tracer::Clock::time_point last_dump;
+    bool dumped = false;
+    std::thread dump_thread;
+    std::atomic<bool> dumping{false};
+};
+
+// never destroyed, threads may still trace while statics go away at exit
+Registry &GetRegistry() {
+    static Registry *registry = new Registry;
+    return *registry;
+}
+
+ThreadRing &GetRing() {
+    static thread_local std::shared_ptr<ThreadRing> ring;
+    if (!ring) {
+        ring = std::make_shared<ThreadRing>();
+        ring->tid = static_cast<int>(syscall(SYS_gettid));
+        Registry &registry = GetRegistry();
+        std::unique_lock<std::mutex> lock(registry.mutex);
+        registry.rings.push_back(ring);
+    }
+    return *ring;
+}
+
+// with the registry locked
+std::vector<ThreadEvents> Snapshot(Registry &registry, std::chrono::milliseconds window) {
+    int64_t since = window.count() > 0 ? ToNanoseconds(Tracer::Clock::now() - window) : INT64_MIN;
+    std::vector<ThreadEvents> threads;
+    for (const auto &ring : registry.rings) {
+        ThreadEvents thread{ring->tid, ring->name.load(std::memory_order_relaxed), {}};
+        ring->Snapshot(since, thread.events);
+        if (!thread.events.empty()) {
+            threads.push_back(std::move(thread));
+        }
+    }
+    return threads;
+}
+
+void WriteString(FILE *file, const char *text) {
+    fputc('"', file);
+    for (const char *c = text; *c; c++) {
+        if (*c == '"' || *c == '\\') {
+            fputc('\\', file);
+        }
+        fputc(static_cast<unsigned char>(*c) < 0x20 ? ' ' : *c, file);
+    }
+    fputc('"', file);
+}
+
+// Chrome's trace event format, timestamps in microseconds
+bool WriteJson(const std::string &path, const std::vector<ThreadEvents> &threads) {
+    FILE *file = fopen(path.c_str(), "w");
+    if (!file) {
+        LOG_ERR << "Cannot write trace " << path << "\n";
+        return false;
+    }
+    int pid = getpid();
+    bool first = true;
+    fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", file);
+    for (const ThreadEvents &thread : threads) {
+        if (thread.name) {
+            fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":", first ? "" : ",\n", pid, thread.tid);
+            WriteString(file, thread.name);
+            fputs("}}", file);
+            first = false;
+        }
+        for (const EventCopy &event : thread.events) {
+            fputs(first ? "{\"name\":" : ",\n{\"name\":", file);
+            WriteString(file, event.name);
+            if (event.duration < 0) {
+                fprintf(file, ",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d}", event.start * 1e-3, pid, thread.tid);
+            }
+            else {
+                fprintf(file, ",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d}", event.start * 1e-3,
+                        event.duration * 1e-3, pid, thread.tid);
+            }
+            first = false;
+        }
+    }
+    fputs("\n]}\n", file);
+    bool written = !ferror(file);
+    return fclose(file) == 0 && written;
+}
+
+} // namespace
+
+void Tracer::SetEnabled(bool enable) {
+    enabled.store(enable, std::memory_order_relaxed);
+}
+
+void Tracer::SetThreadName(const char *name) {
+    const char *unnamed = nullptr;
+    GetRing().name.compare_exchange_strong(unnamed, name, std::memory_order_relaxed);
+}
+
+void Tracer::Complete(const char *name, Clock::time_point start, Clock::time_point end) {
+    if (!IsEnabled()) {
+        return;
+    }
+    GetRing().Push(name, ToNanoseconds(start), ToNanoseconds(end) - ToNanoseconds(start));
+}
+
+void Tracer::Instant(const char *name) {
+    if (!IsEnabled()) {
+        return;
+    }
+    GetRing().Push(name, ToNanoseconds(Clock::now()), -1);
+}
+
+bool Tracer::WriteChromeTrace(const std::string &path, std::chrono::milliseconds window) {
+    std::vector<ThreadEvents> threads;
+    {
+        Registry &registry = GetRegistry();
+        std::unique_lock<std::mutex> lock(registry.mutex);
+        threads = Snapshot(registry, window);
+    }
+    return WriteJson(path, threads);
+}
+
+void Tracer::SetFlightRecorder(const std::string &dir, std::chrono::milliseconds window, std::chrono::seconds min_interval) {
+    Registry &registry = GetRegistry();
+    std::unique_lock<std::mutex> lock(registry.mutex);
+    registry.dump_dir = dir;
+    registry.dump_window = window;
+    registry.dump_interval = min_interval;
+}
+
+bool Tracer::DumpFlightRecorder(const char *reason) {
+    Registry &registry = GetRegistry();
+    std::unique_lock<std::mutex> lock(registry.mutex);
+    Clock::time_point now = Clock::now();
+    if (registry.dump_dir.empty() || registry.dumping.load() || (registry.dumped && now - registry.last_dump < registry.dump_interval)) {
+        return false;
+    }
+    registry.last_dump = now;
+    registry.dumped = true;
+
+    std::vector<ThreadEvents> threads = Snapshot(registry, registry.dump_window);
+    std::string path = registry.dump_dir + "/trace-" + std::to_string(time(nullptr)) + "-" + reason + ".json";
+    for (size_t i = registry.dump_dir.size() + 1; i < path.size(); i++) {
+        if (path[i] == ' ' || path[i] == '/') {
+            path[i] = '-';
+        }
+    }
+
+    // the last dump is done, dumping is false
+    if (registry.dump_thread.joinable()) {
+        registry.dump_thread.join();
+    }
+    registry.dumping = true;
+    registry.dump_thread = std::thread([threads = std::move(threads), path]() {
+        if (WriteJson(path, threads)) {
+            LOG << "Flight recorder written to " << path << std::endl;
+        }
+        GetRegistry().dumping = false;
+    });
+    return true;
+}
+
+void Tracer::Flush() {
+    Registry &registry = GetRegistry();
+    std::unique_lock<std::mutex> lock(registry.mutex);
+    if (registry.dump_thread.joinable()) {
+        registry.dump_thread.join();
+    }
+}
@@ -0,0 +1,71 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+/* spans and instant events from every thread of the pipeline, cheap enough to stay on all the time. each thread
+   writes into a ring of its own with a few atomic stores and no lock, so the rings always hold the last few
+   seconds. a sequence number per slot lets a dump skip events that are overwritten while it copies them.
+   WriteChromeTrace exports them as Chrome trace JSON, for chrome://tracing or ui.perfetto.dev, and
+   DumpFlightRecorder does so in the background when something went wrong, like a missed frame deadline.
+   names have to outlive the trace, string literals */
+class Tracer {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static void SetEnabled(bool);
+    static bool IsEnabled() { return enabled.load(std::memory_order_relaxed); }
+    // shows up as the thread's name in the trace, the first call on a thread counts
+    static void SetThreadName(const char *);
+
+    static void Complete(const char *name, Clock::time_point start, Clock::time_point end);
+    static void Instant(const char *name);
+
+    // everything in the rings from the last window, all of it when window is zero. false when the file can not
+    // be written
+    static bool WriteChromeTrace(const std::string &path, std::chrono::milliseconds window = std::chrono::milliseconds(0));
+
+    // DumpFlightRecorder writes the last window to dir, named after the time and reason, at most once per
+    // min_interval. the rings are copied right away and written on a thread of the tracer
+    static void SetFlightRecorder(const std::string &dir, std::chrono::milliseconds window, std::chrono::seconds min_interval);
+    // false when skipped, because nothing is set up, a dump is still being written or the last was too recent
+    static bool DumpFlightRecorder(const char *reason);
+    // waits for a dump being written
+    static void Flush();
+
+private:
+    static std::atomic<bool> enabled;
+};
+
+// the enclosing scope as a span
+class TraceSpan {
+private:
+    const char *name;
+    Tracer::Clock::time_point start;
+
+public:
+    explicit TraceSpan(const char *name) : name(name) {
+        if (Tracer::IsEnabled()) {
+            start = Tracer::Clock::now();
+        }
+        else {
+            this->name = nullptr;
+        }
+    }
+    ~TraceSpan() {
+        if (name) {
+            Tracer::Complete(name, start, Tracer::Clock::now());
+        }
+    }
+    TraceSpan(const TraceSpan &) = delete;
+    TraceSpan &operator=(const TraceSpan &) = delete;
+};
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+#define TRACE_SCOPE(name) TraceSpan TRACE_CONCAT(trace_span_, __LINE__)(name)
+
+#endif // TRACE_HPP
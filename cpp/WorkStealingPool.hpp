@@ -0,0 +1,145 @@
+#ifndef WORKSTEALINGPOOL_HPP
+#define WORKSTEALINGPOOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/* worker threads with a task deque each, for jobs that spawn their own follow-up work. a task submitted from a
+   worker goes to the back of that worker's deque, and workers take their own newest task first, so the next stage
+   of a job runs where its data is still in cache and few jobs are in flight at once. a worker that runs dry steals
+   the oldest task of another one. tasks submitted from outside are dealt round robin */
+class WorkStealingPool {
+private:
+    struct Queue {
+        std::deque<std::function<void()>> tasks;
+        std::mutex mutex;
+    };
+
+    struct WorkerId {
+        const WorkStealingPool *pool = nullptr;
+        int index = -1;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> workers;
+    std::atomic<int> outstanding{0}; // submitted and not finished, follow-ups included
+    std::atomic<int> queued{0};      // sitting in a deque. raised under mutex, so a worker going to sleep sees it
+    std::atomic<unsigned int> next_queue{0};
+    std::atomic<size_t> steals{0};
+    std::mutex mutex;
+    std::condition_variable work_cv;  // workers wait here when every deque is empty
+    std::condition_variable done_cv;  // Wait waits here
+    bool shutdown = false;
+
+    static WorkerId &CurrentWorker() {
+        static thread_local WorkerId id;
+        return id;
+    }
+
+    bool Pop(int index, std::function<void()> &task) {
+        {
+            Queue &own = *queues[index];
+            std::unique_lock<std::mutex> lock(own.mutex);
+            if (!own.tasks.empty()) {
+                task = std::move(own.tasks.back());
+                own.tasks.pop_back();
+                return true;
+            }
+        }
+        for (size_t i = 1; i < queues.size(); i++) {
+            Queue &victim = *queues[(index + i) % queues.size()];
+            std::unique_lock<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty()) {
+                task = std::move(victim.tasks.front());
+                victim.tasks.pop_front();
+                steals++;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void WorkerLoop(int index) {
+        CurrentWorker() = {this, index};
+        std::function<void()> task;
+        while (true) {
+            if (Pop(index, task)) {
+                queued--;
+                task();
+                task = nullptr;
+                if (outstanding.fetch_sub(1) == 1) {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    done_cv.notify_all();
+                }
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(mutex);
+            work_cv.wait(lock, [this]{ return queued.load() > 0 || shutdown; });
+            if (shutdown && queued.load() <= 0) {
+                return;
+            }
+        }
+    }
+
+public:
+    explicit WorkStealingPool(unsigned int num_threads = std::thread::hardware_concurrency()) {
+        if (num_threads == 0) {
+            num_threads = 1;
+        }
+        for (unsigned int i = 0; i < num_threads; i++) {
+            queues.emplace_back(new Queue);
+        }
+        for (unsigned int i = 0; i < num_threads; i++) {
+            workers.emplace_back(&WorkStealingPool::WorkerLoop, this, i);
+        }
+    }
+
+    ~WorkStealingPool() {
+        Wait();
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            shutdown = true;
+        }
+        work_cv.notify_all();
+        for (std::thread &worker : workers) {
+            worker.join();
+        }
+    }
+
+    WorkStealingPool(const WorkStealingPool &) = delete;
+    WorkStealingPool &operator=(const WorkStealingPool &) = delete;
+
+    void Submit(std::function<void()> task) {
+        outstanding++;
+        const WorkerId &id = CurrentWorker();
+        int index = id.pool == this ? id.index : static_cast<int>(next_queue.fetch_add(1) % queues.size());
+        {
+            Queue &queue = *queues[index];
+            std::unique_lock<std::mutex> lock(queue.mutex);
+            queue.tasks.push_back(std::move(task));
+        }
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            queued++;
+        }
+        work_cv.notify_one();
+    }
+
+    // blocks until every task has run, the ones submitted by tasks as well. not from a worker
+    void Wait() {
+        std::unique_lock<std::mutex> lock(mutex);
+        done_cv.wait(lock, [this]{ return outstanding.load() == 0; });
+    }
+
+    size_t GetSteals() const { return steals.load(); }
+    unsigned int GetNumThreads() const { return workers.size(); }
+};
+
+#endif // WORKSTEALINGPOOL_HPP
@@ -0,0 +1,457 @@
+#include <YuvConvert.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define YUV_X86 1
+#endif
+
+namespace {
+
+constexpr int Fixed(double x) {
+    return static_cast<int>(x * 65536.0 + (x < 0 ? -0.5 : 0.5));
+}
+
+/* every kernel computes
+       out = clamp((ky * (Y - y_offset) + kr * c2 + 32768) >> 16)
+   per channel in 32 bit integers, with c2 = 2 * C - chroma_bias so that the shaders' half level chroma centre
+   stays an integer. the coefficients are the float matrix in 16.16 against c2, which halves them */
+template <YuvMatrix M, YuvRange R>
+struct YuvCoefficients {
+    static constexpr double rv = M == YuvMatrix::BT601 ? 1.4020 : 1.5748;
+    static constexpr double gu = M == YuvMatrix::BT601 ? 0.3441 : 0.1873;
+    static constexpr double gv = M == YuvMatrix::BT601 ? 0.7141 : 0.4681;
+    static constexpr double bu = M == YuvMatrix::BT601 ? 1.7720 : 1.8556;
+    static constexpr double chroma_scale = R == YuvRange::FULL ? 0.5 : 0.5 * 255.0 / 224.0;
+
+    static constexpr int ky = R == YuvRange::FULL ? 65536 : Fixed(255.0 / 219.0);
+    static constexpr int y_offset = R == YuvRange::FULL ? 0 : 16;
+    static constexpr int chroma_bias = R == YuvRange::FULL ? 255 : 256;
+    static constexpr int krv = Fixed(rv * chroma_scale);
+    static constexpr int kgu = -Fixed(gu * chroma_scale);
+    static constexpr int kgv = -Fixed(gv * chroma_scale);
+    static constexpr int kbu = Fixed(bu * chroma_scale);
+};
+
+template <RgbFormat F>
+constexpr int BytesPerPixel() {
+    return F == RgbFormat::RGB888 ? 3 : 4;
+}
+
+template <RgbFormat F>
+inline void StorePixel(unsigned char *dst, int r, int g, int b) {
+    if (F == RgbFormat::XRGB8888) {
+        dst[0] = b;
+        dst[1] = g;
+        dst[2] = r;
+        dst[3] = 255;
+        return;
+    }
+    dst[0] = r;
+    dst[1] = g;
+    dst[2] = b;
+    if (F == RgbFormat::RGBA8888) {
+        dst[3] = 255;
+    }
+}
+
+inline int Descale(int acc) {
+    return std::clamp(acc >> 16, 0, 255);
+}
+
+// one output row, u is the CbCr plane for NV12
+using RowKernel = void (*)(const unsigned char *y, const unsigned char *u, const unsigned char *v,
+                           unsigned char *dst, int width);
+
+struct ScalarIsa {
+    template <class C, RgbFormat F, bool NV12>
+    static void RowFrom(const unsigned char *y, const unsigned char *u, const unsigned char *v,
+                        unsigned char *dst, int x_begin, int width) {
+        for (int x = x_begin; x < width; x++) {
+            int cx = x / 2;
+            int cb = NV12 ? u[cx * 2] : u[cx];
+            int cr = NV12 ? u[cx * 2 + 1] : v[cx];
+            int u2 = 2 * cb - C::chroma_bias;
+            int v2 = 2 * cr - C::chroma_bias;
+            int luma = C::ky * (y[x] - C::y_offset) + 32768;
+            StorePixel<F>(dst + x * BytesPerPixel<F>(), Descale(luma + C::krv * v2),
+                          Descale(luma + C::kgu * u2 + C::kgv * v2), Descale(luma + C::kbu * u2));
+        }
+    }
+
+    template <class C, RgbFormat F, bool NV12>
+    static void Row(const unsigned char *y, const unsigned char *u, const unsigned char *v, unsigned char *dst, int width) {
+        RowFrom<C, F, NV12>(y, u, v, dst, 0, width);
+    }
+};
+
+#if defined(YUV_X86)
+
+// R, G, B bytes of 16 pixels to dst in format F
+template <RgbFormat F>
+__attribute__((target("sse4.1"))) inline void Store16(__m128i r, __m128i g, __m128i b, unsigned char *dst) {
+    const __m128i opaque = _mm_set1_epi8(static_cast<char>(0xff));
+    // XRGB8888 is BGRX in memory
+    __m128i first = F == RgbFormat::XRGB8888 ? b : r;
+    __m128i third = F == RgbFormat::XRGB8888 ? r : b;
+    __m128i fg_lo = _mm_unpacklo_epi8(first, g);
+    __m128i fg_hi = _mm_unpackhi_epi8(first, g);
+    __m128i ta_lo = _mm_unpacklo_epi8(third, opaque);
+    __m128i ta_hi = _mm_unpackhi_epi8(third, opaque);
+    __m128i px[4] = {
+        _mm_unpacklo_epi16(fg_lo, ta_lo), _mm_unpackhi_epi16(fg_lo, ta_lo),
+        _mm_unpacklo_epi16(fg_hi, ta_hi), _mm_unpackhi_epi16(fg_hi, ta_hi)
+    };
+
+    if (F != RgbFormat::RGB888) {
+        for (int i = 0; i < 4; i++) {
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(dst) + i, px[i]);
+        }
+        return;
+    }
+
+    // drop the alpha bytes, 4 x 12 bytes go out as 3 x 16
+    const __m128i drop_alpha = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    for (int i = 0; i < 4; i++) {
+        px[i] = _mm_shuffle_epi8(px[i], drop_alpha);
+    }
+    __m128i *out = reinterpret_cast<__m128i *>(dst);
+    _mm_storeu_si128(out + 0, _mm_or_si128(px[0], _mm_slli_si128(px[1], 12)));
+    _mm_storeu_si128(out + 1, _mm_or_si128(_mm_srli_si128(px[1], 4), _mm_slli_si128(px[2], 8)));
+    _mm_storeu_si128(out + 2, _mm_or_si128(_mm_srli_si128(px[2], 8), _mm_slli_si128(px[3], 4)));
+}
+
+// 8 Cb and 8 Cr bytes for 16 pixels, in the low halves
+template <bool NV12>
+__attribute__((target("sse4.1"))) inline void LoadChroma8(const unsigned char *u, const unsigned char *v, int x,
+                                                          __m128i &cb, __m128i &cr) {
+    if (NV12) {
+        __m128i uv = _mm_loadu_si128(reinterpret_cast<const __m128i *>(u + x));
+        cb = _mm_shuffle_epi8(uv, _mm_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14, -1, -1, -1, -1, -1, -1, -1, -1));
+        cr = _mm_shuffle_epi8(uv, _mm_setr_epi8(1, 3, 5, 7, 9, 11, 13, 15, -1, -1, -1, -1, -1, -1, -1, -1));
+    }
+    else {
+        cb = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(u + x / 2));
+        cr = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(v + x / 2));
+    }
+}
+
+// one channel of 16 pixels from the luma terms of 4 pixels each and the chroma terms of 4 samples each
+__attribute__((target("sse4.1"))) inline __m128i Channel16(const __m128i *luma, __m128i chroma_lo, __m128i chroma_hi) {
+    // every chroma sample covers 2 pixels
+    __m128i p0 = _mm_srai_epi32(_mm_add_epi32(luma[0], _mm_unpacklo_epi32(chroma_lo, chroma_lo)), 16);
+    __m128i p1 = _mm_srai_epi32(_mm_add_epi32(luma[1], _mm_unpackhi_epi32(chroma_lo, chroma_lo)), 16);
+    __m128i p2 = _mm_srai_epi32(_mm_add_epi32(luma[2], _mm_unpacklo_epi32(chroma_hi, chroma_hi)), 16);
+    __m128i p3 = _mm_srai_epi32(_mm_add_epi32(luma[3], _mm_unpackhi_epi32(chroma_hi, chroma_hi)), 16);
+    return _mm_packus_epi16(_mm_packs_epi32(p0, p1), _mm_packs_epi32(p2, p3));
+}
+
+struct Sse41Isa {
+    template <class C, RgbFormat F, bool NV12>
+    __attribute__((target("sse4.1")))
+    static void Row(const unsigned char *y, const unsigned char *u, const unsigned char *v, unsigned char *dst, int width) {
+        const __m128i ky = _mm_set1_epi32(C::ky);
+        const __m128i luma_base = _mm_set1_epi32(32768 - C::ky * C::y_offset);
+        const __m128i bias = _mm_set1_epi32(C::chroma_bias);
+        const __m128i krv = _mm_set1_epi32(C::krv);
+        const __m128i kgu = _mm_set1_epi32(C::kgu);
+        const __m128i kgv = _mm_set1_epi32(C::kgv);
+        const __m128i kbu = _mm_set1_epi32(C::kbu);
+
+        int x = 0;
+        for (; x + 16 <= width; x += 16) {
+            __m128i cb, cr;
+            LoadChroma8<NV12>(u, v, x, cb, cr);
+            __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i *>(y + x));
+
+            // ky * (Y - y_offset) + round for 4 pixels at a time
+            __m128i luma[4] = {
+                _mm_cvtepu8_epi32(pixels), _mm_cvtepu8_epi32(_mm_srli_si128(pixels, 4)),
+                _mm_cvtepu8_epi32(_mm_srli_si128(pixels, 8)), _mm_cvtepu8_epi32(_mm_srli_si128(pixels, 12))
+            };
+            for (int q = 0; q < 4; q++) {
+                luma[q] = _mm_add_epi32(_mm_mullo_epi32(ky, luma[q]), luma_base);
+            }
+
+            __m128i u2_lo = _mm_sub_epi32(_mm_slli_epi32(_mm_cvtepu8_epi32(cb), 1), bias);
+            __m128i u2_hi = _mm_sub_epi32(_mm_slli_epi32(_mm_cvtepu8_epi32(_mm_srli_si128(cb, 4)), 1), bias);
+            __m128i v2_lo = _mm_sub_epi32(_mm_slli_epi32(_mm_cvtepu8_epi32(cr), 1), bias);
+            __m128i v2_hi = _mm_sub_epi32(_mm_slli_epi32(_mm_cvtepu8_epi32(_mm_srli_si128(cr, 4)), 1), bias);
+
+            __m128i r = Channel16(luma, _mm_mullo_epi32(krv, v2_lo), _mm_mullo_epi32(krv, v2_hi));
+            __m128i g = Channel16(luma, _mm_add_epi32(_mm_mullo_epi32(kgu, u2_lo), _mm_mullo_epi32(kgv, v2_lo)),
+                                  _mm_add_epi32(_mm_mullo_epi32(kgu, u2_hi), _mm_mullo_epi32(kgv, v2_hi)));
+            __m128i b = Channel16(luma, _mm_mullo_epi32(kbu, u2_lo), _mm_mullo_epi32(kbu, u2_hi));
+            Store16<F>(r, g, b, dst + x * BytesPerPixel<F>());
+        }
+        ScalarIsa::RowFrom<C, F, NV12>(y, u, v, dst, x, width);
+    }
+};
+
+// the same with 8 lanes, chroma terms of all 8 samples in one vector
+__attribute__((target("avx2"))) inline __m128i Channel16(__m256i luma_lo, __m256i luma_hi, __m256i chroma) {
+    __m256i lo = _mm256_add_epi32(luma_lo, _mm256_permutevar8x32_epi32(chroma, _mm256_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3)));
+    __m256i hi = _mm256_add_epi32(luma_hi, _mm256_permutevar8x32_epi32(chroma, _mm256_setr_epi32(4, 4, 5, 5, 6, 6, 7, 7)));
+    // packs works within 128 bit lanes, put the quarters back in order
+    __m256i words = _mm256_permute4x64_epi64(_mm256_packs_epi32(_mm256_srai_epi32(lo, 16), _mm256_srai_epi32(hi, 16)), 0xd8);
+    return _mm_packus_epi16(_mm256_castsi256_si128(words), _mm256_extracti128_si256(words, 1));
+}
+
+struct Avx2Isa {
+    template <class C, RgbFormat F, bool NV12>
+    __attribute__((target("avx2")))
+    static void Row(const unsigned char *y, const unsigned char *u, const unsigned char *v, unsigned char *dst, int width) {
+        const __m256i ky = _mm256_set1_epi32(C::ky);
+        const __m256i luma_base = _mm256_set1_epi32(32768 - C::ky * C::y_offset);
+        const __m256i bias = _mm256_set1_epi32(C::chroma_bias);
+        const __m256i krv = _mm256_set1_epi32(C::krv);
+        const __m256i kgu = _mm256_set1_epi32(C::kgu);
+        const __m256i kgv = _mm256_set1_epi32(C::kgv);
+        const __m256i kbu = _mm256_set1_epi32(C::kbu);
+
+        int x = 0;
+        for (; x + 16 <= width; x += 16) {
+            __m128i cb, cr;
+            LoadChroma8<NV12>(u, v, x, cb, cr);
+            __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i *>(y + x));
+
+            __m256i luma_lo = _mm256_add_epi32(_mm256_mullo_epi32(ky, _mm256_cvtepu8_epi32(pixels)), luma_base);
+            __m256i luma_hi = _mm256_add_epi32(_mm256_mullo_epi32(ky, _mm256_cvtepu8_epi32(_mm_srli_si128(pixels, 8))), luma_base);
+            __m256i u2 = _mm256_sub_epi32(_mm256_slli_epi32(_mm256_cvtepu8_epi32(cb), 1), bias);
+            __m256i v2 = _mm256_sub_epi32(_mm256_slli_epi32(_mm256_cvtepu8_epi32(cr), 1), bias);
+
+            __m128i r = Channel16(luma_lo, luma_hi, _mm256_mullo_epi32(krv, v2));
+            __m128i g = Channel16(luma_lo, luma_hi, _mm256_add_epi32(_mm256_mullo_epi32(kgu, u2), _mm256_mullo_epi32(kgv, v2)));
+            __m128i b = Channel16(luma_lo, luma_hi, _mm256_mullo_epi32(kbu, u2));
+            Store16<F>(r, g, b, dst + x * BytesPerPixel<F>());
+        }
+        ScalarIsa::RowFrom<C, F, NV12>(y, u, v, dst, x, width);
+    }
+};
+
+#endif // YUV_X86
+
+#if defined(__ARM_NEON)
+
+struct NeonIsa {
+    template <class C, RgbFormat F, bool NV12>
+    static void Row(const unsigned char *y, const unsigned char *u, const unsigned char *v, unsigned char *dst, int width) {
+        const int16x8_t bias = vdupq_n_s16(C::chroma_bias);
+        // ky * (Y - y_offset) + round as one multiply-accumulate
+        const int32x4_t luma_base = vdupq_n_s32(32768 - C::ky * C::y_offset);
+        const uint8x16_t opaque = vdupq_n_u8(255);
+
+        int x = 0;
+        for (; x + 16 <= width; x += 16) {
+            uint8x8_t cb, cr;
+            if (NV12) {
+                uint8x8x2_t uv = vld2_u8(u + x);
+                cb = uv.val[0];
+                cr = uv.val[1];
+            }
+            else {
+                cb = vld1_u8(u + x / 2);
+                cr = vld1_u8(v + x / 2);
+            }
+            uint8x16_t luma = vld1q_u8(y + x);
+
+            int16x8_t u2 = vsubq_s16(vshlq_n_s16(vreinterpretq_s16_u16(vmovl_u8(cb)), 1), bias);
+            int16x8_t v2 = vsubq_s16(vshlq_n_s16(vreinterpretq_s16_u16(vmovl_u8(cr)), 1), bias);
+
+            // chroma terms for samples 0-3 and 4-7, each zipped out to the 2 pixels it covers
+            int32x4_t rc[4], gc[4], bc[4];
+            for (int h = 0; h < 2; h++) {
+                int32x4_t u32 = vmovl_s16(h ? vget_high_s16(u2) : vget_low_s16(u2));
+                int32x4_t v32 = vmovl_s16(h ? vget_high_s16(v2) : vget_low_s16(v2));
+                int32x4_t r = vmulq_n_s32(v32, C::krv);
+                int32x4_t g = vmlaq_n_s32(vmulq_n_s32(u32, C::kgu), v32, C::kgv);
+                int32x4_t b = vmulq_n_s32(u32, C::kbu);
+                int32x4x2_t rz = vzipq_s32(r, r);
+                int32x4x2_t gz = vzipq_s32(g, g);
+                int32x4x2_t bz = vzipq_s32(b, b);
+                rc[h * 2] = rz.val[0];
+                rc[h * 2 + 1] = rz.val[1];
+                gc[h * 2] = gz.val[0];
+                gc[h * 2 + 1] = gz.val[1];
+                bc[h * 2] = bz.val[0];
+                bc[h * 2 + 1] = bz.val[1];
+            }
+
+            int16x4_t r16[4], g16[4], b16[4];
+            for (int q = 0; q < 4; q++) {
+                uint16x8_t luma16 = vmovl_u8(q < 2 ? vget_low_u8(luma) : vget_high_u8(luma));
+                int32x4_t y32 = vreinterpretq_s32_u32(vmovl_u16((q & 1) ? vget_high_u16(luma16) : vget_low_u16(luma16)));
+                int32x4_t yt = vmlaq_n_s32(luma_base, y32, C::ky);
+                r16[q] = vqmovn_s32(vshrq_n_s32(vaddq_s32(yt, rc[q]), 16));
+                g16[q] = vqmovn_s32(vshrq_n_s32(vaddq_s32(yt, gc[q]), 16));
+                b16[q] = vqmovn_s32(vshrq_n_s32(vaddq_s32(yt, bc[q]), 16));
+            }
+            auto narrow = [](const int16x4_t *c) {
+                return vcombine_u8(vqmovun_s16(vcombine_s16(c[0], c[1])), vqmovun_s16(vcombine_s16(c[2], c[3])));
+            };
+            uint8x16_t r = narrow(r16);
+            uint8x16_t g = narrow(g16);
+            uint8x16_t b = narrow(b16);
+
+            unsigned char *out = dst + x * BytesPerPixel<F>();
+            if (F == RgbFormat::RGB888) {
+                uint8x16x3_t px = {{r, g, b}};
+                vst3q_u8(out, px);
+            }
+            else if (F == RgbFormat::RGBA8888) {
+                uint8x16x4_t px = {{r, g, b, opaque}};
+                vst4q_u8(out, px);
+            }
+            else {
+                uint8x16x4_t px = {{b, g, r, opaque}};
+                vst4q_u8(out, px);
+            }
+        }
+        ScalarIsa::RowFrom<C, F, NV12>(y, u, v, dst, x, width);
+    }
+};
+
+#endif // __ARM_NEON
+
+// every matrix, range, format and layout combination of one instruction set
+template <class Isa, class C, RgbFormat F>
+RowKernel PickLayout(YuvLayout layout) {
+    if (layout == YuvLayout::NV12) {
+        return &Isa::template Row<C, F, true>;
+    }
+    return &Isa::template Row<C, F, false>;
+}
+
+template <class Isa, class C>
+RowKernel PickFormat(RgbFormat format, YuvLayout layout) {
+    switch (format) {
+    case RgbFormat::RGB888:
+        return PickLayout<Isa, C, RgbFormat::RGB888>(layout);
+    case RgbFormat::RGBA8888:
+        return PickLayout<Isa, C, RgbFormat::RGBA8888>(layout);
+    case RgbFormat::XRGB8888:
+        return PickLayout<Isa, C, RgbFormat::XRGB8888>(layout);
+    }
+    return nullptr;
+}
+
+template <class Isa>
+RowKernel PickKernel(YuvMatrix matrix, YuvRange range, RgbFormat format, YuvLayout layout) {
+    if (matrix == YuvMatrix::BT601) {
+        return range == YuvRange::FULL ? PickFormat<Isa, YuvCoefficients<YuvMatrix::BT601, YuvRange::FULL>>(format, layout)
+                                       : PickFormat<Isa, YuvCoefficients<YuvMatrix::BT601, YuvRange::LIMITED>>(format, layout);
+    }
+    return range == YuvRange::FULL ? PickFormat<Isa, YuvCoefficients<YuvMatrix::BT709, YuvRange::FULL>>(format, layout)
+                                   : PickFormat<Isa, YuvCoefficients<YuvMatrix::BT709, YuvRange::LIMITED>>(format, layout);
+}
+
+bool IsSupported(YuvKernel kernel) {
+    switch (kernel) {
+    case YuvKernel::SCALAR:
+        return true;
+#if defined(YUV_X86)
+    case YuvKernel::SSE41:
+        return __builtin_cpu_supports("sse4.1");
+    case YuvKernel::AVX2:
+        return __builtin_cpu_supports("avx2");
+#endif
+#if defined(__ARM_NEON)
+    case YuvKernel::NEON:
+        return true;
+#endif
+    default:
+        return false;
+    }
+}
+
+YuvKernel DetectKernel() {
+#if defined(YUV_X86)
+    __builtin_cpu_init();
+#endif
+    for (YuvKernel kernel : {YuvKernel::NEON, YuvKernel::AVX2, YuvKernel::SSE41}) {
+        if (IsSupported(kernel)) {
+            return kernel;
+        }
+    }
+    return YuvKernel::SCALAR;
+}
+
+std::atomic<YuvKernel> &ActiveKernel() {
+    static std::atomic<YuvKernel> kernel(DetectKernel());
+    return kernel;
+}
+
+} // namespace
+
+YuvFrame MakeI420Frame(const unsigned char *frame, int width, int height, int stride) {
+    const unsigned char *u = frame + static_cast<size_t>(stride) * height;
+    const unsigned char *v = u + static_cast<size_t>(stride / 2) * (height / 2);
+    return {frame, u, v, width, height, stride, stride / 2, YuvLayout::I420};
+}
+
+YuvFrame MakeNV12Frame(const unsigned char *frame, int width, int height, int stride) {
+    const unsigned char *uv = frame + static_cast<size_t>(stride) * height;
+    return {frame, uv, nullptr, width, height, stride, stride, YuvLayout::NV12};
+}
+
+void ConvertYuvToRgb(const YuvFrame &frame, unsigned char *dst, int dst_stride, RgbFormat format,
+                     YuvMatrix matrix, YuvRange range, int row_begin, int row_end) {
+    if (row_end < 0) {
+        row_end = frame.Height;
+    }
+
+    RowKernel row_kernel = nullptr;
+    switch (ActiveKernel().load()) {
+#if defined(YUV_X86)
+    case YuvKernel::SSE41:
+        row_kernel = PickKernel<Sse41Isa>(matrix, range, format, frame.Layout);
+        break;
+    case YuvKernel::AVX2:
+        row_kernel = PickKernel<Avx2Isa>(matrix, range, format, frame.Layout);
+        break;
+#endif
+#if defined(__ARM_NEON)
+    case YuvKernel::NEON:
+        row_kernel = PickKernel<NeonIsa>(matrix, range, format, frame.Layout);
+        break;
+#endif
+    default:
+        row_kernel = PickKernel<ScalarIsa>(matrix, range, format, frame.Layout);
+        break;
+    }
+
+    for (int row = row_begin; row < row_end; row++) {
+        const unsigned char *u = frame.U + static_cast<size_t>(row / 2) * frame.UVStride;
+        const unsigned char *v = frame.V ? frame.V + static_cast<size_t>(row / 2) * frame.UVStride : nullptr;
+        row_kernel(frame.Y + static_cast<size_t>(row) * frame.YStride, u, v, dst + static_cast<size_t>(row) * dst_stride, frame.Width);
+    }
+}
+
+YuvKernel GetYuvKernel() {
+    return ActiveKernel().load();
+}
+
+bool SetYuvKernel(YuvKernel kernel) {
+    if (!IsSupported(kernel)) {
+        return false;
+    }
+    ActiveKernel() = kernel;
+    return true;
+}
+
+const char *GetYuvKernelName(YuvKernel kernel) {
+    switch (kernel) {
+    case YuvKernel::SSE41:
+        return "SSE4.1";
+    case YuvKernel::AVX2:
+        return "AVX2";
+    case YuvKernel::NEON:
+        return "NEON";
+    default:
+        return "scalar";
+    }
+}
@@ -0,0 +1,63 @@
+#ifndef YUVCONVERT_HPP
+#define YUVCONVERT_HPP
+
+enum class YuvMatrix {
+    BT601, // the shaders' matrix
+    BT709
+};
+
+enum class YuvRange {
+    FULL,   // 0-255, chroma centred the way the shaders' normalised textures see it (C / 255 - 0.5)
+    LIMITED // 16-235 luma, 16-240 chroma
+};
+
+enum class YuvLayout {
+    I420, // three planes, what PiCamera hands over
+    NV12  // luma plane and one interleaved CbCr plane
+};
+
+enum class RgbFormat {
+    RGB888,  // R, G, B bytes like the capture readback
+    RGBA8888,
+    XRGB8888 // the DRM format, B, G, R, X bytes in memory
+};
+
+enum class YuvKernel {
+    SCALAR,
+    SSE41,
+    AVX2,
+    NEON
+};
+
+// planes of a 4:2:0 frame. for NV12 U points at the interleaved plane and V is unused
+struct YuvFrame {
+    const unsigned char *Y;
+    const unsigned char *U;
+    const unsigned char *V;
+    int Width;
+    int Height;
+    int YStride;
+    int UVStride;
+    YuvLayout Layout;
+};
+
+// a PiCamera frame, planes back to back at stride (vf_stride or sc_stride) with chroma rows at stride / 2
+YuvFrame MakeI420Frame(const unsigned char *frame, int width, int height, int stride);
+YuvFrame MakeNV12Frame(const unsigned char *frame, int width, int height, int stride);
+
+/* converts rows [row_begin, row_end) of frame to dst, which holds the whole image at dst_stride bytes per row.
+   chroma is replicated over its 2x2 block rather than filtered like the shaders' GL_LINEAR sampling. every kernel
+   rounds the same 16.16 fixed point result, so they agree bit for bit, and that result is the shaders' float
+   matrix rounded to the level for 99.9% of all inputs and one level off for the rest, yuvbench checks both. rows
+   are independent, split them across threads freely. no rotation, unlike the still shaders */
+void ConvertYuvToRgb(const YuvFrame &frame, unsigned char *dst, int dst_stride, RgbFormat format,
+                     YuvMatrix matrix = YuvMatrix::BT601, YuvRange range = YuvRange::FULL,
+                     int row_begin = 0, int row_end = -1);
+
+// the best kernel this CPU runs, picked on first use
+YuvKernel GetYuvKernel();
+// forces a kernel, for comparing them. false when this CPU or build can not run it
+bool SetYuvKernel(YuvKernel kernel);
+const char *GetYuvKernelName(YuvKernel kernel);
+
+#endif // YUVCONVERT_HPP
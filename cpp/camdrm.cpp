@@ -1,6 +1,8 @@
 #include <memory>
 #include <thread>
 #include <chrono>
+#include <algorithm>
+#include <filesystem>
 #include <gbm.h>
 #define STB_IMAGE_IMPLEMENTATION
 #define STB_IMAGE_WRITE_IMPLEMENTATION
@@ -12,6 +14,13 @@
 #include <Drm.hpp>
 #include <Touchscreen.hpp>
 #include <ShaderManager.hpp>
+#include <CpuRenderer.hpp>
+#include <CaptureWriter.hpp>
+#include <IdleScheduler.hpp>
+#include <CaptureScheduler.hpp>
+#include <Trace.hpp>
+#include <PerfCounters.hpp>
+#include <Metrics.hpp>
 
 /*
  * Finally! We have a connector with a suitable CRTC. We know which mode we want
@@ -54,10 +63,14 @@ int main(int argc, char **argv)
     const char *card;
     struct modeset_dev *iter;
 
+    Tracer::SetThreadName("main");
+
 	std::shared_ptr<FrameManager> frame_manager = std::make_shared<FrameManager>();
-    std::unique_ptr<ShaderManager> shader_manager(new ShaderManager());
+    std::unique_ptr<Renderer> renderer(new ShaderManager());
+    // the GPU-only capture paths, null once rendering falls back to the CPU
+    ShaderManager *shader_manager = static_cast<ShaderManager*>(renderer.get());
 
-    std::unique_ptr<PiCamera> picamera(new PiCamera(shader_manager->GetViewfinderWidth(), shader_manager->GetViewfinderHeight(), shader_manager->GetStillCaptureWidth(), shader_manager->GetStillCaptureHeight()));
+    std::unique_ptr<PiCamera> picamera(new PiCamera(renderer->GetViewfinderWidth(), renderer->GetViewfinderHeight(), renderer->GetStillCaptureWidth(), renderer->GetStillCaptureHeight()));
 	picamera->Initialize();
     //picamera.StartViewfinder();
 	picamera->SetFrameManager(frame_manager);
@@ -68,6 +81,57 @@ int main(int argc, char **argv)
     }
     std::unique_ptr<Touchscreen> touchscreen(new Touchscreen(argv[1]));
 
+    // two encoders keep up with a burst while leaving cores for the viewfinder, four frames bound the memory
+    const size_t writer_slots = 4;
+    std::unique_ptr<CaptureWriter> capture_writer(new CaptureWriter(std::string(std::getenv("HOME")) + "/codac/captures/", writer_slots, 2));
+    JpegOptions jpeg_options;
+    jpeg_options.quality = 92;
+    capture_writer->SetJpegOptions(jpeg_options);
+
+    // --deferred stores every capture undeveloped, otherwise only shots that neither the GPU nor the CPU can
+    // develop in time are.
+    // --tiled renders stills in tiles between viewfinder frames even when they fit into one texture.
+    // --sync-capture renders captures on the main context instead of the capture thread.
+    // --gpu-only and --cpu-only develop every capture on one side instead of routing between both.
+    // --cpu-render renders everything on the CPU, which happens anyway without a usable GPU.
+    // --trace <path> writes everything the tracer still holds at exit as Chrome trace JSON.
+    // --metrics <path> appends the metrics as a JSON line every interval, --metrics unix:<path> sends them to a
+    // datagram socket instead
+    bool always_defer = false;
+    bool force_tiled = false;
+    bool sync_capture = false;
+    bool cpu_render = false;
+    RoutePolicy route_policy = RoutePolicy::HYBRID;
+    std::string trace_path;
+    std::string metrics_target;
+    for (int i = 2; i < argc; i++) {
+        std::string arg(argv[i]);
+        if (arg == "--deferred") {
+            always_defer = true;
+        }
+        else if (arg == "--tiled") {
+            force_tiled = true;
+        }
+        else if (arg == "--sync-capture") {
+            sync_capture = true;
+        }
+        else if (arg == "--gpu-only") {
+            route_policy = RoutePolicy::GPU_ONLY;
+        }
+        else if (arg == "--cpu-only") {
+            route_policy = RoutePolicy::CPU_ONLY;
+        }
+        else if (arg == "--cpu-render") {
+            cpu_render = true;
+        }
+        else if (arg == "--trace" && i + 1 < argc) {
+            trace_path = argv[++i];
+        }
+        else if (arg == "--metrics" && i + 1 < argc) {
+            metrics_target = argv[++i];
+        }
+    }
+
     /* check which DRM device to open */
 //    if (argc > 1)
 //        card = argv[1];
@@ -116,17 +180,47 @@ int main(int argc, char **argv)
     }
 
     /* OpenGL stuff */ 
-    shader_manager->Initialize();
+    shader_manager->SetTiledCapture(force_tiled);
+    shader_manager->SetCaptureThread(!sync_capture);
+    if (cpu_render || !shader_manager->Initialize()) {
+        // same frames on the dumb buffer, the captures all take the CPU route
+        shader_manager = nullptr;
+        renderer.reset(new CpuRenderer());
+        if (!renderer->Initialize()) {
+            fprintf(stderr, "no renderer, exiting\n");
+            modeset_cleanup(fd);
+            close(fd);
+            return -1;
+        }
+    }
+
+    // develops stored raw captures whenever the camera is left alone
+    std::unique_ptr<IdleScheduler> idle_scheduler(new IdleScheduler(*capture_writer, [&](uint64_t hash, const std::string &name) {
+        int index = renderer->FindLut(hash, name);
+        return index < 0 ? nullptr : &renderer->GetLut(index);
+    }));
+    // the viewfinder and the capture thread keep one core, the other three develop captures the GPU has no time for
+    std::unique_ptr<CaptureScheduler> capture_scheduler(new CaptureScheduler(route_policy, 3));
 
 	picamera->StartCamera();
     
     // initialize variables
     int num_frame = 0;
     bool photo_requested = false;
+    bool capture_since_frame = false; // a capture ran on the main loop since the last viewfinder frame
+    int capture_frames = 0;
+    float capture_frame_max = 0.0f;
+    float idle_frame_max = 0.0f;
     bool prev_shader = false;
     bool next_shader = false;
-    size_t stillcapture_size = shader_manager->GetStillCaptureHeight() * shader_manager->GetStillCaptureWidth();
-    size_t viewfinder_size = shader_manager->GetViewfinderHeight() * shader_manager->GetViewfinderWidth();
+    bool toggle_contact_sheet = false;
+    bool multi_look = false;
+    CaptureFormat capture_format = CaptureFormat::JPEG;
+    size_t stillcapture_size = renderer->GetStillCaptureHeight() * renderer->GetStillCaptureWidth();
+    const std::chrono::milliseconds tile_budget(12); // tiled capture work after each viewfinder frame
+    const int capture_strip_rows = 64; // a multiple of the JPEG MCU height, a few of these are all a capture keeps in memory
+    const std::chrono::seconds capture_deadline(3); // a shot developed later than this is better stored raw
+    size_t viewfinder_size = renderer->GetViewfinderHeight() * renderer->GetViewfinderWidth();
     std::vector<uint8_t> vec_frame;
 	vec_frame.resize(viewfinder_size * 1.5);
     std::vector<uint8_t> cap_frame;
@@ -135,13 +229,38 @@ int main(int argc, char **argv)
     std::vector<unsigned char> drm_preview(640*480*4);
     void* ptr; 
     int lut_index = 0;
+    // a frame this late is a visible stutter, the flight recorder keeps the seconds that led up to it
+    const std::chrono::milliseconds frame_deadline(50);
+    std::string trace_dir = std::string(std::getenv("HOME")) + "/codac/trace";
+    std::error_code trace_dir_error;
+    std::filesystem::create_directories(trace_dir, trace_dir_error);
+    Tracer::SetFlightRecorder(trace_dir, std::chrono::seconds(3), std::chrono::seconds(10));
+    LatencyHistogram &frame_time = Metrics::GetHistogram("frame.time_us");
+    MetricCounter &missed_deadlines = Metrics::GetCounter("frame.missed_deadlines");
+    MetricCounter &dropped_looks = Metrics::GetCounter("capture.dropped_looks");
+    // a summary instead of a line per frame, which cost a write to the terminal every frame
+    Metrics::AddReportSection("Hardware counters per stage, last interval", PerfCounters::IntervalSummary);
+    Metrics::StartReporting(std::chrono::seconds(10), metrics_target);
     std::chrono::time_point<std::chrono::system_clock> start_time = std::chrono::system_clock::now();
+    Tracer::Clock::time_point frame_start = Tracer::Clock::now();
     while(num_frame < 1000) {
 
         touchscreen->PollEvents();
+        if (touchscreen->ProcessInteraction()) {
+            idle_scheduler->NotifyInteraction();
+        }
         photo_requested = touchscreen->ProcessPhotoRequest();
         prev_shader = touchscreen->ProcessPrevShader();
         next_shader = touchscreen->ProcessNextShader();
+        toggle_contact_sheet = touchscreen->ProcessContactSheet();
+        if (touchscreen->ProcessMultiLook()) {
+            multi_look = !multi_look;
+            LOG << "Multi-look export " << (multi_look ? "on" : "off") << std::endl;
+        }
+        if (touchscreen->ProcessCaptureFormat()) {
+            capture_format = capture_format == CaptureFormat::JPEG ? CaptureFormat::PNG : CaptureFormat::JPEG;
+            LOG << "Capture format " << (capture_format == CaptureFormat::JPEG ? "JPEG" : "PNG") << std::endl;
+        }
         
 
         if (photo_requested) {
@@ -153,46 +272,173 @@ int main(int argc, char **argv)
             LOG << "Capture Available!" << std::endl;
 
             frame_manager->swap_capture(cap_frame); 
-            
-            std::vector<unsigned char> rgb_out(stillcapture_size * 4);
 
-            shader_manager->StillCaptureRender(cap_frame, picamera->sc_stride, [&](void *data, size_t size) {
-                // Get data out of buffer
-				memcpy(rgb_out.data(), data, size);
-            });
+            int width = renderer->GetStillCaptureWidth();
+            int height = renderer->GetStillCaptureHeight();
+            auto on_saved = [](const EncodeResult &result) {
+                LOG << "Saved " << result.Path << " (" << result.Bytes << " bytes) in " << result.EncodeSeconds << "s, durable after " << result.DurableSeconds << "s\n";
+            };
 
-            stbi_write_png("debug-capture.png", shader_manager->GetStillCaptureWidth(), shader_manager->GetStillCaptureHeight(), 4, rgb_out.data(),shader_manager->GetStillCaptureWidth()*4); 
-/*            std::thread([rgb_out = std::move(rgb_out), width = shader_manager->GetStillCaptureWidth(), height = shader_manager->GetStillCaptureHeight()]() {
-            stbi_write_png("debug-capture.png", width, height, 4, rgb_out.data(), width*4);
-            }).detach();
-*/
+            CaptureRoute route = CaptureRoute::DEFER;
+            auto submitted = CaptureScheduler::Clock::now();
+            if (!always_defer && capture_writer->GetPending() < writer_slots) {
+                // a tiled capture in progress takes no second one, and without a GPU nothing goes there
+                int gpu_depth = !shader_manager || shader_manager->IsTiledCaptureActive() ? -1 : shader_manager->GetCaptureQueueDepth();
+                route = capture_scheduler->Choose(width, height, gpu_depth, submitted + capture_deadline);
+            }
+
+            // a developed capture takes its writer slot now. the writer may have filled up since GetPending, and
+            // waiting for a slot would stall the viewfinder, so such a capture is stored raw instead
+            bool multi_look_export = multi_look && !(shader_manager && shader_manager->IsTiledCapture());
+            bool yuv = route == CaptureRoute::GPU && !shader_manager->IsTiledCapture() && capture_format == CaptureFormat::JPEG;
+            // tiled captures and strips read back on the main context are produced by the main loop, which must not
+            // wait for the encoder. their stream takes the whole capture, every strip has at least one row
+            bool main_loop_strips = route == CaptureRoute::GPU && (shader_manager->IsTiledCapture() || !shader_manager->HasCaptureThread());
+            std::shared_ptr<CaptureStream> stream;
+            if (!multi_look_export && route != CaptureRoute::DEFER) {
+                EncodeJob job{{}, width, height, 3, capture_format, "", on_saved};
+                job.Layout = yuv ? PixelLayout::YUV420 : PixelLayout::INTERLEAVED;
+                stream = capture_writer->TrySubmitStream(job, main_loop_strips ? height : 4);
+                if (!stream) {
+                    LOG << "Capture writer full, storing the capture raw\n";
+                    route = CaptureRoute::DEFER;
+                }
+            }
+
+            // strips produced on the main loop: a capture the encoder can not take is dropped, not waited for
+            auto try_push_strip = [stream](int first_row, int num_rows, void *data, size_t size) {
+                if (!stream->IsAborted() && !stream->TryPush(data, size, num_rows)) {
+                    LOG_ERR << "Capture dropped, the encoder did not take its rows\n";
+                    stream->Abort();
+                }
+            };
+
+            if (multi_look_export) {
+                // export the selected look plus the next ones, each handed to the writer while the following look is read back
+                std::vector<int> looks;
+                int num_luts = renderer->GetNumLuts();
+                for (int i = 0; i < std::min(4, num_luts); i++) {
+                    looks.push_back((lut_index + i) % num_luts);
+                }
+
+                // the callback runs inside the shared readback of all looks, waiting for the writer there would
+                // hold up the looks behind it. a look the writer has no room for is dropped
+                renderer->StillCaptureRenderMulti(cap_frame, picamera->sc_stride, looks, [&](int look, void *data, size_t size) {
+                    std::vector<unsigned char> rgb_out(static_cast<unsigned char*>(data), static_cast<unsigned char*>(data) + size);
+                    EncodeJob job{std::move(rgb_out), width, height, 3, capture_format, renderer->GetLutName(looks[look]), on_saved};
+                    if (!capture_writer->TrySubmit(job)) {
+                        dropped_looks.Add();
+                        LOG_ERR << "Look " << job.Tag << " dropped, " << capture_writer->GetPending() << " captures still encoding\n";
+                    }
+                });
+            }
+            else if (route == CaptureRoute::DEFER) {
+                // no GPU pass and no encode in the shutter path, the frame goes to storage as it is and the
+                // idle scheduler develops it later with the LUT selected now
+                EncodeJob job{std::move(cap_frame), width, height, 3, capture_format, "", on_saved};
+                job.Layout = PixelLayout::RAW_YUV420;
+                job.Raw.Stride = picamera->sc_stride;
+                job.Raw.LutHash = renderer->GetLut(lut_index).Hash;
+                job.Raw.LutName = renderer->GetLutName(lut_index);
+                job.Raw.Timestamp = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+                // the raw queue never blocks. when storage is that far behind the shot is lost, not the viewfinder
+                if (capture_writer->SubmitRaw(job)) {
+                    idle_scheduler->Wake();
+                    // swap_capture hands this back to the camera, which sizes it for the next capture
+                    cap_frame = std::vector<uint8_t>();
+                }
+                else {
+                    LOG_ERR << "Capture dropped, " << capture_writer->GetPendingRaw() << " raw captures still waiting for storage\n";
+                    cap_frame = std::move(job.Pixels);
+                }
+            }
+            else if (route == CaptureRoute::CPU) {
+                // the GPU is behind, spare cores develop this one with the same LUT and hand on strips the same way
+                capture_scheduler->SubmitCpu(std::move(cap_frame), width, height, picamera->sc_stride, renderer->GetLut(lut_index), [stream](int first_row, int num_rows, void *data, size_t size) {
+                    stream->Push(data, size, num_rows);
+                }, [stream]() {
+                    stream->Finish();
+                });
+                cap_frame = std::vector<uint8_t>();
+            }
+            else if (shader_manager->IsTiledCapture()) {
+                // a few tiles are rendered after every viewfinder frame, each finished band of rows goes on to the
+                // encoder. the frame stays with the capture until the last tile, the camera gets a fresh buffer
+                bool started = shader_manager->BeginTiledCapture(std::move(cap_frame), picamera->sc_stride, try_push_strip, [stream, &capture_scheduler, submitted, width, height]() {
+                    // before Finish, a Flush at exit may return as soon as the stream is done
+                    capture_scheduler->ReportGpu(submitted, width, height);
+                    stream->Finish();
+                });
+                if (!started) {
+                    stream->Abort();
+                }
+                cap_frame = std::vector<uint8_t>();
+            }
+            else {
+                /* strips go from the readback straight into the encoder and on to the card while the next ones
+                   are read back, the developed frame is never whole in memory. JPEG takes the GPU's 4:2:0 planes
+                   and skips colour conversion entirely */
+                auto push_strip = [stream](int first_row, int num_rows, void *data, size_t size) {
+                    stream->Push(data, size, num_rows);
+                };
+
+                // on the capture thread the viewfinder keeps running, the frame goes with the capture. a capture
+                // that did not reach every strip is discarded, never stored short
+                auto on_finished = [stream, &capture_scheduler, submitted, width, height](bool rendered) {
+                    capture_scheduler->ReportGpu(submitted, width, height);
+                    if (rendered) {
+                        stream->Finish();
+                    }
+                    else {
+                        stream->Abort();
+                    }
+                };
+                if (shader_manager->SubmitCapture(std::move(cap_frame), picamera->sc_stride, yuv, capture_strip_rows, push_strip, on_finished)) {
+                    cap_frame = std::vector<uint8_t>();
+                }
+                else {
+                    bool rendered = shader_manager->StillCaptureRenderStrips(cap_frame, picamera->sc_stride, yuv, capture_strip_rows, try_push_strip);
+                    on_finished(rendered && !stream->IsAborted());
+                }
+            }
             picamera->CaptureComplete();
+            capture_since_frame = true;
             num_frame++;
         }
 
         if (next_shader || prev_shader) {
             LOG << "Changing Shader" << std::endl;
-            int num_luts = shader_manager->GetNumLuts();
+            int num_luts = renderer->GetNumLuts();
             if (next_shader) {
                 lut_index = (lut_index + 1) % num_luts;
             }
             else {
                 lut_index = (lut_index - 1 + num_luts) % num_luts;
             }
-            shader_manager->SwitchLUT(lut_index);
+            renderer->SwitchLUT(lut_index);
+
+        }
 
+        if (toggle_contact_sheet) {
+            renderer->SetContactSheet(!renderer->IsContactSheet());
+            LOG << "Contact sheet " << (renderer->IsContactSheet() ? "on" : "off") << std::endl;
         }
         
         if (frame_manager->swap_buffers(vec_frame)) {
             // get data 
             //frame_manager->swap_buffers(vec_frame);
-            shader_manager->ViewfinderRender(vec_frame, picamera->vf_stride, [&](void *data, size_t size) {
+            renderer->ViewfinderRender(vec_frame, picamera->vf_stride, [&](void *data, size_t size) {
                 // write to DRM display
+                TRACE_SCOPE("DRM memcpy");
+                PerfScope perf(PerfStage::DRM_COPY);
 				for (iter = modeset_list; iter; iter = iter->next) {
 					memcpy(&iter->map[0],data,size);
 				}
             });
 
+            if (shader_manager && shader_manager->IsTiledCaptureActive()) {
+                shader_manager->ContinueTiledCapture(tile_budget);
+            }
 
 /* testing for GBM
             eglSwapBuffers(display, surface);
@@ -205,7 +451,33 @@ int main(int argc, char **argv)
 
             std::chrono::duration<float> elapsed_ms = std::chrono::system_clock::now() - start_time;
             start_time = std::chrono::system_clock::now();
-            LOG << "Frame: " << num_frame << " | frame time: " << elapsed_ms.count() << "\n";
+            Tracer::Clock::time_point frame_end = Tracer::Clock::now();
+            Tracer::Complete("frame", frame_start, frame_end);
+            frame_time.Record(std::chrono::duration_cast<std::chrono::microseconds>(frame_end - frame_start).count());
+            // the first frame waits for the camera to start
+            if (num_frame > 0 && frame_end - frame_start > frame_deadline) {
+                Tracer::Instant("frame deadline missed");
+                missed_deadlines.Add();
+                Tracer::DumpFlightRecorder("deadline");
+            }
+            frame_start = frame_end;
+
+            // frames that overlapped a capture against the rest, that difference is what a capture costs the preview
+            bool gpu_busy = shader_manager && (shader_manager->IsCaptureBusy() || shader_manager->IsTiledCaptureActive());
+            if (capture_since_frame || gpu_busy || capture_scheduler->IsCpuBusy()) {
+                capture_frames++;
+                capture_frame_max = std::max(capture_frame_max, elapsed_ms.count());
+            }
+            else {
+                if (capture_frames > 0) {
+                    LOG << "Viewfinder during capture: " << capture_frames << " frames, longest " << capture_frame_max
+                        << "s, longest otherwise " << idle_frame_max << "s" << std::endl;
+                    capture_frames = 0;
+                    capture_frame_max = 0.0f;
+                }
+                idle_frame_max = std::max(idle_frame_max, elapsed_ms.count());
+            }
+            capture_since_frame = false;
             num_frame++;
 			
 			
@@ -214,6 +486,23 @@ int main(int argc, char **argv)
     }
 
     /* cleanup everything */
+    while (shader_manager && shader_manager->ContinueTiledCapture(std::chrono::seconds(1))) {
+    }
+    if (shader_manager) {
+        LOG << "Render stage times:\n" << shader_manager->GetRenderTimings().Summary() << std::flush;
+    }
+    std::string perf_summary = PerfCounters::Summary();
+    if (!perf_summary.empty()) {
+        LOG << "Hardware counters per stage, whole run:\n" << perf_summary << std::flush;
+    }
+    idle_scheduler.reset();
+    capture_writer->Flush();
+    Metrics::StopReporting();
+    if (!trace_path.empty() && Tracer::WriteChromeTrace(trace_path)) {
+        LOG << "Trace written to " << trace_path << std::endl;
+    }
+    Tracer::Flush();
+    capture_scheduler.reset();
     modeset_cleanup(fd);
     frame_manager->Stop();
 
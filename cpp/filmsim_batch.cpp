@@ -0,0 +1,263 @@
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#define STB_IMAGE_IMPLEMENTATION
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image.h"
+#include "stb_image_write.h"
+#include <CpuStillRenderer.hpp>
+#include <JpegWriter.hpp>
+#include <LutEngine.hpp>
+#include <LutLibrary.hpp>
+#include <PerfCounters.hpp>
+#include <PngWriter.hpp>
+#include <RawCapture.hpp>
+#include <WorkStealingPool.hpp>
+#include <log.hpp>
+
+/* develops a directory of captures with LUTs from the LUT library, away from the camera. inputs are raw captures
+   as the camera stores them (.raw), PNGs and JPEGs. each file is decoded once and then developed and encoded once
+   per LUT, every stage its own task on a work-stealing pool, so reading, decoding, LUT work and encoding of
+   different files overlap on all cores while only a few files are in memory at a time. raw captures are developed
+   like the GPU would have at the shutter press, images get the LUT applied as they are.
+   usage: filmsim_batch <input dir> <output dir> [--png] [--quality N] [--threads N] [LUT name ...]
+   without LUT names every LUT in the library is applied */
+
+namespace {
+
+struct Options {
+    std::filesystem::path input_dir;
+    std::filesystem::path output_dir;
+    bool png = false;
+    int quality = 92;
+    unsigned int threads = std::thread::hardware_concurrency();
+    std::vector<std::string> lut_names;
+};
+
+// a decoded input, shared by the develop tasks of all its LUTs and released after the last one
+struct Source {
+    std::string stem;
+    bool raw;   // a YUV420 camera frame, otherwise packed RGB
+    int width;
+    int height;
+    int stride; // of the camera frame
+    std::vector<unsigned char> pixels;
+};
+
+/* what develops with one LUT, built on first use and then shared by all threads. a capture LUT is 144^3 nodes,
+   12 MB once it is a LutCube, so only the ones a batch needs are built */
+class Developers {
+private:
+    const LutLibrary &library;
+    std::mutex mutex;
+    std::map<int, std::shared_ptr<const CpuStillRenderer>> still_renderers;
+    std::map<int, std::shared_ptr<const LutEngine>> engines;
+
+public:
+    explicit Developers(const LutLibrary &library) : library(library) {}
+
+    std::shared_ptr<const CpuStillRenderer> GetStillRenderer(int lut) {
+        std::unique_lock<std::mutex> lock(mutex);
+        auto &renderer = still_renderers[lut];
+        if (!renderer) {
+            renderer = std::make_shared<const CpuStillRenderer>(library.GetLut(lut));
+        }
+        return renderer;
+    }
+
+    std::shared_ptr<const LutEngine> GetEngine(int lut) {
+        std::unique_lock<std::mutex> lock(mutex);
+        auto &engine = engines[lut];
+        if (!engine) {
+            engine = std::make_shared<const LutEngine>(library.GetLut(lut));
+        }
+        return engine;
+    }
+};
+
+bool ParseOptions(int argc, char **argv, Options &options) {
+    std::vector<std::string> positional;
+    for (int i = 1; i < argc; i++) {
+        std::string arg(argv[i]);
+        if (arg == "--png") {
+            options.png = true;
+        }
+        else if (arg == "--quality" && i + 1 < argc) {
+            options.quality = std::stoi(argv[++i]);
+        }
+        else if (arg == "--threads" && i + 1 < argc) {
+            options.threads = std::stoi(argv[++i]);
+        }
+        else {
+            positional.push_back(arg);
+        }
+    }
+    if (positional.size() < 2) {
+        return false;
+    }
+    options.input_dir = positional[0];
+    options.output_dir = positional[1];
+    options.lut_names.assign(positional.begin() + 2, positional.end());
+    return true;
+}
+
+std::string Extension(const std::filesystem::path &path) {
+    std::string extension = path.extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return std::tolower(c); });
+    return extension;
+}
+
+bool Decode(const std::filesystem::path &path, Source &source) {
+    source.stem = path.stem().string();
+    if (Extension(path) == ".raw") {
+        RawCaptureInfo info;
+        if (!ReadRawCapture(path.string(), info, source.pixels)) {
+            return false;
+        }
+        source.raw = true;
+        source.width = info.Width;
+        source.height = info.Height;
+        source.stride = info.Stride;
+        return true;
+    }
+
+    int channels;
+    unsigned char *pixels = stbi_load(path.c_str(), &source.width, &source.height, &channels, 3);
+    if (!pixels) {
+        LOG_ERR << "Failed to decode " << path << ": " << stbi_failure_reason() << std::endl;
+        return false;
+    }
+    source.raw = false;
+    source.stride = source.width * 3;
+    source.pixels.assign(pixels, pixels + static_cast<size_t>(source.width) * source.height * 3);
+    stbi_image_free(pixels);
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    Options options;
+    if (!ParseOptions(argc, argv, options)) {
+        fprintf(stderr, "usage: filmsim_batch <input dir> <output dir> [--png] [--quality N] [--threads N] [LUT name ...]\n");
+        return 1;
+    }
+
+    // the pools bake film models and stacks at load and take the single strip encodes, the batch itself runs on
+    // the work-stealing pool
+    ThreadPool pool;
+    LutCache lut_cache(std::string(std::getenv("HOME")) + "/codac/cache/");
+    LutLibrary library;
+    if (!library.Load(pool, lut_cache)) {
+        return 1;
+    }
+
+    std::vector<int> luts;
+    if (options.lut_names.empty()) {
+        for (int i = 0; i < library.GetNumLuts(); i++) {
+            luts.push_back(i);
+        }
+    }
+    for (const std::string &name : options.lut_names) {
+        int index = library.FindLut(0, name);
+        if (index < 0) {
+            fprintf(stderr, "no LUT named %s\n", name.c_str());
+            return 1;
+        }
+        luts.push_back(index);
+    }
+    if (luts.empty()) {
+        fprintf(stderr, "no LUTs loaded\n");
+        return 1;
+    }
+
+    std::vector<std::filesystem::path> inputs;
+    for (const auto &entry : std::filesystem::directory_iterator(options.input_dir)) {
+        std::string extension = Extension(entry.path());
+        if (entry.is_regular_file() && (extension == ".raw" || extension == ".png" || extension == ".jpg" || extension == ".jpeg")) {
+            inputs.push_back(entry.path());
+        }
+    }
+    std::sort(inputs.begin(), inputs.end());
+    std::filesystem::create_directories(options.output_dir);
+
+    Developers developers(library);
+    JpegWriter jpeg_writer(pool);
+    PngWriter png_writer(pool);
+    JpegOptions jpeg_options;
+    jpeg_options.quality = options.quality;
+    jpeg_options.parallel = false; // files run in parallel already
+    std::atomic<int> written{0};
+    std::atomic<int> failed{0};
+    std::atomic<size_t> bytes{0};
+
+    printf("%zu files x %zu LUTs on %u threads\n", inputs.size(), luts.size(), options.threads);
+    auto start_time = std::chrono::steady_clock::now();
+    {
+        WorkStealingPool batch(options.threads);
+        for (const std::filesystem::path &path : inputs) {
+            batch.Submit([&, path] {
+                auto source = std::make_shared<Source>();
+                if (!Decode(path, *source)) {
+                    failed++;
+                    return;
+                }
+
+                for (int lut : luts) {
+                    batch.Submit([&, source, lut] {
+                        size_t row_bytes = static_cast<size_t>(source->width) * 3;
+                        auto rgb = std::make_shared<std::vector<unsigned char>>(row_bytes * source->height);
+                        if (source->raw) {
+                            developers.GetStillRenderer(lut)->RenderRows(source->pixels.data(), source->width, source->height,
+                                                                        source->stride, rgb->data(), 0, source->height);
+                        }
+                        else {
+                            developers.GetEngine(lut)->ApplyRows(source->pixels.data(), source->stride, rgb->data(), row_bytes,
+                                                                 source->width, 3, 0, source->height);
+                        }
+
+                        std::string name = source->stem + "_" + library.GetLutName(lut) + (options.png ? ".png" : ".jpg");
+                        std::string out_path = (options.output_dir / name).string();
+                        int width = source->width;
+                        int height = source->height;
+                        batch.Submit([&, rgb, out_path, width, height] {
+                            size_t size;
+                            if (options.png) {
+                                PngOptions png_options;
+                                png_options.strip_rows = height; // one strip, on this thread
+                                size = png_writer.WriteFile(out_path, rgb->data(), width, height, 3, width * 3, png_options);
+                            }
+                            else {
+                                size = jpeg_writer.WriteFile(out_path, rgb->data(), width, height, 3, width * 3, jpeg_options);
+                            }
+                            if (size == 0) {
+                                failed++;
+                                return;
+                            }
+                            written++;
+                            bytes += size;
+                        });
+                    });
+                }
+            });
+        }
+        batch.Wait();
+        printf("%zu tasks stolen\n", batch.GetSteals());
+    }
+    std::chrono::duration<float> elapsed = std::chrono::steady_clock::now() - start_time;
+
+    printf("%d images written (%.1f MB), %d failed, in %.2fs: %.2f images/s\n", written.load(), bytes.load() * 1e-6,
+           failed.load(), elapsed.count(), written.load() / elapsed.count());
+    printf("%s", PerfCounters::Summary().c_str());
+    return failed.load() > 0 ? 2 : 0;
+}
@@ -0,0 +1,113 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+#include <LutEngine.hpp>
+#include <ThreadPool.hpp>
+
+/* throughput of the CPU LUT engine: Mpix/s for trilinear and tetrahedral lookups on 1 to 4 cores, and per core.
+   takes a LUT image like the ones in the lut directory, or uses a generated 33^3 one.
+   usage: lutbench [lut.png] [width height] */
+
+namespace {
+
+// a smooth non-trivial look, the exact shape does not matter for timing
+std::vector<unsigned char> GenerateLut(int size) {
+    std::vector<unsigned char> data(static_cast<size_t>(size) * size * size * 3);
+    for (int b = 0; b < size; b++) {
+        for (int g = 0; g < size; g++) {
+            for (int r = 0; r < size; r++) {
+                float rf = r / (size - 1.0f);
+                float gf = g / (size - 1.0f);
+                float bf = b / (size - 1.0f);
+                unsigned char *p = &data[(static_cast<size_t>(b) * size * size + g * size + r) * 3];
+                p[0] = static_cast<unsigned char>(255.0f * std::min(1.0f, std::pow(rf, 0.8f) * 0.9f + 0.1f * bf));
+                p[1] = static_cast<unsigned char>(255.0f * (0.2f * rf + 0.7f * gf + 0.1f * bf));
+                p[2] = static_cast<unsigned char>(255.0f * std::sqrt(bf) * 0.95f);
+            }
+        }
+    }
+    return data;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    int width = 2592;
+    int height = 1944;
+    std::vector<unsigned char> generated;
+    LUT lut;
+    lut.Name = "generated";
+
+    if (argc > 1) {
+        int lut_width, lut_height, channels;
+        lut.Data = stbi_load(argv[1], &lut_width, &lut_height, &channels, 3);
+        if (!lut.Data) {
+            fprintf(stderr, "cannot load %s\n", argv[1]);
+            return 1;
+        }
+        lut.Name = argv[1];
+        lut.Size = static_cast<int>(std::round(std::cbrt(lut_width * lut_height)));
+    }
+    else {
+        lut.Size = 33;
+        generated = GenerateLut(lut.Size);
+        lut.Data = generated.data();
+    }
+    if (argc > 3) {
+        width = std::stoi(argv[2]);
+        height = std::stoi(argv[3]);
+    }
+
+    std::vector<unsigned char> src(static_cast<size_t>(width) * height * 3);
+    for (size_t i = 0; i < src.size(); i++) {
+        src[i] = static_cast<unsigned char>((i * 2654435761u) >> 24);
+    }
+    std::vector<unsigned char> dst(src.size());
+
+    printf("%s, %d^3 nodes, %dx%d RGB, %u hardware threads\n", lut.Name.c_str(), lut.Size, width, height,
+           std::thread::hardware_concurrency());
+
+    for (LutInterpolation interpolation : {LutInterpolation::TRILINEAR, LutInterpolation::TETRAHEDRAL}) {
+        LutEngine engine(lut, interpolation);
+        float single = 0.0f;
+        for (unsigned int cores = 1; cores <= 4; cores++) {
+            // the calling thread is one of the cores
+            std::unique_ptr<ThreadPool> pool(cores > 1 ? new ThreadPool(cores - 1) : nullptr);
+            auto run = [&]() {
+                if (pool) {
+                    engine.Apply(*pool, src.data(), width * 3, dst.data(), width * 3, width, height, 3);
+                }
+                else {
+                    engine.ApplyRows(src.data(), width * 3, dst.data(), width * 3, width, 3, 0, height);
+                }
+            };
+
+            run();
+            const int runs = 5;
+            auto start_time = std::chrono::steady_clock::now();
+            for (int i = 0; i < runs; i++) {
+                run();
+            }
+            std::chrono::duration<float> elapsed = std::chrono::steady_clock::now() - start_time;
+            float mpix = static_cast<float>(width) * height * runs / elapsed.count() * 1e-6f;
+            if (cores == 1) {
+                single = mpix;
+            }
+            printf("%-11s %u core%s: %7.1f Mpix/s, %6.1f per core, scaling %.2fx\n",
+                   interpolation == LutInterpolation::TRILINEAR ? "trilinear" : "tetrahedral", cores,
+                   cores > 1 ? "s" : " ", mpix, mpix / cores, mpix / single);
+        }
+    }
+
+    if (argc > 1) {
+        stbi_image_free(lut.Data);
+    }
+    return 0;
+}
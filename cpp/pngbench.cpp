@@ -0,0 +1,169 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sched.h>
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+#include <PngWriter.hpp>
+#include <ThreadPool.hpp>
+
+/* PngWriter against stbi_write_png: seconds and size per capture at a few zlib levels on 1 to 4 cores. every
+   file is decoded again and has to give back the exact pixels. the cores are limited with the CPU affinity the
+   pool threads inherit. takes an image to encode, or generates a photo-like one. exits 1 when a file does not
+   round-trip.
+   usage: pngbench [image] [width height] */
+
+namespace {
+
+// smooth gradients with mild sensor noise, which is what decides the filter choice and the deflate ratio
+std::vector<unsigned char> GenerateImage(int width, int height) {
+    std::vector<unsigned char> image(static_cast<size_t>(width) * height * 3);
+    uint32_t seed = 1;
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            unsigned char *pixel = &image[(static_cast<size_t>(y) * width + x) * 3];
+            int base[3] = {x * 200 / width + 20, y * 180 / height + 30, (x + y) * 120 / (width + height) + 60};
+            for (int c = 0; c < 3; c++) {
+                seed = seed * 1664525u + 1013904223u;
+                int noise = static_cast<int>(seed >> 29) - 4;
+                pixel[c] = static_cast<unsigned char>(std::min(255, std::max(0, base[c] + noise)));
+            }
+        }
+    }
+    return image;
+}
+
+// the calling thread and every thread it starts from now on run on the first cores CPUs of allowed
+bool LimitCores(const cpu_set_t &allowed, unsigned int cores) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu = 0; cpu < CPU_SETSIZE && static_cast<unsigned int>(CPU_COUNT(&set)) < cores; cpu++) {
+        if (CPU_ISSET(cpu, &allowed)) {
+            CPU_SET(cpu, &set);
+        }
+    }
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+
+bool RoundTrips(const std::vector<unsigned char> &file, const unsigned char *pixels, int width, int height) {
+    int w, h, channels;
+    unsigned char *decoded = stbi_load_from_memory(file.data(), static_cast<int>(file.size()), &w, &h, &channels, 3);
+    if (!decoded) {
+        printf("does not decode: %s\n", stbi_failure_reason());
+        return false;
+    }
+    bool same = w == width && h == height && memcmp(decoded, pixels, static_cast<size_t>(width) * height * 3) == 0;
+    stbi_image_free(decoded);
+    if (!same) {
+        printf("decodes to different pixels\n");
+    }
+    return same;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    int width = 2592;
+    int height = 1944;
+    if (argc > 3) {
+        width = std::stoi(argv[2]);
+        height = std::stoi(argv[3]);
+    }
+    std::vector<unsigned char> generated;
+    unsigned char *pixels = nullptr;
+    std::string name = "generated";
+    if (argc > 1) {
+        int channels;
+        pixels = stbi_load(argv[1], &width, &height, &channels, 3);
+        if (!pixels) {
+            fprintf(stderr, "cannot load %s\n", argv[1]);
+            return 1;
+        }
+        name = argv[1];
+    }
+    else {
+        generated = GenerateImage(width, height);
+        pixels = generated.data();
+    }
+    const size_t stride = static_cast<size_t>(width) * 3;
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        fprintf(stderr, "cannot read the CPU affinity\n");
+        return 1;
+    }
+    unsigned int hardware_threads = CPU_COUNT(&allowed);
+    printf("%s, %dx%d RGB, %u hardware threads\n", name.c_str(), width, height, hardware_threads);
+
+    bool ok = true;
+    const int runs = 3;
+    using Clock = std::chrono::steady_clock;
+
+    // stb is single threaded
+    std::vector<unsigned char> file;
+    auto append = [](void *context, void *data, int size) {
+        std::vector<unsigned char> &out = *static_cast<std::vector<unsigned char> *>(context);
+        out.insert(out.end(), static_cast<unsigned char *>(data), static_cast<unsigned char *>(data) + size);
+    };
+    float stb_seconds = 0.0f;
+    for (int i = 0; i < runs; i++) {
+        file.clear();
+        auto start_time = Clock::now();
+        stbi_write_png_to_func(append, &file, width, height, 3, pixels, static_cast<int>(stride));
+        stb_seconds += std::chrono::duration<float>(Clock::now() - start_time).count() / runs;
+    }
+    printf("stbi_write_png          1 core:  %6.3f s, %5.2f MB\n", stb_seconds, file.size() / float(1 << 20));
+    if (!RoundTrips(file, pixels, width, height)) {
+        ok = false;
+    }
+
+    for (int level : {1, PngOptions().level, 6}) {
+        PngOptions options;
+        options.level = level;
+        float single = 0.0f;
+        for (unsigned int cores = 1; cores <= 4; cores++) {
+            if (cores > hardware_threads) {
+                printf("PngWriter level %d      %u cores: skipped, %u hardware threads\n", level, cores, hardware_threads);
+                continue;
+            }
+            LimitCores(allowed, cores);
+            // the calling thread encodes too, a pool always has one worker
+            ThreadPool pool(std::max(1u, cores - 1));
+            PngWriter writer(pool);
+            auto sink = [&file](const void *data, size_t size) {
+                file.insert(file.end(), static_cast<const unsigned char *>(data), static_cast<const unsigned char *>(data) + size);
+                return true;
+            };
+
+            float seconds = 0.0f;
+            bool written = true;
+            for (int i = 0; i < runs; i++) {
+                file.clear();
+                auto start_time = Clock::now();
+                written = writer.Write(pixels, width, height, 3, stride, options, sink) && written;
+                seconds += std::chrono::duration<float>(Clock::now() - start_time).count() / runs;
+            }
+            if (cores == 1) {
+                single = seconds;
+            }
+            printf("PngWriter level %d      %u core%s: %6.3f s, %5.2f MB, %4.1fx stb, scaling %.2fx\n", level, cores,
+                   cores > 1 ? "s" : " ", seconds, file.size() / float(1 << 20), stb_seconds / seconds, single / seconds);
+            if (!written || !RoundTrips(file, pixels, width, height)) {
+                ok = false;
+            }
+        }
+    }
+    sched_setaffinity(0, sizeof(allowed), &allowed);
+
+    if (argc > 1) {
+        stbi_image_free(pixels);
+    }
+    printf("%s\n", ok ? "every file round-trips" : "FAILED");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,134 @@
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#define STB_IMAGE_IMPLEMENTATION
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image.h"
+#include "stb_image_write.h"
+#include <CpuRenderer.hpp>
+#include <ShaderManager.hpp>
+#include <Trace.hpp>
+#include <YuvConvert.hpp>
+
+/* frame rate of the renderers without a camera or display: viewfinder frames and still captures from synthetic
+   camera frames, with every LUT the camera would load. the CPU renderer by default, the GL pipeline headless with
+   --gpu, which runs under Mesa's software rasterizer on machines without a GPU. --dump writes the last viewfinder
+   frame of every LUT to <dir>/<LUT>.png, to compare against golden images. --trace writes the spans of the last
+   few seconds to a Chrome trace.
+   usage: renderbench [--gpu] [--dump dir] [--trace path] [frames] */
+
+namespace {
+
+// an I420 frame at the camera's stride, smooth gradients with some texture on top
+std::vector<uint8_t> MakeFrame(int width, int height, int stride) {
+    std::vector<uint8_t> frame(static_cast<size_t>(stride) * height * 3 / 2);
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            frame[static_cast<size_t>(y) * stride + x] = static_cast<uint8_t>(128 + 100 * std::sin(x * 0.013 + y * 0.007) + (x * 7 + y * 13) % 23);
+        }
+    }
+    uint8_t *u = frame.data() + static_cast<size_t>(stride) * height;
+    uint8_t *v = u + static_cast<size_t>(stride / 2) * (height / 2);
+    for (int y = 0; y < height / 2; y++) {
+        for (int x = 0; x < width / 2; x++) {
+            u[y * (stride / 2) + x] = static_cast<uint8_t>(128 + 90 * std::sin(x * 0.02));
+            v[y * (stride / 2) + x] = static_cast<uint8_t>(128 + 90 * std::cos(y * 0.03 + x * 0.01));
+        }
+    }
+    return frame;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    int frames = 300;
+    bool gpu = false;
+    std::string dump_dir;
+    std::string trace_path;
+    for (int i = 1; i < argc; i++) {
+        std::string arg(argv[i]);
+        if (arg == "--gpu") {
+            gpu = true;
+        }
+        else if (arg == "--dump" && i + 1 < argc) {
+            dump_dir = argv[++i];
+        }
+        else if (arg == "--trace" && i + 1 < argc) {
+            trace_path = argv[++i];
+        }
+        else {
+            frames = std::stoi(arg);
+        }
+    }
+
+    std::unique_ptr<Renderer> renderer_ptr;
+    if (gpu) {
+        ShaderManager *shader_manager = new ShaderManager();
+        shader_manager->SetHeadless(true);
+        shader_manager->SetCaptureThread(false);
+        renderer_ptr.reset(shader_manager);
+    }
+    else {
+        renderer_ptr.reset(new CpuRenderer());
+    }
+    Renderer &renderer = *renderer_ptr;
+    if (!renderer.Initialize()) {
+        fprintf(stderr, "cannot initialize the %s renderer\n", gpu ? "headless GL" : "CPU");
+        return 1;
+    }
+
+    // the camera pads rows to a multiple of 64
+    const int vf_width = renderer.GetViewfinderWidth();
+    const int vf_height = renderer.GetViewfinderHeight();
+    const int vf_stride = (vf_width + 63) / 64 * 64;
+    const int sc_width = renderer.GetStillCaptureWidth();
+    const int sc_height = renderer.GetStillCaptureHeight();
+    const int sc_stride = (sc_width + 63) / 64 * 64;
+    std::vector<uint8_t> vf_frame = MakeFrame(vf_width, vf_height, vf_stride);
+    std::vector<uint8_t> sc_frame = MakeFrame(sc_width, sc_height, sc_stride);
+    std::vector<unsigned char> screen;
+
+    printf("%d LUTs, %u hardware threads, %s YUV kernel\n", renderer.GetNumLuts(), std::thread::hardware_concurrency(),
+           GetYuvKernelName(GetYuvKernel()));
+
+    for (int lut = 0; lut < renderer.GetNumLuts(); lut++) {
+        renderer.SwitchLUT(lut);
+        // copied out like the main loop copies into the dumb buffer
+        auto to_screen = [&](void *data, size_t size) {
+            screen.assign(static_cast<unsigned char*>(data), static_cast<unsigned char*>(data) + size);
+        };
+
+        renderer.ViewfinderRender(vf_frame, vf_stride, to_screen);
+        auto start_time = std::chrono::steady_clock::now();
+        for (int i = 0; i < frames; i++) {
+            renderer.ViewfinderRender(vf_frame, vf_stride, to_screen);
+        }
+        std::chrono::duration<float> viewfinder = std::chrono::steady_clock::now() - start_time;
+        if (!dump_dir.empty()) {
+            // the screen is 480 wide and 640 high as the dumb buffer sees it
+            std::string path = dump_dir + "/" + renderer.GetLutName(lut) + ".png";
+            stbi_write_png(path.c_str(), 480, 640, 4, screen.data(), 480 * 4);
+        }
+
+        // the first still with a LUT builds its cube
+        auto discard = [](void *, size_t) {};
+        renderer.StillCaptureRender(sc_frame, sc_stride, discard);
+        start_time = std::chrono::steady_clock::now();
+        renderer.StillCaptureRender(sc_frame, sc_stride, discard);
+        std::chrono::duration<float> still = std::chrono::steady_clock::now() - start_time;
+
+        printf("%-24s viewfinder %6.1f fps (%5.2f ms), still %dx%d in %.3fs\n", renderer.GetLutName(lut).c_str(),
+               frames / viewfinder.count(), viewfinder.count() / frames * 1e3f, sc_width, sc_height, still.count());
+    }
+    if (gpu) {
+        printf("%s", static_cast<ShaderManager&>(renderer).GetRenderTimings().Summary().c_str());
+    }
+    if (!trace_path.empty() && !Tracer::WriteChromeTrace(trace_path, std::chrono::seconds(5))) {
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,87 @@
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <vector>
+#include <CaptureStorage.hpp>
+
+/* writes files through CaptureStorage around and well past the block ring, in appends of odd sizes and in one
+   go, and reads every one back. the size and every byte have to match what was appended, and no temporary file
+   may be left behind. exits 1 when a file differs.
+   usage: storagetest [dir] */
+
+namespace {
+
+const size_t block = 1 << 20;
+
+std::vector<unsigned char> Noise(size_t size, uint32_t seed) {
+    std::vector<unsigned char> data(size);
+    for (size_t i = 0; i < size; i++) {
+        seed = seed * 1664525u + 1013904223u;
+        data[i] = static_cast<unsigned char>(seed >> 24);
+    }
+    return data;
+}
+
+// max_append 0 appends everything at once
+bool WriteAndCheck(CaptureStorage &storage, const std::string &path, size_t size, size_t max_append) {
+    std::vector<unsigned char> data = Noise(size, static_cast<uint32_t>(size + max_append));
+    std::unique_ptr<StorageFile> file = storage.Create(path, size);
+    if (!file) {
+        printf("%s: could not be created\n", path.c_str());
+        return false;
+    }
+
+    bool appended = true;
+    uint32_t seed = 7;
+    for (size_t offset = 0; offset < size && appended;) {
+        size_t n = size - offset;
+        if (max_append > 0) {
+            seed = seed * 1664525u + 1013904223u;
+            n = std::min(n, 1 + seed % max_append);
+        }
+        appended = file->Append(data.data() + offset, n);
+        offset += n;
+    }
+    size_t closed = file->Close();
+    storage.Sync();
+
+    std::ifstream in(path, std::ios::binary);
+    std::vector<unsigned char> written((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    bool ok = appended && closed == size && written == data && !std::filesystem::exists(path + ".part");
+    size_t first_diff = std::mismatch(data.begin(), data.begin() + std::min(data.size(), written.size()), written.begin()).first - data.begin();
+    std::string appends = max_append ? "appends of up to " + std::to_string(max_append) + " bytes" : "one append";
+    std::string outcome = ok ? "identical" : "FAILED, first difference at " + std::to_string(first_diff);
+    printf("%-9zu bytes in %-30s %9zu written, %s\n", size, appends.c_str(), written.size(), outcome.c_str());
+    return ok;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    std::string dir = argc > 1 ? argv[1] : "/tmp/storagetest";
+    if (dir.back() != '/') {
+        dir += '/';
+    }
+    std::error_code error;
+    std::filesystem::remove_all(dir, error);
+
+    bool ok = true;
+    {
+        CaptureStorage storage(dir);
+        // the file keeps 4 blocks, everything past that reuses them
+        const size_t sizes[] = {0, 1, block - 1, block, 4 * block, 4 * block + 1, 9 * block + 4097, 17 * block + 123};
+        const size_t appends[] = {0, 4096, 300000};
+        int index = 0;
+        for (size_t size : sizes) {
+            for (size_t max_append : appends) {
+                ok = WriteAndCheck(storage, dir + "file-" + std::to_string(index++) + ".bin", size, max_append) && ok;
+            }
+        }
+    }
+    printf("%s\n", ok ? "all files intact" : "FAILED");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,243 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstdio>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+#include <CaptureWriter.hpp>
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+/* the shutter path against a full capture writer, the way camdrm submits: a developed capture takes a writer
+   slot with TrySubmitStream, without one it is stored raw with SubmitRaw, and when that queue is full too the
+   capture is dropped. none of it may wait for the encoder. fails when a submit blocks or a capture is lost
+   while there was room for it, and when a written file does not hold what was submitted: PNGs have to decode to
+   the frame exactly, JPEGs to within a few levels and raw files have to read back byte for byte.
+   usage: writerbench [output dir] [shots] */
+
+namespace {
+
+const int width = 2592;
+const int height = 1944;
+const int stride = 2624; // the camera pads rows to a multiple of 64
+
+// noise keeps the PNG encoder busy for a while
+std::vector<unsigned char> NoiseFrame(size_t size, uint32_t seed) {
+    std::vector<unsigned char> frame(size);
+    for (size_t i = 0; i < size; i++) {
+        seed = seed * 1664525u + 1013904223u;
+        frame[i] = static_cast<unsigned char>(seed >> 24);
+    }
+    return frame;
+}
+
+// smooth enough to survive JPEG within a few levels
+std::vector<unsigned char> GradientFrame(int width, int height) {
+    std::vector<unsigned char> frame(static_cast<size_t>(width) * height * 3);
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            unsigned char *pixel = &frame[(static_cast<size_t>(y) * width + x) * 3];
+            pixel[0] = static_cast<unsigned char>(x * 255 / width);
+            pixel[1] = static_cast<unsigned char>(y * 255 / height);
+            pixel[2] = static_cast<unsigned char>(128 + (x - y) * 64 / width);
+        }
+    }
+    return frame;
+}
+
+// the rows the renderer would hand over after the shutter press, in strips
+void PushFrame(CaptureStream &stream, const std::vector<unsigned char> &frame) {
+    const int strip_rows = 16;
+    const size_t row_bytes = static_cast<size_t>(width) * 3;
+    for (int row = 0; row < height; row += strip_rows) {
+        int rows = std::min(strip_rows, height - row);
+        stream.Push(frame.data() + row * row_bytes, rows * row_bytes, rows);
+    }
+    stream.Finish();
+}
+
+EncodeJob MakeJob(std::vector<unsigned char> pixels, CaptureFormat format) {
+    EncodeJob job;
+    job.Pixels = std::move(pixels);
+    job.Width = width;
+    job.Height = height;
+    job.Channels = 3;
+    job.Format = format;
+    return job;
+}
+
+std::vector<std::string> ListFiles(const std::string &dir, const std::string &extension) {
+    std::vector<std::string> paths;
+    std::error_code error;
+    for (const auto &entry : std::filesystem::directory_iterator(dir, error)) {
+        if (entry.path().extension() == extension) {
+            paths.push_back(entry.path().string());
+        }
+    }
+    std::sort(paths.begin(), paths.end());
+    return paths;
+}
+
+// the largest difference of any channel, -1 when the file does not decode to the frame's size
+int CompareImage(const std::string &path, const std::vector<unsigned char> &frame) {
+    int w, h, channels;
+    unsigned char *pixels = stbi_load(path.c_str(), &w, &h, &channels, 3);
+    if (!pixels) {
+        printf("%s does not decode: %s\n", path.c_str(), stbi_failure_reason());
+        return -1;
+    }
+    int max_diff = -1;
+    if (w == width && h == height) {
+        max_diff = 0;
+        for (size_t i = 0; i < frame.size(); i++) {
+            max_diff = std::max(max_diff, std::abs(pixels[i] - frame[i]));
+        }
+    }
+    stbi_image_free(pixels);
+    return max_diff;
+}
+
+bool CheckRaw(const std::string &path, const std::vector<unsigned char> &frame) {
+    std::error_code error;
+    uintmax_t size = std::filesystem::file_size(path, error);
+    RawCaptureInfo info;
+    std::vector<unsigned char> stored;
+    if (error || size != GetRawCaptureSize(frame) || !ReadRawCapture(path, info, stored)) {
+        printf("%s: %ju bytes for a %zu byte raw capture\n", path.c_str(), size, GetRawCaptureSize(frame));
+        return false;
+    }
+    if (info.Width != width || info.Height != height || info.Stride != stride || stored != frame) {
+        printf("%s does not hold the submitted frame\n", path.c_str());
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    std::string dir = argc > 1 ? argv[1] : "/tmp/writerbench";
+    int shots = argc > 2 ? std::stoi(argv[2]) : 6;
+    if (dir.back() != '/') {
+        dir += '/';
+    }
+    std::error_code error;
+    std::filesystem::remove_all(dir, error);
+
+    const size_t max_pending = 2;
+    const size_t max_raw_pending = 2;
+    CaptureWriter writer(dir, max_pending, 1, max_raw_pending);
+    std::vector<unsigned char> rgb = NoiseFrame(static_cast<size_t>(width) * height * 3, 1);
+    std::vector<unsigned char> yuv = NoiseFrame(static_cast<size_t>(stride) * height * 3 / 2, 2);
+    std::vector<unsigned char> gradient = GradientFrame(width, height);
+
+    // fill every slot, the encoder has seconds of work ahead of it
+    for (size_t i = 0; i < max_pending; i++) {
+        writer.Submit(MakeJob(rgb, CaptureFormat::PNG));
+    }
+    printf("writer full: %zu of %zu jobs pending\n", writer.GetPending(), max_pending);
+
+    using Clock = std::chrono::steady_clock;
+    int developed = 0, stored_raw = 0, dropped = 0;
+    double worst_ms = 0.0;
+    bool failed = false;
+    for (int shot = 0; shot < shots; shot++) {
+        size_t raw_before = writer.GetPendingRaw();
+        // camdrm moves the camera frame in, the copy is left out of the timing
+        EncodeJob raw = MakeJob(yuv, CaptureFormat::JPEG);
+        raw.Layout = PixelLayout::RAW_YUV420;
+        raw.Raw.Stride = stride;
+
+        auto start_time = Clock::now();
+        EncodeJob job = MakeJob({}, CaptureFormat::JPEG);
+        std::shared_ptr<CaptureStream> stream = writer.TrySubmitStream(job);
+        const char *outcome = "developed";
+        if (stream) {
+            developed++;
+        }
+        else {
+            if (writer.SubmitRaw(raw)) {
+                stored_raw++;
+                outcome = "stored raw";
+            }
+            else {
+                dropped++;
+                outcome = "dropped";
+                if (raw_before < max_raw_pending) {
+                    printf("shot %d dropped with %zu of %zu raw slots in use\n", shot, raw_before, max_raw_pending);
+                    failed = true;
+                }
+                if (raw.Pixels.size() != yuv.size()) {
+                    printf("shot %d: a rejected raw job lost its frame\n", shot);
+                    failed = true;
+                }
+            }
+        }
+        double ms = std::chrono::duration<double, std::milli>(Clock::now() - start_time).count();
+        worst_ms = std::max(worst_ms, ms);
+        if (stream) {
+            PushFrame(*stream, gradient);
+        }
+        printf("shot %d %-10s in %6.3f ms, %zu jobs and %zu raw frames pending\n", shot, outcome, ms,
+               writer.GetPending(), writer.GetPendingRaw());
+    }
+
+    // a submit that waited for the encoder takes as long as a PNG encode, far beyond a viewfinder frame
+    const double frame_ms = 33.0;
+    if (worst_ms > frame_ms) {
+        printf("a submit took %.1f ms, longer than a viewfinder frame\n", worst_ms);
+        failed = true;
+    }
+
+    auto flush_start = Clock::now();
+    writer.Flush();
+    std::chrono::duration<float> flushed = Clock::now() - flush_start;
+    // drained, the next shot has to be developed, which checks the streamed JPEG as well
+    EncodeJob job = MakeJob({}, CaptureFormat::JPEG);
+    std::shared_ptr<CaptureStream> stream = writer.TrySubmitStream(job);
+    if (stream) {
+        developed++;
+        PushFrame(*stream, gradient);
+        writer.Flush();
+    }
+    else {
+        printf("an empty writer refused a capture\n");
+        failed = true;
+    }
+
+    printf("%d developed, %d stored raw, %d dropped, worst submit %.3f ms, flushed in %.2fs\n", developed, stored_raw,
+           dropped, worst_ms, flushed.count());
+
+    // every file has to be the frame that went in
+    std::vector<std::string> pngs = ListFiles(writer.GetOutputDir(), ".png");
+    std::vector<std::string> jpegs = ListFiles(writer.GetOutputDir(), ".jpg");
+    std::vector<std::string> raws = ListFiles(writer.GetPendingDir(), ".raw");
+    if (pngs.size() != max_pending || jpegs.size() != static_cast<size_t>(developed) || raws.size() != static_cast<size_t>(stored_raw)) {
+        printf("%zu PNG, %zu JPEG and %zu raw files for %zu, %d and %d captures\n", pngs.size(), jpegs.size(), raws.size(),
+               max_pending, developed, stored_raw);
+        failed = true;
+    }
+    for (const std::string &path : pngs) {
+        int diff = CompareImage(path, rgb);
+        if (diff != 0) {
+            printf("%s differs from the frame by up to %d\n", path.c_str(), diff);
+            failed = true;
+        }
+    }
+    // quality 92 keeps a gradient within a few levels, a broken file is far off or does not decode
+    const int jpeg_tolerance = 8;
+    for (const std::string &path : jpegs) {
+        int diff = CompareImage(path, gradient);
+        if (diff < 0 || diff > jpeg_tolerance) {
+            printf("%s differs from the frame by up to %d\n", path.c_str(), diff);
+            failed = true;
+        }
+    }
+    for (const std::string &path : raws) {
+        failed = !CheckRaw(path, yuv) || failed;
+    }
+    printf("%zu PNG, %zu JPEG and %zu raw files checked: %s\n", pngs.size(), jpegs.size(), raws.size(), failed ? "FAILED" : "ok");
+    return failed ? 1 : 0;
+}
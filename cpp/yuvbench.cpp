@@ -0,0 +1,302 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <ThreadPool.hpp>
+#include <YuvConvert.hpp>
+
+#if (defined(__arm__) || defined(__aarch64__)) && !defined(__ARM_NEON)
+#error "yuvbench tests the NEON kernel, build it with NEON enabled"
+#endif
+
+/* checks every YUV kernel this CPU runs against the scalar one, bit for bit, and the scalar one against the
+   shaders' float matrix, within one level, for all matrices, ranges, formats and layouts. every Y, Cb, Cr
+   combination is covered, and odd widths leave a scalar tail and a half chroma sample. then throughput in MB/s of
+   YUV read, on 1 and 4 cores and per core. exits 1 when a check fails.
+   usage: yuvbench [width height] */
+
+namespace {
+
+struct Planes {
+    std::vector<unsigned char> y, u, v;
+    YuvFrame frame;
+};
+
+// both layouts from the same samples. cb and cr are indexed by chroma column and row
+Planes MakePlanes(int width, int height, YuvLayout layout, const std::vector<unsigned char> &luma,
+                  const std::vector<unsigned char> &cb, const std::vector<unsigned char> &cr) {
+    int chroma_width = (width + 1) / 2;
+    int chroma_height = (height + 1) / 2;
+    Planes planes;
+    planes.y = luma;
+    int uv_stride = layout == YuvLayout::NV12 ? chroma_width * 2 : chroma_width;
+    planes.u.resize(static_cast<size_t>(uv_stride) * chroma_height);
+    if (layout == YuvLayout::NV12) {
+        for (size_t i = 0; i < cb.size(); i++) {
+            planes.u[i * 2] = cb[i];
+            planes.u[i * 2 + 1] = cr[i];
+        }
+    }
+    else {
+        planes.u = cb;
+        planes.v = cr;
+    }
+    planes.frame = {planes.y.data(), planes.u.data(), planes.v.empty() ? nullptr : planes.v.data(), width, height,
+                    width, uv_stride, layout};
+    return planes;
+}
+
+// the still shaders' arithmetic in double: normalised luma and centred chroma through the matrix, then to unorm8
+void ReferencePixel(int y, int cb, int cr, YuvMatrix matrix, YuvRange range, int rgb[3]) {
+    bool bt601 = matrix == YuvMatrix::BT601;
+    double rv = bt601 ? 1.4020 : 1.5748;
+    double gu = bt601 ? 0.3441 : 0.1873;
+    double gv = bt601 ? 0.7141 : 0.4681;
+    double bu = bt601 ? 1.7720 : 1.8556;
+    double luma = range == YuvRange::FULL ? y / 255.0 : (y - 16) / 219.0;
+    double u = range == YuvRange::FULL ? cb / 255.0 - 0.5 : (cb - 128) / 224.0;
+    double v = range == YuvRange::FULL ? cr / 255.0 - 0.5 : (cr - 128) / 224.0;
+    double channels[3] = {luma + rv * v, luma - gu * u - gv * v, luma + bu * u};
+    for (int c = 0; c < 3; c++) {
+        rgb[c] = static_cast<int>(std::floor(std::clamp(channels[c], 0.0, 1.0) * 255.0 + 0.5));
+    }
+}
+
+const char *FormatName(RgbFormat format) {
+    switch (format) {
+    case RgbFormat::RGB888: return "RGB888";
+    case RgbFormat::RGBA8888: return "RGBA8888";
+    case RgbFormat::XRGB8888: return "XRGB8888";
+    }
+    return "unknown";
+}
+
+int BytesPerPixel(RgbFormat format) {
+    return format == RgbFormat::RGB888 ? 3 : 4;
+}
+
+// canary bytes after every row catch a kernel writing past the width
+const int row_padding = 64;
+const unsigned char canary = 0xa5;
+
+std::vector<unsigned char> Convert(const YuvFrame &frame, RgbFormat format, YuvMatrix matrix, YuvRange range) {
+    int stride = frame.Width * BytesPerPixel(format) + row_padding;
+    std::vector<unsigned char> rgb(static_cast<size_t>(stride) * frame.Height, canary);
+    ConvertYuvToRgb(frame, rgb.data(), stride, format, matrix, range);
+    return rgb;
+}
+
+struct CheckResult {
+    size_t pixels = 0;
+    size_t exact = 0;        // against the float matrix
+    size_t off_by_one = 0;
+    size_t errors = 0;       // more than a level off, a wrong alpha or a damaged canary
+};
+
+// the scalar output against the reference, channel order and padding included
+void CheckAgainstReference(const std::vector<unsigned char> &rgb, const YuvFrame &frame, RgbFormat format,
+                           YuvMatrix matrix, YuvRange range, const std::vector<unsigned char> &cb,
+                           const std::vector<unsigned char> &cr, CheckResult &result) {
+    int bpp = BytesPerPixel(format);
+    int stride = frame.Width * bpp + row_padding;
+    int chroma_width = (frame.Width + 1) / 2;
+    for (int row = 0; row < frame.Height; row++) {
+        const unsigned char *line = &rgb[static_cast<size_t>(row) * stride];
+        for (int x = 0; x < frame.Width; x++) {
+            size_t chroma = static_cast<size_t>(row / 2) * chroma_width + x / 2;
+            int expected[3];
+            ReferencePixel(frame.Y[static_cast<size_t>(row) * frame.YStride + x], cb[chroma], cr[chroma], matrix, range, expected);
+            const unsigned char *px = line + x * bpp;
+            int got[3] = {px[0], px[1], px[2]};
+            if (format == RgbFormat::XRGB8888) {
+                std::swap(got[0], got[2]);
+            }
+            int worst = 0;
+            for (int c = 0; c < 3; c++) {
+                worst = std::max(worst, std::abs(got[c] - expected[c]));
+            }
+            result.pixels++;
+            if (worst == 0) {
+                result.exact++;
+            }
+            else if (worst == 1) {
+                result.off_by_one++;
+            }
+            if (worst > 1 || (bpp == 4 && px[3] != 255)) {
+                result.errors++;
+            }
+        }
+        for (int i = frame.Width * bpp; i < stride; i++) {
+            if (line[i] != canary) {
+                result.errors++;
+                break;
+            }
+        }
+    }
+}
+
+std::vector<YuvKernel> SupportedKernels() {
+    std::vector<YuvKernel> kernels;
+    for (YuvKernel kernel : {YuvKernel::SCALAR, YuvKernel::SSE41, YuvKernel::AVX2, YuvKernel::NEON}) {
+        if (SetYuvKernel(kernel)) {
+            kernels.push_back(kernel);
+        }
+        else {
+            printf("%s kernel not available on this CPU or build\n", GetYuvKernelName(kernel));
+        }
+    }
+    return kernels;
+}
+
+/* one frame of samples. exhaustive puts every Cb, Cr pair on 64 chroma blocks, whose 4 pixels each take all 256
+   luma values between them: 16.7M pixels at 512 wide. otherwise the samples are pseudo random */
+struct Samples {
+    int width, height;
+    std::vector<unsigned char> luma, cb, cr;
+};
+
+Samples ExhaustiveSamples() {
+    Samples samples{512, 32768, {}, {}, {}};
+    int chroma_width = samples.width / 2;
+    samples.luma.resize(static_cast<size_t>(samples.width) * samples.height);
+    samples.cb.resize(static_cast<size_t>(chroma_width) * samples.height / 2);
+    samples.cr.resize(samples.cb.size());
+    for (size_t block = 0; block < samples.cb.size(); block++) {
+        size_t pair = block / 64;
+        samples.cb[block] = static_cast<unsigned char>(pair & 255);
+        samples.cr[block] = static_cast<unsigned char>(pair >> 8);
+        size_t row = block / chroma_width * 2;
+        size_t column = block % chroma_width * 2;
+        int first = static_cast<int>(block % 64) * 4;
+        samples.luma[row * samples.width + column] = static_cast<unsigned char>(first);
+        samples.luma[row * samples.width + column + 1] = static_cast<unsigned char>(first + 1);
+        samples.luma[(row + 1) * samples.width + column] = static_cast<unsigned char>(first + 2);
+        samples.luma[(row + 1) * samples.width + column + 1] = static_cast<unsigned char>(first + 3);
+    }
+    return samples;
+}
+
+Samples RandomSamples(int width, int height, uint32_t seed) {
+    Samples samples{width, height, {}, {}, {}};
+    auto next = [&seed]() {
+        seed = seed * 1664525u + 1013904223u;
+        return static_cast<unsigned char>(seed >> 24);
+    };
+    samples.luma.resize(static_cast<size_t>(width) * height);
+    samples.cb.resize(static_cast<size_t>((width + 1) / 2) * ((height + 1) / 2));
+    samples.cr.resize(samples.cb.size());
+    std::generate(samples.luma.begin(), samples.luma.end(), next);
+    std::generate(samples.cb.begin(), samples.cb.end(), next);
+    std::generate(samples.cr.begin(), samples.cr.end(), next);
+    return samples;
+}
+
+// false when a kernel disagrees with the scalar one or the scalar one with the reference. one line per matrix and
+// range, the layouts and formats are named only when they fail
+bool Check(const Samples &samples, const std::vector<YuvKernel> &kernels) {
+    bool ok = true;
+    for (YuvMatrix matrix : {YuvMatrix::BT601, YuvMatrix::BT709}) {
+        for (YuvRange range : {YuvRange::FULL, YuvRange::LIMITED}) {
+            CheckResult result;
+            std::string failures;
+            for (YuvLayout layout : {YuvLayout::I420, YuvLayout::NV12}) {
+                Planes planes = MakePlanes(samples.width, samples.height, layout, samples.luma, samples.cb, samples.cr);
+                for (RgbFormat format : {RgbFormat::RGB888, RgbFormat::RGBA8888, RgbFormat::XRGB8888}) {
+                    std::string name = std::string(layout == YuvLayout::I420 ? "I420 " : "NV12 ") + FormatName(format);
+                    SetYuvKernel(YuvKernel::SCALAR);
+                    std::vector<unsigned char> scalar = Convert(planes.frame, format, matrix, range);
+                    size_t errors = result.errors;
+                    CheckAgainstReference(scalar, planes.frame, format, matrix, range, samples.cb, samples.cr, result);
+                    if (result.errors != errors) {
+                        failures += "\n  " + name + ": " + std::to_string(result.errors - errors) +
+                                    " pixels more than a level off the reference or with a wrong alpha or padding";
+                    }
+
+                    for (YuvKernel kernel : kernels) {
+                        SetYuvKernel(kernel);
+                        if (kernel != YuvKernel::SCALAR && Convert(planes.frame, format, matrix, range) != scalar) {
+                            failures += "\n  " + name + ": " + GetYuvKernelName(kernel) + " differs from scalar";
+                        }
+                    }
+                }
+            }
+            ok = ok && failures.empty();
+            printf("%4dx%-5d %s %-7s %6.2f%% exact, %.2f%% one level off the float matrix%s%s\n", samples.width,
+                   samples.height, matrix == YuvMatrix::BT601 ? "BT601" : "BT709",
+                   range == YuvRange::FULL ? "full" : "limited", 100.0 * result.exact / result.pixels,
+                   100.0 * result.off_by_one / result.pixels, failures.empty() ? "" : "  FAILED", failures.c_str());
+        }
+    }
+    return ok;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    int width = 2592;
+    int height = 1944;
+    if (argc > 2) {
+        width = std::stoi(argv[1]);
+        height = std::stoi(argv[2]);
+    }
+
+    printf("%u hardware threads, %s YUV kernel selected\n", std::thread::hardware_concurrency(), GetYuvKernelName(GetYuvKernel()));
+    YuvKernel detected = GetYuvKernel();
+    std::vector<YuvKernel> kernels = SupportedKernels();
+
+    bool ok = Check(ExhaustiveSamples(), kernels);
+    // odd widths leave scalar tails after every vector width and a chroma sample covering one pixel
+    for (int odd_width : {1, 7, 15, 17, 31, 33, 47, 641}) {
+        ok = Check(RandomSamples(odd_width, 6, static_cast<uint32_t>(odd_width)), kernels) && ok;
+    }
+
+    Samples frame_samples = RandomSamples(width, height, 1);
+    double mb = width * static_cast<double>(height) * 1.5 / (1 << 20);
+    for (YuvKernel kernel : kernels) {
+        SetYuvKernel(kernel);
+        for (YuvLayout layout : {YuvLayout::I420, YuvLayout::NV12}) {
+            Planes planes = MakePlanes(width, height, layout, frame_samples.luma, frame_samples.cb, frame_samples.cr);
+            for (RgbFormat format : {RgbFormat::RGB888, RgbFormat::XRGB8888}) {
+                int stride = width * BytesPerPixel(format);
+                std::vector<unsigned char> rgb(static_cast<size_t>(stride) * height);
+                float rates[2];
+                const unsigned int core_counts[2] = {1, 4};
+                for (int c = 0; c < 2; c++) {
+                    // the calling thread is one of the cores
+                    unsigned int cores = core_counts[c];
+                    std::unique_ptr<ThreadPool> pool(cores > 1 ? new ThreadPool(cores - 1) : nullptr);
+                    auto run = [&]() {
+                        if (pool) {
+                            pool->ParallelFor(0, height, [&](int begin, int end) {
+                                ConvertYuvToRgb(planes.frame, rgb.data(), stride, format, YuvMatrix::BT601, YuvRange::FULL, begin, end);
+                            }, 16);
+                        }
+                        else {
+                            ConvertYuvToRgb(planes.frame, rgb.data(), stride, format);
+                        }
+                    };
+
+                    run();
+                    const int runs = 5;
+                    auto start_time = std::chrono::steady_clock::now();
+                    for (int i = 0; i < runs; i++) {
+                        run();
+                    }
+                    std::chrono::duration<float> elapsed = std::chrono::steady_clock::now() - start_time;
+                    rates[c] = static_cast<float>(mb * runs / elapsed.count());
+                }
+                printf("%-6s %-4s %-8s %dx%d: 1 core %7.1f MB/s, 4 cores %7.1f MB/s, %6.1f MB/s per core\n",
+                       GetYuvKernelName(kernel), layout == YuvLayout::I420 ? "I420" : "NV12", FormatName(format),
+                       width, height, rates[0], rates[1], rates[1] / 4);
+            }
+        }
+    }
+    SetYuvKernel(detected);
+
+    printf("%s\n", ok ? "all kernels agree" : "FAILED");
+    return ok ? 0 : 1;
+}